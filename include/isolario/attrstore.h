@@ -0,0 +1,106 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+/**
+ * @file isolario/attrstore.h
+ *
+ * @brief Deduplicated storage for BGP path attributes.
+ *
+ * Inside a RIB the same attribute blob is usually shared by a large number
+ * of prefixes announced by the same peer. An attribute store keeps a single
+ * reference counted copy of each distinct blob, so that in-memory RIBs may
+ * store a pointer to it, and caches may be keyed on its address.
+ *
+ * @note This file is guaranteed to include standard \a stdint.h and
+ *       \a stddef.h, a number of other files may be included in the interest
+ *       of providing API functionality, but the includer of this file
+ *       should not rely on such behavior.
+ */
+
+#ifndef ISOLARIO_ATTRSTORE_H_
+#define ISOLARIO_ATTRSTORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct attrstore_s attrstore_t;
+
+/**
+ * @brief Interned attributes handle.
+ *
+ * Two handles obtained from the same store are equal if and only if they
+ * refer to the same peer and attribute bytes, so they may be compared by
+ * address. Contents never change while a reference is held.
+ * Handles are only ever allocated by a store, reference counting is kept
+ * private to it.
+ */
+typedef struct attrref_s {
+    uint32_t peer;          ///< Peer the attributes belong to.
+    uint16_t len;           ///< Attributes length, in bytes.
+    unsigned char attrs[];  ///< Raw BGP path attributes.
+} attrref_t;
+
+/**
+ * @brief Create a new attribute store.
+ *
+ * @param [in] hint Expected number of distinct attribute blobs, 0 if unknown.
+ *
+ * @return A new store, to be freed with attrstore_destroy(), \a NULL
+ *         on out of memory.
+ *
+ * @note A store may be used concurrently by any number of threads.
+ */
+attrstore_t *attrstore_create(size_t hint);
+
+/**
+ * @brief Intern attributes for a peer.
+ *
+ * @return A handle to the interned copy of \a attrs, holding a new reference
+ *         to be released with attrstore_unref(), \a NULL on out of memory.
+ */
+const attrref_t *attrstore_intern(attrstore_t *st, uint32_t peer, const void *attrs, size_t n);
+
+/// @brief Acquire a new reference to an already referenced handle.
+const attrref_t *attrstore_ref(const attrref_t *ref);
+
+/// @brief Release a reference, handle is freed once no reference is left.
+void attrstore_unref(attrstore_t *st, const attrref_t *ref);
+
+/// @brief Distinct attribute blobs currently in store.
+size_t attrstore_count(attrstore_t *st);
+
+/**
+ * @brief Free a store and any handle inside it.
+ *
+ * @warning Any outstanding handle becomes invalid.
+ */
+void attrstore_destroy(attrstore_t *st);
+
+#endif
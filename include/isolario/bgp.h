@@ -49,6 +49,10 @@
 #include <isolario/netaddr.h>
 #include <isolario/io.h>  // also includes stddef.h
 #include <stdint.h>
+#include <time.h>
+
+typedef struct attrstore_s attrstore_t;  // see isolario/attrstore.h
+typedef struct ribcols_s ribcols_t;      // see isolario/ribcols.h
 
 enum {
     BGP_FSM_IDLE        = 1,
@@ -89,12 +93,15 @@ enum {
     BGPF_STRIPUNREACH = 1 << 5,  // Strip MP UNREACH attributes from
                                  // attribute list
                                  // (they shouldn't be there anyway...)
-    BGPF_LEGACYMRT    = 1 << 6   // Legacy TABLE DUMP format
+    BGPF_LEGACYMRT    = 1 << 6,  // Legacy TABLE DUMP format
                                  // Full BGP attribute list with 16-bits AS PATH
                                  // this flag implies BGPF_FULLMPREACH and
                                  // disables both BGPF_ASN32BIT and BGPF_ADDPATH,
                                  // this flag prevails
                                  // over both BGPF_STDMRT and BGPF_GUESSMRT
+
+    BGPF_INDEXATTRS   = 1 << 7   // Validate and index every attribute
+                                 // of an update upfront
 };
 
 /**
@@ -159,6 +166,12 @@ inline purefunc nonullreturn const char *bgpstrerror(int err)
 
 /**
  * @brief Initialize a BGP packet for read from pre-existing data.
+ *
+ * With \a BGPF_INDEXATTRS, the Path Attributes field of an update is
+ * validated and every attribute (including unrecognized ones) is indexed
+ * by code in a single pass, attribute accessors and iterators won't
+ * scan the field again. A malformed field closes the packet and
+ * returns \a BGP_EBADWDRWN or \a BGP_EBADATTR.
  */
 int setbgpread(const void *data, size_t n, int flags);
 
@@ -275,6 +288,10 @@ nonnull(1) int putwithdrawn(const void *p);
 
 int endwithdrawn(void);
 
+size_t getwithdrawnprefixes(void *dst, size_t cap);
+
+size_t getmpunreachprefixes(void *dst, size_t cap);
+
 int setbgpattribs(const void *data, size_t n);
 
 void *getbgpattribs(size_t *pn);
@@ -310,6 +327,10 @@ void *nextnlri(void);
 
 int endnlri(void);
 
+size_t getnlriprefixes(void *dst, size_t cap);
+
+size_t getmpreachprefixes(void *dst, size_t cap);
+
 typedef struct {
     size_t as_size;
     int type, segno;
@@ -326,6 +347,10 @@ as_pathent_t *nextaspath(void);
 
 int endaspath(void);
 
+size_t getrealaspath(uint32_t *dst, size_t cap, uint8_t *types);
+
+const uint32_t *getrealaspathptr(size_t *pn, const uint8_t **ptypes);
+
 int startnhop(void);
 
 netaddr_t *nextnhop(void);
@@ -359,7 +384,10 @@ enum {
      *
      * @see [BGP extended messages draft](https://tools.ietf.org/html/draft-ietf-idr-bgp-extended-messages-24)
      */
-    BGPBUFSIZ = 4096
+    BGPBUFSIZ = 4096,
+
+    /// @brief Longest real AS path cached inside a message by getrealaspath().
+    BGPASPCACHESIZ = 64
 };
 
 /**
@@ -372,7 +400,7 @@ enum {
  *          is to be accessed directly, use the appropriate functions instead!
  */
 typedef struct {
-    uint16_t flags;      ///< @private General status flags.
+    uint32_t flags;      ///< @private General status flags.
     uint16_t pktlen;     ///< @private Actual packet length.
     uint16_t bufsiz;     ///< @private Packet buffer capacity
     int16_t err;         ///< @private Last error code.
@@ -424,6 +452,11 @@ typedef struct {
                     };
 
                     uint16_t offtab[16];  ///< @private Notable attributes offset table.
+                    uint16_t attrtab[256];  ///< @private Attribute offset table, see \a BGPF_INDEXATTRS.
+
+                    int16_t asplen;                         ///< @private Cached real AS path length, -1 if not cached, -2 if too long.
+                    uint8_t asptypes[BGPASPCACHESIZ];       ///< @private Cached real AS path segment types.
+                    uint32_t aspcache[BGPASPCACHESIZ];      ///< @private Cached real AS path.
                 };
 
                 /// @private write-specific fields.
@@ -473,6 +506,21 @@ nonnull(1) void *bgpfinish_r(bgp_msg_t *msg, size_t *pn);
 
 nonnull(1) int bgpclose_r(bgp_msg_t *msg);
 
+/**
+ * @brief Set the shrink policy for buffers of packets exceeding \a BGPBUFSIZ.
+ *
+ * Such buffers are retained by the calling thread on bgpclose_r() and
+ * recycled by subsequent reads and writes, buffers larger than \a maxsiz
+ * bytes are freed instead. 0 (the default) retains buffers of any size.
+ */
+void setbgpbufretain(size_t maxsiz);
+
+/// @brief Largest packet (in bytes) that required a heap buffer inside the calling thread.
+size_t getbgpbufhiwater(void);
+
+/// @brief Free any buffer retained by the calling thread, this also happens automatically on thread exit.
+void bgpreleasebufs(void);
+
 nonnull(1) bgp_open_t *getbgpopen_r(bgp_msg_t *msg);
 
 nonnull(1) int setbgpopen_r(bgp_msg_t *msg, const bgp_open_t *open);
@@ -505,6 +553,19 @@ nonnull(1) int startmpunreachnlri_r(bgp_msg_t *msg);
  *          The returned pointer may always be used as \a netaddr_t.
  */
 nonnull(1) void *nextwithdrawn_r(bgp_msg_t *msg);
+
+/**
+ * @brief Bulk variant of nextwithdrawn_r(), decode withdrawn prefixes into columns.
+ *
+ * Rows are appended until either prefixes or columns space run out,
+ * \a stamp and \a peer_idx are copied to every row, origin AS and
+ * attributes are always 0 and \a NULL.
+ *
+ * @return Rows appended, 0 once no prefix is left, or on error, which is
+ *         reported by bgperror_r().
+ */
+nonnull(1, 2) size_t nextwithdrawncols_r(bgp_msg_t *msg, ribcols_t *cols, time_t stamp, uint32_t peer_idx);
+
 /**
  * @warning \a p may be either a \a netaddr_t or a \a netaddrap_t, depending on
  *          the package being ADDPATH enabled.
@@ -513,6 +574,30 @@ nonnull(1, 2) int putwithdrawn_r(bgp_msg_t *msg, const void *p);
 
 nonnull(1) int endwithdrawn_r(bgp_msg_t *msg);
 
+/**
+ * @brief Decode the whole Withdrawn field into a prefix array, in one pass.
+ *
+ * Unlike nextwithdrawn_r(), this function doesn't need nor disturb any
+ * iteration, and validates prefix lengths against the address family.
+ *
+ * @param [out] dst Destination array, either of \a netaddr_t or
+ *                  \a netaddrap_t, depending on the package being ADDPATH
+ *                  enabled, may be \a NULL if \a cap is 0.
+ * @param [in]  cap Capacity of \a dst, in elements.
+ *
+ * @return Number of prefixes inside the field, if greater than \a cap only
+ *         the first \a cap are stored. 0 on error, which is reported by
+ *         bgperror_r().
+ */
+nonnull(1) size_t getwithdrawnprefixes_r(bgp_msg_t *msg, void *dst, size_t cap);
+
+/**
+ * @brief Decode the MP_UNREACH_NLRI attribute prefixes into a prefix array.
+ *
+ * @see getwithdrawnprefixes_r()
+ */
+nonnull(1) size_t getmpunreachprefixes_r(bgp_msg_t *msg, void *dst, size_t cap);
+
 nonnull(1) int setbgpattribs_r(bgp_msg_t *msg, const void *data, size_t n);
 
 nonnull(1) void *getbgpattribs_r(bgp_msg_t *msg, size_t *pn);
@@ -550,6 +635,36 @@ nonnull(1) void *nextnlri_r(bgp_msg_t *msg);
 
 nonnull(1) int endnlri_r(bgp_msg_t *msg);
 
+/**
+ * @brief Decode the whole NLRI field into a prefix array, in one pass.
+ *
+ * @see getwithdrawnprefixes_r()
+ */
+nonnull(1) size_t getnlriprefixes_r(bgp_msg_t *msg, void *dst, size_t cap);
+
+/**
+ * @brief Decode the MP_REACH_NLRI attribute prefixes into a prefix array.
+ *
+ * @see getwithdrawnprefixes_r()
+ */
+nonnull(1) size_t getmpreachprefixes_r(bgp_msg_t *msg, void *dst, size_t cap);
+
+/**
+ * @brief Bulk variant of nextnlri_r(), decode announced prefixes into columns.
+ *
+ * Rows are appended until either prefixes or columns space run out,
+ * \a stamp and \a peer_idx are copied to every row, the origin AS is
+ * taken from the message AS path.
+ *
+ * @param [in] st Attribute store to intern message attributes into (keyed on
+ *                \a peer_idx), for the \a attrs column, may be \a NULL in
+ *                which case rows are set to \a NULL.
+ *
+ * @return Rows appended, 0 once no prefix is left, or on error, which is
+ *         reported by bgperror_r().
+ */
+nonnull(1, 2) size_t nextnlricols_r(bgp_msg_t *msg, ribcols_t *cols, time_t stamp, uint32_t peer_idx, attrstore_t *st);
+
 nonnull(1) int startaspath_r(bgp_msg_t *msg);
 
 nonnull(1) int startas4path_r(bgp_msg_t *msg);
@@ -560,6 +675,40 @@ nonnull(1) as_pathent_t *nextaspath_r(bgp_msg_t *msg);
 
 nonnull(1) int endaspath_r(bgp_msg_t *msg);
 
+/**
+ * @brief Decode the real AS path into a flat array, in one pass.
+ *
+ * The AS path is reconciled with AS4_PATH just like startrealaspath_r()
+ * does, the result is cached inside the message (as long as it doesn't
+ * exceed \a BGPASPCACHESIZ), so any following call is a plain copy.
+ * This function doesn't need nor disturb any iteration.
+ *
+ * @param [out] dst   Destination array, may be \a NULL if \a cap is 0.
+ * @param [in]  cap   Capacity of \a dst (and \a types), in ASes.
+ * @param [out] types If not \a NULL, receives the segment type
+ *                    (\a AS_SEGMENT_SEQ or \a AS_SEGMENT_SET) of each AS.
+ *
+ * @return Number of ASes inside the path, if greater than \a cap only
+ *         the first \a cap are stored. 0 on error, which is reported by
+ *         bgperror_r().
+ */
+nonnull(1) size_t getrealaspath_r(bgp_msg_t *msg, uint32_t *dst, size_t cap, uint8_t *types);
+
+/**
+ * @brief Access the real AS path cached inside the message, without copying it.
+ *
+ * Same as getrealaspath_r(), but returns the cache itself.
+ *
+ * @param [out] pn     Receives the number of ASes inside the path.
+ * @param [out] ptypes If not \a NULL, receives the cached segment types.
+ *
+ * @return The cached path, valid until the message is closed, \a NULL if
+ *         the path is longer than \a BGPASPCACHESIZ (getrealaspath_r() or
+ *         iteration must be used instead) or on error, which is reported
+ *         by bgperror_r().
+ */
+nonnull(1, 2) const uint32_t *getrealaspathptr_r(bgp_msg_t *msg, size_t *pn, const uint8_t **ptypes);
+
 nonnull(1) int startnhop_r(bgp_msg_t *msg);
 
 nonnull(1) netaddr_t *nextnhop_r(bgp_msg_t *msg);
@@ -574,6 +723,16 @@ nonnull(1) int endcommunities_r(bgp_msg_t *msg);
 
 // utility functions for update packages, direct access to notable attributes
 
+/**
+ * @brief Direct access to an arbitrary attribute.
+ *
+ * @return The first attribute with the given \a code, \a NULL if none
+ *         is present or on error. This is a constant time lookup for
+ *         packets opened with \a BGPF_INDEXATTRS.
+ */
+wur bgpattr_t *getbgpattrib(int code);
+nonnull(1) wur bgpattr_t *getbgpattrib_r(bgp_msg_t *msg, int code);
+
 wur bgpattr_t *getbgporigin(void);
 nonnull(1) wur bgpattr_t *getbgporigin_r(bgp_msg_t *msg);
 
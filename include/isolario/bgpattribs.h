@@ -434,6 +434,23 @@ bgpattr_t *putasseg16(bgpattr_t *dst, int type, const uint16_t *seg, size_t coun
  */
 bgpattr_t *putasseg32(bgpattr_t *attr, int type, const uint32_t *seg, size_t count);
 
+/**
+ * @brief Find the origin AS inside a raw path attributes list.
+ *
+ * The origin AS is the last AS of the AS_PATH, provided that its last
+ * segment is a non-empty AS_SEQUENCE. If ASes are 16-bits wide and the
+ * path originates from \a AS_TRANS, the AS4_PATH origin is used instead,
+ * as mandated by RFC 6793.
+ *
+ * @param [in] attrs   Raw path attributes, such as a RIB entry's.
+ * @param [in] n       Attributes size, in bytes.
+ * @param [in] as_size AS_PATH AS size, in bytes, either 2 or 4.
+ *
+ * @return The origin AS, 0 if AS_PATH is missing, empty, truncated, or
+ *         ends with an AS_SET.
+ */
+uint32_t getoriginas(const void *attrs, size_t n, size_t as_size);
+
 // TODO size_t stoaspath(bgpattr_t *attr, size_t n, int code, int flags, size_t as_size, const char *s, char **eptr);
 
 inline uint32_t getoriginatorid(const bgpattr_t *attr)
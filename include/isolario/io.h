@@ -35,15 +35,32 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 typedef struct io_rw_s io_rw_t;
 
+// NOTE: readers may call the optional members below whenever they are not
+// NULL, hand-filled io_rw_t must zero every member it doesn't implement,
+// e.g. starting from a zero-initialized struct (io_rw_t io = { 0 };),
+// IO_*_INIT() and io_*_init() do so already
 struct io_rw_s {
     size_t (*read)(io_rw_t *io, void *dst, size_t n);
     size_t (*write)(io_rw_t *io, const void *buf, size_t n);
     int    (*error)(io_rw_t *io);
     int    (*close)(io_rw_t *io);
 
+    // optional zero-copy interface, NULL when unsupported by the backend:
+    // peek() returns a pointer to the next n bytes (or less, on end of stream,
+    // the actual amount is stored to *pn) without consuming them,
+    // memory is guaranteed to stay valid until close(),
+    // consume() discards the next n bytes, returning the amount actually skipped
+    void  *(*peek)(io_rw_t *io, size_t n, size_t *pn);
+    size_t (*consume)(io_rw_t *io, size_t n);
+
+    // optional scatter-gather write, NULL when unsupported by the backend,
+    // use io_writev() to fallback to write() transparently
+    size_t (*writev)(io_rw_t *io, const struct iovec *iov, int iovcnt);
+
     union {
         // Unix file descriptor
         struct {
@@ -74,6 +91,7 @@ struct io_rw_s {
 
 size_t io_mread(io_rw_t *io, void *dst, size_t n);
 size_t io_mwrite(io_rw_t *io, const void *src, size_t n);
+size_t io_mwritev(io_rw_t *io, const struct iovec *iov, int iovcnt);
 int    io_merror(io_rw_t *io);
 int    io_mclose(io_rw_t *io);
 
@@ -86,7 +104,10 @@ int    io_mclose(io_rw_t *io);
     .read  = io_mread,                                                \
     .write = io_mwrite,                                               \
     .error = io_merror,                                               \
-    .close = io_mclose                                                \
+    .close = io_mclose,                                               \
+    .peek  = NULL,                                                    \
+    .consume = NULL,                                                  \
+    .writev = io_mwritev                                              \
 }
 
 #define IO_MEM_RDINIT(src, size) {                \
@@ -98,33 +119,45 @@ int    io_mclose(io_rw_t *io);
     .read  = io_mread,                            \
     .write = io_mwrite,                           \
     .error = io_merror,                           \
-    .close = io_mclose                            \
+    .close = io_mclose,                           \
+    .peek  = NULL,                                \
+    .consume = NULL,                              \
+    .writev = io_mwritev                          \
 }
 
 static inline nonnull(1, 2) void io_mem_wrinit(io_rw_t *io, void *dst, size_t size)
 {
+    io->mem.flags = IO_MEM_WRBIT;
     io->mem.ptr = (unsigned char *) dst;
     io->mem.end = (unsigned char *) dst + size;
     io->read  = io_mread;
     io->write = io_mwrite;
     io->error = io_merror;
     io->close = io_mclose;
+    io->peek    = NULL;
+    io->consume = NULL;
+    io->writev  = io_mwritev;
 }
 
 static inline nonnull(1, 2) void io_mem_rdinit(io_rw_t *io, const void *src, size_t size)
 {
+    io->mem.flags = 0;
     io->mem.ptr = (unsigned char *) src;
     io->mem.end = (unsigned char *) src + size;
     io->read  = io_mread;
     io->write = io_mwrite;
     io->error = io_merror;
     io->close = io_mclose;
+    io->peek    = NULL;
+    io->consume = NULL;
+    io->writev  = io_mwritev;
 }
 
 // stdio FILE abstaction
 
 size_t io_fread(io_rw_t *io, void *dst, size_t n);
 size_t io_fwrite(io_rw_t *io, const void *src, size_t n);
+size_t io_fwritev(io_rw_t *io, const struct iovec *iov, int iovcnt);
 int    io_ferror(io_rw_t *io);
 int    io_fclose(io_rw_t *io);
 
@@ -136,6 +169,9 @@ inline nonnull(1, 2) void io_file_init(io_rw_t *io, FILE *file)
     io->write = io_fwrite;
     io->error = io_ferror;
     io->close = io_fclose;
+    io->peek    = NULL;
+    io->consume = NULL;
+    io->writev  = io_fwritev;
 }
 
 #define IO_FILE_INIT(file) { \
@@ -143,13 +179,17 @@ inline nonnull(1, 2) void io_file_init(io_rw_t *io, FILE *file)
     .read  = io_fread,       \
     .write = io_fwrite,      \
     .error = io_ferror,      \
-    .close = io_fclose       \
+    .close = io_fclose,      \
+    .peek  = NULL,           \
+    .consume = NULL,         \
+    .writev = io_fwritev     \
 }
 
 // POSIX fd abstraction
 
 size_t io_fdread(io_rw_t *io, void *dst, size_t n);
 size_t io_fdwrite(io_rw_t *io, const void *src, size_t n);
+size_t io_fdwritev(io_rw_t *io, const struct iovec *iov, int iovcnt);
 int    io_fderror(io_rw_t *io);
 int    io_fdclose(io_rw_t *io);
 
@@ -162,6 +202,9 @@ inline nonnull(1) void io_fd_init(io_rw_t *io, int fd)
     io->write  = io_fdwrite;
     io->error  = io_fderror;
     io->close  = io_fdclose;
+    io->peek    = NULL;
+    io->consume = NULL;
+    io->writev  = io_fdwritev;
 }
 
 #define IO_FD_INIT(fd) {     \
@@ -169,14 +212,100 @@ inline nonnull(1) void io_fd_init(io_rw_t *io, int fd)
     .read  = io_fdread,      \
     .write = io_fdwrite,     \
     .error = io_fderror,     \
-    .close = io_fdclose      \
+    .close = io_fdclose,     \
+    .peek  = NULL,           \
+    .consume = NULL,         \
+    .writev = io_fdwritev    \
 }
 
+// scatter-gather write, forwards to io->writev() when available, otherwise
+// small segments are gathered in a local buffer and handed to write() at once,
+// returns the total amount of bytes written, short on error
+
+nonnull(1) size_t io_writev(io_rw_t *io, const struct iovec *iov, int iovcnt);
+
+// discard the next n bytes, using consume() when available, advancing memory
+// I/O directly and seeking large skips over plain fds or FILEs, otherwise
+// reading into a scratch buffer, returns the amount of bytes skipped, short on
+// end of stream or error (a seek past the end of a file is only detected by
+// the following read)
+
+nonnull(1) size_t io_skip(io_rw_t *io, size_t n);
+
 // compressed I/O (io_rw_t * structures are malloc()ed, but free()ed by their close() function)
+// io_bz2open() read mode accepts a trailing 't' option followed by a thread
+// count (or '*' to pass it as an int argument, 0 or no count picks the number
+// of online CPUs), blocks are then decoded in parallel,
+// io_zopen() accepts the same 't' option in write mode, compressing chunks
+// in parallel while still producing a single stream,
+// io_xzopen() accepts the same 't' option in both modes, enabling liblzma
+// threaded coders when available (threaded decoding only supports .xz files),
+// io_zstdopen() write mode takes a compression level (1-19+, 3 by default),
+// followed by an optional 'l' window log, 'c' to enable checksums and the same
+// 't' option, which sets libzstd worker count (ignored if unsupported by the
+// library), in read mode 'l' limits the accepted window log instead
 
 malloclike wur nonnull(3) io_rw_t *io_zopen(int fd, size_t bufsiz, const char *mode, ...);
 malloclike wur nonnull(3) io_rw_t *io_bz2open(int fd, size_t bufsiz, const char *mode, ...);
 malloclike wur nonnull(3) io_rw_t *io_lz4open(int fd, size_t bufsiz, const char *mode, ...);
 malloclike wur nonnull(3) io_rw_t *io_xzopen(int fd, size_t bufsiz, const char *mode, ...);
+malloclike wur nonnull(3) io_rw_t *io_zstdopen(int fd, size_t bufsiz, const char *mode, ...);
+
+// resume decoding raw deflate data from the current fd position, as found
+// in gzip or zlib streams, used to implement random access over compressed
+// files: bits (0-7) of value are the leftover bits of the byte preceding fd
+// position, dict is the latest uncompressed data (up to 32KiB) preceding it
+
+malloclike wur io_rw_t *io_zresume(int fd, size_t bufsiz, int bits, int value, const void *dict, size_t dictlen);
+
+// buffered I/O, stacks a buffer of bufsiz bytes (1 MiB if 0) on top of any
+// other io_rw_t, so that small reads or writes (e.g. MRT or BGP headers)
+// are served from memory instead of hitting the underlying stream,
+// mode is either "r" or "w", the io_rw_t * structure is malloc()ed
+// but free()d by its close() function, which also closes inner
+
+malloclike wur nonnull(1, 3) io_rw_t *io_bufopen(io_rw_t *inner, size_t bufsiz, const char *mode);
+
+// asynchronous read-ahead, reads inner on a dedicated thread into a ring of
+// nbufs buffers (4 if 0), bufsiz large each (1 MiB if 0), so that decoding
+// of the inner stream overlaps with the caller's processing of data,
+// read only, the io_rw_t * structure is malloc()ed but free()d by its close()
+// function, which also closes inner
+
+malloclike wur nonnull(1) io_rw_t *io_asyncopen(io_rw_t *inner, size_t nbufs, size_t bufsiz);
+
+// io_uring based reader (Linux only), keeps up to nbufs (4 if 0) reads of
+// bufsiz bytes (1 MiB if 0) in flight on fd, the submission ring may be shared
+// by any number of readers, even across threads,
+// io_ringcreate() returns NULL with errno set when io_uring is unavailable
+// (e.g. old kernel, seccomp restrictions or non-Linux system),
+// io_uringopen() accepts a NULL ring and falls back to plain synchronous reads,
+// the ring must outlive every reader using it,
+// the io_rw_t * structure is malloc()ed, but free()d by its close() function,
+// which also closes fd
+
+typedef struct io_ring_s io_ring_t;
+
+malloclike wur io_ring_t *io_ringcreate(unsigned entries);
+void io_ringfree(io_ring_t *ring);
+
+malloclike wur io_rw_t *io_uringopen(io_ring_t *ring, int fd, size_t nbufs, size_t bufsiz);
+
+// direct I/O reader, bypasses the page cache (O_DIRECT, or F_NOCACHE on
+// macOS) reading fd into two aligned buffers of bufsiz bytes (1 MiB if 0,
+// rounded up to alignment), one is filled by a background thread while the
+// other is consumed, if direct I/O is refused by the filesystem, reads fall
+// back to regular ones, dropping data from the page cache once read,
+// fd must be seekable, read only, the io_rw_t * structure is malloc()ed
+// but free()d by its close() function, which also closes fd
+
+malloclike wur io_rw_t *io_directopen(int fd, size_t bufsiz);
+
+// memory mapped I/O (read only, supports zero-copy peek() and consume(),
+// mode is "r", optionally followed by an access hint: 'S'equential (default),
+// 'R'andom or 'W'illneed,
+// io_rw_t * structure is malloc()ed, but free()d by its close() function)
+
+malloclike wur nonnull(2) io_rw_t *io_mmapopen(int fd, const char *mode);
 
 #endif
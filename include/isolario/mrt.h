@@ -44,6 +44,10 @@
 #include <stdarg.h>
 #include <time.h>
 
+typedef struct attrstore_s attrstore_t;  // see isolario/attrstore.h
+typedef struct attrref_s attrref_t;
+typedef struct ribcols_s ribcols_t;      // see isolario/ribcols.h
+
 enum {
     MRT_NULL = 0,          // Deprecated
     MRT_START = 1,         // Deprecated
@@ -131,9 +135,11 @@ typedef struct {
     time_t originated;
     netaddr_t nlri;        // same as rib_header_t nlri when TABLE_DUMPV2
     uint32_t pathid;       // only meaningful for ADDPATH TABLE_DUMPV2 subtypes, 0 otherwise
-    peer_entry_t *peer;    // PEER_INDEX information when TABLE_DUMPV2, available
-                           // peer information when TABLE_DUMP
+    const peer_entry_t *peer;  // PEER_INDEX information when TABLE_DUMPV2, available
+                               // peer information when TABLE_DUMP
     bgpattr_t *attrs;
+    const attrref_t *attrref;  // interned attrs, a new reference owned by the caller,
+                               // only when an attribute store is set, NULL otherwise
 } rib_entry_t;
 
 /**
@@ -157,6 +163,11 @@ enum {
     MRT_TABLE_DUMPV2_RIB_GENERIC_ADDPATH = 12            /// RFC8050
 };
 
+enum {
+    MRTF_DEFAULT = 0,       ///< Default flags for \a setmrtread(), copy the buffer.
+    MRTF_NOCOPY  = 1 << 0   ///< A flag for \a setmrtread(), read record in place, without copying it.
+};
+
 enum {
     //recoverable errors
     MRT_NOTPEERIDX = -1,
@@ -222,7 +233,7 @@ inline const char *mrtstrerror(int err)
 
 int mrterror(void);
 
-int setmrtread(const void *data, size_t n);
+int setmrtread(const void *data, size_t n, int flags);
 
 int setmrtreadfd(int fd);
 
@@ -272,6 +283,20 @@ typedef struct {
     };
 } zebra_header_t;
 
+/**
+ * @brief Immutable, fully decoded Peer Index.
+ *
+ * Built once from a PEER_INDEX_TABLE record with newpeerindex_r(), never
+ * modified afterwards, so it may be shared by any number of threads reading
+ * RIBs concurrently, see setribpeerindex_r().
+ */
+typedef struct {
+    struct in_addr collector;  ///< Collector BGP ID.
+    const char *viewname;      ///< View name, empty string if none.
+    size_t npeers;             ///< Peer entries count.
+    peer_entry_t peers[];      ///< Decoded peer entries, by index.
+} peer_index_t;
+
 /// @brief Packet reader/writer global status structure.
 typedef struct mrt_msg_s {
     uint16_t flags;      ///< General status flags.
@@ -279,6 +304,8 @@ typedef struct mrt_msg_s {
     uint32_t bufsiz;     ///< Packet buffer capacity
 
     struct mrt_msg_s *peer_index;
+    const peer_index_t *pidx;  ///< Decoded Peer Index, takes precedence over peer_index
+    attrstore_t *attrstore;    ///< RIB entries attributes are interned here, if not NULL
 
     mrt_header_t hdr;
     union {
@@ -296,6 +323,15 @@ typedef struct mrt_msg_s {
         bgp4mp_header_t bgp4mphdr;
 
         zebra_header_t zebrahdr;
+
+        struct {
+            io_rw_t *wrio;     ///< Batched records destination, if any
+            uint32_t recoff;   ///< Current record offset inside buffer
+            uint32_t wrlen;    ///< Batched bytes inside buffer
+            uint32_t cntoff;   ///< Current record entries count offset, 0 if none
+            uint16_t wrcount;  ///< Entries written to current record
+            uint16_t wrhdrsiz; ///< Current record header size
+        };
     };
 
     unsigned char *buf;  ///< Packet buffer base.
@@ -340,19 +376,177 @@ int mrterror_r(mrt_msg_t *msg);
 
 int mrtclose_r(mrt_msg_t *msg);
 
-int setmrtread_r(mrt_msg_t *msg, const void *data, size_t n);
+int setmrtread_r(mrt_msg_t *msg, const void *data, size_t n, int flags);
 
 int setmrtreadfd_r(mrt_msg_t *msg, int fd);
 
 int setmrtreadfrom_r(mrt_msg_t *msg, io_rw_t *io);
 
+// buffer retention
+
+/**
+ * @brief Set the shrink policy for buffers of records exceeding \a MRTBUFSIZ.
+ *
+ * Such buffers are retained by the calling thread when a message is closed,
+ * and recycled by subsequent reads, so that RIB dumps with consistently
+ * large records don't pay a malloc()/free() pair for each of them.
+ * Buffers larger than \a maxsiz bytes are freed on close instead,
+ * 0 (the default) retains buffers of any size.
+ */
+void setmrtbufretain(size_t maxsiz);
+
+/// @brief Largest record (in bytes) that required a heap buffer inside the calling thread.
+size_t getmrtbufhiwater(void);
+
+/// @brief Free any buffer retained by the calling thread, this also happens automatically on thread exit.
+void mrtreleasebufs(void);
+
+// iterator
+
+/**
+ * @brief Iterator over MRT records stored in memory (e.g. a memory mapped file).
+ *
+ * Records are read in place with \a MRTF_NOCOPY, so memory must outlive
+ * every message read through the iterator (and its Peer Index).
+ */
+typedef struct {
+    const unsigned char *ptr, *end;
+} mrt_iter_t;
+
+void mrtiterinit(mrt_iter_t *it, const void *data, size_t n);
+
+/**
+ * @brief Read next record into \a msg, which should be closed with mrtclose_r()
+ *        when done, just like with setmrtread_r().
+ *
+ * @return \a MRT_ENOERR on success, \a MRT_EIO once no records are left,
+ *         any other error code on corrupted or truncated data.
+ */
+int mrtiternext(mrt_iter_t *it, mrt_msg_t *msg);
+
+/// @brief Bytes left to be iterated.
+size_t mrtiterleft(const mrt_iter_t *it);
+
+// header filter
+
+/// @brief Fields checked by a \a mrt_hdrfilter_t.
+enum {
+    MRTHF_TYPE     = 1 << 0,  ///< Record type must equal \a type.
+    MRTHF_SUBTYPE  = 1 << 1,  ///< Record subtype must equal \a subtype.
+    MRTHF_PEERAS   = 1 << 2,  ///< BGP4MP or Zebra peer AS must equal \a peer_as.
+    MRTHF_PEERADDR = 1 << 3,  ///< BGP4MP or Zebra peer address must equal \a peer_addr.
+    MRTHF_LOCALAS  = 1 << 4,  ///< BGP4MP or Zebra local AS must equal \a local_as.
+    MRTHF_TIME     = 1 << 5   ///< Timestamp must fall inside [\a start, \a end).
+};
+
+/**
+ * @brief Record filter evaluated on MRT, BGP4MP and Zebra headers alone.
+ *
+ * Only fields selected by \a fields are checked, records must match all of
+ * them. Records lacking a checked field (e.g. peer AS in a TABLE_DUMPV2 RIB)
+ * never match.
+ */
+typedef struct {
+    int fields;                  ///< \a MRTHF_* fields to be checked.
+    int type, subtype;
+    uint32_t peer_as, local_as;
+    netaddr_t peer_addr;
+    struct timespec start, end;
+} mrt_hdrfilter_t;
+
+/**
+ * @brief Test whether a record opened for read matches \a flt.
+ *
+ * @return Non-zero if \a msg matches, 0 otherwise. A record with a corrupted
+ *         BGP4MP or Zebra header never matches, and the error is
+ *         reported by mrterror_r().
+ */
+int mrthdrmatch_r(mrt_msg_t *msg, const mrt_hdrfilter_t *flt);
+
+int setmrtreadfiltered(io_rw_t *io, const mrt_hdrfilter_t *flt);
+
+/**
+ * @brief Read the next record matching \a flt from \a io.
+ *
+ * Works like setmrtreadfrom_r(), but records are matched against \a flt
+ * as soon as their headers are available. Only the headers of rejected
+ * records are decoded, and their bodies are skipped with io_skip()
+ * without being copied. Zero-copy streams are never copied at all.
+ *
+ * @return \a MRT_ENOERR once a matching record is read, \a MRT_EIO if
+ *         no matching record is left, any other error code on corrupted
+ *         or truncated data.
+ */
+int setmrtreadfiltered_r(mrt_msg_t *msg, io_rw_t *io, const mrt_hdrfilter_t *flt);
+
 // header
 
 mrt_header_t *getmrtheader_r(mrt_msg_t *msg);
 
-int setmrtheaderv_r(mrt_msg_t *msg, const mrt_header_t *hdr, va_list va);  // TODO
+int setmrtheaderv_r(mrt_msg_t *msg, const mrt_header_t *hdr, va_list va);
 
-int setmrtheader_r(mrt_msg_t *msg, const mrt_header_t *hdr, ...);  // TODO
+/**
+ * @brief Start a new record on a message opened for write.
+ *
+ * Any record in progress is completed, the new record is encoded in place
+ * right after it, inside the message buffer. Additional arguments depend on
+ * record type:
+ * - \a MRT_BGP4MP and \a MRT_BGP4MP_ET: a <tt>const bgp4mp_header_t *</tt>,
+ *   BGP data (if any) is appended with wrapbgp4mp_r();
+ * - \a MRT_TABLE_DUMPV2_PEER_INDEX_TABLE: a <tt>struct in_addr</tt> collector
+ *   BGP ID and a <tt>const char *</tt> view name (may be \a NULL), peers are
+ *   appended with putpeerent_r();
+ * - any other non-generic \a MRT_TABLE_DUMPV2 RIB subtype: an \a uint32_t
+ *   sequence number and a <tt>const netaddr_t *</tt> prefix, entries are
+ *   appended with putribent_r().
+ *
+ * \a hdr->len is ignored, it is computed when record is completed.
+ *
+ * @return \a MRT_ENOERR on success, \a MRT_ETYPENOTSUP for types that
+ *         can't be written, any other MRT error code otherwise.
+ */
+int setmrtheader_r(mrt_msg_t *msg, const mrt_header_t *hdr, ...);
+
+// write
+
+/// @brief Size of the buffer used to batch records written to an \a io_rw_t.
+#define MRTWRBUFSIZ (64 * 1024)
+
+int setmrtwrite(io_rw_t *io);
+
+/**
+ * @brief Open a message for write.
+ *
+ * Records are started with setmrtheader_r() and encoded one after another
+ * inside a single reusable buffer.
+ * If \a io is not \a NULL, records are batched inside a buffer of
+ * \a MRTWRBUFSIZ bytes (retained across messages, like any other large
+ * buffer), which is written to \a io with a single write whenever it is
+ * full, on mrtflush_r() and on mrtclose_r(). Otherwise records accumulate in
+ * memory and may be retrieved with mrtfinish_r().
+ *
+ * No memory is allocated in steady state, unless a single record
+ * exceeds the buffer.
+ */
+int setmrtwrite_r(mrt_msg_t *msg, io_rw_t *io);
+
+int mrtflush(void);
+
+/**
+ * @brief Complete current record and write any batched record to the
+ *        message's \a io_rw_t.
+ */
+int mrtflush_r(mrt_msg_t *msg);
+
+void *mrtfinish(size_t *pn);
+
+/**
+ * @brief Complete current record and retrieve any record batched in memory.
+ *
+ * @return Pointer to the encoded records, valid until the next write
+ *         operation on \a msg, or \a NULL on error.
+ */
+void *mrtfinish_r(mrt_msg_t *msg, size_t *pn);
 
 // Peer Index
 
@@ -379,6 +573,23 @@ void *getpeerents(size_t *pcount, size_t *pn);
  */
 void *getpeerents_r(mrt_msg_t *msg, size_t *pcount, size_t *pn);
 
+/**
+ * @brief Build an immutable Peer Index from the current PEER_INDEX_TABLE.
+ *
+ * @param [in]  msg Message opened for read on a PEER_INDEX_TABLE record,
+ *                  it may be closed as soon as this function returns.
+ * @param [out] ppi Storage for the new Peer Index, to be freed with
+ *                  freepeerindex().
+ *
+ * @return \a MRT_ENOERR on success, \a MRT_NOTPEERIDX if \a msg is not a
+ *         PEER_INDEX_TABLE, any other MRT error code otherwise.
+ */
+int newpeerindex_r(mrt_msg_t *msg, peer_index_t **ppi);
+
+int newpeerindex(peer_index_t **ppi);
+
+void freepeerindex(peer_index_t *pi);
+
 int startpeerents(size_t *pcount);
 
 int startpeerents_r(mrt_msg_t *msg, size_t *pcount);
@@ -389,6 +600,12 @@ peer_entry_t *nextpeerent_r(mrt_msg_t *msg);
 
 int putpeerent(const peer_entry_t *pe);
 
+/**
+ * @brief Append a peer to the PEER_INDEX_TABLE being written.
+ *
+ * A 32 bits AS is encoded if \a pe->as_size says so, or if AS doesn't fit
+ * in 16 bits.
+ */
 int putpeerent_r(mrt_msg_t *msg, const peer_entry_t *pe);
 
 int endpeerents(void);
@@ -401,6 +618,27 @@ int setribpi(void);
 
 int setribpi_r(mrt_msg_t *msg, mrt_msg_t *pi);
 
+int setribpeerindex(const peer_index_t *pi);
+
+/**
+ * @brief Associate a RIB record with an immutable Peer Index.
+ *
+ * Peer entries returned by nextribent_r() point directly inside \a pi,
+ * so no decoding takes place for each RIB entry, \a pi must outlive \a msg.
+ * Takes precedence over any Peer Index set with setribpi_r().
+ */
+int setribpeerindex_r(mrt_msg_t *msg, const peer_index_t *pi);
+
+/**
+ * @brief Intern attributes of any RIB entry returned by nextribent_r() into \a st.
+ *
+ * Each entry's \a attrref field is filled with a new reference to the
+ * interned attributes (keyed on the entry's peer index), which the caller
+ * must release with attrstore_unref() when done, \a attrs points inside it.
+ * Pass \a NULL to stop interning.
+ */
+int setribattrstore_r(mrt_msg_t *msg, attrstore_t *st);
+
 int setribents(const void *buf, size_t n);
 
 int setribents_r(mrt_msg_t *msg, const void *buf, size_t n);
@@ -424,8 +662,33 @@ rib_entry_t *nextribent(void);
 
 rib_entry_t *nextribent_r(mrt_msg_t *msg);
 
+/**
+ * @brief Bulk variant of nextribent_r(), decode RIB entries into columns.
+ *
+ * Appends a row for each entry left in the RIB record opened with
+ * startribents_r(), until either entries or columns space run out.
+ * Rows carry the entry's PEER_INDEX position and originated time.
+ * The \a attrs column is only filled if an attribute store was set with
+ * setribattrstore_r(), otherwise rows are set to \a NULL.
+ *
+ * @return Rows appended, 0 once no entry is left, or on error, which is
+ *         reported by mrterror_r().
+ */
+size_t nextribcols_r(mrt_msg_t *msg, ribcols_t *cols);
+
 int putribent(const rib_entry_t *pe, uint16_t idx, time_t seconds, const bgpattr_t *attrs, size_t attrs_size);
 
+/**
+ * @brief Append an entry to the TABLE_DUMPV2 RIB record being written.
+ *
+ * @param [in] msg
+ * @param [in] pe         Only used for its \a pathid with ADDPATH subtypes,
+ *                        may be \a NULL (path identifier 0).
+ * @param [in] idx        Peer index, inside the dump's PEER_INDEX_TABLE.
+ * @param [in] seconds    Originated time.
+ * @param [in] attrs      BGP path attributes.
+ * @param [in] attrs_size Attributes size, in bytes.
+ */
 int putribent_r(mrt_msg_t *msg, const rib_entry_t *pe, uint16_t idx, time_t seconds, const bgpattr_t *attrs, size_t attrs_size);
 
 int endribents(void);
@@ -442,6 +705,24 @@ void *unwrapbgp4mp(size_t *pn);
 
 void *unwrapbgp4mp_r(mrt_msg_t *msg, size_t *pn);
 
+int wrapbgp4mp(const void *data, size_t n);
+
+/// @brief Append BGP data (as returned by bgpfinish()) to the BGP4MP record being written.
+int wrapbgp4mp_r(mrt_msg_t *msg, const void *data, size_t n);
+
+/**
+ * @brief Write a complete BGP4MP or BGP4MP_ET record to \a io.
+ *
+ * Header type and subtype select the record encoding, \a hdr->len is ignored
+ * and computed from the BGP4MP header and \a n, \a data is a BGP message
+ * (as returned by bgpfinish()), ignored for state change records.
+ * The MRT header, BGP4MP header and BGP data are written with a single
+ * io_writev(), so BGP data is never copied by backends supporting it.
+ *
+ * @return \a MRT_ENOERR on success, an error code otherwise.
+ */
+nonnull(1, 2, 3) int mrtwritebgp4mp(io_rw_t *io, const mrt_header_t *hdr, const bgp4mp_header_t *bgp4mp, const void *data, size_t n);
+
 // ZEBRA BGP
 
 zebra_header_t *getzebraheader(void);
@@ -0,0 +1,237 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+/**
+ * @file isolario/mrtindex.h
+ *
+ * @brief Random access indexes over MRT archives.
+ *
+ * @note This file is guaranteed to include standard \a stdint.h and \a time.h,
+ *       a number of other files may be included in the interest of providing
+ *       API functionality, but the includer of this file
+ *       should not rely on such behavior.
+ */
+
+#ifndef ISOLARIO_MRTINDEX_H_
+#define ISOLARIO_MRTINDEX_H_
+
+#include <isolario/io.h>
+#include <isolario/netaddr.h>
+#include <stdint.h>
+#include <time.h>
+
+/// @brief Size of the inflate window stored along each checkpoint.
+#define MRTZ_WINSIZ 32768
+
+/**
+ * @brief Checkpoint inside a gzip (or zlib) compressed MRT archive.
+ *
+ * Checkpoints are taken at deflate block boundaries, which don't generally
+ * coincide with MRT record boundaries, so each checkpoint also records
+ * the position of the first MRT record following it.
+ */
+typedef struct {
+    uint64_t in;      ///< Compressed offset of the first byte not completely consumed.
+    uint64_t out;     ///< Uncompressed offset at checkpoint.
+    uint64_t recoff;  ///< Uncompressed offset of the first MRT record starting at or after \a out.
+    time_t stamp;     ///< Timestamp of the MRT record at \a recoff.
+    int bits;         ///< Leftover bits (0-7) of the byte at \a in - 1.
+    unsigned char *window;  ///< Uncompressed data preceding \a out, \a MRTZ_WINSIZ bytes.
+} mrtzpoint_t;
+
+/// @brief Checkpoint index over a gzip (or zlib) compressed MRT archive.
+typedef struct {
+    uint64_t span;        ///< Minimum uncompressed distance between checkpoints.
+    size_t npoints;       ///< Checkpoints count.
+    mrtzpoint_t *points;  ///< Checkpoints, sorted by offset.
+} mrtzindex_t;
+
+/**
+ * @brief Build a checkpoint index over a gzip (or zlib) compressed MRT file.
+ *
+ * @param [out] idx  Index to be initialized, must be freed with mrtzfreeindex().
+ * @param [in]  fd   File to be indexed, must be positioned at its beginning,
+ *                   it is read to the end, but left open.
+ * @param [in]  span Uncompressed distance between checkpoints, 0 for 1MiB.
+ *
+ * @return \a MRT_ENOERR on success, an MRT error code otherwise.
+ *
+ * @note Only the first member of a multi-member gzip file is indexed.
+ */
+int mrtzbuildindex(mrtzindex_t *idx, int fd, uint64_t span);
+
+/**
+ * @brief Store an index to a sidecar file.
+ *
+ * @return \a MRT_ENOERR on success, \a MRT_EIO on I/O error.
+ */
+int mrtzsaveindex(const mrtzindex_t *idx, io_rw_t *io);
+
+/**
+ * @brief Load an index from a sidecar file, as written by mrtzsaveindex().
+ *
+ * @return \a MRT_ENOERR on success, an MRT error code otherwise, in which
+ *         case \a idx is left empty.
+ */
+int mrtzloadindex(mrtzindex_t *idx, io_rw_t *io);
+
+/// @brief Free any memory associated with an index.
+void mrtzfreeindex(mrtzindex_t *idx);
+
+/**
+ * @brief Find the best checkpoint to read records since a given time.
+ *
+ * Assumes records appear in (mostly) non-decreasing timestamp order,
+ * as in update archives.
+ *
+ * @return The last checkpoint whose record timestamp precedes \a t, or the
+ *         first checkpoint if none does, \a NULL for empty indexes.
+ */
+const mrtzpoint_t *mrtzfindpoint(const mrtzindex_t *idx, time_t t);
+
+/**
+ * @brief Open a compressed MRT file positioned at the record following a checkpoint.
+ *
+ * @param [in] fd     File the index was built upon, must be seekable, it is
+ *                    closed when the returned \a io_rw_t is closed, or
+ *                    immediately on failure.
+ * @param [in] pt     Checkpoint, as returned by mrtzfindpoint().
+ * @param [in] bufsiz Read buffer size, as in io_zopen().
+ *
+ * @return A reader whose first byte is the MRT record header at \a pt->recoff,
+ *         or \a NULL on failure, \a errno is set to indicate the error.
+ */
+io_rw_t *mrtzopenat(int fd, const mrtzpoint_t *pt, size_t bufsiz);
+
+/// @brief Default distance between time index points, in bytes.
+#define MRTT_DEFSPAN (1024 * 1024)
+
+/// @brief Position of an MRT record inside an archive, as stored by a time index.
+typedef struct {
+    uint64_t off;    ///< Uncompressed offset of the record header.
+    uint64_t recno;  ///< Records preceding this one.
+    time_t stamp;    ///< Record timestamp.
+} mrttpoint_t;
+
+/// @brief First and last record of a BGP4MP (or Zebra) peer inside an archive.
+typedef struct {
+    uint32_t peer_as;
+    netaddr_t peer_addr;
+    uint64_t nrecs;             ///< Records from this peer.
+    mrttpoint_t first, last;
+} mrttpeer_t;
+
+/// @brief Time and offset index over an MRT archive.
+typedef struct {
+    uint64_t span;        ///< Minimum uncompressed distance between points.
+    uint64_t nrecs;       ///< Total records count.
+    uint64_t size;        ///< Total uncompressed size.
+    size_t npoints;       ///< Index points count.
+    mrttpoint_t *points;  ///< Index points, sorted by offset.
+    size_t npeers;        ///< Peers count.
+    mrttpeer_t *peers;    ///< Peers, sorted by AS and address.
+} mrttindex_t;
+
+/**
+ * @brief Build a time index over an MRT stream, in one pass.
+ *
+ * Offsets are relative to the uncompressed stream, so \a io may be any
+ * reader (plain file, memory mapped, or compressed), the same kind of
+ * reader should be used with mrttseekpoint().
+ *
+ * @param [out] idx  Index to be initialized, must be freed with mrttfreeindex().
+ * @param [in]  io   Stream to be indexed, read to the end, but left open.
+ * @param [in]  span Distance between index points, 0 for \a MRTT_DEFSPAN.
+ *
+ * @return \a MRT_ENOERR on success, an MRT error code otherwise.
+ */
+int mrttbuildindex(mrttindex_t *idx, io_rw_t *io, uint64_t span);
+
+/**
+ * @brief Store a time index to a sidecar file.
+ *
+ * @return \a MRT_ENOERR on success, \a MRT_EIO on I/O error.
+ */
+int mrttsaveindex(const mrttindex_t *idx, io_rw_t *io);
+
+/**
+ * @brief Load a time index from a sidecar file, as written by mrttsaveindex().
+ *
+ * @return \a MRT_ENOERR on success, an MRT error code otherwise, in which
+ *         case \a idx is left empty.
+ */
+int mrttloadindex(mrttindex_t *idx, io_rw_t *io);
+
+/// @brief Free any memory associated with a time index.
+void mrttfreeindex(mrttindex_t *idx);
+
+/**
+ * @brief Find the best point to read records since a given time.
+ *
+ * Same as mrtzfindpoint(), the returned point generally precedes \a t,
+ * so records before \a t should still be skipped, e.g. with
+ * setmrtreadfiltered_r() and \a MRTHF_TIME.
+ */
+const mrttpoint_t *mrttfindpoint(const mrttindex_t *idx, time_t t);
+
+/// @brief Lookup a peer inside a time index, \a NULL if not found.
+const mrttpeer_t *mrttfindpeer(const mrttindex_t *idx, uint32_t peer_as, const netaddr_t *peer_addr);
+
+/**
+ * @brief Position a reader at an index point.
+ *
+ * \a io must be positioned at the beginning of the stream the index was
+ * built upon, the record at \a pt is then the next one returned by
+ * setmrtreadfrom_r(). Uncompressed files are seeked directly,
+ * memory mapped files are consumed, compressed streams are decoded up to
+ * \a pt without being parsed, see io_skip().
+ *
+ * @return \a MRT_ENOERR on success, \a MRT_EIO on truncated stream or I/O error.
+ */
+int mrttseekpoint(io_rw_t *io, const mrttpoint_t *pt);
+
+/**
+ * @brief Open a gzip compressed MRT file positioned at an index point.
+ *
+ * Decoding resumes from the nearest checkpoint in \a zidx preceding
+ * \a pt, so only data between the two is decompressed.
+ *
+ * @param [in] fd     File both indexes were built upon, ownership is
+ *                    taken as in mrtzopenat().
+ * @param [in] zidx   Checkpoint index.
+ * @param [in] pt     Time index point.
+ * @param [in] bufsiz Read buffer size, as in io_zopen().
+ *
+ * @return A reader whose first byte is the MRT record header at \a pt->off,
+ *         or \a NULL on failure, \a errno is set to indicate the error.
+ */
+io_rw_t *mrttzopenat(int fd, const mrtzindex_t *zidx, const mrttpoint_t *pt, size_t bufsiz);
+
+#endif
@@ -0,0 +1,109 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+/**
+ * @file isolario/mrtmerge.h
+ *
+ * @brief Timestamp ordered merge of multiple MRT streams.
+ *
+ * A merger reads records from any number of MRT streams (e.g. BGP4MP
+ * updates dumped by different collectors) and returns them in global
+ * timestamp order, microseconds included for extended timestamp records.
+ *
+ * Each stream is expected to be mostly sorted, records may be displaced
+ * by at most a given tolerance window, which the merger compensates
+ * by reading ahead. Read ahead is bounded by a per stream record limit,
+ * so memory usage never exceeds that amount of records per stream,
+ * regardless of input size. Records displaced by more than the tolerance
+ * window (or the read ahead limit) are still returned, though not
+ * necessarily in order.
+ *
+ * @note This file is guaranteed to include standard \a stddef.h and
+ *       \a time.h, a number of other files may be included in the interest
+ *       of providing API functionality, but the includer of this file
+ *       should not rely on such behavior.
+ */
+
+#ifndef ISOLARIO_MRTMERGE_H_
+#define ISOLARIO_MRTMERGE_H_
+
+#include <isolario/io.h>
+#include <isolario/mrt.h>
+#include <stddef.h>
+#include <time.h>
+
+typedef struct mrtmerge_s mrtmerge_t;
+
+/// @brief Default per stream read ahead limit, in records.
+#define MRTM_DEFLOOKAHEAD 64
+
+/**
+ * @brief Create a new merger.
+ *
+ * @param [in] ios       Streams to be merged, they are not closed by the
+ *                       merger and must outlive it.
+ * @param [in] n         Streams count.
+ * @param [in] window    Tolerance window for out of order records,
+ *                       \a NULL if streams are strictly sorted.
+ * @param [in] lookahead Maximum records read ahead for each stream,
+ *                       0 uses \a MRTM_DEFLOOKAHEAD.
+ *
+ * @return A new merger, to be freed with freemrtmerge(), \a NULL on
+ *         out of memory.
+ */
+mrtmerge_t *newmrtmerge(io_rw_t *const ios[], size_t n, const struct timespec *window, size_t lookahead);
+
+/**
+ * @brief Fetch the next record in timestamp order.
+ *
+ * Records with equal timestamps are returned ordered by stream index,
+ * and in the order they appear inside each stream.
+ *
+ * @param [in]  mm      Merger.
+ * @param [out] pmsg    Set to the next record, opened for read. The record
+ *                      is owned by the merger and is closed on the next
+ *                      call to mrtmergenext(), or by freemrtmerge().
+ * @param [out] pstream If not \a NULL, set to the index of the stream
+ *                      \a *pmsg was read from, to the index of the
+ *                      failing stream when an error is returned, or to
+ *                      the streams count once all of them are exhausted.
+ *
+ * @return \a MRT_ENOERR on success, \a MRT_EIO once all streams are
+ *         exhausted, an MRT error code if a stream failed (including
+ *         \a MRT_EIO, use \a pstream to tell the two apart).
+ *         A failed stream is excluded from the merge, so mrtmergenext()
+ *         may be called again to resume with the remaining streams.
+ */
+int mrtmergenext(mrtmerge_t *mm, mrt_msg_t **pmsg, size_t *pstream);
+
+/// @brief Free a merger and any record it holds, streams are left open.
+void freemrtmerge(mrtmerge_t *mm);
+
+#endif
@@ -0,0 +1,122 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+/**
+ * @file isolario/mrtpool.h
+ *
+ * @brief Parallel processing of TABLE_DUMPV2 RIB dumps over a worker pool.
+ *
+ * @note This file is guaranteed to include standard \a stdint.h,
+ *       a number of other files may be included in the interest of providing
+ *       API functionality, but the includer of this file
+ *       should not rely on such behavior.
+ */
+
+#ifndef ISOLARIO_MRTPOOL_H_
+#define ISOLARIO_MRTPOOL_H_
+
+#include <isolario/io.h>
+#include <isolario/mrt.h>
+#include <stdint.h>
+
+/// @brief Flags for mrtribforeach().
+enum {
+    MRTPF_DEFAULT = 0,
+    MRTPF_ORDERED = 1 << 0  ///< Invoke commit callback one batch at a time, in sequence order
+};
+
+/// @brief Default number of records inside each batch dispatched to workers.
+#define MRTP_DEFBATCHSIZ 256
+
+/**
+ * @brief Record callback for mrtribforeach().
+ *
+ * @param [in] msg   Record opened for read, associated with the dump's Peer
+ *                   Index when it is a RIB, so nextribent_r() can be used
+ *                   right away. \a msg is closed once callback returns.
+ * @param [in] seqno Record sequence number, starting from 0 at the
+ *                   first record following the PEER_INDEX_TABLE.
+ * @param [in] arg   User argument, as passed to mrtribforeach().
+ *
+ * @return 0 to continue processing, any other value stops it.
+ */
+typedef int (*mrtribfunc_t)(mrt_msg_t *msg, uint64_t seqno, void *arg);
+
+/**
+ * @brief Batch commit callback for mrtribforeach().
+ *
+ * @param [in] seqno Sequence number of the first record in batch.
+ * @param [in] nrecs Number of records in batch, the record callback was
+ *                   invoked on each of them (unless processing was stopped).
+ * @param [in] arg   User argument, as passed to mrtribforeach().
+ *
+ * @return 0 to continue processing, any other value stops it.
+ */
+typedef int (*mrtribcommitfunc_t)(uint64_t seqno, size_t nrecs, void *arg);
+
+/**
+ * @brief Process a TABLE_DUMPV2 dump in parallel.
+ *
+ * The PEER_INDEX_TABLE is read once from \a io and shared read-only among
+ * workers, following records are read in batches of \a batchsiz records
+ * by the calling thread and dispatched to a pool of \a nthreads workers,
+ * each record being handed to \a fn with a worker private \a mrt_msg_t.
+ *
+ * \a fn is invoked concurrently and records are processed in no
+ * particular order (records inside a batch are processed in order, though).
+ * Once every record in a batch is processed, \a commit (if not \c NULL)
+ * is invoked for it by the same worker.
+ * With \a MRTPF_ORDERED, \a commit invocations are serialized in sequence
+ * number order, while \a fn still runs in parallel: \a fn should decode
+ * and stage its results, and \a commit deliver them, so only delivery
+ * is serial.
+ *
+ * At most two batches per worker are in flight at any time,
+ * so memory usage is bounded regardless of dump size.
+ * A batch stays in flight until it is committed, hence records whose
+ * sequence numbers are \a nthreads * 2 * \a batchsiz apart never
+ * share their staging area if indexed modulo that value.
+ *
+ * @param [in] io       Dump to be read, starting with its PEER_INDEX_TABLE.
+ * @param [in] nthreads Workers count, 0 uses the number of online CPUs.
+ * @param [in] batchsiz Records per batch, 0 uses \a MRTP_DEFBATCHSIZ.
+ * @param [in] flags    \a MRTPF_* flags.
+ * @param [in] fn       Record callback.
+ * @param [in] commit   Batch commit callback, may be \c NULL.
+ * @param [in] arg      User argument passed to \a fn and \a commit.
+ *
+ * @return \a MRT_ENOERR once the whole dump is processed, the first non-zero
+ *         value returned by \a fn or \a commit if processing was stopped, an MRT error
+ *         code on read failure, \a MRT_NOTPEERIDX if dump doesn't start
+ *         with a PEER_INDEX_TABLE.
+ */
+int mrtribforeach(io_rw_t *io, int nthreads, size_t batchsiz, int flags, mrtribfunc_t fn, mrtribcommitfunc_t commit, void *arg);
+
+#endif
@@ -105,7 +105,7 @@ typedef struct {
 #define IPV4_SIZE sizeof(struct in_addr)
 #define IPV4_BIT  IPV4_SIZE * CHAR_BIT
 #define IPV6_SIZE sizeof(struct in6_addr)
-#define IPV6_BIT  IPV6_BIT * CHAR_BIT
+#define IPV6_BIT  IPV6_SIZE * CHAR_BIT
 
 typedef struct {
     netaddr_t pfx;
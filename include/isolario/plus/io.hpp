@@ -64,10 +64,11 @@ namespace isolario
         z_format format;  ///< Z compression format.
         int compression;  ///< Only meaningful for \a io_access::write, compression level [1-9]
         int window_bits;  ///< Only meaningful for \a io_access::write, sensible range: [8, 15]
+        int threads;      ///< Only meaningful for \a io_access::write, compression threads, 1 compresses on the calling thread, 0 uses all online CPUs
         inline static constexpr const char *extension = ".gz";
 
         constexpr z_params() noexcept
-            : io_params(), format(z_format::rfc1952), compression(-1), window_bits(15)
+            : io_params(), format(z_format::rfc1952), compression(-1), window_bits(15), threads(1)
         {
         }
     };
@@ -77,10 +78,11 @@ namespace isolario
         int verbosity;    ///< Verbosity level [0-9]
         int work_factor;  ///< Only meaningful for \a io_access::write, BZ2 work factor
         bool small_flag;  ///< Only meaningful for \a io_access::read, BZ2 small flag
+        int threads;      ///< Only meaningful for \a io_access::read, decoding threads, 1 decodes on the calling thread, 0 uses all online CPUs
         inline static constexpr const char *extension = ".bz2";
 
         constexpr bz2_params() noexcept
-            : io_params(), compression(9), verbosity(0), work_factor(0), small_flag(false)
+            : io_params(), compression(9), verbosity(0), work_factor(0), small_flag(false), threads(1)
         {
         }
     };
@@ -95,10 +97,11 @@ namespace isolario
         lzma_checksum checksum;      ///< Only meaningful for \a io_access::write, checksum algorithm used for data integrity.
         std::uint64_t memory_usage;  ///< Only meaningful for \a io_access::read, decoding process memory usage.
         bool extreme_preset;         ///< Only meaningful for \a io_access::write, extreme preset for data compression.
+        int threads;                 ///< Coding threads, 1 codes on the calling thread, 0 uses all online CPUs.
         inline static constexpr const char *extension = ".xz";
 
         constexpr xz_params() noexcept
-            : io_params(), compression(6), checksum(lzma_checksum::crc64), memory_usage(~0ull), extreme_preset(false)
+            : io_params(), compression(6), checksum(lzma_checksum::crc64), memory_usage(~0ull), extreme_preset(false), threads(1)
         {
         }
     };
@@ -111,6 +114,30 @@ namespace isolario
             : io_params(), compression(0) {}
     };
 
+    struct zstd_params : io_params {
+        int compression;  ///< Only meaningful for \a io_access::write, compression level [1-19], up to 22 with large windows
+        int window_log;   ///< Maximum back-reference distance (log2), 0 uses library defaults, limits memory usage for \a io_access::read
+        bool checksum;    ///< Only meaningful for \a io_access::write, append a content checksum to each frame
+        int threads;      ///< Only meaningful for \a io_access::write, compression threads, 1 compresses on the calling thread, 0 uses all online CPUs
+        inline static constexpr const char *extension = ".zst";
+
+        constexpr zstd_params() noexcept
+            : io_params(), compression(3), window_log(0), checksum(false), threads(1)
+        {
+        }
+    };
+
+    enum class mmap_advice { sequential = 'S',
+                             random = 'R',
+                             willneed = 'W' };
+
+    struct mmap_params {
+        mmap_advice advice;  ///< Expected access pattern, passed to madvise().
+
+        constexpr mmap_params() noexcept
+            : advice(mmap_advice::sequential) {}
+    };
+
     class io_rw
     {
       public:
@@ -263,6 +290,44 @@ namespace isolario
             return do_lz4_open(fd, params);
         }
 
+        bool zstd_open(int fd, const zstd_params &params = zstd_params()) noexcept
+        {
+            close();
+
+            return do_zstd_open(fd, params);
+        }
+
+        bool zstd_open(const char *name, const zstd_params &params = zstd_params()) noexcept
+        {
+            close();
+
+            int fd = do_open(name, params.access);
+            if (fd < 0) {
+                return false;
+            }
+
+            return do_zstd_open(fd, params);
+        }
+
+        bool mmap_open(int fd, const mmap_params &params = mmap_params()) noexcept
+        {
+            close();
+
+            return do_mmap_open(fd, params);
+        }
+
+        bool mmap_open(const char *name, const mmap_params &params = mmap_params()) noexcept
+        {
+            close();
+
+            int fd = do_open(name, io_access::read);
+            if (fd < 0) {
+                return false;
+            }
+
+            return do_mmap_open(fd, params);
+        }
+
         std::size_t read(void *dest, std::size_t n) noexcept
         {
             if (!is_open()) {
@@ -343,6 +408,10 @@ namespace isolario
                     [[fallthrough]];
                 case io_access::read:
                     *p++ = char(params.format);
+                    if (params.access == io_access::write && params.threads != 1) {
+                        *p++ = 't';
+                        *p++ = '*';
+                    }
                     *p = '\0';
                     break;
                 default:
@@ -350,7 +419,7 @@ namespace isolario
             }
 
             // NOTE: arguments are ignored for io_access::read
-            ptr = io_zopen(fd, params.bufsiz, mode, params.compression, params.window_bits);
+            ptr = io_zopen(fd, params.bufsiz, mode, params.compression, params.window_bits, params.threads);
             return ptr != nullptr;
         }
 
@@ -368,8 +437,12 @@ namespace isolario
                     }
                     *p++ = 'v';
                     *p++ = '*';
+                    if (params.threads != 1) {
+                        *p++ = 't';
+                        *p++ = '*';
+                    }
                     *p = '\0';
-                    ptr = io_bz2open(fd, params.bufsiz, mode, params.verbosity);
+                    ptr = io_bz2open(fd, params.bufsiz, mode, params.verbosity, params.threads);
                     break;
                 case io_access::write:
                     *p++ = '*';
@@ -401,17 +474,61 @@ namespace isolario
                     }
 
                     *p++ = char(params.checksum);
+                    if (params.threads != 1) {
+                        *p++ = 't';
+                        *p++ = '*';
+                    }
                     *p++ = '\0';
 
-                    ptr = io_xzopen(fd, params.bufsiz, mode, params.compression);
+                    ptr = io_xzopen(fd, params.bufsiz, mode, params.compression, params.threads);
                     break;
                 case io_access::read:
                     *p++ = char(params.checksum);
                     *p++ = 'm';
                     *p++ = '*';
+                    if (params.threads != 1) {
+                        *p++ = 't';
+                        *p++ = '*';
+                    }
+                    *p = '\0';
+
+                    ptr = io_xzopen(fd, params.bufsiz, mode, params.memory_usage, params.threads);
+                    break;
+                default:
+                    return false;
+            }
+
+            return ptr != nullptr;
+        }
+
+        bool do_zstd_open(int fd, const zstd_params &params) noexcept
+        {
+            char mode[16];
+
+            char *p = mode;
+            *p++ = char(params.access);
+            switch (params.access) {
+                case io_access::write:
+                    *p++ = '*';
+                    *p++ = 'l';
+                    *p++ = '*';
+                    if (params.checksum) {
+                        *p++ = 'c';
+                    }
+                    if (params.threads != 1) {
+                        *p++ = 't';
+                        *p++ = '*';
+                    }
+                    *p = '\0';
+
+                    ptr = io_zstdopen(fd, params.bufsiz, mode, params.compression, params.window_log, params.threads);
+                    break;
+                case io_access::read:
+                    *p++ = 'l';
+                    *p++ = '*';
                     *p = '\0';
 
-                    ptr = io_xzopen(fd, params.bufsiz, mode, params.memory_usage);
+                    ptr = io_zstdopen(fd, params.bufsiz, mode, params.window_log);
                     break;
                 default:
                     return false;
@@ -441,6 +558,14 @@ namespace isolario
             return ptr != nullptr;
         }
 
+        bool do_mmap_open(int fd, const mmap_params &params) noexcept
+        {
+            const char mode[] = { 'r', char(params.advice), '\0' };
+
+            ptr = io_mmapopen(fd, mode);
+            return ptr != nullptr;
+        }
+
         io_rw_t *ptr;
         io_rw_t buf;
     };
@@ -0,0 +1,74 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+/**
+ * @file isolario/ribcols.h
+ *
+ * @brief Columnar (struct of arrays) rows for bulk RIB and UPDATE decoding.
+ *
+ * Bulk decoders such as nextribcols_r() and nextnlricols_r() turn RIB
+ * entries and announced or withdrawn prefixes into rows, stored column by
+ * column into caller provided arrays, so that analytics may run tight
+ * loops over each column.
+ *
+ * @note This file is guaranteed to include standard \a stddef.h, \a stdint.h
+ *       and \a time.h, a number of other files may be included in the
+ *       interest of providing API functionality, but the includer of this
+ *       file should not rely on such behavior.
+ */
+
+#ifndef ISOLARIO_RIBCOLS_H_
+#define ISOLARIO_RIBCOLS_H_
+
+#include <isolario/attrstore.h>
+#include <isolario/netaddr.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Row columns.
+ *
+ * Each non-\a NULL column holds up to \a cap rows, decoders append rows
+ * starting at \a len and update it. Any column may be left \a NULL if the
+ * caller isn't interested in it, in which case it is not decoded at all.
+ */
+typedef struct ribcols_s {
+    size_t len;               ///< Rows currently stored.
+    size_t cap;               ///< Rows each column can hold.
+    time_t *stamp;            ///< Originated time for RIB entries, message time for updates.
+    uint32_t *peer_idx;       ///< Peer index.
+    netaddr_t *pfx;           ///< Prefix.
+    uint32_t *pathid;         ///< ADD-PATH path identifier, 0 if none.
+    uint32_t *origin_as;      ///< Origin AS, 0 if unknown (see getoriginas()).
+    const attrref_t **attrs;  ///< Interned attributes, a new reference per row, or \a NULL.
+} ribcols_t;
+
+#endif
@@ -0,0 +1,223 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+/**
+ * @file isolario/ribengine.h
+ *
+ * @brief RIB reconstruction from TABLE_DUMPV2 snapshots and BGP4MP updates.
+ *
+ * A RIB engine keeps the Adj-RIB-In of every peer it encounters, it is
+ * usually seeded with a TABLE_DUMPV2 snapshot and then fed with the update
+ * stream following it, applying announcements and withdrawals incrementally.
+ * Path attributes are interned into an attribute store, so routes sharing
+ * the same attributes share memory, too.
+ *
+ * While updates are applied, the engine takes in-memory checkpoints at
+ * regular time intervals. Only the first retained checkpoint holds the
+ * whole state, any other one records the routes changed since the previous,
+ * so memory grows with the update stream rather than with the RIB size.
+ * The state at an arbitrary time can then be rebuilt by restoring the
+ * nearest preceding checkpoint and replaying only the updates following it.
+ *
+ * @note This file is guaranteed to include standard \a stddef.h, \a stdint.h
+ *       and \a time.h, a number of other files may be included in the
+ *       interest of providing API functionality, but the includer of this
+ *       file should not rely on such behavior.
+ */
+
+#ifndef ISOLARIO_RIBENGINE_H_
+#define ISOLARIO_RIBENGINE_H_
+
+#include <isolario/attrstore.h>
+#include <isolario/io.h>
+#include <isolario/mrt.h>
+#include <isolario/netaddr.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef struct ribengine_s ribengine_t;
+
+/// @brief A peer known to a RIB engine.
+typedef struct {
+    uint32_t peer_as;
+    netaddr_t peer_addr;
+    size_t nroutes;  ///< Routes inside this peer's Adj-RIB-In.
+} ribpeer_t;
+
+/**
+ * @brief Route callback for ribengine_foreach().
+ *
+ * @return 0 to continue iteration, any other value stops it.
+ */
+typedef int (*ribroutefunc_t)(size_t peer, const netaddr_t *pfx, uint32_t pathid, const attrref_t *attrs, void *arg);
+
+/**
+ * @brief Create a new, empty, RIB engine.
+ *
+ * @param [in] interval Seconds between checkpoints, 0 disables automatic
+ *                      checkpoints.
+ * @param [in] maxckpts Checkpoints retained, the oldest one is folded
+ *                      into the following one when exceeded, 0 for no
+ *                      limit.
+ *
+ * @return A new engine, to be freed with ribengine_destroy(), \a NULL on
+ *         out of memory.
+ */
+ribengine_t *ribengine_create(time_t interval, size_t maxckpts);
+
+/**
+ * @brief Load a TABLE_DUMPV2 snapshot.
+ *
+ * Every unicast RIB entry is inserted into the Adj-RIB-In of its peer,
+ * replacing any existing route for the same prefix and path identifier.
+ * Engine time is set to the snapshot time, and a checkpoint is taken
+ * at the beginning of the update stream.
+ *
+ * @param [in] io Snapshot, starting with its PEER_INDEX_TABLE.
+ *
+ * @return \a MRT_ENOERR on success, an MRT error code otherwise.
+ */
+int ribengine_loaddump(ribengine_t *eng, io_rw_t *io);
+
+/**
+ * @brief Apply a single BGP4MP record.
+ *
+ * UPDATE messages (both plain and multiprotocol) are applied to the
+ * Adj-RIB-In of the sending peer, a state change leaving the Established
+ * state clears it. Any other record is ignored.
+ *
+ * If the record timestamp crosses the checkpoint interval, a checkpoint
+ * is taken before the record is applied.
+ *
+ * @param [in] msg Record opened for read.
+ * @param [in] off Record offset inside the update stream, as used
+ *                 by ribengine_query() to resume replay.
+ *
+ * @return \a MRT_ENOERR on success, \a MRT_ENOMEM on out of memory, the
+ *         MRT or BGP error that prevented decoding otherwise, in which case
+ *         the record is ignored and the engine is left consistent.
+ */
+int ribengine_apply(ribengine_t *eng, mrt_msg_t *msg, uint64_t off);
+
+/**
+ * @brief Apply a whole update stream with ribengine_apply().
+ *
+ * Record offsets continue from the end of the last applied record (0 for
+ * an engine that didn't apply any yet), so \a io should be positioned
+ * right after it, usually at the beginning of the update stream. Records
+ * that can't be decoded are skipped.
+ *
+ * @return \a MRT_ENOERR once the stream is exhausted, an MRT error code
+ *         on I/O error, corrupted stream or out of memory.
+ */
+int ribengine_replay(ribengine_t *eng, io_rw_t *io);
+
+/**
+ * @brief Take a checkpoint of the current state.
+ *
+ * The first checkpoint copies the whole state, any following one takes
+ * over the changes recorded since the previous checkpoint.
+ *
+ * @param [in] off Update stream offset the state is valid for, i.e. the
+ *                 offset of the next record to be applied.
+ */
+int ribengine_checkpoint(ribengine_t *eng, uint64_t off);
+
+/// @brief Number of checkpoints retained by the engine.
+size_t ribengine_ncheckpoints(const ribengine_t *eng);
+
+/**
+ * @brief Rebuild the RIB as of a given time.
+ *
+ * The last checkpoint not following \a t is restored into a new engine,
+ * then records following it are replayed from \a io up to \a t.
+ * Replay stops at the first record following \a t, so the update stream
+ * is expected to be timestamp ordered.
+ *
+ * @param [in]  t     Query time, records timestamped up to \a t
+ *                    (included) are applied.
+ * @param [in]  io    A fresh reader over the same update stream \a eng was
+ *                    fed with, positioned at its beginning, it is seeked
+ *                    with mrttseekpoint().
+ * @param [out] pview Set to the rebuilt state, an engine without checkpoints
+ *                    that may be inspected and must be destroyed before
+ *                    \a eng.
+ *
+ * @return \a MRT_ENOERR on success, \a MRT_EINVOP if no checkpoint precedes
+ *         \a t, an MRT error code on I/O error or out of memory.
+ */
+int ribengine_query(ribengine_t *eng, time_t t, io_rw_t *io, ribengine_t **pview);
+
+/// @brief Timestamp of the last applied record.
+time_t ribengine_time(const ribengine_t *eng);
+
+/// @brief Number of known peers.
+size_t ribengine_npeers(const ribengine_t *eng);
+
+/// @brief Peer at index \a i, peers are indexed in order of appearance.
+const ribpeer_t *ribengine_peer(const ribengine_t *eng, size_t i);
+
+/**
+ * @brief Find a peer index.
+ *
+ * @return Index of the peer, or \a SIZE_MAX if not found.
+ */
+size_t ribengine_findpeer(const ribengine_t *eng, uint32_t peer_as, const netaddr_t *peer_addr);
+
+/**
+ * @brief Find a route inside a peer's Adj-RIB-In.
+ *
+ * Attributes are kept in the same form regardless of their source, that is
+ * the one of TABLE_DUMPV2 RIB entries (RFC 6396): ASes are 32 bits wide,
+ * with AS_PATH and AGGREGATOR already reconciled with AS4_PATH and
+ * AS4_AGGREGATOR, MP_REACH_NLRI only retains the next hop length and
+ * the next hop, MP_UNREACH_NLRI is never present.
+ *
+ * @return The route attributes, or \a NULL if no such route exists.
+ */
+const attrref_t *ribengine_lookup(const ribengine_t *eng, size_t peer, const netaddr_t *pfx, uint32_t pathid);
+
+/**
+ * @brief Iterate over every route inside a peer's Adj-RIB-In.
+ *
+ * Routes are visited in no particular order, within a single pass over
+ * the engine, even when \a peer is \a SIZE_MAX, which visits the routes
+ * of every peer.
+ *
+ * @return 0 if iteration completed, the first non-zero value returned by
+ *         \a fn otherwise.
+ */
+int ribengine_foreach(const ribengine_t *eng, size_t peer, ribroutefunc_t fn, void *arg);
+
+/// @brief Free an engine along with its checkpoints.
+void ribengine_destroy(ribengine_t *eng);
+
+#endif
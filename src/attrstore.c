@@ -0,0 +1,229 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <assert.h>
+#include <isolario/attrstore.h>
+#include <isolario/branch.h>
+#include <isolario/strutil.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    ATTRSTORE_MINBUCKETS = 64
+};
+
+// private bookkeeping, allocated right before the public handle
+typedef struct attrnode_s {
+    struct attrnode_s *next;  // hash chain
+    uint32_t hash;            // cached hash value
+    atomic_uint refcnt;
+} attrnode_t;
+
+struct attrstore_s {
+    pthread_mutex_t mutex;
+    size_t count;     // handles in store
+    size_t nbuckets;  // always a power of 2
+    attrnode_t **buckets;
+};
+
+static attrref_t *getref(attrnode_t *node)
+{
+    return (attrref_t *) (node + 1);
+}
+
+static attrnode_t *getnode(const attrref_t *ref)
+{
+    return (attrnode_t *) ref - 1;
+}
+
+static uint32_t attrhash(uint32_t peer, const void *attrs, size_t n)
+{
+    uint64_t h = memdjb2(attrs, n);
+
+    h = ((h << 5) + h) ^ peer;
+    return h ^ (h >> 32);
+}
+
+attrstore_t *attrstore_create(size_t hint)
+{
+    attrstore_t *st = malloc(sizeof(*st));
+    if (unlikely(!st))
+        return NULL;
+
+    size_t nbuckets = ATTRSTORE_MINBUCKETS;
+    while (nbuckets < hint)
+        nbuckets <<= 1;
+
+    st->buckets = calloc(nbuckets, sizeof(*st->buckets));
+    if (unlikely(!st->buckets)) {
+        free(st);
+        return NULL;
+    }
+    if (pthread_mutex_init(&st->mutex, NULL) != 0) {
+        free(st->buckets);
+        free(st);
+        return NULL;
+    }
+
+    st->count    = 0;
+    st->nbuckets = nbuckets;
+    return st;
+}
+
+static void rehash(attrstore_t *st)
+{
+    size_t nbuckets = st->nbuckets << 1;
+
+    attrnode_t **buckets = calloc(nbuckets, sizeof(*buckets));
+    if (unlikely(!buckets))
+        return;  // keep going with longer chains
+
+    for (size_t i = 0; i < st->nbuckets; i++) {
+        attrnode_t *node = st->buckets[i];
+        while (node) {
+            attrnode_t *next = node->next;
+            attrnode_t **head = &buckets[node->hash & (nbuckets - 1)];
+
+            node->next = *head;
+            *head      = node;
+            node       = next;
+        }
+    }
+
+    free(st->buckets);
+    st->buckets  = buckets;
+    st->nbuckets = nbuckets;
+}
+
+const attrref_t *attrstore_intern(attrstore_t *st, uint32_t peer, const void *attrs, size_t n)
+{
+    assert(n <= UINT16_MAX);
+
+    uint32_t hash = attrhash(peer, attrs, n);
+
+    pthread_mutex_lock(&st->mutex);
+
+    attrnode_t **head = &st->buckets[hash & (st->nbuckets - 1)];
+    for (attrnode_t *node = *head; node; node = node->next) {
+        attrref_t *ref = getref(node);
+        if (node->hash == hash && ref->peer == peer && ref->len == n && memcmp(ref->attrs, attrs, n) == 0) {
+            atomic_fetch_add_explicit(&node->refcnt, 1, memory_order_relaxed);
+            pthread_mutex_unlock(&st->mutex);
+            return ref;
+        }
+    }
+
+    // sizeof(attrnode_t) is pointer aligned, so the handle following it is aligned too
+    attrnode_t *node = malloc(sizeof(*node) + sizeof(attrref_t) + n);
+    if (unlikely(!node)) {
+        pthread_mutex_unlock(&st->mutex);
+        return NULL;
+    }
+
+    attrref_t *ref = getref(node);
+
+    node->hash = hash;
+    atomic_init(&node->refcnt, 1);
+    ref->peer  = peer;
+    ref->len   = n;
+    memcpy(ref->attrs, attrs, n);
+
+    node->next = *head;
+    *head      = node;
+    if (++st->count > st->nbuckets)
+        rehash(st);
+
+    pthread_mutex_unlock(&st->mutex);
+    return ref;
+}
+
+const attrref_t *attrstore_ref(const attrref_t *ref)
+{
+    // caller holds a reference, so it can't drop to 0 concurrently
+    atomic_fetch_add_explicit(&getnode(ref)->refcnt, 1, memory_order_relaxed);
+    return ref;
+}
+
+void attrstore_unref(attrstore_t *st, const attrref_t *ref)
+{
+    attrnode_t *node = getnode(ref);
+
+    // fast path, not the last reference: no lock needed
+    unsigned cnt = atomic_load_explicit(&node->refcnt, memory_order_relaxed);
+    while (cnt > 1) {
+        if (atomic_compare_exchange_weak_explicit(&node->refcnt, &cnt, cnt - 1, memory_order_release, memory_order_relaxed))
+            return;
+    }
+
+    // possibly the last one, but attrstore_intern() may revive the handle
+    // until it is unlinked, so check again under lock
+    pthread_mutex_lock(&st->mutex);
+
+    if (atomic_fetch_sub_explicit(&node->refcnt, 1, memory_order_acq_rel) == 1) {
+        attrnode_t **ptr = &st->buckets[node->hash & (st->nbuckets - 1)];
+        while (*ptr != node)
+            ptr = &(*ptr)->next;
+
+        *ptr = node->next;
+        st->count--;
+        free(node);
+    }
+
+    pthread_mutex_unlock(&st->mutex);
+}
+
+size_t attrstore_count(attrstore_t *st)
+{
+    pthread_mutex_lock(&st->mutex);
+    size_t count = st->count;
+    pthread_mutex_unlock(&st->mutex);
+
+    return count;
+}
+
+void attrstore_destroy(attrstore_t *st)
+{
+    for (size_t i = 0; i < st->nbuckets; i++) {
+        attrnode_t *node = st->buckets[i];
+        while (node) {
+            attrnode_t *next = node->next;
+
+            free(node);
+            node = next;
+        }
+    }
+
+    pthread_mutex_destroy(&st->mutex);
+    free(st->buckets);
+    free(st);
+}
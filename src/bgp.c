@@ -28,17 +28,27 @@
 // THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //
 
+#include <isolario/attrstore.h>
 #include <isolario/bgp.h>
 #include <isolario/branch.h>
 #include <isolario/endian.h>
+#include <isolario/ribcols.h>
 #include <isolario/util.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-enum { BGPGROWSTEP  = 256 };
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+enum {
+    BGPGROWSTEP = 256,
+    BGPNRETAIN  = 2  ///< Heap buffers retained per thread for packets exceeding BGPBUFSIZ
+};
 
 /// @brief BGP packet marker, prepended to any packet
 static const unsigned char bgp_marker[] = {
@@ -68,7 +78,8 @@ enum {
     F_COMMUNITY  = 1 << 12,
     F_ADDPATH    = 1 << 13,
     F_ASN32BIT   = 1 << 14,
-    F_PRESOFFTAB = 1 << 15  ///< See rebuildbgpfrommrt()
+    F_PRESOFFTAB = 1 << 15, ///< See rebuildbgpfrommrt()
+    F_INDEXED    = 1 << 16  ///< Attributes indexed in attrtab, see \a BGPF_INDEXATTRS
 };
 
 /// @brief Offsets for various BGP packet fields
@@ -115,7 +126,7 @@ enum {
 #define EXTRACT_CODE_INDEX(x) ((x) - INDEX_BIAS)
 
 // NOTE: index count must be less than nelems(bgp_msg_t.offtab)!
-static const int8_t attr_code_index[255] = {
+static const int8_t attr_code_index[256] = {
     [AS_PATH_CODE]            = MAKE_CODE_INDEX(0),
     [ORIGIN_CODE]             = MAKE_CODE_INDEX(1),
     [ATOMIC_AGGREGATE_CODE]   = MAKE_CODE_INDEX(2),
@@ -215,6 +226,135 @@ static int endpending(bgp_msg_t *msg)
 
 #define CHECKTYPE(exp_type) CHECKTYPER(exp_type, (msg)->err)
 
+/// @brief Heap buffers for packets exceeding \a BGPBUFSIZ, retained by each thread across bgpclose_r().
+static _Thread_local struct bgpretained {
+    unsigned char *bufs[BGPNRETAIN];
+    size_t sizes[BGPNRETAIN];
+    size_t hiwater;
+    size_t maxsiz;    ///< Shrink policy, 0 means no limit
+    bool registered;  ///< Buffers are released on thread exit
+} retained;
+
+static pthread_once_t retainonce = PTHREAD_ONCE_INIT;
+static pthread_key_t retainkey;
+static bool retainhaskey;
+
+static void bgpfreeretained(void *p)
+{
+    struct bgpretained *r = p;
+    for (int i = 0; i < BGPNRETAIN; i++) {
+        free(r->bufs[i]);
+        r->bufs[i] = NULL;
+    }
+}
+
+static void bgpmkretainkey(void)
+{
+    // on failure, buffers are only released by an explicit bgpreleasebufs()
+    retainhaskey = (pthread_key_create(&retainkey, bgpfreeretained) == 0);
+}
+
+static unsigned char *bgpgetbuf(size_t n, uint16_t *pcap)
+{
+    assert(n <= UINT16_MAX);
+
+    if (n > retained.hiwater)
+        retained.hiwater = n;
+
+    // pick the smallest retained buffer that fits
+    int best = -1;
+    for (int i = 0; i < BGPNRETAIN; i++) {
+        if (retained.bufs[i] && retained.sizes[i] >= n && (best < 0 || retained.sizes[i] < retained.sizes[best]))
+            best = i;
+    }
+    if (best >= 0) {
+        unsigned char *buf = retained.bufs[best];
+
+        *pcap = retained.sizes[best];
+        retained.bufs[best] = NULL;
+        return buf;
+    }
+
+    // none fits, drop the largest retained buffer and allocate a new one
+    int largest = -1;
+    for (int i = 0; i < BGPNRETAIN; i++) {
+        if (retained.bufs[i] && (largest < 0 || retained.sizes[i] > retained.sizes[largest]))
+            largest = i;
+    }
+    if (largest >= 0) {
+        free(retained.bufs[largest]);
+        retained.bufs[largest] = NULL;
+    }
+
+    size_t cap = (n + BGPBUFSIZ - 1) & ~((size_t) BGPBUFSIZ - 1);
+    if (cap > UINT16_MAX)
+        cap = UINT16_MAX;
+
+    unsigned char *buf = malloc(cap);
+    if (likely(buf))
+        *pcap = cap;
+
+    return buf;
+}
+
+static void bgpputbuf(unsigned char *buf, uint16_t cap)
+{
+    if (retained.maxsiz != 0 && cap > retained.maxsiz) {
+        free(buf);
+        return;
+    }
+
+    // retain inside a free slot, or replace the smallest retained buffer
+    int slot = 0;
+    for (int i = 0; i < BGPNRETAIN; i++) {
+        if (!retained.bufs[i]) {
+            slot = i;
+            break;
+        }
+        if (retained.sizes[i] < retained.sizes[slot])
+            slot = i;
+    }
+    if (retained.bufs[slot]) {
+        if (retained.sizes[slot] >= cap) {
+            free(buf);
+            return;
+        }
+
+        free(retained.bufs[slot]);
+    }
+
+    retained.bufs[slot]  = buf;
+    retained.sizes[slot] = cap;
+    if (unlikely(!retained.registered)) {
+        pthread_once(&retainonce, bgpmkretainkey);
+        retained.registered = retainhaskey && pthread_setspecific(retainkey, &retained) == 0;
+    }
+}
+
+void setbgpbufretain(size_t maxsiz)
+{
+    retained.maxsiz = maxsiz;
+    if (maxsiz == 0)
+        return;
+
+    for (int i = 0; i < BGPNRETAIN; i++) {
+        if (retained.bufs[i] && retained.sizes[i] > maxsiz) {
+            free(retained.bufs[i]);
+            retained.bufs[i] = NULL;
+        }
+    }
+}
+
+size_t getbgpbufhiwater(void)
+{
+    return retained.hiwater;
+}
+
+void bgpreleasebufs(void)
+{
+    bgpfreeretained(&retained);
+}
+
 static int bgpensure(bgp_msg_t *msg, size_t len)
 {
     len += msg->pktlen;
@@ -224,21 +364,27 @@ static int bgpensure(bgp_msg_t *msg, size_t len)
         if (unlikely(len > UINT16_MAX))
             len = UINT16_MAX;
 
-        unsigned char *buf = msg->buf;
-        if (buf == msg->fastbuf)
-            buf = NULL;
-
-        unsigned char *larger = realloc(buf, len);
-        if (unlikely(!larger)) {
-            msg->err = BGP_ENOMEM;
-            return false;
-        }
+        if (msg->buf == msg->fastbuf) {
+            uint16_t cap;
+            unsigned char *larger = bgpgetbuf(len, &cap);
+            if (unlikely(!larger)) {
+                msg->err = BGP_ENOMEM;
+                return false;
+            }
 
-        if (!buf)
             memcpy(larger, msg->buf, msg->pktlen);
+            msg->buf    = larger;
+            msg->bufsiz = cap;
+        } else {
+            unsigned char *larger = realloc(msg->buf, len);
+            if (unlikely(!larger)) {
+                msg->err = BGP_ENOMEM;
+                return false;
+            }
 
-        msg->buf    = larger;
-        msg->bufsiz = len;
+            msg->buf    = larger;
+            msg->bufsiz = len;
+        }
     }
 
     return true;
@@ -252,6 +398,61 @@ bgp_msg_t *getbgp(void)
     return &curmsg;
 }
 
+/// @brief Validate Path Attributes field and index every attribute, see BGPF_INDEXATTRS.
+static int indexbgpattribs(bgp_msg_t *msg)
+{
+    if (msg->pktlen < BASE_PACKET_LENGTH || msg->buf[TYPE_OFFSET] != BGP_UPDATE)
+        return BGP_ENOERR;  // nothing to index
+    if (unlikely(msg->pktlen < MIN_UPDATE_LENGTH))
+        return BGP_EBADWDRWN;
+
+    const unsigned char *end = &msg->buf[msg->pktlen];
+
+    size_t n = 0;
+    unsigned char *ptr = getwithdrawn_r(msg, &n);
+    if (unlikely((size_t) (end - ptr) < n + sizeof(uint16_t)))
+        return BGP_EBADWDRWN;
+
+    ptr = getbgpattribs_r(msg, &n);
+    if (unlikely((size_t) (end - ptr) < n))
+        return BGP_EBADATTR;
+
+    memset(msg->attrtab, 0, sizeof(msg->attrtab));
+
+    end = ptr + n;
+    while (ptr < end) {
+        if (unlikely(end - ptr < ATTR_HEADER_SIZE))
+            return BGP_EBADATTR;
+
+        const bgpattr_t *attr = (const bgpattr_t *) ptr;
+
+        size_t len = attr->len;
+        size_t hdrsize = ATTR_HEADER_SIZE;
+        if (attr->flags & ATTR_EXTENDED_LENGTH) {
+            if (unlikely(end - ptr < ATTR_EXTENDED_HEADER_SIZE))
+                return BGP_EBADATTR;
+
+            hdrsize = ATTR_EXTENDED_HEADER_SIZE;
+            len <<= 8;
+            len |= attr->exlen[1];  // len was exlen[0]
+        }
+
+        len += hdrsize;
+        if (unlikely((size_t) (end - ptr) < len))
+            return BGP_EBADATTR;
+
+        // offset 0 is never a valid attribute offset, so it marks a missing one,
+        // duplicate attributes are malformed anyway, the first one wins
+        if (msg->attrtab[attr->code] == 0)
+            msg->attrtab[attr->code] = ptr - msg->buf;
+
+        ptr += len;
+    }
+
+    msg->flags |= F_INDEXED;
+    return BGP_ENOERR;
+}
+
 int setbgpread(const void *data, size_t n, int flags)
 {
     return setbgpread_r(&curmsg, data, n, flags);
@@ -275,9 +476,10 @@ int setbgpread_r(bgp_msg_t *msg, const void *data, size_t n, int flags)
         msg->buf    = (unsigned char *) data;  // we won't modify it, it's read-only
         msg->flags |= F_SH;                    // mark buffer as shared
     } else {
-        msg->buf = msg->fastbuf;
+        msg->buf    = msg->fastbuf;
+        msg->bufsiz = sizeof(msg->fastbuf);
         if (unlikely(n > sizeof(msg->fastbuf)))
-            msg->buf = malloc(n);
+            msg->buf = bgpgetbuf(n, &msg->bufsiz);
 
         if (unlikely(!msg->buf))
             return BGP_ENOMEM;
@@ -286,6 +488,12 @@ int setbgpread_r(bgp_msg_t *msg, const void *data, size_t n, int flags)
     }
 
     memset(msg->offtab, 0, sizeof(msg->offtab));
+    msg->asplen = -1;
+    if (flags & BGPF_INDEXATTRS) {
+        msg->err = indexbgpattribs(msg);
+        if (unlikely(msg->err != BGP_ENOERR))
+            return bgpclose_r(msg);
+    }
     return BGP_ENOERR;
 }
 
@@ -307,8 +515,18 @@ int setbgpreadfrom(io_rw_t *io, int flags)
 
 int setbgpreadfrom_r(bgp_msg_t *msg, io_rw_t *io, int flags)
 {
-    unsigned char hdr[BASE_PACKET_LENGTH];
-    if (io->read(io, hdr, sizeof(hdr)) != sizeof(hdr))
+    unsigned char hdrbuf[BASE_PACKET_LENGTH];
+    const unsigned char *hdr = hdrbuf;
+    unsigned char *data = NULL;  // only set for zero-copy streams
+
+    size_t n;
+    if (io->peek) {
+        data = io->peek(io, BASE_PACKET_LENGTH, &n);
+        hdr  = data;
+    } else {
+        n = io->read(io, hdrbuf, sizeof(hdrbuf));
+    }
+    if (n != BASE_PACKET_LENGTH)
         return BGP_EIO;
 
     uint16_t len;
@@ -320,18 +538,36 @@ int setbgpreadfrom_r(bgp_msg_t *msg, io_rw_t *io, int flags)
     if (len < BASE_PACKET_LENGTH)
         return BGP_EBADHDR;
 
-    msg->buf = msg->fastbuf;
-    if (unlikely(len > sizeof(msg->fastbuf)))
-        msg->buf = malloc(len);
-    if (unlikely(!msg->buf))
-        return BGP_ENOMEM;
-
-    memcpy(msg->buf, hdr, sizeof(hdr));
-    size_t n = len - sizeof(hdr);
-    if (io->read(io, &msg->buf[sizeof(hdr)], n) != n)
-        return BGP_EIO;
+    int shared = 0;
+    if (data) {
+        // zero-copy, reference the packet directly inside the stream
+        data = io->peek(io, len, &n);
+        if (n != len)
+            return BGP_EIO;
 
-    msg->flags = F_RD;
+        io->consume(io, len);
+        msg->buf    = data;
+        msg->bufsiz = len;
+        shared      = F_SH;
+    } else {
+        msg->buf    = msg->fastbuf;
+        msg->bufsiz = sizeof(msg->fastbuf);
+        if (unlikely(len > sizeof(msg->fastbuf)))
+            msg->buf = bgpgetbuf(len, &msg->bufsiz);
+        if (unlikely(!msg->buf))
+            return BGP_ENOMEM;
+
+        memcpy(msg->buf, hdr, BASE_PACKET_LENGTH);
+        n = len - BASE_PACKET_LENGTH;
+        if (io->read(io, &msg->buf[BASE_PACKET_LENGTH], n) != n) {
+            if (msg->buf != msg->fastbuf)
+                bgpputbuf(msg->buf, msg->bufsiz);
+
+            return BGP_EIO;
+        }
+    }
+
+    msg->flags = F_RD | shared;
     if (flags & BGPF_ASN32BIT)
         msg->flags |= F_ASN32BIT;
     if (flags & BGPF_ADDPATH)
@@ -339,8 +575,13 @@ int setbgpreadfrom_r(bgp_msg_t *msg, io_rw_t *io, int flags)
 
     msg->err = BGP_ENOERR;
     msg->pktlen = len;
-    msg->bufsiz = len;
     memset(msg->offtab, 0, sizeof(msg->offtab));
+    msg->asplen = -1;
+    if (flags & BGPF_INDEXATTRS) {
+        msg->err = indexbgpattribs(msg);
+        if (unlikely(msg->err != BGP_ENOERR))
+            return bgpclose_r(msg);
+    }
     return BGP_ENOERR;
 }
 
@@ -737,6 +978,8 @@ void *bgpfinish_r(bgp_msg_t *msg, size_t *pn)
     if ((msg->flags & F_PRESOFFTAB)== 0)
         memset(msg->offtab, 0, sizeof(msg->offtab));
 
+    msg->asplen = -1;
+
     msg->flags &= ~(F_WR | F_PRESOFFTAB);
     msg->flags |= F_RD; //allow reading from this message in the future
     return msg->buf;
@@ -751,7 +994,7 @@ int bgpclose_r(bgp_msg_t *msg)
 {
     int err = msg->err;
     if (msg->buf != msg->fastbuf && (msg->flags & F_SH) == 0)
-        free(msg->buf);
+        bgpputbuf(msg->buf, msg->bufsiz);
 
     // memset(msg, 0, sizeof(*msg) - BGPBUFSIZ); XXX: optimize
     msg->err   = BGP_ENOERR;
@@ -970,7 +1213,7 @@ int endbgpcaps_r(bgp_msg_t *msg)
 // Update message read/write functions =========================================
 
 #define SAVE_UPDATE_ITER(pkt)                  \
-    int prev_flags_             = pkt->flags;  \
+    uint32_t prev_flags_        = pkt->flags;  \
     unsigned char *prev_ustart_ = pkt->ustart; \
     unsigned char *prev_uptr_   = pkt->uptr;   \
     unsigned char *prev_uend_   = pkt->uend;
@@ -1125,43 +1368,45 @@ void *getwithdrawn_r(bgp_msg_t *msg, size_t *pn)
     return ptr;
 }
 
-void *nextwithdrawn(void)
-{
-    return nextwithdrawn_r(&curmsg);
-}
-
-void *nextwithdrawn_r(bgp_msg_t *msg)
-{
-    CHECKFLAGSR(F_RD | F_WITHDRN, NULL);
-
-    netaddr_t *addr = &msg->pfxbuf.pfx;
-    while (unlikely(msg->uptr == msg->uend)) {  // this loop handles empty MP_UNREACH
-        if ((msg->flags & F_ALLWITHDRN) == 0)
-            return NULL;  // we're done
+/**
+ * @brief Move withdrawn or NLRI iteration to the next prefix field if needed.
+ *
+ * Once the current field is over and \a allflag is set, iteration switches
+ * to the MP_UNREACH_NLRI (\a F_ALLWITHDRN) or MP_REACH_NLRI (\a F_ALLNLRI)
+ * attribute, setting the prefix family accordingly.
+ *
+ * @return \a true if a prefix is available at \a msg->uptr, \a false once
+ *         no prefix is left or on error.
+ */
+static bool nextfield(bgp_msg_t *msg, int allflag, int err)
+{
+    while (unlikely(msg->uptr == msg->uend)) {  // this loop handles empty MP attributes
+        if ((msg->flags & allflag) == 0)
+            return false;
 
-        msg->flags &= ~F_ALLWITHDRN;
+        msg->flags &= ~allflag;
 
-        bgpattr_t *attr = getbgpmpunreach_r(msg);
+        bgpattr_t *attr = (allflag == F_ALLNLRI) ? getbgpmpreach_r(msg) : getbgpmpunreach_r(msg);
         if (!attr)
-            return NULL;
+            return false;
 
         afi_t  afi  = getmpafi(attr);
         safi_t safi = getmpsafi(attr);
         if (unlikely(safi != SAFI_UNICAST && safi != SAFI_MULTICAST)) {
-            msg->err = BGP_EBADWDRWN;  // FIXME
-            return NULL;
+            msg->err = err;  // FIXME
+            return false;
         }
 
         switch (afi) {
         case AFI_IPV4:
-            addr->family = AF_INET;
+            msg->pfxbuf.pfx.family = AF_INET;
             break;
         case AFI_IPV6:
-            addr->family = AF_INET6;
+            msg->pfxbuf.pfx.family = AF_INET6;
             break;
         default:
-            msg->err = BGP_EBADWDRWN; // FIXME;
-            return NULL;
+            msg->err = err; // FIXME;
+            return false;
         }
 
         size_t len;
@@ -1170,6 +1415,22 @@ void *nextwithdrawn_r(bgp_msg_t *msg)
         msg->uend   = msg->ustart + len;
     }
 
+    return true;
+}
+
+void *nextwithdrawn(void)
+{
+    return nextwithdrawn_r(&curmsg);
+}
+
+void *nextwithdrawn_r(bgp_msg_t *msg)
+{
+    CHECKFLAGSR(F_RD | F_WITHDRN, NULL);
+
+    if (!nextfield(msg, F_ALLWITHDRN, BGP_EBADWDRWN))
+        return NULL;  // we're done
+
+    netaddr_t *addr = &msg->pfxbuf.pfx;
     memset(addr->bytes, 0, sizeof(addr->bytes));
     if (msg->flags & F_ADDPATH) {
         uint32_t pathid;
@@ -1233,6 +1494,96 @@ int putwithdrawn_r(bgp_msg_t *msg, const void *p)
     return BGP_ENOERR;
 }
 
+/**
+ * @brief Decode a single prefix, shared by the bulk decoders.
+ *
+ * @return Pointer past the decoded prefix, \a NULL if it is malformed.
+ */
+static inline const unsigned char *decodeprefix(const unsigned char *ptr, const unsigned char *end,
+                                                short family, bool addpath,
+                                                netaddr_t *addr, uint32_t *pathid)
+{
+    const int maxbitlen = (family == AF_INET6) ? IPV6_BIT : IPV4_BIT;
+
+    if (addpath) {
+        // if <=, also catch the case in which there is room for the PATHID,
+        // but no room for prefix bit length
+        if (unlikely(end - ptr <= (ptrdiff_t) sizeof(*pathid)))
+            return NULL;
+
+        memcpy(pathid, ptr, sizeof(*pathid));
+        *pathid = frombig32(*pathid);
+        ptr += sizeof(*pathid);
+    }
+
+    int bitlen = *ptr++;
+    int n = naddrsize(bitlen);
+    if (unlikely(bitlen > maxbitlen || end - ptr < n))
+        return NULL;
+
+    addr->family = family;
+    addr->bitlen = bitlen;
+    memset(addr->bytes, 0, sizeof(addr->bytes));
+    memcpy(addr->bytes, ptr, n);
+    return ptr + n;
+}
+
+/**
+ * @brief Decode withdrawn or NLRI prefixes straight into columns.
+ *
+ * Picks up where the current iteration left, see nextfield().
+ */
+static size_t decodecols(bgp_msg_t *msg, ribcols_t *cols, int allflag, int err,
+                         time_t stamp, uint32_t peer_idx, uint32_t origin_as, const attrref_t *ref)
+{
+    const bool addpath = (msg->flags & F_ADDPATH) != 0;
+
+    size_t start = cols->len;
+    while (cols->len < cols->cap && nextfield(msg, allflag, err)) {
+        const short family = msg->pfxbuf.pfx.family;
+        const unsigned char *end = msg->uend;
+
+        size_t i = cols->len;
+        while (msg->uptr < end && i < cols->cap) {
+            netaddr_t pfx;
+            uint32_t pathid = 0;
+
+            netaddr_t *addr = (cols->pfx) ? &cols->pfx[i] : &pfx;
+            const unsigned char *next = decodeprefix(msg->uptr, end, family, addpath, addr, &pathid);
+            if (unlikely(!next)) {
+                msg->err = err;
+                cols->len = i;
+                return i - start;
+            }
+
+            msg->uptr = (unsigned char *) next;
+
+            if (cols->stamp)
+                cols->stamp[i] = stamp;
+            if (cols->peer_idx)
+                cols->peer_idx[i] = peer_idx;
+            if (cols->pathid)
+                cols->pathid[i] = pathid;
+            if (cols->origin_as)
+                cols->origin_as[i] = origin_as;
+            if (cols->attrs)
+                cols->attrs[i] = (ref) ? attrstore_ref(ref) : NULL;
+
+            i++;
+        }
+
+        cols->len = i;
+    }
+
+    return cols->len - start;
+}
+
+size_t nextwithdrawncols_r(bgp_msg_t *msg, ribcols_t *cols, time_t stamp, uint32_t peer_idx)
+{
+    CHECKFLAGSR(F_RD | F_WITHDRN, 0);
+    return decodecols(msg, cols, F_ALLWITHDRN, BGP_EBADWDRWN, stamp, peer_idx, 0, NULL);
+}
+
 int endwithdrawn(void)
 {
     return endwithdrawn_r(&curmsg);
@@ -1336,6 +1687,22 @@ bgpattr_t *nextbgpattrib_r(bgp_msg_t *msg)
     if (msg->uptr == msg->uend)
         return NULL;
 
+    if (msg->flags & F_INDEXED) {
+        // attributes were validated upfront, no need to check bounds
+        bgpattr_t *attr = (bgpattr_t *) msg->uptr;
+
+        size_t len = attr->len;
+        size_t hdrsize = ATTR_HEADER_SIZE;
+        if (attr->flags & ATTR_EXTENDED_LENGTH) {
+            hdrsize = ATTR_EXTENDED_HEADER_SIZE;
+            len <<= 8;
+            len |= attr->exlen[1];
+        }
+
+        msg->uptr += hdrsize + len;
+        return attr;
+    }
+
     if (unlikely(msg->uptr + ATTR_HEADER_SIZE > msg->uend)) {
         msg->err = BGP_EBADATTR;
         return NULL;
@@ -1491,41 +1858,10 @@ void *nextnlri_r(bgp_msg_t *msg)
 {
     CHECKFLAGSR(F_RD | F_NLRI, NULL);
 
-    netaddr_t *addr = &msg->pfxbuf.pfx;
-    while (unlikely(msg->uptr == msg->uend)) {  // this handles empty MP_REACH attributes
-        if ((msg->flags & F_ALLNLRI) == 0)
-            return NULL;
-
-        msg->flags &= ~F_ALLNLRI;
-
-        bgpattr_t *attr = getbgpmpreach_r(msg);
-        if (!attr)
-            return NULL;
-
-        afi_t afi   = getmpafi(attr);
-        safi_t safi = getmpsafi(attr);
-        if (unlikely(safi != SAFI_UNICAST && safi != SAFI_MULTICAST)) {
-            msg->err = BGP_EBADNLRI;  // FIXME
-            return NULL;
-        }
-        switch (afi) {
-        case AFI_IPV4:
-            addr->family = AF_INET;
-            break;
-        case AFI_IPV6:
-            addr->family = AF_INET6;
-            break;
-        default:
-            msg->err = BGP_EBADNLRI; // FIXME;
-            return NULL;
-        }
-
-        size_t len;
-        msg->ustart = getmpnlri(attr, &len);
-        msg->uptr   = msg->ustart;
-        msg->uend   = msg->uptr + len;
-    }
+    if (!nextfield(msg, F_ALLNLRI, BGP_EBADNLRI))
+        return NULL;
 
+    netaddr_t *addr = &msg->pfxbuf.pfx;
     memset(addr->bytes, 0, sizeof(addr->bytes));
     if (msg->flags & F_ADDPATH) {
         uint32_t pathid;
@@ -1597,6 +1933,193 @@ int endnlri_r(bgp_msg_t *msg)
     return msg->err;
 }
 
+size_t nextnlricols_r(bgp_msg_t *msg, ribcols_t *cols, time_t stamp, uint32_t peer_idx, attrstore_t *st)
+{
+    CHECKFLAGSR(F_RD | F_NLRI, 0);
+
+    size_t n;
+    const void *attrs = getbgpattribs_r(msg, &n);
+    if (unlikely(!attrs))
+        return 0;
+
+    uint32_t origin_as = 0;
+    if (cols->origin_as)
+        origin_as = getoriginas(attrs, n, (msg->flags & F_ASN32BIT) ? sizeof(uint32_t) : sizeof(uint16_t));
+
+    // interned only if any row is going to reference them
+    const attrref_t *ref = NULL;
+    if (cols->attrs && st && cols->len < cols->cap && nextfield(msg, F_ALLNLRI, BGP_EBADNLRI)) {
+        ref = attrstore_intern(st, peer_idx, attrs, n);
+        if (unlikely(!ref)) {
+            msg->err = BGP_ENOMEM;
+            return 0;
+        }
+    }
+
+    size_t count = decodecols(msg, cols, F_ALLNLRI, BGP_EBADNLRI, stamp, peer_idx, origin_as, ref);
+    if (ref)
+        attrstore_unref(st, ref);
+
+    return count;
+}
+
+// Bulk prefix decoding =======================================================
+
+/**
+ * @brief Decode a prefix field into an array.
+ *
+ * Always called with constant \a family and \a addpath, so that each call
+ * site gets its own specialized loop.
+ */
+static inline size_t decodeprefixes(bgp_msg_t *msg, const unsigned char *ptr, size_t len,
+                                    short family, bool addpath, void *dst, size_t cap, int err)
+{
+    const unsigned char *end = ptr + len;
+
+    netaddr_t *addrs = dst;
+    netaddrap_t *aps = dst;
+
+    size_t i = 0;
+    while (ptr < end) {
+        netaddr_t pfx;  // prefixes past cap are only validated and counted
+        uint32_t pathid = 0;
+
+        netaddr_t *addr = &pfx;
+        if (likely(i < cap))
+            addr = (addpath) ? &aps[i].pfx : &addrs[i];
+
+        ptr = decodeprefix(ptr, end, family, addpath, addr, &pathid);
+        if (unlikely(!ptr)) {
+            msg->err = err;
+            return 0;
+        }
+
+        if (addpath && likely(i < cap))
+            aps[i].pathid = pathid;
+
+        i++;
+    }
+
+    return i;
+}
+
+static size_t decodefield(bgp_msg_t *msg, const unsigned char *ptr, size_t len,
+                          short family, void *dst, size_t cap, int err)
+{
+    const unsigned char *end = &msg->buf[msg->pktlen];
+    if (unlikely(ptr > end || len > (size_t) (end - ptr))) {
+        msg->err = err;
+        return 0;
+    }
+
+    if (msg->flags & F_ADDPATH) {
+        if (family == AF_INET6)
+            return decodeprefixes(msg, ptr, len, AF_INET6, true, dst, cap, err);
+        else
+            return decodeprefixes(msg, ptr, len, AF_INET, true, dst, cap, err);
+    } else {
+        if (family == AF_INET6)
+            return decodeprefixes(msg, ptr, len, AF_INET6, false, dst, cap, err);
+        else
+            return decodeprefixes(msg, ptr, len, AF_INET, false, dst, cap, err);
+    }
+}
+
+static size_t decodempfield(bgp_msg_t *msg, bgpattr_t *attr, void *dst, size_t cap, int err)
+{
+    if (!attr)
+        return 0;
+
+    // AFI, SAFI and, for MP_REACH_NLRI, next hop length
+    size_t size;
+    const unsigned char *end = getattrlen(attr, &size);
+    if (unlikely(size < sizeof(uint16_t) + sizeof(uint8_t) + (attr->code == MP_REACH_NLRI_CODE))) {
+        msg->err = err;
+        return 0;
+    }
+
+    end += size;
+
+    short family;
+    safi_t safi = getmpsafi(attr);
+    if (unlikely(safi != SAFI_UNICAST && safi != SAFI_MULTICAST)) {
+        msg->err = err;
+        return 0;
+    }
+
+    switch (getmpafi(attr)) {
+    case AFI_IPV4:
+        family = AF_INET;
+        break;
+    case AFI_IPV6:
+        family = AF_INET6;
+        break;
+    default:
+        msg->err = err;
+        return 0;
+    }
+
+    // next hop length is untrusted, NLRI must not spill out of the attribute
+    size_t len;
+    const unsigned char *ptr = getmpnlri(attr, &len);
+    if (unlikely(ptr > end)) {
+        msg->err = BGP_EBADATTR;
+        return 0;
+    }
+
+    return decodefield(msg, ptr, len, family, dst, cap, err);
+}
+
+size_t getwithdrawnprefixes(void *dst, size_t cap)
+{
+    return getwithdrawnprefixes_r(&curmsg, dst, cap);
+}
+
+size_t getwithdrawnprefixes_r(bgp_msg_t *msg, void *dst, size_t cap)
+{
+    CHECKTYPEANDFLAGSR(BGP_UPDATE, F_RD, 0);
+
+    size_t len;
+    const unsigned char *ptr = getwithdrawn_r(msg, &len);
+    return decodefield(msg, ptr, len, AF_INET, dst, cap, BGP_EBADWDRWN);
+}
+
+size_t getmpunreachprefixes(void *dst, size_t cap)
+{
+    return getmpunreachprefixes_r(&curmsg, dst, cap);
+}
+
+size_t getmpunreachprefixes_r(bgp_msg_t *msg, void *dst, size_t cap)
+{
+    CHECKTYPEANDFLAGSR(BGP_UPDATE, F_RD, 0);
+    return decodempfield(msg, getbgpmpunreach_r(msg), dst, cap, BGP_EBADWDRWN);
+}
+
+size_t getnlriprefixes(void *dst, size_t cap)
+{
+    return getnlriprefixes_r(&curmsg, dst, cap);
+}
+
+size_t getnlriprefixes_r(bgp_msg_t *msg, void *dst, size_t cap)
+{
+    CHECKTYPEANDFLAGSR(BGP_UPDATE, F_RD, 0);
+
+    size_t len;
+    const unsigned char *ptr = getnlri_r(msg, &len);
+    return decodefield(msg, ptr, len, AF_INET, dst, cap, BGP_EBADNLRI);
+}
+
+size_t getmpreachprefixes(void *dst, size_t cap)
+{
+    return getmpreachprefixes_r(&curmsg, dst, cap);
+}
+
+size_t getmpreachprefixes_r(bgp_msg_t *msg, void *dst, size_t cap)
+{
+    CHECKTYPEANDFLAGSR(BGP_UPDATE, F_RD, 0);
+    return decodempfield(msg, getbgpmpreach_r(msg), dst, cap, BGP_EBADNLRI);
+}
+
 static int dostartaspath(bgp_msg_t *msg, bgpattr_t *attr, size_t as_size)
 {
     endpending(msg);
@@ -1778,7 +2301,8 @@ as_pathent_t *nextaspath_r(bgp_msg_t *msg)
     // if we are rebuilding a real AS path,
     // then ascount starts as > 0 and decrements towards 0, until it switches to AS4_PATH;
     // else ascount starts as -1 and decrements at will (!= 0 is always true, which is what we want);
-    if (msg->ascount != 0) {
+    // a SET counts as a single AS (RFC 6793), so it is always taken whole
+    if (msg->ascount != 0 || (msg->asp.type == AS_SEGMENT_SET && msg->segi > 1)) {
         // only decrement AS count if element is first in a SET or if inside a SEQ
         msg->ascount -= (msg->asp.type != AS_SEGMENT_SET || msg->segi == 1);
         return &msg->asp;
@@ -1808,6 +2332,223 @@ int endaspath_r(bgp_msg_t *msg)
     return BGP_ENOERR;
 }
 
+/// @brief Decode a run of \a n 32-bits big endian ASes.
+static void decodeas32(uint32_t *dst, const unsigned char *src, size_t n)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // byteswap 4 ASes at a time: swap 16-bits halves, then bytes inside them
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) &src[i * sizeof(*dst)]);
+
+        v = _mm_shufflelo_epi16(v, 0xb1);
+        v = _mm_shufflehi_epi16(v, 0xb1);
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *) &dst[i], v);
+    }
+#endif
+
+    for (; i < n; i++) {
+        uint32_t as;
+
+        memcpy(&as, &src[i * sizeof(as)], sizeof(as));
+        dst[i] = frombig32(as);
+    }
+}
+
+/// @brief Count ASes in path the way RFC 6793 does, a set counts as one.
+static bool countaspath(const unsigned char *ptr, const unsigned char *end, size_t as_size, size_t *pcount)
+{
+    size_t count = 0;
+    while (ptr < end) {
+        if (unlikely(end - ptr < 2))
+            return false;
+
+        int type = *ptr++;
+        size_t segcount = *ptr++;
+
+        if (unlikely((size_t) (end - ptr) < segcount * as_size))
+            return false;
+
+        ptr += segcount * as_size;
+        count += (type == AS_SEGMENT_SET) ? 1 : segcount;
+    }
+
+    *pcount = count;
+    return true;
+}
+
+/**
+ * @brief Append at most \a limit ASes (as counted by countaspath()) from
+ *        path to \a dst, starting at \a *pn.
+ */
+static bool appendaspath(const unsigned char *ptr, const unsigned char *end, size_t as_size, size_t limit,
+                         uint32_t *dst, uint8_t *types, size_t cap, size_t *pn)
+{
+    size_t n = *pn;
+    while (ptr < end && limit > 0) {
+        if (unlikely(end - ptr < 2))
+            return false;
+
+        int type = *ptr++;
+        size_t segcount = *ptr++;
+
+        if (unlikely((size_t) (end - ptr) < segcount * as_size))
+            return false;
+
+        size_t count = segcount;
+        if (type == AS_SEGMENT_SET) {
+            limit--;  // sets are taken whole
+        } else {
+            if (count > limit)
+                count = limit;
+
+            limit -= count;
+        }
+
+        if (n < cap) {
+            size_t m = min(count, cap - n);
+            if (as_size == sizeof(uint32_t)) {
+                decodeas32(&dst[n], ptr, m);
+            } else {
+                for (size_t i = 0; i < m; i++) {
+                    uint16_t as16;
+
+                    memcpy(&as16, &ptr[i * sizeof(as16)], sizeof(as16));
+                    dst[n + i] = frombig16(as16);
+                }
+            }
+
+            if (types)
+                memset(&types[n], type, m);
+        }
+
+        n   += count;
+        ptr += segcount * as_size;
+    }
+
+    *pn = n;
+    return true;
+}
+
+static size_t decoderealaspath(bgp_msg_t *msg, uint32_t *dst, size_t cap, uint8_t *types)
+{
+    bgpattr_t *asp = getbgpaspath_r(msg);
+    if (!asp)
+        return 0;
+
+    size_t len;
+    const unsigned char *ptr = getaspath(asp, &len);
+    const unsigned char *end = ptr + len;
+
+    size_t n = 0;
+    if (msg->flags & F_ASN32BIT) {
+        if (unlikely(!appendaspath(ptr, end, sizeof(uint32_t), SIZE_MAX, dst, types, cap, &n)))
+            goto malformed;
+
+        return n;
+    }
+
+    // same rules as startrealaspath_r()
+    bgpattr_t *as4p = getbgpas4path_r(msg);
+
+    bgpattr_t *aggr  = getbgpaggregator_r(msg);
+    bgpattr_t *aggr4 = getbgpas4aggregator_r(msg);
+    if (aggr && aggr4 && getaggregatoras(aggr) != AS_TRANS)
+        as4p = NULL;
+
+    size_t limit = SIZE_MAX;
+    const unsigned char *as4ptr = NULL, *as4end = NULL;
+    if (as4p) {
+        as4ptr = getaspath(as4p, &len);
+        as4end = as4ptr + len;
+
+        size_t ascount, as4count;
+        if (unlikely(!countaspath(ptr, end, sizeof(uint16_t), &ascount)))
+            goto malformed;
+        if (unlikely(!countaspath(as4ptr, as4end, sizeof(uint32_t), &as4count)))
+            goto malformed;
+
+        if (ascount >= as4count)
+            limit = ascount - as4count;
+        else
+            as4ptr = as4end = NULL;  // must ignore AS4_PATH
+    }
+
+    if (unlikely(!appendaspath(ptr, end, sizeof(uint16_t), limit, dst, types, cap, &n)))
+        goto malformed;
+    if (unlikely(!appendaspath(as4ptr, as4end, sizeof(uint32_t), SIZE_MAX, dst, types, cap, &n)))
+        goto malformed;
+
+    return n;
+
+malformed:
+    msg->err = BGP_EBADATTR;
+    return 0;
+}
+
+size_t getrealaspath(uint32_t *dst, size_t cap, uint8_t *types)
+{
+    return getrealaspath_r(&curmsg, dst, cap, types);
+}
+
+static void cacherealaspath(bgp_msg_t *msg)
+{
+    size_t n = decoderealaspath(msg, msg->aspcache, nelems(msg->aspcache), msg->asptypes);
+    if (unlikely(msg->err))
+        return;
+
+    msg->asplen = (n > nelems(msg->aspcache)) ? -2 : (int16_t) n;
+}
+
+size_t getrealaspath_r(bgp_msg_t *msg, uint32_t *dst, size_t cap, uint8_t *types)
+{
+    CHECKTYPEANDFLAGSR(BGP_UPDATE, F_RD, 0);
+
+    if (msg->asplen == -1) {
+        cacherealaspath(msg);
+        if (unlikely(msg->err))
+            return 0;
+    }
+    if (msg->asplen < 0)
+        return decoderealaspath(msg, dst, cap, types);  // too long to be cached
+
+    size_t n = msg->asplen;
+    size_t m = min(n, cap);
+    if (m > 0) {
+        memcpy(dst, msg->aspcache, m * sizeof(*dst));
+        if (types)
+            memcpy(types, msg->asptypes, m * sizeof(*types));
+    }
+
+    return n;
+}
+
+const uint32_t *getrealaspathptr(size_t *pn, const uint8_t **ptypes)
+{
+    return getrealaspathptr_r(&curmsg, pn, ptypes);
+}
+
+const uint32_t *getrealaspathptr_r(bgp_msg_t *msg, size_t *pn, const uint8_t **ptypes)
+{
+    CHECKTYPEANDFLAGSR(BGP_UPDATE, F_RD, NULL);
+
+    if (msg->asplen == -1) {
+        cacherealaspath(msg);
+        if (unlikely(msg->err))
+            return NULL;
+    }
+    if (msg->asplen < 0)
+        return NULL;  // too long to be cached
+
+    *pn = msg->asplen;
+    if (ptypes)
+        *ptypes = msg->asptypes;
+
+    return msg->aspcache;
+}
+
 int startnhop(void)
 {
     return startnhop_r(&curmsg);
@@ -2022,6 +2763,11 @@ static bgpattr_t *seekbgpattr(bgp_msg_t *msg, int code)
 {
     CHECKTYPEANDFLAGSR(BGP_UPDATE, F_RD, NULL);
 
+    if (msg->flags & F_INDEXED) {
+        uint16_t off = msg->attrtab[code];
+        return (off != 0) ? (bgpattr_t *) &msg->buf[off] : NULL;
+    }
+
     int idx = EXTRACT_CODE_INDEX(attr_code_index[code]);
 
     assert(idx >= 0 && idx < (int) nelems(msg->offtab));
@@ -2056,6 +2802,34 @@ static bgpattr_t *seekbgpattr(bgp_msg_t *msg, int code)
     return (bgpattr_t *) &msg->buf[off];
 }
 
+bgpattr_t *getbgpattrib(int code)
+{
+    return getbgpattrib_r(&curmsg, code);
+}
+
+bgpattr_t *getbgpattrib_r(bgp_msg_t *msg, int code)
+{
+    CHECKTYPEANDFLAGSR(BGP_UPDATE, F_RD, NULL);
+
+    if (unlikely(code < 0 || code > UINT8_MAX))
+        return NULL;
+    if (msg->flags & F_INDEXED || attr_code_index[code] != 0)
+        return seekbgpattr(msg, code);
+
+    // not a notable attribute, plain iteration
+    bgpattr_t *attr;
+
+    SAVE_UPDATE_ITER(msg);
+
+    startbgpattribs_r(msg);
+    while ((attr = nextbgpattrib_r(msg)) != NULL && attr->code != code);
+
+    int err = endbgpattribs_r(msg);
+
+    RESTORE_UPDATE_ITER(msg);
+    return (likely(err == BGP_ENOERR)) ? attr : NULL;
+}
+
 bgpattr_t *getbgporigin(void)
 {
     return getbgporigin_r(&curmsg);
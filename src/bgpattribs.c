@@ -31,6 +31,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <isolario/bgp.h>
 #include <isolario/bgpattribs.h>
 #include <isolario/strutil.h>
 #include <isolario/util.h>
@@ -218,6 +219,81 @@ bgpattr_t *putasseg16(bgpattr_t *attr, int type, const uint16_t *seg, size_t cou
     return attr;
 }
 
+// last AS of a path, 0 unless it ends with a non-empty AS_SEQUENCE
+static uint32_t pathorigin(const unsigned char *ptr, size_t len, size_t as_size)
+{
+    const unsigned char *end  = ptr + len;
+    const unsigned char *last = NULL;
+
+    int type = AS_SEGMENT_SET;
+    while (end - ptr >= AS_SEGMENT_HEADER_SIZE) {
+        type = ptr[0];
+
+        size_t size = ptr[1] * as_size;
+        ptr += AS_SEGMENT_HEADER_SIZE;
+        if (unlikely((size_t) (end - ptr) < size))
+            return 0;  // truncated segment
+
+        last = (size > 0) ? ptr + size - as_size : NULL;
+        ptr += size;
+    }
+    if (!last || type != AS_SEGMENT_SEQ)
+        return 0;
+
+    if (as_size == sizeof(uint32_t)) {
+        uint32_t as32;
+        memcpy(&as32, last, sizeof(as32));
+        return frombig32(as32);
+    }
+
+    uint16_t as16;
+    memcpy(&as16, last, sizeof(as16));
+    return frombig16(as16);
+}
+
+uint32_t getoriginas(const void *attrs, size_t n, size_t as_size)
+{
+    const bgpattr_t *aspath = NULL, *as4path = NULL;
+
+    const unsigned char *ptr = attrs;
+    while (n >= ATTR_HEADER_SIZE) {
+        const bgpattr_t *attr = (const bgpattr_t *) ptr;
+
+        size_t hdrsize = (attr->flags & ATTR_EXTENDED_LENGTH) ? ATTR_EXTENDED_HEADER_SIZE : ATTR_HEADER_SIZE;
+        if (unlikely(n < hdrsize))
+            break;
+
+        size_t size;
+        getattrlen(attr, &size);
+        size += hdrsize;
+        if (unlikely(size > n))
+            break;
+
+        if (attr->code == AS_PATH_CODE)
+            aspath = attr;
+        else if (attr->code == AS4_PATH_CODE)
+            as4path = attr;
+
+        ptr += size;
+        n   -= size;
+    }
+    if (!aspath)
+        return 0;
+
+    size_t len;
+    const unsigned char *data = getaspath(aspath, &len);
+
+    uint32_t origin = pathorigin(data, len, as_size);
+    if (origin == AS_TRANS && as_size == sizeof(uint16_t) && as4path) {
+        data = getaspath(as4path, &len);
+
+        uint32_t as4 = pathorigin(data, len, sizeof(uint32_t));
+        if (as4 != 0)
+            origin = as4;
+    }
+    return origin;
+}
+
 bgpattr_t *setmpafisafi(bgpattr_t *dst, afi_t afi, safi_t safi)
 {
     assert(dst->code == MP_REACH_NLRI_CODE || dst->code == MP_UNREACH_NLRI_CODE);
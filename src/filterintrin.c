@@ -226,13 +226,9 @@ void vm_exec_hasattr(filter_vm_t *vm, int code)
         ptr = getbgplargecommunities_r(vm->bgp);
         break;
     default:
-        // no luck, plain iteration
-        startbgpattribs_r(vm->bgp);
-        while ((ptr = nextbgpattrib_r(vm->bgp)) != NULL) {
-            if (ptr->code == code)
-                break;
-        }
-        endbgpattribs_r(vm->bgp);
+        // constant time for indexed messages, plain iteration otherwise
+        ptr = getbgpattrib_r(vm->bgp, code);
+        break;
     }
 
     assert(ptr == NULL || ptr->code == code);
@@ -467,11 +463,45 @@ extern void vm_exec_addrcontains(filter_vm_t *vm, int kidx);
 
 extern void vm_exec_ascontains(filter_vm_t *vm, int kidx);
 
+// real AS path accesses that rewind the iterator are self-contained,
+// so they can be served by the flat AS path cached inside the packet,
+// returns NULL if the iterator must be used instead (e.g. path too long)
+static const uint32_t *vm_flataspath(filter_vm_t *vm, int access, size_t *pn)
+{
+    if (access != (FOPC_ACCESS_SETTLE | FOPC_ACCESS_REAL_AS_PATH))
+        return NULL;
+
+    vm_exec_settle(vm);
+    return getrealaspathptr_r(vm->bgp, pn, NULL);
+}
+
+static bool vm_aspeq(const filter_vm_t *vm, const uint32_t *path)
+{
+    for (int i = 0; i < vm->si; i++) {
+        if (vm->sp[i].as != path[i] && vm->sp[i].as != AS_ANY)
+            return false;
+    }
+
+    return true;
+}
+
 void vm_exec_aspmatch(filter_vm_t *vm, int access)
 {
     if (getbgptype_r(vm->bgp) != BGP_UPDATE)
         vm_abort(vm, VM_PACKET_MISMATCH);
 
+    size_t n;
+    const uint32_t *path = vm_flataspath(vm, access, &n);
+    if (path) {
+        int value = false;
+        for (size_t i = 0; i + vm->si <= n && !value; i++)
+            value = vm_aspeq(vm, &path[i]);
+
+        vm_clearstack(vm);
+        vm->sp[vm->si++].value = value;
+        return;
+    }
+
     vm_prepare_as_access(vm, access);
 
     uint32_t asbuf[vm->si];
@@ -517,6 +547,16 @@ void vm_exec_aspstarts(filter_vm_t *vm, int access)
     if (getbgptype_r(vm->bgp) != BGP_UPDATE)
         vm_abort(vm, VM_PACKET_MISMATCH);
 
+    size_t n;
+    const uint32_t *path = vm_flataspath(vm, access, &n);
+    if (path) {
+        int value = (n >= (size_t) vm->si && vm_aspeq(vm, path));
+
+        vm_clearstack(vm);
+        vm->sp[vm->si++].value = value;
+        return;
+    }
+
     vm_prepare_as_access(vm, access);
 
     int i;
@@ -539,6 +579,16 @@ void vm_exec_aspends(filter_vm_t *vm, int access)
     if (getbgptype_r(vm->bgp) != BGP_UPDATE)
         vm_abort(vm, VM_PACKET_MISMATCH);
 
+    size_t len;
+    const uint32_t *path = vm_flataspath(vm, access, &len);
+    if (path) {
+        int value = (len >= (size_t) vm->si && vm_aspeq(vm, &path[len - vm->si]));
+
+        vm_clearstack(vm);
+        vm->sp[vm->si++].value = value;
+        return;
+    }
+
     vm_prepare_as_access(vm, access);
 
     uint32_t asbuf[vm->si];
@@ -579,6 +629,16 @@ void vm_exec_aspexact(filter_vm_t *vm, int access)
     if (getbgptype_r(vm->bgp) != BGP_UPDATE)
         vm_abort(vm, VM_PACKET_MISMATCH);
 
+    size_t n;
+    const uint32_t *path = vm_flataspath(vm, access, &n);
+    if (path) {
+        int value = (n == (size_t) vm->si && vm_aspeq(vm, path));
+
+        vm_clearstack(vm);
+        vm->sp[vm->si++].value = value;
+        return;
+    }
+
     vm_prepare_as_access(vm, access);
 
     as_pathent_t *ent;
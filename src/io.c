@@ -32,24 +32,57 @@
 #include <bzlib.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <isolario/branch.h>
 #include <isolario/io.h>
+#include <isolario/threading.h>
 #include <isolario/util.h>
 #include <limits.h>
 #include <lz4frame.h>
 #include <lzma.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <zlib.h>
+#include <zstd.h>
+#include <zstd_errors.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define IO_HAVE_URING
+#endif
+#endif
+
+#if !defined(O_DIRECT) && defined(__O_DIRECT)
+#define O_DIRECT __O_DIRECT  // glibc only exposes O_DIRECT with _GNU_SOURCE
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 16  // minimum guaranteed by POSIX
+#endif
 
 #ifndef LZMA_IGNORE_CHECK
 #define LZMA_IGNORE_CHECK UINT32_C(0x10)
 #endif
 
+// multi-threaded xz encoder is stable since 5.2.0, decoder since 5.4.0
+#if LZMA_VERSION >= UINT32_C(50020002)
+#define IO_XZ_ENCODER_MT
+#endif
+#if LZMA_VERSION >= UINT32_C(50040002)
+#define IO_XZ_DECODER_MT
+#endif
+
 // memory I/O ==================================================================
 
 size_t io_mread(io_rw_t *io, void *dst, size_t n)
@@ -83,6 +116,18 @@ size_t io_mwrite(io_rw_t *io, const void *src, size_t n)
     return n;
 }
 
+size_t io_mwritev(io_rw_t *io, const struct iovec *iov, int iovcnt)
+{
+    size_t n = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        size_t nw = io_mwrite(io, iov[i].iov_base, iov[i].iov_len);
+        n += nw;
+        if (nw != iov[i].iov_len)
+            break;
+    }
+    return n;
+}
+
 int io_merror(io_rw_t *io)
 {
     return (io->mem.flags & IO_MEM_ERRBIT) != 0;
@@ -113,6 +158,19 @@ size_t io_fwrite(io_rw_t *io, const void *src, size_t n)
 #endif
 }
 
+size_t io_fwritev(io_rw_t *io, const struct iovec *iov, int iovcnt)
+{
+    // FILE is buffered already, just append each segment
+    size_t n = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        size_t nw = io_fwrite(io, iov[i].iov_base, iov[i].iov_len);
+        n += nw;
+        if (nw != iov[i].iov_len)
+            break;
+    }
+    return n;
+}
+
 int io_ferror(io_rw_t *io)
 {
 #ifdef __linux__
@@ -151,6 +209,16 @@ size_t io_fdwrite(io_rw_t *io, const void *src, size_t n)
     return nw;
 }
 
+size_t io_fdwritev(io_rw_t *io, const struct iovec *iov, int iovcnt)
+{
+    ssize_t nw = writev(io->un.fd, iov, min(iovcnt, IOV_MAX));
+    if (nw < 0) {
+        io->un.err = 1;
+        nw = 0;
+    }
+    return nw;
+}
+
 int io_fderror(io_rw_t *io)
 {
     return io->un.err;
@@ -163,6 +231,94 @@ int io_fdclose(io_rw_t *io)
 
 extern void io_fd_init(io_rw_t *io, int fd);
 
+// Scatter-gather I/O ==========================================================
+
+enum { IO_WRITEVBUFSIZ = 4096 };
+
+size_t io_writev(io_rw_t *io, const struct iovec *iov, int iovcnt)
+{
+    if (io->writev)
+        return io->writev(io, iov, iovcnt);
+
+    // gather small segments so the backend sees as few write()s as possible,
+    // segments larger than the local buffer are written directly
+    unsigned char buf[IO_WRITEVBUFSIZ];
+    size_t len = 0;
+    size_t n = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        const void *src = iov[i].iov_base;
+        size_t size = iov[i].iov_len;
+        if (size <= sizeof(buf) - len) {
+            memcpy(buf + len, src, size);
+            len += size;
+            continue;
+        }
+
+        if (len > 0) {
+            size_t nw = io->write(io, buf, len);
+            n += nw;
+            if (nw != len)
+                return n;
+
+            len = 0;
+        }
+        if (size <= sizeof(buf)) {
+            memcpy(buf, src, size);
+            len = size;
+            continue;
+        }
+
+        size_t nw = io->write(io, src, size);
+        n += nw;
+        if (nw != size)
+            return n;
+    }
+    if (len > 0)
+        n += io->write(io, buf, len);
+
+    return n;
+}
+
+enum { IO_SKIPBUFSIZ = 4096 };
+
+size_t io_skip(io_rw_t *io, size_t n)
+{
+    if (io->consume)
+        return io->consume(io, n);
+
+    if (io->read == io_mread) {
+        if (unlikely(io->mem.flags != 0)) {
+            io->mem.flags |= IO_MEM_ERRBIT;
+            return 0;
+        }
+        if ((size_t) (io->mem.end - io->mem.ptr) < n)
+            n = io->mem.end - io->mem.ptr;
+
+        io->mem.ptr += n;
+        return n;
+    }
+
+    // seeking costs a syscall of its own, only worth it for large skips,
+    // failures (e.g. pipes) fall back to reading
+    if (n >= IO_SKIPBUFSIZ && n <= INT32_MAX) {
+        if (io->read == io_fdread && lseek(io->un.fd, n, SEEK_CUR) >= 0)
+            return n;
+        if (io->read == io_fread && fseeko(io->file, n, SEEK_CUR) == 0)
+            return n;
+    }
+
+    unsigned char buf[IO_SKIPBUFSIZ];
+    size_t skipped = 0;
+    while (skipped < n) {
+        size_t chunk = min(n - skipped, sizeof(buf));
+        size_t nr = io->read(io, buf, chunk);
+        skipped += nr;
+        if (nr != chunk)
+            break;
+    }
+    return skipped;
+}
+
 // Dynamically allocated I/O types =============================================
 
 static void *io_getstate(io_rw_t *io)
@@ -211,9 +367,11 @@ static size_t io_zread(io_rw_t *io, void *dst, size_t n)
         }
 
         int err = inflate(str, Z_NO_FLUSH);
+        if (err == Z_STREAM_END)
+            break;  // don't spin over trailing data
         if (unlikely(err == Z_NEED_DICT))
             err = Z_DATA_ERROR;
-        if (unlikely(err != Z_OK && err != Z_STREAM_END)) {
+        if (unlikely(err != Z_OK)) {
             z->err = err;
             break;
         }
@@ -272,11 +430,24 @@ static int io_zclose(io_rw_t *io)
         inflateEnd(str);
         break;
     case 'w':
-        if (err == 0) {  // don't attempt to finalize write upon previous error
+        while (err == 0) {  // don't attempt to finalize write upon previous error
             int res = deflate(str, Z_FINISH);
+            if (res != Z_OK && res != Z_STREAM_END) {
+                err = res;
+                break;
+            }
+
+            // flush buffer, possibly more than once if pending output doesn't fit
             int n = z->bufsiz - str->avail_out;
-            if (res == Z_STREAM_END && write(z->fd, z->buf, n) != n)
+            if (write(z->fd, z->buf, n) != n) {
                 err = Z_ERRNO;
+                break;
+            }
+            if (res == Z_STREAM_END)
+                break;
+
+            str->next_out = z->buf;
+            str->avail_out = z->bufsiz;
         }
 
         deflateEnd(str);
@@ -293,6 +464,397 @@ static int io_zclose(io_rw_t *io)
     return err;
 }
 
+// parallel compression (pigz style): input is split in fixed size chunks, each
+// compressed by a worker thread to raw deflate data, primed with the tail of
+// the previous chunk as dictionary. Non-final chunks end with a sync flush,
+// so they are concatenated in order into a single stream, checksums are
+// computed for each chunk and combined by the writer
+
+enum {
+    IO_ZCHUNKSIZ = 128 * 1024,
+    IO_ZDICTSIZ  = 32 * 1024
+};
+
+typedef struct io_zmtstate_s io_zmtstate;
+
+typedef struct io_zchunk_s {
+    struct io_zchunk_s *next;
+    io_zmtstate *owner;
+    bool last;
+    bool done;  // protected by owner mutex
+    int err;
+    uLong check;  // crc32 or adler32 of chunk data, depending on format
+    size_t dictlen;
+    size_t inlen;
+    size_t outlen;
+    unsigned char *out;
+    unsigned char dict[IO_ZDICTSIZ];
+    unsigned char in[];  // chunk size large
+} io_zchunk;
+
+struct io_zmtstate_s {
+    int fd;
+    int err;
+    int format;  // either 'd', 'z' or 'g'
+    int compression;
+    int wbits;
+    int ninflight;
+    int maxinflight;
+    size_t chunksiz;
+    uLong check;
+    uLong total;  // uncompressed size
+    io_zchunk *cur;  // chunk being filled
+    io_zchunk *head, *tail;
+    pool_t *pool;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static void io_zmtdeflate(void *job)
+{
+    io_zchunk *c = *(io_zchunk **) job;
+    io_zmtstate *st = c->owner;
+
+    if (st->format == 'g')
+        c->check = crc32(crc32(0, Z_NULL, 0), c->in, c->inlen);
+    else if (st->format == 'z')
+        c->check = adler32(adler32(0, Z_NULL, 0), c->in, c->inlen);
+
+    z_stream str;
+    memset(&str, 0, sizeof(str));
+
+    int err = deflateInit2(&str, st->compression, Z_DEFLATED, -st->wbits, 8, Z_DEFAULT_STRATEGY);
+    if (err != Z_OK)
+        goto done;
+
+    if (c->dictlen > 0)
+        err = deflateSetDictionary(&str, c->dict, c->dictlen);
+
+    size_t cap = deflateBound(&str, c->inlen) + 16;  // leave room for sync flush marker
+    c->out = malloc(cap);
+    if (unlikely(!c->out))
+        err = Z_MEM_ERROR;
+
+    int flush = c->last ? Z_FINISH : Z_SYNC_FLUSH;
+
+    str.next_in   = c->in;
+    str.avail_in  = c->inlen;
+    str.next_out  = c->out;
+    str.avail_out = cap;
+    while (err == Z_OK) {
+        if (str.avail_out == 0) {
+            unsigned char *out = realloc(c->out, cap * 2);
+            if (unlikely(!out)) {
+                err = Z_MEM_ERROR;
+                break;
+            }
+
+            c->out        = out;
+            str.next_out  = out + cap;
+            str.avail_out = cap;
+            cap          *= 2;
+        }
+
+        err = deflate(&str, flush);
+        if (err == Z_OK && flush == Z_SYNC_FLUSH && str.avail_out > 0)
+            break;  // flush complete
+    }
+    if (err == Z_STREAM_END)
+        err = Z_OK;
+
+    c->outlen = cap - str.avail_out;
+    deflateEnd(&str);
+
+done:
+    pthread_mutex_lock(&st->mutex);
+
+    c->err  = err;
+    c->done = true;
+
+    pthread_cond_signal(&st->cond);
+    pthread_mutex_unlock(&st->mutex);
+}
+
+static io_zchunk *io_zmtnewchunk(io_zmtstate *st)
+{
+    io_zchunk *c = malloc(sizeof(*c) + st->chunksiz);
+    if (unlikely(!c))
+        return NULL;
+
+    c->next    = NULL;
+    c->owner   = st;
+    c->last    = false;
+    c->done    = false;
+    c->err     = Z_OK;
+    c->check   = 0;
+    c->dictlen = 0;
+    c->inlen   = 0;
+    c->outlen  = 0;
+    c->out     = NULL;
+    return c;
+}
+
+static int io_zmtflush(io_zmtstate *st, bool all)
+{
+    // write out compressed chunks in order, block if too many are pending
+    while (st->head) {
+        io_zchunk *c = st->head;
+
+        bool wait = all || st->ninflight >= st->maxinflight;
+
+        pthread_mutex_lock(&st->mutex);
+        if (!c->done && !wait) {
+            pthread_mutex_unlock(&st->mutex);
+            break;
+        }
+        while (!c->done)
+            pthread_cond_wait(&st->cond, &st->mutex);
+
+        pthread_mutex_unlock(&st->mutex);
+
+        st->head = c->next;
+        if (!st->head)
+            st->tail = NULL;
+
+        st->ninflight--;
+
+        if (st->err == Z_OK) {
+            if (unlikely(c->err != Z_OK))
+                st->err = c->err;
+            else if (unlikely(write(st->fd, c->out, c->outlen) != (ssize_t) c->outlen))
+                st->err = Z_ERRNO;
+        }
+        if (st->err == Z_OK) {
+            if (st->format == 'g')
+                st->check = crc32_combine(st->check, c->check, c->inlen);
+            else if (st->format == 'z')
+                st->check = adler32_combine(st->check, c->check, c->inlen);
+
+            st->total += c->inlen;
+        }
+
+        free(c->out);
+        free(c);
+    }
+
+    return st->err;
+}
+
+static int io_zmtsubmit(io_zmtstate *st, bool last)
+{
+    io_zchunk *c = st->cur;
+
+    c->last = last;
+    st->cur = NULL;
+    if (!last) {
+        // prime next chunk with the tail of the current one
+        io_zchunk *next = io_zmtnewchunk(st);
+        if (unlikely(!next)) {
+            st->err = Z_MEM_ERROR;
+            free(c);
+            return st->err;
+        }
+
+        size_t dictlen = min(c->inlen, (size_t) 1 << st->wbits);
+        memcpy(next->dict, c->in + c->inlen - dictlen, dictlen);
+        next->dictlen = dictlen;
+
+        st->cur = next;
+    }
+
+    if (st->tail)
+        st->tail->next = c;
+    else
+        st->head = c;
+
+    st->tail = c;
+    st->ninflight++;
+    if (unlikely(pool_dispatch(st->pool, &c, sizeof(c)) != 0))
+        io_zmtdeflate(&c);  // compress synchronously
+
+    return io_zmtflush(st, false);
+}
+
+static size_t io_zmtread(io_rw_t *io, void *dst, size_t n)
+{
+    io_zmtstate *st = io_getstate(io);
+
+    (void) dst, (void) n;
+
+    st->err = Z_STREAM_ERROR;  // parallel mode is write only
+    return 0;
+}
+
+static size_t io_zmtwrite(io_rw_t *io, const void *src, size_t n)
+{
+    io_zmtstate *st = io_getstate(io);
+
+    const unsigned char *ptr = src;
+    size_t left = n;
+    while (left > 0 && st->err == Z_OK) {
+        io_zchunk *c = st->cur;
+
+        size_t nw = min(left, st->chunksiz - c->inlen);
+        memcpy(c->in + c->inlen, ptr, nw);
+        c->inlen += nw;
+        ptr      += nw;
+        left     -= nw;
+
+        if (c->inlen == st->chunksiz)
+            io_zmtsubmit(st, false);
+    }
+
+    return n - left;
+}
+
+static int io_zmterror(io_rw_t *io)
+{
+    io_zmtstate *st = io_getstate(io);
+    return st->err;
+}
+
+static int io_zmtclose(io_rw_t *io)
+{
+    io_zmtstate *st = io_getstate(io);
+
+    if (st->err == Z_OK)
+        io_zmtsubmit(st, true);
+
+    io_zmtflush(st, true);
+    pool_join(st->pool);
+
+    unsigned char trailer[8];
+    size_t n = 0;
+    switch (st->format) {
+    case 'g':
+        // gzip trailer, CRC32 and size modulo 2^32, both little endian
+        for (int i = 0; i < 4; i++)
+            trailer[n++] = (st->check >> (8 * i)) & 0xff;
+        for (int i = 0; i < 4; i++)
+            trailer[n++] = (st->total >> (8 * i)) & 0xff;
+        break;
+    case 'z':
+        // zlib trailer, Adler32 big endian
+        for (int i = 3; i >= 0; i--)
+            trailer[n++] = (st->check >> (8 * i)) & 0xff;
+        break;
+    default:
+        break;
+    }
+
+    int err = st->err;
+    if (err == Z_OK && write(st->fd, trailer, n) != (ssize_t) n)
+        err = Z_ERRNO;
+    if (close(st->fd) != 0)
+        err = Z_ERRNO;
+
+    free(st->cur);
+    pthread_cond_destroy(&st->cond);
+    pthread_mutex_destroy(&st->mutex);
+    free(io);
+    return err;
+}
+
+static io_rw_t *io_zmtopen(int fd, size_t bufsiz, int compression, int wbits, int format, int nthreads)
+{
+    if (nthreads <= 0) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = clamp(ncpus, 1, INT_MAX / 2);
+    }
+
+    io_zmtstate *st;
+    io_rw_t *io = malloc(io_getsize(sizeof(*st)));
+    if (unlikely(!io))
+        return NULL;
+
+    io->read = io_zmtread;
+    io->write = io_zmtwrite;
+    io->error = io_zmterror;
+    io->close = io_zmtclose;
+    io->peek = NULL;
+    io->consume = NULL;
+    io->writev = NULL;
+
+    st = io_getstate(io);
+    memset(st, 0, sizeof(*st));
+    st->fd = fd;
+    st->err = Z_OK;
+    st->format = format;
+    st->compression = compression;
+    st->wbits = clamp(wbits, 9, 15);  // raw deflate doesn't support 8
+    st->maxinflight = 2 * nthreads;
+    st->chunksiz = max(bufsiz, (size_t) IO_ZCHUNKSIZ);
+
+    st->cur = io_zmtnewchunk(st);
+    if (unlikely(!st->cur))
+        goto fail;
+
+    if (pthread_mutex_init(&st->mutex, NULL) != 0)
+        goto fail_chunk;
+    if (pthread_cond_init(&st->cond, NULL) != 0)
+        goto fail_mutex;
+
+    st->pool = pool_create(nthreads, io_zmtdeflate);
+    if (unlikely(!st->pool))
+        goto fail_cond;
+    if (unlikely(pool_nthreads(st->pool) == 0)) {
+        errno = EAGAIN;
+        goto fail_pool;
+    }
+
+    // stream header, written last so a failed open leaves fd untouched
+    int level = (compression == Z_DEFAULT_COMPRESSION) ? 6 : compression;
+
+    unsigned char hdr[10];
+    size_t n = 0;
+    switch (format) {
+    case 'g':
+        st->check = crc32(0, Z_NULL, 0);
+
+        hdr[n++] = 0x1f;  // magic
+        hdr[n++] = 0x8b;
+        hdr[n++] = Z_DEFLATED;
+        hdr[n++] = 0;  // flags
+        hdr[n++] = 0;  // modification time, unavailable
+        hdr[n++] = 0;
+        hdr[n++] = 0;
+        hdr[n++] = 0;
+        hdr[n++] = (level == 9) ? 2 : (level == 1) ? 4 : 0;
+        hdr[n++] = 3;  // OS, Unix
+        break;
+    case 'z': {
+        st->check = adler32(0, Z_NULL, 0);
+
+        unsigned flevel = (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+        unsigned cmf = ((st->wbits - 8) << 4) | Z_DEFLATED;
+        unsigned flg = flevel << 6;
+
+        flg += 31 - (cmf * 256 + flg) % 31;
+        hdr[n++] = cmf;
+        hdr[n++] = flg;
+        break;
+    }
+    default:
+        break;
+    }
+    if (write(fd, hdr, n) != (ssize_t) n)
+        goto fail_pool;
+
+    return io;
+
+fail_pool:
+    pool_join(st->pool);
+fail_cond:
+    pthread_cond_destroy(&st->cond);
+fail_mutex:
+    pthread_mutex_destroy(&st->mutex);
+fail_chunk:
+    free(st->cur);
+fail:
+    free(io);
+    return NULL;
+}
+
 io_rw_t *io_zopen(int fd, size_t bufsiz, const char *mode, ...)
 {
     if (bufsiz == 0)
@@ -309,6 +871,9 @@ io_rw_t *io_zopen(int fd, size_t bufsiz, const char *mode, ...)
     io->write = io_zwrite;
     io->error = io_zerror;
     io->close = io_zclose;
+    io->peek = NULL;
+    io->consume = NULL;
+    io->writev = NULL;
 
     va_list va;
     va_start(va, mode);
@@ -323,7 +888,6 @@ io_rw_t *io_zopen(int fd, size_t bufsiz, const char *mode, ...)
     int wbits = 15;
     switch (z->mode) {
     case 'r':
-        mode++;
         break;
     case 'w':
         if (*mode == '*') {
@@ -361,23 +925,54 @@ io_rw_t *io_zopen(int fd, size_t bufsiz, const char *mode, ...)
 
     // normalize window bits
     wbits = clamp(wbits, 8, 15);
+
+    int format = 'g';
     switch (*mode) {
     case 'd':
         // use the original deflate format RFC 1951
-        wbits = -wbits;
+        format = *mode++;
         break;
     case 'z':
         // use the zlib format RFC 1950
+        format = *mode++;
         break;
     case 'g':
+        mode++;
+        // fallthrough
     default:
         // support gzip compression (default) RFC 1952
-        wbits += 16;
         break;
     }
 
+    int nthreads = -1;  // by default compress on the calling thread
+    if (z->mode == 'w' && *mode == 't') {
+        mode++;
+
+        nthreads = 0;  // as many threads as online CPUs
+        if (*mode == '*') {
+            nthreads = va_arg(va, int);
+            mode++;
+        } else if (isdigit((unsigned char) *mode)) {
+            nthreads = atoi(mode);
+            do mode++; while (isdigit((unsigned char) *mode));
+        }
+
+        nthreads = max(nthreads, 0);
+    }
+
     va_end(va);
 
+    if (nthreads >= 0) {
+        // parallel compression uses its own state
+        free(io);
+        return io_zmtopen(fd, bufsiz, compression, wbits, format, nthreads);
+    }
+
+    if (format == 'd')
+        wbits = -wbits;
+    else if (format == 'g')
+        wbits += 16;
+
     // open stream
     z_stream *str = &z->stream;
     memset(str, 0, sizeof(*str));
@@ -402,6 +997,57 @@ fail:
     return NULL;
 }
 
+io_rw_t *io_zresume(int fd, size_t bufsiz, int bits, int value, const void *dict, size_t dictlen)
+{
+    if (bufsiz == 0)
+        bufsiz = BUFSIZ;
+    if (unlikely(bufsiz > INT_MAX))
+        bufsiz = INT_MAX;
+
+    io_zstate *z;
+    io_rw_t *io = malloc(io_getsize(sizeof(*z) + bufsiz));
+    if (unlikely(!io))
+        return NULL;
+
+    io->read = io_zread;
+    io->write = io_zwrite;
+    io->error = io_zerror;
+    io->close = io_zclose;
+    io->peek = NULL;
+    io->consume = NULL;
+    io->writev = NULL;
+
+    z = io_getstate(io);
+    z->fd = fd;
+    z->err = 0;
+    z->mode = 'r';
+    z->bufsiz = bufsiz;
+
+    z_stream *str = &z->stream;
+    memset(str, 0, sizeof(*str));
+
+    // decode raw deflate data, there's no header to be found mid-stream
+    int err = inflateInit2(str, -15);
+    if (err != Z_OK)
+        goto fail;
+
+    if (bits > 0)
+        err = inflatePrime(str, bits, value >> (8 - bits));
+    if (err == Z_OK && dictlen > 0)
+        err = inflateSetDictionary(str, dict, dictlen);
+    if (err != Z_OK) {
+        inflateEnd(str);
+        goto fail;
+    }
+
+    return io;
+
+fail:
+    errno = (err == Z_MEM_ERROR) ? ENOMEM : EINVAL;
+    free(io);
+    return NULL;
+}
+
 // BZip2 =======================================================================
 
 typedef struct {
@@ -544,23 +1190,689 @@ static int io_bz2close(io_rw_t *io)
     return err;
 }
 
-io_rw_t *io_bz2open(int fd, size_t bufsiz, const char *mode, ...)
+// parallel decompression: bzip2 blocks are independent and delimited by 48 bit
+// magic numbers (not byte aligned), each block is cut out of the compressed
+// stream and rebuilt as a standalone single block stream, which is decoded by
+// a worker thread, output is then handed out in order by the reader.
+// A magic may (very rarely) occur by chance inside compressed data:
+// * an end of stream magic is only accepted if followed by zero padding and
+//   either the expected combined stream CRC, EOF, or another stream;
+// * a block split by a chance block magic fails to decode, so (like lbzip2
+//   and pbzip2 do) it is merged with the following one and decoded again,
+//   as long as the merged span may still be a single block: anything longer
+//   is real corruption.
+
+#define BZ2_BLOCK_MAGIC UINT64_C(0x314159265359)
+#define BZ2_EOS_MAGIC   UINT64_C(0x177245385090)
+
+enum {
+    BZ2_MAGIC_BITS = 48,
+    BZ2_CRC_BITS   = 32,
+    BZ2_HDRSIZ     = 4,  // "BZh" followed by block size digit
+
+    BZ2_SCAN_HEADER = 0,
+    BZ2_SCAN_BLOCK
+};
+
+typedef struct io_bz2mtstate_s io_bz2mtstate;
+
+typedef struct io_bz2block_s {
+    struct io_bz2block_s *next;
+    io_bz2mtstate *owner;
+    bool done;         // protected by owner mutex
+    bool eos;          // last block of its stream
+    int err;
+    char level;        // stream block size digit
+    unsigned char *in; // standalone stream, kept in case of a merge
+    size_t insiz;
+    uint64_t nbits;    // block bits inside in, following stream header
+    char *out;         // decoded data
+    size_t outsiz;
+    size_t outpos;     // data already handed out to the reader
+} io_bz2block;
+
+struct io_bz2mtstate_s {
+    int fd;
+    int err;
+    int scanerr;    // error detected while scanning input, reported after preceding blocks
+    int verbosity;
+    int small;
+    int state;      // either BZ2_SCAN_HEADER or BZ2_SCAN_BLOCK
+    bool eof;       // fd reached EOF
+    bool end;       // no more blocks to be scanned
+    char level;
+    uint32_t combcrc;   // combined CRC of the stream blocks scanned so far
+    unsigned nstreams;
+    int ninflight;
+    int maxinflight;
+    size_t bufsiz;  // read granularity
+    unsigned char *buf;
+    size_t buflen, bufcap;
+    size_t hdrpos;      // next stream header byte offset, for BZ2_SCAN_HEADER
+    uint64_t blkstart;  // current block bit offset, for BZ2_SCAN_BLOCK
+    uint64_t scanpos;   // bit offset to resume magic search from
+    io_bz2block *head, *tail;
+    pool_t *pool;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static uint64_t io_bz2getbits(const unsigned char *buf, uint64_t pos, int n)
 {
-    if (bufsiz == 0)
-        bufsiz = BUFSIZ;
+    uint64_t v = 0;
+    for (int i = 0; i < n; i++, pos++)
+        v = (v << 1) | ((buf[pos >> 3] >> (7 - (pos & 7))) & 1);
 
-    if (unlikely(bufsiz > INT_MAX))
-        bufsiz = INT_MAX;  // restrict to signed values for Unix ssize_t
+    return v;
+}
 
-    io_bz2state *bz;
-    io_rw_t *io = malloc(io_getsize(sizeof(*bz) + bufsiz));
-    if (unlikely(!io))
-        return NULL;
+static void io_bz2putbits(unsigned char *buf, uint64_t pos, uint64_t v, int n)
+{
+    for (int i = n - 1; i >= 0; i--, pos++) {
+        unsigned char mask = 0x80 >> (pos & 7);
+        if ((v >> i) & 1)
+            buf[pos >> 3] |= mask;
+        else
+            buf[pos >> 3] &= ~mask;
+    }
+}
+
+static void io_bz2copybits(unsigned char *dst, uint64_t dstpos, const unsigned char *src, uint64_t srcpos, uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++)
+        io_bz2putbits(dst, dstpos + i, io_bz2getbits(src, srcpos + i, 1), 1);
+}
+
+static uint64_t io_bz2findmagic(const unsigned char *buf, size_t len, uint64_t from, bool *eos)
+{
+    const uint64_t mask = (UINT64_C(1) << BZ2_MAGIC_BITS) - 1;
+
+    // slide a 64 bits window over buf, each new byte completes 8 candidates
+    size_t j = from >> 3;
+    size_t i = (j >= 7) ? j - 7 : 0;
+
+    uint64_t w = 0;
+    for ( ; i < j; i++)
+        w = (w << 8) | buf[i];
+
+    for ( ; j < len; j++) {
+        w = (w << 8) | buf[j];
+        for (int k = 7; k >= 0; k--) {
+            int64_t p = (int64_t) (j + 1) * 8 - BZ2_MAGIC_BITS - k;
+            if (p < (int64_t) from)
+                continue;
+
+            uint64_t v = (w >> k) & mask;
+            if (v == BZ2_BLOCK_MAGIC || v == BZ2_EOS_MAGIC) {
+                *eos = (v == BZ2_EOS_MAGIC);
+                return p;
+            }
+        }
+    }
+    return UINT64_MAX;
+}
+
+static int io_bz2mtfill(io_bz2mtstate *st)
+{
+    // discard data preceding the current block or stream header
+    size_t keep = (st->state == BZ2_SCAN_HEADER) ? st->hdrpos : st->blkstart >> 3;
+    if (keep > st->buflen)
+        keep = st->buflen;
+
+    if (keep > 0) {
+        memmove(st->buf, st->buf + keep, st->buflen - keep);
+        st->buflen -= keep;
+        if (st->state == BZ2_SCAN_HEADER) {
+            st->hdrpos -= keep;
+        } else {
+            st->blkstart -= keep * 8;
+            st->scanpos  -= keep * 8;
+        }
+    }
+
+    if (st->bufcap - st->buflen < st->bufsiz) {
+        size_t cap = max(st->bufcap * 2, st->buflen + st->bufsiz);
+        unsigned char *buf = realloc(st->buf, cap);
+        if (unlikely(!buf)) {
+            st->scanerr = BZ_MEM_ERROR;
+            return -1;
+        }
+
+        st->buf    = buf;
+        st->bufcap = cap;
+    }
+
+    ssize_t n = read(st->fd, st->buf + st->buflen, st->bufsiz);
+    if (unlikely(n < 0)) {
+        st->scanerr = BZ_IO_ERROR;
+        return -1;
+    }
+    if (n == 0)
+        st->eof = true;
+
+    st->buflen += n;
+    return 0;
+}
+
+static io_bz2block *io_bz2mtallocblock(io_bz2mtstate *st, char level, uint64_t nbits)
+{
+    io_bz2block *blk = malloc(sizeof(*blk));
+    if (unlikely(!blk))
+        return NULL;
+
+    blk->insiz = BZ2_HDRSIZ + (nbits + BZ2_MAGIC_BITS + BZ2_CRC_BITS + 7) / 8;
+    blk->in    = malloc(blk->insiz);
+    if (unlikely(!blk->in)) {
+        free(blk);
+        return NULL;
+    }
+
+    blk->next   = NULL;
+    blk->owner  = st;
+    blk->done   = false;
+    blk->eos    = false;
+    blk->err    = BZ_OK;
+    blk->level  = level;
+    blk->nbits  = nbits;
+    blk->out    = NULL;
+    blk->outsiz = 0;
+    blk->outpos = 0;
+
+    blk->in[0] = 'B';
+    blk->in[1] = 'Z';
+    blk->in[2] = 'h';
+    blk->in[3] = level;
+    return blk;
+}
+
+static void io_bz2mtendblock(io_bz2block *blk)
+{
+    // stream trailer, the combined CRC of a single block stream is the block CRC
+    uint64_t pos = BZ2_HDRSIZ * 8;
+    uint64_t crc = io_bz2getbits(blk->in, pos + BZ2_MAGIC_BITS, BZ2_CRC_BITS);
+
+    pos += blk->nbits;
+    io_bz2putbits(blk->in, pos, BZ2_EOS_MAGIC, BZ2_MAGIC_BITS);
+    pos += BZ2_MAGIC_BITS;
+    io_bz2putbits(blk->in, pos, crc, BZ2_CRC_BITS);
+    pos += BZ2_CRC_BITS;
+    if (pos & 7)
+        blk->in[pos >> 3] &= 0xff << (8 - (pos & 7));  // zero padding
+}
+
+static io_bz2block *io_bz2mtmkblock(io_bz2mtstate *st, uint64_t start, uint64_t end)
+{
+    uint64_t nbits = end - start;
+
+    io_bz2block *blk = io_bz2mtallocblock(st, st->level, nbits);
+    if (unlikely(!blk))
+        return NULL;
+
+    unsigned char *dst = blk->in + BZ2_HDRSIZ;
+
+    // copy block bits, realigning them to a byte boundary
+    const unsigned char *src = &st->buf[start >> 3];
+    size_t avail  = st->buflen - (start >> 3);
+    size_t nbytes = (nbits + 7) / 8;
+    int shift     = start & 7;
+    if (shift == 0) {
+        memcpy(dst, src, nbytes);
+    } else {
+        for (size_t i = 0; i < nbytes; i++) {
+            unsigned char lo = (i + 1 < avail) ? src[i + 1] : 0;
+            dst[i] = (src[i] << shift) | (lo >> (8 - shift));
+        }
+    }
+
+    io_bz2mtendblock(blk);
+    return blk;
+}
+
+/// @brief Longest compressed block for a stream block size digit, in bits.
+static uint64_t io_bz2maxblockbits(char level)
+{
+    // bzip2 compressed output never exceeds input by more than 1% plus 600 bytes
+    uint64_t maxsiz = (level - '0') * UINT64_C(100000);
+    return (maxsiz + maxsiz / 100 + 600) * 8;
+}
+
+/// @brief Merge a block that failed to decode with the following one.
+static io_bz2block *io_bz2mtmergeblocks(io_bz2mtstate *st, const io_bz2block *a, const io_bz2block *b)
+{
+    io_bz2block *blk = io_bz2mtallocblock(st, a->level, a->nbits + b->nbits);
+    if (unlikely(!blk))
+        return NULL;
+
+    // a is byte aligned inside its stream, b must be appended bit by bit
+    uint64_t pos = BZ2_HDRSIZ * 8;
+
+    memcpy(blk->in + BZ2_HDRSIZ, a->in + BZ2_HDRSIZ, (a->nbits + 7) / 8);
+    io_bz2copybits(blk->in, pos + a->nbits, b->in, pos, b->nbits);
+
+    blk->eos = b->eos;
+    io_bz2mtendblock(blk);
+    return blk;
+}
+
+/// @brief Tell whether an end of stream magic at bit \a pos is genuine, -1 if more data is needed.
+static int io_bz2mtisend(const io_bz2mtstate *st, uint64_t pos, uint32_t combcrc)
+{
+    uint64_t crcpos = pos + BZ2_MAGIC_BITS;
+    uint64_t padpos = crcpos + BZ2_CRC_BITS;
+    size_t next     = (padpos + 7) / 8;
+    size_t need     = next + BZ2_HDRSIZ + BZ2_MAGIC_BITS / 8;
+
+    if (st->buflen < need && !st->eof)
+        return -1;
+    if (st->buflen < next)
+        return false;
+
+    if (padpos & 7) {
+        if (io_bz2getbits(st->buf, padpos, 8 - (padpos & 7)) != 0)
+            return false;  // bzip2 always pads streams with zeros
+    }
+    if (io_bz2getbits(st->buf, crcpos, BZ2_CRC_BITS) == combcrc)
+        return true;
+
+    // a block was split by chance, so the combined CRC can't be trusted,
+    // check for what may legitimately follow a stream
+    if (st->buflen == next)
+        return true;  // EOF
+    if (st->buflen < need)
+        return false;
+
+    const unsigned char *hdr = st->buf + next;
+    if (memcmp(hdr, "BZh", 3) != 0 || hdr[3] < '1' || hdr[3] > '9')
+        return false;
+
+    uint64_t magic = io_bz2getbits(hdr, BZ2_HDRSIZ * 8, BZ2_MAGIC_BITS);
+    return magic == BZ2_BLOCK_MAGIC || magic == BZ2_EOS_MAGIC;
+}
+
+static io_bz2block *io_bz2mtnextblock(io_bz2mtstate *st)
+{
+    while (!st->end) {
+        if (st->state == BZ2_SCAN_HEADER) {
+            // an empty stream is the shortest: header, EOS magic and CRC
+            size_t need = st->hdrpos + BZ2_HDRSIZ + (BZ2_MAGIC_BITS + BZ2_CRC_BITS) / 8;
+            if (st->buflen < need && !st->eof) {
+                if (io_bz2mtfill(st) != 0)
+                    break;
+
+                continue;
+            }
+
+            const unsigned char *hdr = st->buf + st->hdrpos;
+            if (st->buflen < need || memcmp(hdr, "BZh", 3) != 0 || hdr[3] < '1' || hdr[3] > '9') {
+                // like bzip2(1), ignore trailing garbage after the first stream
+                if (st->nstreams == 0 && st->buflen > st->hdrpos)
+                    st->scanerr = BZ_DATA_ERROR_MAGIC;
+
+                break;
+            }
+
+            st->level   = hdr[3];
+            st->combcrc = 0;
+            st->nstreams++;
+
+            uint64_t pos   = (st->hdrpos + BZ2_HDRSIZ) * 8;
+            uint64_t magic = io_bz2getbits(st->buf, pos, BZ2_MAGIC_BITS);
+            if (magic == BZ2_EOS_MAGIC) {
+                st->hdrpos = need;  // empty stream, skip it
+            } else if (magic == BZ2_BLOCK_MAGIC) {
+                st->blkstart = pos;
+                st->scanpos  = pos + BZ2_MAGIC_BITS;
+                st->state    = BZ2_SCAN_BLOCK;
+            } else {
+                st->scanerr = BZ_DATA_ERROR;
+                break;
+            }
+
+            continue;
+        }
+
+        // search the magic terminating the current block
+        bool eos;
+        uint64_t pos = io_bz2findmagic(st->buf, st->buflen, st->scanpos, &eos);
+        if (pos == UINT64_MAX) {
+            if (st->eof) {
+                st->scanerr = BZ_UNEXPECTED_EOF;
+                break;
+            }
+
+            // no need to rescan bits that can't start a magic
+            uint64_t nbits = st->buflen * 8;
+            if (nbits >= st->scanpos + BZ2_MAGIC_BITS - 1)
+                st->scanpos = nbits - (BZ2_MAGIC_BITS - 1);
+            if (io_bz2mtfill(st) != 0)
+                break;
+
+            continue;
+        }
+
+        uint32_t crc     = io_bz2getbits(st->buf, st->blkstart + BZ2_MAGIC_BITS, BZ2_CRC_BITS);
+        uint32_t combcrc = ((st->combcrc << 1) | (st->combcrc >> 31)) ^ crc;
+        if (eos) {
+            int res = io_bz2mtisend(st, pos, combcrc);
+            if (res < 0) {
+                if (io_bz2mtfill(st) != 0)
+                    break;
+
+                continue;  // scanpos is unchanged, the same magic is found again
+            }
+            if (!res) {
+                st->scanpos = pos + 1;  // chance magic inside block data
+                continue;
+            }
+        }
+
+        io_bz2block *blk = io_bz2mtmkblock(st, st->blkstart, pos);
+        if (unlikely(!blk)) {
+            st->scanerr = BZ_MEM_ERROR;
+            break;
+        }
+
+        blk->eos    = eos;
+        st->combcrc = combcrc;
+        if (eos) {
+            // next stream (if any) starts at the byte following the stream CRC
+            st->hdrpos = (pos + BZ2_MAGIC_BITS + BZ2_CRC_BITS + 7) / 8;
+            st->state  = BZ2_SCAN_HEADER;
+        } else {
+            st->blkstart = pos;
+            st->scanpos  = pos + BZ2_MAGIC_BITS;
+        }
+
+        return blk;
+    }
+
+    st->end = true;
+    return NULL;
+}
+
+static void io_bz2mtdecode(void *job)
+{
+    io_bz2block *blk = *(io_bz2block **) job;
+    io_bz2mtstate *st = blk->owner;
+
+    bz_stream str;
+    memset(&str, 0, sizeof(str));
+
+    char *out = NULL;
+    size_t outsiz = 0;
+    size_t outcap = (blk->level - '0') * 100000;  // usual upper bound, grown on demand
+
+    int err = BZ2_bzDecompressInit(&str, st->verbosity, st->small);
+    if (err == BZ_OK) {
+        str.next_in  = (char *) blk->in;
+        str.avail_in = blk->insiz;
+
+        while (err == BZ_OK) {
+            if (!out || outsiz == outcap) {
+                if (out)
+                    outcap *= 2;
+
+                char *p = realloc(out, outcap);
+                if (unlikely(!p)) {
+                    err = BZ_MEM_ERROR;
+                    break;
+                }
+
+                out = p;
+            }
+
+            unsigned int avail = min(outcap - outsiz, UINT_MAX);
+            str.next_out  = out + outsiz;
+            str.avail_out = avail;
+
+            err = BZ2_bzDecompress(&str);
+            outsiz += avail - str.avail_out;
+            if (err == BZ_OK && str.avail_in == 0 && str.avail_out > 0)
+                err = BZ_UNEXPECTED_EOF;
+        }
+        if (err == BZ_STREAM_END)
+            err = BZ_OK;
+
+        BZ2_bzDecompressEnd(&str);
+    }
+
+    pthread_mutex_lock(&st->mutex);
+
+    blk->out    = out;
+    blk->outsiz = outsiz;
+    blk->err    = err;
+    blk->done   = true;
+
+    pthread_cond_signal(&st->cond);
+    pthread_mutex_unlock(&st->mutex);
+}
+
+static void io_bz2mtfreeblock(io_bz2block *blk)
+{
+    free(blk->in);
+    free(blk->out);
+    free(blk);
+}
+
+static size_t io_bz2mtread(io_rw_t *io, void *dst, size_t n)
+{
+    io_bz2mtstate *st = io_getstate(io);
+
+    char *ptr = dst;
+    size_t left = n;
+    while (left > 0 && st->err == 0) {
+        // keep workers busy
+        while (st->ninflight < st->maxinflight) {
+            io_bz2block *blk = io_bz2mtnextblock(st);
+            if (!blk)
+                break;
+
+            if (st->tail)
+                st->tail->next = blk;
+            else
+                st->head = blk;
+
+            st->tail = blk;
+            st->ninflight++;
+            if (unlikely(pool_dispatch(st->pool, &blk, sizeof(blk)) != 0))
+                io_bz2mtdecode(&blk);  // decode synchronously
+        }
+
+        io_bz2block *blk = st->head;
+        if (!blk) {
+            st->err = st->scanerr;  // no more data
+            break;
+        }
+
+        pthread_mutex_lock(&st->mutex);
+        while (!blk->done)
+            pthread_cond_wait(&st->cond, &st->mutex);
+
+        pthread_mutex_unlock(&st->mutex);
+
+        if (unlikely(blk->err == BZ_DATA_ERROR || blk->err == BZ_UNEXPECTED_EOF) && !blk->eos) {
+            // block may have been split by a chance magic, retry merged with the next one
+            if (!blk->next) {
+                io_bz2block *next = io_bz2mtnextblock(st);
+                if (next) {
+                    next->done = true;  // never decoded on its own
+                    blk->next  = next;
+                    st->tail   = next;
+                    st->ninflight++;
+                }
+            }
+
+            io_bz2block *next = blk->next;
+            if (next && blk->nbits + next->nbits > io_bz2maxblockbits(blk->level)) {
+                st->err = BZ_DATA_ERROR;  // too long for a single block, give up
+                break;
+            }
+            if (next) {
+                pthread_mutex_lock(&st->mutex);
+                while (!next->done)
+                    pthread_cond_wait(&st->cond, &st->mutex);
+
+                pthread_mutex_unlock(&st->mutex);
+
+                io_bz2block *merged = io_bz2mtmergeblocks(st, blk, next);
+                if (unlikely(!merged)) {
+                    st->err = BZ_MEM_ERROR;
+                    break;
+                }
+
+                io_bz2mtdecode(&merged);
+
+                merged->next = next->next;
+                st->head = merged;
+                if (st->tail == next)
+                    st->tail = merged;
+
+                st->ninflight--;
+                io_bz2mtfreeblock(blk);
+                io_bz2mtfreeblock(next);
+                continue;
+            }
+        }
+        if (unlikely(blk->err != BZ_OK)) {
+            st->err = blk->err;
+            break;
+        }
+
+        size_t nr = min(left, blk->outsiz - blk->outpos);
+        memcpy(ptr, blk->out + blk->outpos, nr);
+        blk->outpos += nr;
+        ptr         += nr;
+        left        -= nr;
+
+        if (blk->outpos == blk->outsiz) {
+            st->head = blk->next;
+            if (!st->head)
+                st->tail = NULL;
+
+            st->ninflight--;
+            io_bz2mtfreeblock(blk);
+        }
+    }
+
+    return n - left;
+}
+
+static size_t io_bz2mtwrite(io_rw_t *io, const void *src, size_t n)
+{
+    io_bz2mtstate *st = io_getstate(io);
+
+    (void) src, (void) n;
+
+    st->err = BZ_SEQUENCE_ERROR;  // parallel mode is read only
+    return 0;
+}
+
+static int io_bz2mterror(io_rw_t *io)
+{
+    io_bz2mtstate *st = io_getstate(io);
+    return st->err;
+}
+
+static int io_bz2mtclose(io_rw_t *io)
+{
+    io_bz2mtstate *st = io_getstate(io);
+
+    pool_join(st->pool);  // completes any pending block
+
+    io_bz2block *blk = st->head;
+    while (blk) {
+        io_bz2block *next = blk->next;
+
+        io_bz2mtfreeblock(blk);
+        blk = next;
+    }
+
+    pthread_cond_destroy(&st->cond);
+    pthread_mutex_destroy(&st->mutex);
+    free(st->buf);
+
+    int err = st->err;
+    if (close(st->fd) != 0)
+        err = BZ_IO_ERROR;
+
+    free(io);
+    return err;
+}
+
+static io_rw_t *io_bz2mtopen(int fd, size_t bufsiz, int nthreads, int verbosity, int small)
+{
+    if (nthreads <= 0) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = clamp(ncpus, 1, INT_MAX / 2);
+    }
+
+    io_bz2mtstate *st;
+    io_rw_t *io = malloc(io_getsize(sizeof(*st)));
+    if (unlikely(!io))
+        return NULL;
+
+    io->read = io_bz2mtread;
+    io->write = io_bz2mtwrite;
+    io->error = io_bz2mterror;
+    io->close = io_bz2mtclose;
+    io->peek = NULL;
+    io->consume = NULL;
+    io->writev = NULL;
+
+    st = io_getstate(io);
+    memset(st, 0, sizeof(*st));
+    st->fd = fd;
+    st->verbosity = verbosity;
+    st->small = small;
+    st->state = BZ2_SCAN_HEADER;
+    st->maxinflight = 2 * nthreads;  // allow readahead while the reader consumes data
+    st->bufsiz = bufsiz;
+
+    if (pthread_mutex_init(&st->mutex, NULL) != 0)
+        goto fail;
+    if (pthread_cond_init(&st->cond, NULL) != 0)
+        goto fail_mutex;
+
+    st->pool = pool_create(nthreads, io_bz2mtdecode);
+    if (unlikely(!st->pool))
+        goto fail_cond;
+    if (unlikely(pool_nthreads(st->pool) == 0)) {
+        pool_join(st->pool);
+        errno = EAGAIN;
+        goto fail_cond;
+    }
+
+    return io;
+
+fail_cond:
+    pthread_cond_destroy(&st->cond);
+fail_mutex:
+    pthread_mutex_destroy(&st->mutex);
+fail:
+    free(io);
+    return NULL;
+}
+
+io_rw_t *io_bz2open(int fd, size_t bufsiz, const char *mode, ...)
+{
+    if (bufsiz == 0)
+        bufsiz = BUFSIZ;
+
+    if (unlikely(bufsiz > INT_MAX))
+        bufsiz = INT_MAX;  // restrict to signed values for Unix ssize_t
+
+    io_bz2state *bz;
+    io_rw_t *io = malloc(io_getsize(sizeof(*bz) + bufsiz));
+    if (unlikely(!io))
+        return NULL;
 
     io->read = io_bz2read;
     io->write = io_bz2write;
     io->error = io_bz2error;
     io->close = io_bz2close;
+    io->peek = NULL;
+    io->consume = NULL;
+    io->writev = NULL;
 
     va_list va;
     va_start(va, mode);
@@ -621,10 +1933,30 @@ io_rw_t *io_bz2open(int fd, size_t bufsiz, const char *mode, ...)
     if (*mode == 'v') {
         mode++;
 
-        if (*mode == '*')
+        if (*mode == '*') {
             verbosity = va_arg(va, int);
-        else
+            mode++;
+        } else {
             verbosity = atoi(mode);  // on bad value verbosity = 0, which is good
+            while (isdigit((unsigned char) *mode))
+                mode++;
+        }
+    }
+
+    int nthreads = -1;  // by default decompress on the calling thread
+    if (bz->mode == 'r' && *mode == 't') {
+        mode++;
+
+        nthreads = 0;  // as many threads as online CPUs
+        if (*mode == '*') {
+            nthreads = va_arg(va, int);
+            mode++;
+        } else if (isdigit((unsigned char) *mode)) {
+            nthreads = atoi(mode);
+            do mode++; while (isdigit((unsigned char) *mode));
+        }
+
+        nthreads = max(nthreads, 0);
     }
     va_end(va);
 
@@ -633,6 +1965,12 @@ io_rw_t *io_bz2open(int fd, size_t bufsiz, const char *mode, ...)
     verbosity = clamp(verbosity, 0, 4);
     factor = clamp(factor, 0, 255);
 
+    if (nthreads >= 0) {
+        // parallel decompression uses its own state
+        free(io);
+        return io_bz2mtopen(fd, bufsiz, nthreads, verbosity, small);
+    }
+
     int err;
     if (bz->mode == 'r') {
         err = BZ2_bzDecompressInit(str, verbosity, small);
@@ -774,6 +2112,72 @@ static int io_xzclose(io_rw_t *io)
     return err;
 }
 
+#if defined(IO_XZ_ENCODER_MT) || defined(IO_XZ_DECODER_MT)
+
+static uint32_t io_xzthreads(int nthreads)
+{
+    if (nthreads > 0)
+        return nthreads;
+
+    uint32_t ncpus = lzma_cputhreads();
+    return (ncpus > 0) ? ncpus : 1;
+}
+
+#endif
+
+static lzma_ret io_xzencoder(lzma_stream *str, uint32_t preset, lzma_check check, int nthreads)
+{
+#ifdef IO_XZ_ENCODER_MT
+    if (nthreads >= 0) {
+        lzma_mt mt;
+        memset(&mt, 0, sizeof(mt));
+        mt.threads = io_xzthreads(nthreads);
+        mt.preset  = preset;
+        mt.check   = check;
+
+        lzma_ret err = lzma_stream_encoder_mt(str, &mt);
+        if (err == LZMA_OK || err == LZMA_MEM_ERROR)
+            return err;
+
+        // fallback to single-threaded encoder
+    }
+#else
+    (void) nthreads;
+#endif
+
+    return lzma_easy_encoder(str, preset, check);
+}
+
+static lzma_ret io_xzdecoder(lzma_stream *str, uint64_t memusage, uint32_t flags, int nthreads)
+{
+#ifdef IO_XZ_DECODER_MT
+    // NOTE: unlike the default decoder, the threaded one only supports the .xz format
+    if (nthreads >= 0) {
+        lzma_mt mt;
+        memset(&mt, 0, sizeof(mt));
+        mt.flags   = flags;
+        mt.threads = io_xzthreads(nthreads);
+
+        // beyond this limit the decoder falls back to a single thread,
+        // by default be conservative like xz(1) and use a fraction of RAM
+        uint64_t physmem = lzma_physmem();
+
+        mt.memlimit_stop      = memusage;
+        mt.memlimit_threading = (physmem > 0) ? min(memusage, physmem / 4) : memusage;
+
+        lzma_ret err = lzma_stream_decoder_mt(str, &mt);
+        if (err == LZMA_OK || err == LZMA_MEM_ERROR)
+            return err;
+
+        // fallback to single-threaded decoder
+    }
+#else
+    (void) nthreads;
+#endif
+
+    return lzma_auto_decoder(str, memusage, flags);
+}
+
 io_rw_t *io_xzopen(int fd, size_t bufsiz, const char *mode, ...)
 {
     if (bufsiz == 0)
@@ -790,6 +2194,9 @@ io_rw_t *io_xzopen(int fd, size_t bufsiz, const char *mode, ...)
     io->write = io_xzwrite;
     io->error = io_xzerror;
     io->close = io_xzclose;
+    io->peek = NULL;
+    io->consume = NULL;
+    io->writev = NULL;
 
     xz = io_getstate(io);
     xz->fd = fd;
@@ -827,6 +2234,7 @@ io_rw_t *io_xzopen(int fd, size_t bufsiz, const char *mode, ...)
     uint32_t presets = 0;
     uint32_t flags = 0;
     uint64_t memusage = UINT64_MAX;
+    int nthreads = -1;  // single-threaded coding by default
     lzma_check check = LZMA_CHECK_CRC64;
     while ((c = *mode++) != '\0') {
         switch (c) {
@@ -854,12 +2262,27 @@ io_rw_t *io_xzopen(int fd, size_t bufsiz, const char *mode, ...)
         case 'm':
             if (*mode == '*') {
                 memusage = va_arg(va, uint64_t);
+                mode++;
             } else if (isdigit((unsigned char) *mode)) {
                 memusage = atoll(mode);
 
                 do mode++; while (isdigit((unsigned char) *mode));
             }
 
+            break;
+        case 't':
+            // multi-threaded coding, 0 uses as many threads as online CPUs
+            nthreads = 0;
+            if (*mode == '*') {
+                nthreads = va_arg(va, int);
+                mode++;
+            } else if (isdigit((unsigned char) *mode)) {
+                nthreads = atoi(mode);
+
+                do mode++; while (isdigit((unsigned char) *mode));
+            }
+
+            nthreads = max(nthreads, 0);
             break;
         default:
             break;
@@ -877,9 +2300,9 @@ io_rw_t *io_xzopen(int fd, size_t bufsiz, const char *mode, ...)
 
     int err;
     if (xz->mode == 'r') {
-        err = lzma_auto_decoder(str, memusage, flags);
+        err = io_xzdecoder(str, memusage, flags, nthreads);
     } else {
-        err = lzma_easy_encoder(str, compression | presets, check);
+        err = io_xzencoder(str, compression | presets, check, nthreads);
 
         str->next_out = xz->buf;
         str->avail_out = xz->bufsiz;
@@ -923,7 +2346,7 @@ static LZ4F_errorCode_t io_lz4begincompress(io_lz4state *lz, const LZ4F_preferen
     if (LZ4F_isError(lz->err))
         return lz->err;
 
-    size_t hdrsiz = LZ4F_compressBegin(lz->cctx, lz->cbufptr, lz->cbufsiz, prefs);
+    size_t hdrsiz = LZ4F_compressBegin(lz->cctx, lz->cbufptr, lz->cbufavail, prefs);
     if (LZ4F_isError(hdrsiz)) {
         LZ4F_freeCompressionContext(lz->cctx);
         return hdrsiz;
@@ -951,9 +2374,11 @@ static ssize_t io_lz4flush(io_lz4state *lz)
 
 static ssize_t io_lz4docompress(io_lz4state *lz)
 {
-    size_t cn = LZ4F_compressUpdate(lz->cctx, lz->cbufptr, lz->cbufsiz - lz->cbufavail, lz->buf, lz->bufsiz - lz->bufavail, NULL);
+    // compressed buffer has room for the frame header plus the worst case
+    // update, so pending header bytes needn't be flushed first
+    size_t cn = LZ4F_compressUpdate(lz->cctx, lz->cbufptr, lz->cbufavail, lz->buf, lz->bufsiz - lz->bufavail, NULL);
     if (unlikely(LZ4F_isError(cn))) {
-        lz->err = 1;
+        lz->err = cn;
         return -1;
     }
 
@@ -968,65 +2393,55 @@ static ssize_t io_lz4docompress(io_lz4state *lz)
     return n;
 }
 
+// decode at least one byte into buf, returns 0 on end of stream
 static ssize_t io_lz4fillbuf(io_lz4state *lz)
 {
-    // LZ4 wants unconsumed data to be available to subsequent calls
-    memmove(&lz->buf[lz->bufsiz], lz->cbufptr, lz->cbufavail);
+    while (true) {
+        if (lz->cbufavail == 0) {
+            ssize_t n = read(lz->fd, &lz->buf[lz->bufsiz], lz->cbufsiz);
+            if (unlikely(n < 0)) {
+                lz->err = errno;
+                return -1;
+            }
+            if (n == 0)
+                return 0;
+
+            lz->cbufptr = &lz->buf[lz->bufsiz];
+            lz->cbufavail = n;
+        }
 
-    lz->cbufptr = &lz->buf[lz->bufsiz] + lz->cbufavail;
-    lz->cbufavail = lz->cbufsiz - lz->cbufavail;
+        // consecutive frames are decoded transparently
+        size_t dstsize = lz->bufsiz;
+        size_t srcsize = lz->cbufavail;
+        size_t dn = LZ4F_decompress(lz->dctx, lz->buf, &dstsize, lz->cbufptr, &srcsize, NULL);
+        if (unlikely(LZ4F_isError(dn))) {
+            lz->err = dn;
+            return -1;
+        }
 
-    ssize_t n = read(lz->fd, lz->cbufptr, lz->cbufavail);
-    if (unlikely(n < 0)) {
-        lz->err = errno;
-        return -1;
+        lz->cbufptr += srcsize;
+        lz->cbufavail -= srcsize;
+        if (dstsize > 0) {
+            lz->bufptr = lz->buf;
+            lz->bufavail = dstsize;
+            return dstsize;
+        }
     }
-    if (n == 0)
-        return 0;  // FIXME EOF
-
-    lz->cbufptr += n;
-    lz->cbufavail -= n;
-
-    size_t dstsize = lz->bufsiz;
-    size_t srcsize = lz->cbufsiz - lz->cbufavail;
-    size_t dn = LZ4F_decompress(lz->dctx, lz->buf, &dstsize, &lz->buf[lz->bufsiz], &srcsize, NULL);
-    if (dn == 0) {
-        // FIXME sucks
-        LZ4F_frameInfo_t frame;
-
-        const unsigned char *src = &lz->buf[lz->bufsiz];
-        dn = LZ4F_getFrameInfo(lz->dctx, &frame, src, &srcsize);
-        if (!LZ4F_isError(dn)) {
-            src += srcsize;
-            srcsize = (lz->cbufsiz - lz->cbufavail) - srcsize;
-            dstsize = lz->bufsiz;
-
-            dn = LZ4F_decompress(lz->dctx, lz->buf, &dstsize, src, &srcsize, NULL);
-        }
-    }
-    if (LZ4F_isError(dn)) {
-        lz->err = dn;
-        return -1;
-    }
-
-    lz->cbufptr += srcsize;
-    lz->cbufavail -= srcsize;
-
-    lz->bufptr = lz->buf;
-    lz->bufavail = dstsize;
-    return n;
-}
+}
 
 static size_t io_lz4read(io_rw_t *io, void *dst, size_t n)
 {
     io_lz4state *lz = io_getstate(io);
 
-    if (unlikely(LZ4F_isError(lz->err)))
+    if (unlikely(lz->err != 0))
         return 0;
 
     unsigned char *ptr = dst;
     size_t avail = n;
     while (avail > 0) {
+        if (lz->bufavail == 0 && io_lz4fillbuf(lz) <= 0)
+            break;
+
         size_t size = min(avail, (size_t) lz->bufavail);
         memcpy(ptr, lz->bufptr, size);
 
@@ -1035,9 +2450,6 @@ static size_t io_lz4read(io_rw_t *io, void *dst, size_t n)
 
         lz->bufptr += size;
         lz->bufavail -= size;
-
-        if (lz->bufavail == 0 && io_lz4fillbuf(lz) <= 0)
-            break;
     }
 
     return n - avail;
@@ -1047,7 +2459,7 @@ static size_t io_lz4write(io_rw_t *io, const void *src, size_t n)
 {
     io_lz4state *lz = io_getstate(io);
 
-    if (unlikely(LZ4F_isError(lz->err)))
+    if (unlikely(lz->err != 0))
         return 0;
 
     const unsigned char *ptr = src;
@@ -1070,16 +2482,19 @@ static size_t io_lz4write(io_rw_t *io, const void *src, size_t n)
 
 static void io_lz4finish(io_lz4state *lz)
 {
-    if (lz->cbufavail < LZ4_END_FRAME_SIZE_MAX)
-        io_lz4flush(lz);  // TODO error check
+    if (lz->err != 0)
+        return;
+
+    // compress any pending data, then close the frame
+    if (lz->bufavail < lz->bufsiz && io_lz4docompress(lz) < 0)
+        return;
 
     size_t n = LZ4F_compressEnd(lz->cctx, lz->cbufptr, lz->cbufavail, NULL);
     if (LZ4F_isError(n)) {
-        lz->err = 1;
+        lz->err = n;
         return;
     }
 
-    // lz->cbufptr   += n; useless
     lz->cbufavail -= n;
     io_lz4flush(lz);
 }
@@ -1139,7 +2554,9 @@ io_rw_t *io_lz4open(int fd, size_t bufsiz, const char *mode, ...)
     }
     va_end(va);
 
-    size_t bound = LZ4F_compressBound(bufsiz, &prefs);
+    // room for the frame header along with the worst case compressed buffer,
+    // also used as compressed input buffer for reads
+    size_t bound = LZ4F_HEADER_SIZE_MAX + LZ4F_compressBound(bufsiz, &prefs);
 
     io_lz4state *lz;
     io_rw_t *io = malloc(io_getsize(sizeof(*lz) + bufsiz + bound));
@@ -1150,16 +2567,19 @@ io_rw_t *io_lz4open(int fd, size_t bufsiz, const char *mode, ...)
     io->write = io_lz4write;
     io->error = io_lz4error;
     io->close = io_lz4close;
+    io->peek = NULL;
+    io->consume = NULL;
+    io->writev = NULL;
 
     lz = io_getstate(io);
     lz->fd = fd;
     lz->err = 0;
     lz->bufptr = lz->buf;
     lz->cbufptr = &lz->buf[bufsiz];
-    lz->bufavail = bufsiz;
+    lz->bufavail = (rw == 'r') ? 0 : bufsiz;  // pending output for reads, room for input on writes
     lz->bufsiz = bufsiz;
     lz->cbufsiz = bound;
-    lz->cbufavail = bound;
+    lz->cbufavail = (rw == 'r') ? 0 : bound;  // pending input for reads, room for output on writes
     lz->cctx = NULL;
     lz->dctx = NULL;
     if (rw == 'r') {
@@ -1174,3 +2594,1687 @@ io_rw_t *io_lz4open(int fd, size_t bufsiz, const char *mode, ...)
 
     return io;
 }
+
+// Zstandard ===================================================================
+
+typedef struct {
+    int fd;
+    int err;   // either ZSTD_ErrorCode or errno
+    int mode;  // either 'r' or 'w'
+    bool eof;
+    size_t pending;  // last ZSTD_decompressStream() hint, nonzero inside a frame
+    ZSTD_CCtx *cctx;
+    ZSTD_DCtx *dctx;
+    size_t bufsiz;
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    unsigned char buf[];  // bufsiz large
+} io_zstdstate;
+
+static size_t io_zstdread(io_rw_t *io, void *dst, size_t n)
+{
+    io_zstdstate *zs = io_getstate(io);
+    if (unlikely(zs->err != 0))
+        return 0;
+
+    ZSTD_outBuffer out = { dst, n, 0 };
+    while (out.pos < out.size) {
+        if (zs->in.pos == zs->in.size && !zs->eof) {
+            ssize_t nr = read(zs->fd, zs->buf, zs->bufsiz);
+            if (nr < 0) {
+                zs->err = errno;
+                break;
+            }
+            if (nr == 0)
+                zs->eof = true;
+
+            zs->in.src = zs->buf;
+            zs->in.size = nr;
+            zs->in.pos = 0;
+        }
+
+        size_t pos = out.pos;
+        size_t inpos = zs->in.pos;
+        size_t ret = ZSTD_decompressStream(zs->dctx, &out, &zs->in);
+        if (unlikely(ZSTD_isError(ret))) {
+            zs->err = ZSTD_getErrorCode(ret);
+            break;
+        }
+        if (out.pos == pos && zs->in.pos == inpos) {
+            if (zs->eof) {
+                // no more input nor buffered output, stream must be complete
+                if (zs->pending != 0)
+                    zs->err = ZSTD_error_srcSize_wrong;
+
+                break;
+            }
+
+            continue;
+        }
+
+        // NOTE: only trust hint on progress, it's nonzero between frames too
+        zs->pending = ret;
+    }
+    return out.pos;
+}
+
+static bool io_zstdflush(io_zstdstate *zs)
+{
+    ssize_t n = zs->out.pos;
+    if (write(zs->fd, zs->buf, n) != n) {
+        zs->err = errno;
+        return false;
+    }
+
+    zs->out.pos = 0;
+    return true;
+}
+
+static size_t io_zstdwrite(io_rw_t *io, const void *src, size_t n)
+{
+    io_zstdstate *zs = io_getstate(io);
+    if (unlikely(zs->err != 0))
+        return 0;
+
+    ZSTD_inBuffer in = { src, n, 0 };
+    while (in.pos < in.size) {
+        if (zs->out.pos == zs->out.size && !io_zstdflush(zs))
+            break;
+
+        size_t ret = ZSTD_compressStream2(zs->cctx, &zs->out, &in, ZSTD_e_continue);
+        if (unlikely(ZSTD_isError(ret))) {
+            zs->err = ZSTD_getErrorCode(ret);
+            break;
+        }
+    }
+    return in.pos;
+}
+
+static int io_zstderror(io_rw_t *io)
+{
+    io_zstdstate *zs = io_getstate(io);
+    return zs->err;
+}
+
+static int io_zstdclose(io_rw_t *io)
+{
+    io_zstdstate *zs = io_getstate(io);
+
+    switch (zs->mode) {
+    case 'w':
+        while (zs->err == 0) {
+            // end frame and flush it to disk
+            ZSTD_inBuffer in = { NULL, 0, 0 };
+            size_t ret = ZSTD_compressStream2(zs->cctx, &zs->out, &in, ZSTD_e_end);
+            if (ZSTD_isError(ret)) {
+                zs->err = ZSTD_getErrorCode(ret);
+                break;
+            }
+            if (!io_zstdflush(zs) || ret == 0)
+                break;
+        }
+
+        ZSTD_freeCCtx(zs->cctx);
+        break;
+    case 'r':
+        ZSTD_freeDCtx(zs->dctx);
+        break;
+    default:
+        assert(false);
+        break;
+    }
+
+    int err = zs->err;
+    if (close(zs->fd) != 0)
+        err = errno;
+
+    free(io);
+    return err;
+}
+
+static int io_zstdarg(const char **pmode, va_list *va, int defval)
+{
+    const char *mode = *pmode;
+
+    int val = defval;
+    if (*mode == '*') {
+        val = va_arg(*va, int);
+        mode++;
+    } else if (isdigit((unsigned char) *mode)) {
+        val = atoi(mode);
+
+        do mode++; while (isdigit((unsigned char) *mode));
+    }
+
+    *pmode = mode;
+    return val;
+}
+
+io_rw_t *io_zstdopen(int fd, size_t bufsiz, const char *mode, ...)
+{
+    int rw = *mode++;
+    switch (rw) {
+    case 'r':
+        if (bufsiz == 0)
+            bufsiz = ZSTD_DStreamInSize();
+        break;
+    case 'w':
+        if (bufsiz == 0)
+            bufsiz = ZSTD_CStreamOutSize();
+        break;
+    default:
+        errno = EINVAL;
+        return NULL;
+    }
+    if (unlikely(bufsiz > INT_MAX))
+        bufsiz = INT_MAX;  // ssize_t used for Unix I/O is signed, pick safe values
+
+    io_zstdstate *zs;
+    io_rw_t *io = malloc(io_getsize(sizeof(*zs) + bufsiz));
+    if (unlikely(!io))
+        return NULL;
+
+    io->read = io_zstdread;
+    io->write = io_zstdwrite;
+    io->error = io_zstderror;
+    io->close = io_zstdclose;
+    io->peek = NULL;
+    io->consume = NULL;
+    io->writev = NULL;
+
+    zs = io_getstate(io);
+    memset(zs, 0, sizeof(*zs));
+    zs->fd = fd;
+    zs->mode = rw;
+    zs->bufsiz = bufsiz;
+
+    va_list va;
+
+    va_start(va, mode);
+
+    int compression = ZSTD_CLEVEL_DEFAULT;
+    if (rw == 'w')
+        compression = io_zstdarg(&mode, &va, compression);
+
+    // parse optional arguments
+    char c;
+    int windowlog = 0;  // library default
+    int nthreads = -1;  // single-threaded compression by default
+    int checksum = 0;
+    while ((c = *mode++) != '\0') {
+        switch (c) {
+        case 'l':
+            // window log, bounds memory usage on both ends
+            windowlog = io_zstdarg(&mode, &va, 0);
+            break;
+        case 'c':
+            checksum = 1;
+            break;
+        case '-':
+            checksum = 0;
+            break;
+        case 't':
+            // multi-threaded compression, 0 uses as many threads as online CPUs
+            nthreads = max(io_zstdarg(&mode, &va, 0), 0);
+            break;
+        default:
+            break;
+        }
+    }
+
+    va_end(va);
+
+    // normalize compression value
+    compression = clamp(compression, 1, ZSTD_maxCLevel());
+
+    size_t ret;
+    if (rw == 'r') {
+        zs->dctx = ZSTD_createDCtx();
+        if (unlikely(!zs->dctx)) {
+            errno = ENOMEM;
+            goto fail;
+        }
+
+        zs->in.src = zs->buf;
+        if (windowlog > 0) {
+            ret = ZSTD_DCtx_setParameter(zs->dctx, ZSTD_d_windowLogMax, windowlog);
+            if (ZSTD_isError(ret)) {
+                ZSTD_freeDCtx(zs->dctx);
+                errno = EINVAL;  // window log out of bounds
+                goto fail;
+            }
+        }
+    } else {
+        zs->cctx = ZSTD_createCCtx();
+        if (unlikely(!zs->cctx)) {
+            errno = ENOMEM;
+            goto fail;
+        }
+
+        ret = ZSTD_CCtx_setParameter(zs->cctx, ZSTD_c_compressionLevel, compression);
+        if (!ZSTD_isError(ret))
+            ret = ZSTD_CCtx_setParameter(zs->cctx, ZSTD_c_checksumFlag, checksum);
+        if (!ZSTD_isError(ret) && windowlog > 0)
+            ret = ZSTD_CCtx_setParameter(zs->cctx, ZSTD_c_windowLog, windowlog);
+
+        if (ZSTD_isError(ret)) {
+            ZSTD_freeCCtx(zs->cctx);
+            errno = EINVAL;  // rejected parameter
+            goto fail;
+        }
+
+        if (nthreads >= 0) {
+            if (nthreads == 0) {
+                long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+                nthreads = clamp(ncpus, 1, INT_MAX / 2);
+            }
+
+            // fails when libzstd is built without threading support,
+            // in that case fallback to single-threaded compression
+            ZSTD_CCtx_setParameter(zs->cctx, ZSTD_c_nbWorkers, nthreads);
+        }
+
+        zs->out.dst = zs->buf;
+        zs->out.size = zs->bufsiz;
+    }
+
+    return io;
+
+fail:
+    free(io);
+    return NULL;
+}
+
+// Buffered I/O ================================================================
+
+enum { IO_BUFDEFSIZ = 1024 * 1024 };
+
+typedef struct {
+    io_rw_t *inner;
+    int err;
+    int mode;  // either 'r' or 'w'
+    size_t bufsiz;
+    unsigned char *ptr, *end;  // read: unread data window, write: pending data is [buf, ptr)
+    unsigned char buf[];       // bufsiz large
+} io_bufstate;
+
+static size_t io_bufread(io_rw_t *io, void *dst, size_t n)
+{
+    io_bufstate *b = io_getstate(io);
+
+    if (unlikely(b->mode != 'r')) {
+        b->err = EBADF;
+        return 0;
+    }
+
+    unsigned char *p = dst;
+    size_t left = n;
+    while (left > 0) {
+        size_t avail = b->end - b->ptr;
+        if (avail > 0) {
+            size_t nr = min(avail, left);
+            memcpy(p, b->ptr, nr);
+            b->ptr += nr;
+            p      += nr;
+            left   -= nr;
+            continue;
+        }
+
+        if (left >= b->bufsiz) {
+            // large read, bypass buffer entirely
+            size_t nr = b->inner->read(b->inner, p, left);
+            left -= nr;
+            break;
+        }
+
+        size_t nr = b->inner->read(b->inner, b->buf, b->bufsiz);
+        b->ptr = b->buf;
+        b->end = b->buf + nr;
+        if (nr == 0)
+            break;  // EOF or error, error() forwards inner errors
+    }
+    return n - left;
+}
+
+static int io_bufflush(io_bufstate *b)
+{
+    size_t n = b->ptr - b->buf;
+    if (n > 0 && b->inner->write(b->inner, b->buf, n) != n) {
+        int err = b->inner->error(b->inner);
+        b->err = (err != 0) ? err : EIO;
+    }
+
+    b->ptr = b->buf;
+    return b->err;
+}
+
+static size_t io_bufwrite(io_rw_t *io, const void *src, size_t n)
+{
+    io_bufstate *b = io_getstate(io);
+
+    if (unlikely(b->mode != 'w')) {
+        b->err = EBADF;
+        return 0;
+    }
+    if (unlikely(b->err != 0))
+        return 0;
+
+    size_t avail = b->end - b->ptr;
+    if (n <= avail) {
+        memcpy(b->ptr, src, n);
+        b->ptr += n;
+        return n;
+    }
+
+    if (io_bufflush(b) != 0)
+        return 0;
+
+    if (n >= b->bufsiz)
+        return b->inner->write(b->inner, src, n);  // large write, bypass buffer
+
+    memcpy(b->ptr, src, n);
+    b->ptr += n;
+    return n;
+}
+
+static size_t io_bufwritev(io_rw_t *io, const struct iovec *iov, int iovcnt)
+{
+    io_bufstate *b = io_getstate(io);
+
+    size_t n = 0;
+    for (int i = 0; i < iovcnt; i++)
+        n += iov[i].iov_len;
+
+    if (n < b->bufsiz) {
+        // buffer the whole record, flushing at most once
+        size_t nw = 0;
+        for (int i = 0; i < iovcnt; i++) {
+            size_t len = io_bufwrite(io, iov[i].iov_base, iov[i].iov_len);
+            nw += len;
+            if (len != iov[i].iov_len)
+                break;
+        }
+        return nw;
+    }
+
+    if (unlikely(b->mode != 'w')) {
+        b->err = EBADF;
+        return 0;
+    }
+    if (unlikely(b->err != 0) || io_bufflush(b) != 0)
+        return 0;
+
+    return io_writev(b->inner, iov, iovcnt);  // large write, bypass buffer
+}
+
+static size_t io_bufconsume(io_rw_t *io, size_t n)
+{
+    io_bufstate *b = io_getstate(io);
+
+    if (unlikely(b->mode != 'r')) {
+        b->err = EBADF;
+        return 0;
+    }
+
+    size_t avail = b->end - b->ptr;
+    if (n <= avail) {
+        b->ptr += n;
+        return n;
+    }
+
+    // drop buffered data, then skip the rest in the underlying stream
+    b->ptr = b->end;
+
+    size_t left = n - avail;
+    if (b->inner->consume)
+        return avail + b->inner->consume(b->inner, left);
+
+    while (left > 0) {
+        size_t nr = b->inner->read(b->inner, b->buf, min(left, b->bufsiz));
+        if (nr == 0)
+            break;
+
+        left -= nr;
+    }
+    b->ptr = b->end = b->buf;
+    return n - left;
+}
+
+static int io_buferror(io_rw_t *io)
+{
+    io_bufstate *b = io_getstate(io);
+    return (b->err != 0) ? b->err : b->inner->error(b->inner);
+}
+
+static int io_bufclose(io_rw_t *io)
+{
+    io_bufstate *b = io_getstate(io);
+
+    int err = b->err;
+    if (b->mode == 'w' && err == 0)  // don't attempt to flush upon previous error
+        err = io_bufflush(b);
+
+    int res = b->inner->close(b->inner);
+    if (err == 0)
+        err = res;
+
+    free(io);
+    return err;
+}
+
+io_rw_t *io_bufopen(io_rw_t *inner, size_t bufsiz, const char *mode)
+{
+    if (bufsiz == 0)
+        bufsiz = IO_BUFDEFSIZ;
+
+    if (unlikely(*mode != 'r' && *mode != 'w')) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    io_bufstate *b;
+    io_rw_t *io = malloc(io_getsize(sizeof(*b) + bufsiz));
+    if (unlikely(!io))
+        return NULL;
+
+    io->read = io_bufread;
+    io->write = io_bufwrite;
+    io->error = io_buferror;
+    io->close = io_bufclose;
+    io->peek = NULL;  // buffer contents are recycled, can't honor peek() lifetime
+    io->consume = io_bufconsume;
+    io->writev = io_bufwritev;
+
+    b = io_getstate(io);
+    b->inner = inner;
+    b->err = 0;
+    b->mode = *mode;
+    b->bufsiz = bufsiz;
+    b->ptr = b->buf;
+    b->end = (b->mode == 'w') ? b->buf + bufsiz : b->buf;
+    return io;
+}
+
+// Asynchronous read-ahead =====================================================
+
+enum { IO_ASYNCDEFBUFS = 4 };
+
+typedef struct {
+    io_rw_t *inner;
+    int err;
+    int innererr;  // error encountered by the background thread
+    bool eof;      // background thread is done reading
+    bool stop;     // close() requested background thread termination
+    size_t nbufs;
+    size_t bufsiz;
+    size_t nfull;  // filled buffers, shared with background thread
+    size_t wr;     // next buffer to be filled (background thread only)
+    size_t rd;     // buffer being consumed (reader only)
+    size_t rdpos;  // offset inside buffer being consumed (reader only)
+    size_t ready;  // filled buffers known to the reader (reader only)
+    size_t *lens;  // amount of data inside each buffer
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t notempty;
+    pthread_cond_t notfull;
+    unsigned char buf[];  // nbufs * bufsiz large
+} io_asyncstate;
+
+static void *io_asyncroutine(void *arg)
+{
+    io_asyncstate *as = arg;
+
+    pthread_mutex_lock(&as->mutex);
+    while (true) {
+        while (as->nfull == as->nbufs && !as->stop)
+            pthread_cond_wait(&as->notfull, &as->mutex);
+        if (as->stop)
+            break;
+
+        size_t slot = as->wr;
+        pthread_mutex_unlock(&as->mutex);
+
+        // fill a buffer, without holding the lock
+        io_rw_t *inner = as->inner;
+        size_t n = inner->read(inner, &as->buf[slot * as->bufsiz], as->bufsiz);
+        int err = inner->error(inner);
+
+        pthread_mutex_lock(&as->mutex);
+        if (n > 0) {
+            as->lens[slot] = n;
+            as->wr = (slot + 1) % as->nbufs;
+            as->nfull++;
+        }
+        if (n == 0 || err != 0) {
+            as->innererr = err;
+            as->eof = true;
+        }
+
+        pthread_cond_signal(&as->notempty);
+        if (as->eof)
+            break;
+    }
+    pthread_mutex_unlock(&as->mutex);
+    return NULL;
+}
+
+static size_t io_asyncxfer(io_asyncstate *as, unsigned char *dst, size_t n)
+{
+    size_t left = n;
+    while (left > 0) {
+        if (as->ready == 0) {
+            // wait for the background thread
+            pthread_mutex_lock(&as->mutex);
+            while (as->nfull == 0 && !as->eof)
+                pthread_cond_wait(&as->notempty, &as->mutex);
+
+            as->ready = as->nfull;
+            if (as->ready == 0)
+                as->err = as->innererr;  // reached end of data
+
+            pthread_mutex_unlock(&as->mutex);
+            if (as->ready == 0)
+                break;
+        }
+
+        size_t len = as->lens[as->rd];
+        size_t nr  = min(left, len - as->rdpos);
+        if (dst) {
+            memcpy(dst, &as->buf[as->rd * as->bufsiz + as->rdpos], nr);
+            dst += nr;
+        }
+
+        as->rdpos += nr;
+        left      -= nr;
+        if (as->rdpos == len) {
+            // hand buffer back to the background thread
+            as->rdpos = 0;
+            as->rd    = (as->rd + 1) % as->nbufs;
+            as->ready--;
+
+            pthread_mutex_lock(&as->mutex);
+            as->nfull--;
+            pthread_cond_signal(&as->notfull);
+            pthread_mutex_unlock(&as->mutex);
+        }
+    }
+
+    return n - left;
+}
+
+static size_t io_asyncread(io_rw_t *io, void *dst, size_t n)
+{
+    io_asyncstate *as = io_getstate(io);
+    return io_asyncxfer(as, dst, n);
+}
+
+static size_t io_asyncconsume(io_rw_t *io, size_t n)
+{
+    io_asyncstate *as = io_getstate(io);
+    return io_asyncxfer(as, NULL, n);
+}
+
+static size_t io_asyncwrite(io_rw_t *io, const void *src, size_t n)
+{
+    io_asyncstate *as = io_getstate(io);
+
+    (void) src, (void) n;
+
+    as->err = EBADF;  // read only
+    return 0;
+}
+
+static int io_asyncerror(io_rw_t *io)
+{
+    io_asyncstate *as = io_getstate(io);
+    return as->err;
+}
+
+static int io_asyncclose(io_rw_t *io)
+{
+    io_asyncstate *as = io_getstate(io);
+
+    pthread_mutex_lock(&as->mutex);
+    as->stop = true;
+    pthread_cond_signal(&as->notfull);
+    pthread_mutex_unlock(&as->mutex);
+
+    pthread_join(as->thread, NULL);
+    pthread_cond_destroy(&as->notfull);
+    pthread_cond_destroy(&as->notempty);
+    pthread_mutex_destroy(&as->mutex);
+
+    int err = as->err;
+    int res = as->inner->close(as->inner);
+    if (err == 0)
+        err = res;
+
+    free(as->lens);
+    free(io);
+    return err;
+}
+
+io_rw_t *io_asyncopen(io_rw_t *inner, size_t nbufs, size_t bufsiz)
+{
+    if (nbufs == 0)
+        nbufs = IO_ASYNCDEFBUFS;
+    if (bufsiz == 0)
+        bufsiz = IO_BUFDEFSIZ;
+
+    nbufs = max(nbufs, 2);  // at least one buffer being filled while the other is consumed
+    if (unlikely(bufsiz > (SIZE_MAX - sizeof(io_asyncstate) - sizeof(io_rw_t)) / nbufs)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    io_asyncstate *as;
+    io_rw_t *io = malloc(io_getsize(sizeof(*as) + nbufs * bufsiz));
+    if (unlikely(!io))
+        return NULL;
+
+    io->read = io_asyncread;
+    io->write = io_asyncwrite;
+    io->error = io_asyncerror;
+    io->close = io_asyncclose;
+    io->peek = NULL;  // buffers are recycled, can't honor peek() lifetime
+    io->consume = io_asyncconsume;
+    io->writev = NULL;
+
+    as = io_getstate(io);
+    memset(as, 0, sizeof(*as));
+    as->inner = inner;
+    as->nbufs = nbufs;
+    as->bufsiz = bufsiz;
+    as->lens = malloc(nbufs * sizeof(*as->lens));
+    if (unlikely(!as->lens))
+        goto fail;
+
+    if (pthread_mutex_init(&as->mutex, NULL) != 0)
+        goto fail_lens;
+    if (pthread_cond_init(&as->notempty, NULL) != 0)
+        goto fail_mutex;
+    if (pthread_cond_init(&as->notfull, NULL) != 0)
+        goto fail_notempty;
+
+    int err = pthread_create(&as->thread, NULL, io_asyncroutine, as);
+    if (err != 0) {
+        errno = err;
+        goto fail_notfull;
+    }
+
+    return io;
+
+fail_notfull:
+    pthread_cond_destroy(&as->notfull);
+fail_notempty:
+    pthread_cond_destroy(&as->notempty);
+fail_mutex:
+    pthread_mutex_destroy(&as->mutex);
+fail_lens:
+    free(as->lens);
+fail:
+    free(io);
+    return NULL;
+}
+
+// io_uring ====================================================================
+
+enum {
+    IO_URINGDEFENTRIES = 64,
+    IO_URINGDEFBUFS    = 4
+};
+
+// request lifecycle: IDLE -> (queued) BUSY -> (completed) READY -> IDLE
+enum {
+    IO_URINGIDLE,
+    IO_URINGBUSY,
+    IO_URINGREADY
+};
+
+typedef struct {
+    int state;           // written by whoever reaps the completion, under ring lock
+    int res;             // bytes read or -errno, valid when READY
+    bool inring;         // request was queued to the ring, not to be read synchronously
+    off_t off;           // file offset of this request
+    struct iovec iov;    // request buffer and size
+} io_uringreq;
+
+struct io_ring_s {
+    pthread_mutex_t mutex;
+    pthread_cond_t reaped;  // signaled whenever completions are reaped
+    bool waiting;           // a thread is blocked waiting for completions
+    int fd;
+    int err;                // fatal ring error, causes fallback to read(2)
+    unsigned inflight;      // submitted requests not reaped yet
+    unsigned maxinflight;   // never overflow the completion queue
+    unsigned pending;       // queued requests not yet handed to the kernel
+#ifdef IO_HAVE_URING
+    unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+    unsigned *cqhead, *cqtail, *cqmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqmap, *cqmap;
+    size_t sqmaplen, cqmaplen, sqesmaplen;
+#endif
+};
+
+typedef struct {
+    io_ring_t *ring;  // NULL for synchronous reads
+    int fd;
+    int err;
+    bool eof;         // EOF reached, don't queue any more request
+    bool seekable;    // requests are issued at explicit offsets
+    off_t off;        // file offset of the next request
+    size_t nbufs;
+    size_t bufsiz;
+    size_t rd;        // request being consumed
+    size_t rdpos;     // offset inside request being consumed
+    bool rdready;     // request being consumed is known to be READY
+    size_t nqueued;   // requests in flight or ready, starting from rd
+    io_uringreq *reqs;
+    unsigned char *bufs;  // nbufs * bufsiz large
+} io_uringstate;
+
+#ifdef IO_HAVE_URING
+
+static int io_uringsetup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uringenter(int fd, unsigned tosubmit, unsigned mincomplete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, tosubmit, mincomplete, flags, NULL, 0);
+}
+
+// reap every available completion, ring must be locked
+static void io_ringreap(io_ring_t *ring)
+{
+    unsigned head = *ring->cqhead;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *) ring->cqtail, memory_order_acquire);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqmask];
+        io_uringreq *req = (io_uringreq *) (uintptr_t) cqe->user_data;
+
+        req->res    = cqe->res;
+        req->inring = false;
+        req->state  = IO_URINGREADY;
+        ring->inflight--;
+        head++;
+    }
+
+    atomic_store_explicit((_Atomic unsigned *) ring->cqhead, head, memory_order_release);
+}
+
+// hand queued requests to the kernel, ring must be locked
+static int io_ringflush(io_ring_t *ring)
+{
+    while (ring->pending > 0) {
+        int n = io_uringenter(ring->fd, ring->pending, 0, 0);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                // kernel is short on resources, make room by reaping completions
+                io_ringreap(ring);
+                continue;
+            }
+
+            ring->err = errno;
+            return -1;
+        }
+
+        ring->pending -= n;
+    }
+    return 0;
+}
+
+// wait for at least one completion and reap it, ring must be locked;
+// the lock is released while blocked inside the kernel, and only one thread
+// at a time waits there, any other one waits for it to reap
+static int io_ringgetevents(io_ring_t *ring)
+{
+    if (ring->waiting) {
+        pthread_cond_wait(&ring->reaped, &ring->mutex);
+        return (ring->err == 0) ? 0 : -1;
+    }
+    if (io_ringflush(ring) != 0)
+        return -1;
+
+    ring->waiting = true;
+    pthread_mutex_unlock(&ring->mutex);
+
+    int n = io_uringenter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+    int err = errno;
+
+    pthread_mutex_lock(&ring->mutex);
+    ring->waiting = false;
+
+    if (n < 0 && err != EINTR && err != EAGAIN && err != EBUSY)
+        ring->err = err;
+
+    io_ringreap(ring);
+    pthread_cond_broadcast(&ring->reaped);
+    return (ring->err == 0) ? 0 : -1;
+}
+
+// queue a read request, ring must be locked
+static int io_ringqueue(io_ring_t *ring, int fd, io_uringreq *req)
+{
+    while (ring->inflight >= ring->maxinflight) {
+        io_ringreap(ring);
+        if (ring->inflight < ring->maxinflight)
+            break;
+        if (io_ringgetevents(ring) != 0)
+            return -1;
+    }
+
+    unsigned tail = *ring->sqtail;
+    unsigned head = atomic_load_explicit((_Atomic unsigned *) ring->sqhead, memory_order_acquire);
+    if (tail - head > *ring->sqmask) {
+        // submission queue full, pending requests must be consumed first
+        if (io_ringflush(ring) != 0)
+            return -1;
+
+        head = atomic_load_explicit((_Atomic unsigned *) ring->sqhead, memory_order_acquire);
+    }
+
+    unsigned idx = tail & *ring->sqmask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_READV;  // available since Linux 5.1, unlike IORING_OP_READ
+    sqe->fd        = fd;
+    sqe->off       = req->off;
+    sqe->addr      = (uintptr_t) &req->iov;
+    sqe->len       = 1;
+    sqe->user_data = (uintptr_t) req;
+
+    ring->sqarray[idx] = idx;
+    atomic_store_explicit((_Atomic unsigned *) ring->sqtail, tail + 1, memory_order_release);
+
+    req->state  = IO_URINGBUSY;
+    req->inring = true;
+    ring->pending++;
+    ring->inflight++;
+    return 0;
+}
+
+// wait for a queued request to complete, ring must be locked (see io_ringgetevents())
+static void io_ringwait(io_ring_t *ring, io_uringreq *req)
+{
+    io_ringreap(ring);
+    while (req->inring) {
+        if (io_ringgetevents(ring) != 0)
+            break;
+    }
+}
+
+#endif
+
+io_ring_t *io_ringcreate(unsigned entries)
+{
+#ifdef IO_HAVE_URING
+    if (entries == 0)
+        entries = IO_URINGDEFENTRIES;
+
+    io_ring_t *ring = malloc(sizeof(*ring));
+    if (unlikely(!ring))
+        return NULL;
+
+    memset(ring, 0, sizeof(*ring));
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = io_uringsetup(entries, &p);
+    if (ring->fd < 0)
+        goto fail;  // not supported by kernel, or forbidden (e.g. seccomp)
+
+    ring->sqmaplen   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cqmaplen   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqesmaplen = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ring->sqmaplen = ring->cqmaplen = max(ring->sqmaplen, ring->cqmaplen);
+
+    ring->sqmap = mmap(NULL, ring->sqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqmap == MAP_FAILED)
+        goto fail_fd;
+
+    ring->cqmap = ring->sqmap;
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+        ring->cqmap = mmap(NULL, ring->cqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cqmap == MAP_FAILED)
+            goto fail_sqmap;
+    }
+
+    ring->sqes = mmap(NULL, ring->sqesmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto fail_cqmap;
+
+    unsigned char *sq = ring->sqmap;
+    unsigned char *cq = ring->cqmap;
+
+    ring->sqhead  = (unsigned *) (sq + p.sq_off.head);
+    ring->sqtail  = (unsigned *) (sq + p.sq_off.tail);
+    ring->sqmask  = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring->sqarray = (unsigned *) (sq + p.sq_off.array);
+    ring->cqhead  = (unsigned *) (cq + p.cq_off.head);
+    ring->cqtail  = (unsigned *) (cq + p.cq_off.tail);
+    ring->cqmask  = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring->cqes    = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    ring->maxinflight = p.cq_entries;
+
+    int err = pthread_mutex_init(&ring->mutex, NULL);
+    if (err != 0) {
+        errno = err;
+        goto fail_sqes;
+    }
+    err = pthread_cond_init(&ring->reaped, NULL);
+    if (err != 0) {
+        errno = err;
+        goto fail_mutex;
+    }
+
+    return ring;
+
+fail_mutex:
+    pthread_mutex_destroy(&ring->mutex);
+fail_sqes:
+    munmap(ring->sqes, ring->sqesmaplen);
+fail_cqmap:
+    if (ring->cqmap != ring->sqmap)
+        munmap(ring->cqmap, ring->cqmaplen);
+fail_sqmap:
+    munmap(ring->sqmap, ring->sqmaplen);
+fail_fd:
+    close(ring->fd);
+fail:
+    free(ring);
+    return NULL;
+#else
+    (void) entries;
+
+    errno = ENOSYS;
+    return NULL;
+#endif
+}
+
+void io_ringfree(io_ring_t *ring)
+{
+    if (!ring)
+        return;
+
+#ifdef IO_HAVE_URING
+    assert(ring->inflight == 0);
+
+    munmap(ring->sqes, ring->sqesmaplen);
+    if (ring->cqmap != ring->sqmap)
+        munmap(ring->cqmap, ring->cqmaplen);
+
+    munmap(ring->sqmap, ring->sqmaplen);
+    close(ring->fd);
+    pthread_cond_destroy(&ring->reaped);
+    pthread_mutex_destroy(&ring->mutex);
+#endif
+    free(ring);
+}
+
+// queue read requests until every buffer is busy
+static void io_uringfill(io_uringstate *ur)
+{
+    if (ur->eof || ur->err != 0 || ur->nqueued == ur->nbufs)
+        return;
+
+#ifdef IO_HAVE_URING
+    io_ring_t *ring = ur->ring;
+    if (ring)
+        pthread_mutex_lock(&ring->mutex);
+#endif
+
+    while (ur->nqueued < ur->nbufs) {
+        io_uringreq *req = &ur->reqs[(ur->rd + ur->nqueued) % ur->nbufs];
+
+        req->off    = ur->off;
+        req->state  = IO_URINGBUSY;  // synchronous reads are performed lazily
+        req->inring = false;
+#ifdef IO_HAVE_URING
+        // on failure, request is left to synchronous reads
+        if (ring && ring->err == 0 && ur->seekable)
+            io_ringqueue(ring, ur->fd, req);
+#endif
+        ur->off += ur->bufsiz;
+        ur->nqueued++;
+    }
+
+#ifdef IO_HAVE_URING
+    if (ring) {
+        io_ringflush(ring);
+        pthread_mutex_unlock(&ring->mutex);
+    }
+#endif
+}
+
+// wait for a request to complete
+static void io_uringwait(io_uringstate *ur, io_uringreq *req)
+{
+#ifdef IO_HAVE_URING
+    io_ring_t *ring = ur->ring;
+    if (ring) {
+        pthread_mutex_lock(&ring->mutex);
+        if (req->inring)
+            io_ringwait(ring, req);
+
+        pthread_mutex_unlock(&ring->mutex);
+    }
+#endif
+
+    if (req->state == IO_URINGBUSY && !req->inring) {
+        // synchronous fallback
+        ssize_t n = ur->seekable ?
+                    pread(ur->fd, req->iov.iov_base, req->iov.iov_len, req->off) :
+                    read(ur->fd, req->iov.iov_base, req->iov.iov_len);
+
+        req->res   = (n < 0) ? -errno : n;
+        req->state = IO_URINGREADY;
+    }
+}
+
+// wait for in flight requests following the first skip ones to complete,
+// so their buffers may be reused or released
+static void io_uringdrain(io_uringstate *ur, size_t skip)
+{
+#ifdef IO_HAVE_URING
+    io_ring_t *ring = ur->ring;
+    if (!ring)
+        return;
+
+    pthread_mutex_lock(&ring->mutex);
+    for (size_t i = skip; i < ur->nqueued; i++) {
+        io_uringreq *req = &ur->reqs[(ur->rd + i) % ur->nbufs];
+        if (req->inring)
+            io_ringwait(ring, req);
+    }
+    pthread_mutex_unlock(&ring->mutex);
+#else
+    (void) ur, (void) skip;
+#endif
+}
+
+static size_t io_uringxfer(io_uringstate *ur, unsigned char *dst, size_t n)
+{
+    size_t left = n;
+    while (left > 0 && ur->err == 0) {
+        io_uringfill(ur);
+        if (ur->nqueued == 0)
+            break;  // EOF
+
+        io_uringreq *req = &ur->reqs[ur->rd];
+        if (!ur->rdready) {
+            io_uringwait(ur, req);
+            if (req->state != IO_URINGREADY) {
+                ur->err = EIO;  // ring failed while request was in flight
+                break;
+            }
+            if (req->res < 0) {
+                ur->err = -req->res;
+                break;
+            }
+            if (req->res == 0) {
+                ur->eof = true;
+                break;
+            }
+            if ((size_t) req->res < req->iov.iov_len && ur->seekable) {
+                // short read, requests following this one assumed a full
+                // read and are useless, drain them and restart from here
+                io_uringdrain(ur, 1);
+
+                ur->nqueued = 1;
+                ur->off     = req->off + req->res;
+            }
+
+            ur->rdready = true;
+        }
+
+        size_t nr = min(left, (size_t) req->res - ur->rdpos);
+        if (dst) {
+            memcpy(dst, (unsigned char *) req->iov.iov_base + ur->rdpos, nr);
+            dst += nr;
+        }
+
+        ur->rdpos += nr;
+        left      -= nr;
+        if (ur->rdpos == (size_t) req->res) {
+            // recycle buffer for a new request
+            req->state  = IO_URINGIDLE;
+            ur->rdready = false;
+            ur->rdpos   = 0;
+            ur->rd     = (ur->rd + 1) % ur->nbufs;
+            ur->nqueued--;
+        }
+    }
+
+    return n - left;
+}
+
+static size_t io_uringread(io_rw_t *io, void *dst, size_t n)
+{
+    io_uringstate *ur = io_getstate(io);
+    return io_uringxfer(ur, dst, n);
+}
+
+static size_t io_uringconsume(io_rw_t *io, size_t n)
+{
+    io_uringstate *ur = io_getstate(io);
+    return io_uringxfer(ur, NULL, n);
+}
+
+static size_t io_uringwrite(io_rw_t *io, const void *src, size_t n)
+{
+    io_uringstate *ur = io_getstate(io);
+
+    (void) src, (void) n;
+
+    ur->err = EBADF;  // read only
+    return 0;
+}
+
+static int io_uringerror(io_rw_t *io)
+{
+    io_uringstate *ur = io_getstate(io);
+    return ur->err;
+}
+
+static int io_uringclose(io_rw_t *io)
+{
+    io_uringstate *ur = io_getstate(io);
+
+    // kernel may still be writing to our buffers
+    io_uringdrain(ur, 0);
+
+    int err = ur->err;
+    if (close(ur->fd) != 0 && err == 0)
+        err = errno;
+
+    free(io);
+    return err;
+}
+
+io_rw_t *io_uringopen(io_ring_t *ring, int fd, size_t nbufs, size_t bufsiz)
+{
+    if (nbufs == 0)
+        nbufs = IO_URINGDEFBUFS;
+    if (bufsiz == 0)
+        bufsiz = IO_BUFDEFSIZ;
+
+    if (unlikely(bufsiz > INT_MAX))
+        bufsiz = INT_MAX;  // completion results are int, pick safe values
+    if (unlikely(nbufs > (SIZE_MAX - sizeof(io_uringstate) - sizeof(io_rw_t)) / (bufsiz + sizeof(io_uringreq)))) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    io_uringstate *ur;
+    io_rw_t *io = malloc(io_getsize(sizeof(*ur) + nbufs * sizeof(*ur->reqs) + nbufs * bufsiz));
+    if (unlikely(!io))
+        return NULL;
+
+    io->read = io_uringread;
+    io->write = io_uringwrite;
+    io->error = io_uringerror;
+    io->close = io_uringclose;
+    io->peek = NULL;  // buffers are recycled, can't honor peek() lifetime
+    io->consume = io_uringconsume;
+    io->writev = NULL;
+
+    ur = io_getstate(io);
+    memset(ur, 0, sizeof(*ur));
+    ur->ring = ring;
+    ur->fd = fd;
+    ur->nbufs = nbufs;
+    ur->bufsiz = bufsiz;
+    ur->reqs = (io_uringreq *) (ur + 1);
+    ur->bufs = (unsigned char *) (ur->reqs + nbufs);
+
+    // pipes and sockets can only be read sequentially, one request at a time
+    ur->off = lseek(fd, 0, SEEK_CUR);
+    ur->seekable = (ur->off >= 0);
+    if (!ur->seekable)
+        ur->off = 0;
+
+    for (size_t i = 0; i < nbufs; i++) {
+        io_uringreq *req = &ur->reqs[i];
+
+        req->state        = IO_URINGIDLE;
+        req->iov.iov_base = &ur->bufs[i * bufsiz];
+        req->iov.iov_len  = bufsiz;
+    }
+
+    // get requests going right away
+    io_uringfill(ur);
+    return io;
+}
+
+// Direct I/O ==================================================================
+
+enum { IO_DIRECTALIGN = 4096 };  // satisfies any common logical block size
+
+typedef struct {
+    int fd;
+    int err;
+    int innererr;  // error encountered by the background thread
+    bool direct;   // page cache is bypassed, otherwise it is dropped after reads
+    bool eof;      // background thread is done reading
+    bool stop;     // close() requested background thread termination
+    off_t off;     // next aligned file offset to be read (background thread only)
+    size_t skip;   // leading bytes to discard, when opened at an unaligned offset
+    size_t bufsiz;
+    size_t nfull;  // filled buffers, shared with background thread
+    size_t wr;     // next buffer to be filled (background thread only)
+    size_t rd;     // buffer being consumed (reader only)
+    size_t rdpos;  // offset inside buffer being consumed (reader only)
+    size_t ready;  // filled buffers known to the reader (reader only)
+    size_t starts[2], ends[2];  // data window inside each buffer
+    unsigned char *bufs;        // 2 * bufsiz large, IO_DIRECTALIGN aligned
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t notempty;
+    pthread_cond_t notfull;
+} io_directstate;
+
+static bool io_directenable(int fd, bool enable)
+{
+#if defined(O_DIRECT)
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0)
+        return false;
+
+    flags = enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+    return fcntl(fd, F_SETFL, flags) == 0;
+#elif defined(F_NOCACHE)
+    return fcntl(fd, F_NOCACHE, enable) == 0;
+#else
+    (void) fd, (void) enable;
+    return false;
+#endif
+}
+
+static ssize_t io_directfill(io_directstate *dr, unsigned char *buf)
+{
+    ssize_t n;
+    while (true) {
+        n = pread(dr->fd, buf, dr->bufsiz, dr->off);
+        if (n >= 0 || errno != EINVAL || !dr->direct)
+            break;
+
+        // filesystem refused direct I/O (e.g. tmpfs or unaligned tail),
+        // fallback to regular reads
+        io_directenable(dr->fd, false);
+        dr->direct = false;
+    }
+    if (n <= 0)
+        return n;
+
+#ifdef POSIX_FADV_DONTNEED
+    if (!dr->direct)
+        posix_fadvise(dr->fd, dr->off, n, POSIX_FADV_DONTNEED);  // don't pollute page cache
+#endif
+
+    dr->off += n;
+    return n;
+}
+
+static void *io_directroutine(void *arg)
+{
+    io_directstate *dr = arg;
+
+    pthread_mutex_lock(&dr->mutex);
+    while (true) {
+        while (dr->nfull == 2 && !dr->stop)
+            pthread_cond_wait(&dr->notfull, &dr->mutex);
+        if (dr->stop)
+            break;
+
+        size_t slot = dr->wr;
+        pthread_mutex_unlock(&dr->mutex);
+
+        // fill a buffer, without holding the lock
+        ssize_t n = io_directfill(dr, &dr->bufs[slot * dr->bufsiz]);
+        int err = (n < 0) ? errno : 0;
+
+        pthread_mutex_lock(&dr->mutex);
+        if (n > 0 && (size_t) n > dr->skip) {
+            dr->starts[slot] = dr->skip;
+            dr->ends[slot]   = n;
+            dr->wr = (slot + 1) % 2;
+            dr->nfull++;
+        }
+        if (n <= 0) {
+            dr->innererr = err;
+            dr->eof = true;
+        }
+
+        dr->skip = 0;
+        pthread_cond_signal(&dr->notempty);
+        if (dr->eof)
+            break;
+    }
+    pthread_mutex_unlock(&dr->mutex);
+    return NULL;
+}
+
+static size_t io_directxfer(io_directstate *dr, unsigned char *dst, size_t n)
+{
+    size_t left = n;
+    while (left > 0) {
+        if (dr->ready == 0) {
+            // wait for the background thread
+            pthread_mutex_lock(&dr->mutex);
+            while (dr->nfull == 0 && !dr->eof)
+                pthread_cond_wait(&dr->notempty, &dr->mutex);
+
+            dr->ready = dr->nfull;
+            if (dr->ready == 0)
+                dr->err = dr->innererr;  // reached end of data
+
+            pthread_mutex_unlock(&dr->mutex);
+            if (dr->ready == 0)
+                break;
+
+            if (dr->rdpos == 0)
+                dr->rdpos = dr->starts[dr->rd];
+        }
+
+        size_t end = dr->ends[dr->rd];
+        size_t nr  = min(left, end - dr->rdpos);
+        if (dst) {
+            memcpy(dst, &dr->bufs[dr->rd * dr->bufsiz + dr->rdpos], nr);
+            dst += nr;
+        }
+
+        dr->rdpos += nr;
+        left      -= nr;
+        if (dr->rdpos == end) {
+            // hand buffer back to the background thread
+            dr->rd = (dr->rd + 1) % 2;
+            dr->ready--;
+            dr->rdpos = (dr->ready > 0) ? dr->starts[dr->rd] : 0;
+
+            pthread_mutex_lock(&dr->mutex);
+            dr->nfull--;
+            pthread_cond_signal(&dr->notfull);
+            pthread_mutex_unlock(&dr->mutex);
+        }
+    }
+
+    return n - left;
+}
+
+static size_t io_directread(io_rw_t *io, void *dst, size_t n)
+{
+    io_directstate *dr = io_getstate(io);
+    return io_directxfer(dr, dst, n);
+}
+
+static size_t io_directconsume(io_rw_t *io, size_t n)
+{
+    io_directstate *dr = io_getstate(io);
+    return io_directxfer(dr, NULL, n);
+}
+
+static size_t io_directwrite(io_rw_t *io, const void *src, size_t n)
+{
+    io_directstate *dr = io_getstate(io);
+
+    (void) src, (void) n;
+
+    dr->err = EBADF;  // read only
+    return 0;
+}
+
+static int io_directerror(io_rw_t *io)
+{
+    io_directstate *dr = io_getstate(io);
+    return dr->err;
+}
+
+static int io_directclose(io_rw_t *io)
+{
+    io_directstate *dr = io_getstate(io);
+
+    pthread_mutex_lock(&dr->mutex);
+    dr->stop = true;
+    pthread_cond_signal(&dr->notfull);
+    pthread_mutex_unlock(&dr->mutex);
+
+    pthread_join(dr->thread, NULL);
+    pthread_cond_destroy(&dr->notfull);
+    pthread_cond_destroy(&dr->notempty);
+    pthread_mutex_destroy(&dr->mutex);
+
+    int err = dr->err;
+    if (close(dr->fd) != 0 && err == 0)
+        err = errno;
+
+    free(dr->bufs);
+    free(io);
+    return err;
+}
+
+io_rw_t *io_directopen(int fd, size_t bufsiz)
+{
+    if (bufsiz == 0)
+        bufsiz = IO_BUFDEFSIZ;
+
+    size_t align = IO_DIRECTALIGN;
+    long pagesiz = sysconf(_SC_PAGESIZE);
+    if (pagesiz > 0 && (size_t) pagesiz > align)
+        align = pagesiz;
+
+    bufsiz = min(bufsiz, (size_t) INT_MAX);  // ssize_t used for Unix I/O is signed, pick safe values
+    bufsiz = (bufsiz + align - 1) & ~(align - 1);
+
+    // O_DIRECT requires file offset to be aligned too
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0)
+        return NULL;  // direct I/O only makes sense on regular files
+
+    io_directstate *dr;
+    io_rw_t *io = malloc(io_getsize(sizeof(*dr)));
+    if (unlikely(!io))
+        return NULL;
+
+    io->read = io_directread;
+    io->write = io_directwrite;
+    io->error = io_directerror;
+    io->close = io_directclose;
+    io->peek = NULL;  // buffers are recycled, can't honor peek() lifetime
+    io->consume = io_directconsume;
+    io->writev = NULL;
+
+    dr = io_getstate(io);
+    memset(dr, 0, sizeof(*dr));
+    dr->fd = fd;
+    dr->bufsiz = bufsiz;
+    dr->off = pos & ~((off_t) align - 1);
+    dr->skip = pos - dr->off;
+
+    int err = posix_memalign((void **) &dr->bufs, align, 2 * bufsiz);
+    if (err != 0) {
+        errno = err;
+        goto fail;
+    }
+
+    // when direct I/O is unsupported, pages are dropped from cache after use
+    dr->direct = io_directenable(fd, true);
+
+    if (pthread_mutex_init(&dr->mutex, NULL) != 0)
+        goto fail_bufs;
+    if (pthread_cond_init(&dr->notempty, NULL) != 0)
+        goto fail_mutex;
+    if (pthread_cond_init(&dr->notfull, NULL) != 0)
+        goto fail_notempty;
+
+    err = pthread_create(&dr->thread, NULL, io_directroutine, dr);
+    if (err != 0) {
+        errno = err;
+        goto fail_notfull;
+    }
+
+    return io;
+
+fail_notfull:
+    pthread_cond_destroy(&dr->notfull);
+fail_notempty:
+    pthread_cond_destroy(&dr->notempty);
+fail_mutex:
+    pthread_mutex_destroy(&dr->mutex);
+fail_bufs:
+    if (dr->direct)
+        io_directenable(fd, false);
+
+    free(dr->bufs);
+fail:
+    free(io);
+    return NULL;
+}
+
+// Memory mapped I/O ===========================================================
+
+typedef struct {
+    int fd;
+    int err;
+    unsigned char *base;
+    unsigned char *ptr;
+    unsigned char *end;
+} io_mmapstate;
+
+static size_t io_mmapread(io_rw_t *io, void *dst, size_t n)
+{
+    io_mmapstate *mm = io_getstate(io);
+
+    if ((size_t) (mm->end - mm->ptr) < n)
+        n = mm->end - mm->ptr;
+
+    memcpy(dst, mm->ptr, n);
+    mm->ptr += n;
+    return n;
+}
+
+static size_t io_mmapwrite(io_rw_t *io, const void *src, size_t n)
+{
+    io_mmapstate *mm = io_getstate(io);
+
+    (void) src, (void) n;
+
+    mm->err = EBADF;  // mapping is read-only
+    return 0;
+}
+
+static void *io_mmappeek(io_rw_t *io, size_t n, size_t *pn)
+{
+    io_mmapstate *mm = io_getstate(io);
+
+    if ((size_t) (mm->end - mm->ptr) < n)
+        n = mm->end - mm->ptr;
+
+    *pn = n;
+    return mm->ptr;
+}
+
+static size_t io_mmapconsume(io_rw_t *io, size_t n)
+{
+    io_mmapstate *mm = io_getstate(io);
+
+    if ((size_t) (mm->end - mm->ptr) < n)
+        n = mm->end - mm->ptr;
+
+    mm->ptr += n;
+    return n;
+}
+
+static int io_mmaperror(io_rw_t *io)
+{
+    io_mmapstate *mm = io_getstate(io);
+    return mm->err;
+}
+
+static int io_mmapclose(io_rw_t *io)
+{
+    io_mmapstate *mm = io_getstate(io);
+
+    int err = mm->err;
+    if (mm->base && munmap(mm->base, mm->end - mm->base) != 0)
+        err = errno;
+    if (close(mm->fd) != 0)
+        err = errno;
+
+    free(io);
+    return err;
+}
+
+io_rw_t *io_mmapopen(int fd, const char *mode)
+{
+    if (unlikely(*mode++ != 'r')) {
+        errno = EINVAL;  // only reading is supported
+        return NULL;
+    }
+
+    // access pattern hint, sequential scan is the common case
+    int advice = MADV_SEQUENTIAL;
+    switch (*mode) {
+    case 'R':
+        advice = MADV_RANDOM;
+        break;
+    case 'W':
+        advice = MADV_WILLNEED;
+        break;
+    default:
+        break;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return NULL;
+    if (unlikely(!S_ISREG(st.st_mode))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (unlikely((uintmax_t) st.st_size > SIZE_MAX)) {
+        errno = EFBIG;
+        return NULL;
+    }
+
+    io_mmapstate *mm;
+    io_rw_t *io = malloc(io_getsize(sizeof(*mm)));
+    if (unlikely(!io))
+        return NULL;
+
+    io->read = io_mmapread;
+    io->write = io_mmapwrite;
+    io->error = io_mmaperror;
+    io->close = io_mmapclose;
+    io->peek = io_mmappeek;
+    io->consume = io_mmapconsume;
+    io->writev = NULL;
+
+    mm = io_getstate(io);
+    mm->fd = fd;
+    mm->err = 0;
+    mm->base = NULL;  // empty files can't be mapped, treat them as empty streams
+
+    size_t size = st.st_size;
+    if (size > 0) {
+        void *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            free(io);
+            return NULL;
+        }
+
+        madvise(base, size, advice);  // just a hint, ignore failure
+        mm->base = base;
+    }
+
+    mm->ptr = mm->base;
+    mm->end = mm->base + size;
+    return io;
+}
@@ -29,16 +29,20 @@
 //
 
 #include <assert.h>
+#include <isolario/attrstore.h>
 #include <isolario/branch.h>
 #include <isolario/endian.h>
 #include <isolario/mrt.h>
+#include <isolario/ribcols.h>
 #include <isolario/util.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
 enum {
-    MRTGROWSTEP = 256
+    MRTGROWSTEP = 256,
+    MRTNRETAIN  = 2  ///< Heap buffers retained per thread (e.g. one for a Peer Index, one for RIBs)
 };
 
 /// @brief Offsets for various MRT packet fields
@@ -70,13 +74,16 @@ enum {
     F_HAS_STATE = 1 << 6,
     F_WRAPS_BGP = 1 << 7,
     F_ADDPATH   = 1 << 8,
+    F_SH        = 1 << 9,    ///< Packet data is shared (e.g. memory mapped) and should not be free()d on close
 
     F_RD   = 1 << 10,        ///< Packet opened for read
     F_WR   = 1 << (10 + 1),  ///< Packet opened for write
     F_RDWR = F_RD | F_WR,    ///< Shorthand for \a (F_RD | F_WR).
 
     F_PE = 1 << (10 + 2),
-    F_RE = 1 << (10 + 3)
+    F_RE = 1 << (10 + 3),
+
+    F_WRREC = 1 << (10 + 4)  ///< A record is being written
 };
 
 #define SHIFT(idx) ((idx) - MRT_BGP)
@@ -155,7 +162,7 @@ static const uint16_t masktab[][MAX_MRT_SUBTYPE + 1] = {
 #define CHECKFLAGS(which) CHECKFLAGSR(which, (msg)->err)
 
 #define CHECKPEERIDXR(retval) do {                                                 \
-    if (unlikely(!(msg)->peer_index))                                              \
+    if (unlikely(!(msg)->peer_index && !(msg)->pidx))                              \
         (msg)->err = ((msg)->err != MRT_ENOERR) ? (msg)->err : MRT_ENEEDSPEERIDX;  \
     if (unlikely((msg)->err))                                                      \
         return (retval);                                                           \
@@ -194,6 +201,129 @@ int mrterror_r(mrt_msg_t *msg)
     return msg->err;
 }
 
+// buffer retention section
+
+/// @brief Heap buffers for records exceeding \a MRTBUFSIZ, retained by each thread across mrtclose_r().
+static _Thread_local struct mrtretained {
+    unsigned char *bufs[MRTNRETAIN];
+    size_t sizes[MRTNRETAIN];
+    size_t hiwater;
+    size_t maxsiz;    ///< Shrink policy, 0 means no limit
+    bool registered;  ///< Buffers are released on thread exit
+} retained;
+
+static pthread_once_t retainonce = PTHREAD_ONCE_INIT;
+static pthread_key_t retainkey;
+static bool retainhaskey;
+
+static void mrtfreeretained(void *p)
+{
+    struct mrtretained *r = p;
+    for (int i = 0; i < MRTNRETAIN; i++) {
+        free(r->bufs[i]);
+        r->bufs[i] = NULL;
+    }
+}
+
+static void mrtmkretainkey(void)
+{
+    // on failure, buffers are only released by an explicit mrtreleasebufs()
+    retainhaskey = (pthread_key_create(&retainkey, mrtfreeretained) == 0);
+}
+
+static unsigned char *mrtgetbuf(size_t n, uint32_t *pcap)
+{
+    // pick the smallest retained buffer that fits
+    int best = -1;
+    for (int i = 0; i < MRTNRETAIN; i++) {
+        if (retained.bufs[i] && retained.sizes[i] >= n && (best < 0 || retained.sizes[i] < retained.sizes[best]))
+            best = i;
+    }
+    if (best >= 0) {
+        unsigned char *buf = retained.bufs[best];
+
+        *pcap = retained.sizes[best];
+        retained.bufs[best] = NULL;
+        return buf;
+    }
+
+    // none fits, drop the largest retained buffer (its contents are garbage anyway) and allocate a new one
+    int largest = -1;
+    for (int i = 0; i < MRTNRETAIN; i++) {
+        if (retained.bufs[i] && (largest < 0 || retained.sizes[i] > retained.sizes[largest]))
+            largest = i;
+    }
+    if (largest >= 0) {
+        free(retained.bufs[largest]);
+        retained.bufs[largest] = NULL;
+    }
+
+    size_t cap = (n + MRTBUFSIZ - 1) & ~((size_t) MRTBUFSIZ - 1);
+    unsigned char *buf = malloc(cap);
+    if (likely(buf))
+        *pcap = cap;
+
+    return buf;
+}
+
+static void mrtputbuf(unsigned char *buf, size_t cap)
+{
+    if (retained.maxsiz != 0 && cap > retained.maxsiz) {
+        free(buf);
+        return;
+    }
+
+    // retain inside a free slot, or replace the smallest retained buffer
+    int slot = 0;
+    for (int i = 0; i < MRTNRETAIN; i++) {
+        if (!retained.bufs[i]) {
+            slot = i;
+            break;
+        }
+        if (retained.sizes[i] < retained.sizes[slot])
+            slot = i;
+    }
+    if (retained.bufs[slot]) {
+        if (retained.sizes[slot] >= cap) {
+            free(buf);
+            return;
+        }
+
+        free(retained.bufs[slot]);
+    }
+
+    retained.bufs[slot]  = buf;
+    retained.sizes[slot] = cap;
+    if (unlikely(!retained.registered)) {
+        pthread_once(&retainonce, mrtmkretainkey);
+        retained.registered = retainhaskey && pthread_setspecific(retainkey, &retained) == 0;
+    }
+}
+
+void setmrtbufretain(size_t maxsiz)
+{
+    retained.maxsiz = maxsiz;
+    if (maxsiz == 0)
+        return;
+
+    for (int i = 0; i < MRTNRETAIN; i++) {
+        if (retained.bufs[i] && retained.sizes[i] > maxsiz) {
+            free(retained.bufs[i]);
+            retained.bufs[i] = NULL;
+        }
+    }
+}
+
+size_t getmrtbufhiwater(void)
+{
+    return retained.hiwater;
+}
+
+void mrtreleasebufs(void)
+{
+    mrtfreeretained(&retained);
+}
+
 // read section
 
 static int setuppitable(mrt_msg_t *msg, mrt_msg_t *pi)
@@ -305,21 +435,15 @@ int setmrtpi_r(mrt_msg_t *msg, mrt_msg_t *pi)
     return MRT_EINVOP;
 }
 
-int setmrtread(const void *data, size_t n)
+int setmrtread(const void *data, size_t n, int flags)
 {
-    int res = setmrtread_r(&curmsg, data, n);
+    int res = setmrtread_r(&curmsg, data, n, flags);
     if (likely(res == MRT_ENOERR) && curpimsg.flags != 0)
         setuppitable(&curmsg, &curpimsg);
 
     return res;
 }
 
-int setmrtread_r(mrt_msg_t *msg, const void *data, size_t n)
-{
-    io_rw_t io = IO_MEM_RDINIT(data, n);
-    return setmrtreadfrom_r(msg, &io);
-}
-
 int setmrtreadfd(int fd)
 {
     io_rw_t io = IO_FD_INIT(fd);
@@ -344,14 +468,9 @@ int setmrtreadfrom(io_rw_t *io)
     return res;
 }
 
-int setmrtreadfrom_r(mrt_msg_t *msg, io_rw_t *io)
+// decode header into msg->hdr, returns packet flags, or a negated error code
+static int decodemrthdr(mrt_msg_t *msg, const unsigned char *hdr)
 {
-    unsigned char hdr[MRT_HDRSIZ];
-    size_t n = io->read(io, hdr, sizeof(hdr));
-    if (unlikely(n != sizeof(hdr)))
-        return (n > 0) ? MRT_EBADHDR : MRT_EIO;  // either we couldn't fetch a complete header or there are no bytes left
-
-    // decode header into msg->hdr for easy access
     memset(&msg->hdr, 0, sizeof(msg->hdr));
 
     uint32_t time;
@@ -367,9 +486,9 @@ int setmrtreadfrom_r(mrt_msg_t *msg, io_rw_t *io)
 
     // don't accept absurd values
     if (unlikely(type < MRT_BGP || type > MRT_BGP4MP_ET))
-        return MRT_ETYPENOTSUP;
+        return -MRT_ETYPENOTSUP;
     if (unlikely(subtype >= nelems(masktab[0])))
-        return MRT_EBADHDR;
+        return -MRT_EBADHDR;
 
     msg->hdr.type    = type;
     msg->hdr.subtype = subtype;
@@ -379,22 +498,16 @@ int setmrtreadfrom_r(mrt_msg_t *msg, io_rw_t *io)
     msg->hdr.len = frombig32(len);
     int flags = mrtflags(&msg->hdr);
     if (unlikely((flags & F_VALID) == 0))
-        return MRT_EBADHDR;
+        return -MRT_EBADHDR;
+    if (unlikely((flags & F_IS_EXT) && msg->hdr.len < sizeof(uint32_t)))
+        return -MRT_EBADHDR;  // no room for microsecond timestamp
 
-    // populate message buffer
-    msg->buf = msg->fastbuf;
-    n        = msg->hdr.len + sizeof(hdr);
-    if (unlikely(n > sizeof(msg->fastbuf)))
-        msg->buf = malloc(n);
-    if (unlikely(!msg->buf))
-        return MRT_ENOMEM;
-
-    // copy header over
-    memcpy(msg->buf, hdr, sizeof(hdr));
-    // copy leftover packet
-    if (unlikely(io->read(io, &msg->buf[MRT_HDRSIZ], msg->hdr.len) != msg->hdr.len))
-        return io->error(io) ? MRT_EIO : MRT_EBADHDR;
+    return flags;
+}
 
+// complete message setup, once msg->buf holds the whole record
+static int setupmrtmsg(mrt_msg_t *msg, int flags)
+{
     // read extended timestamp if necessary
     if (flags & F_IS_EXT) {
         uint32_t usec;
@@ -405,13 +518,301 @@ int setmrtreadfrom_r(mrt_msg_t *msg, io_rw_t *io)
 
     msg->flags      = flags | F_RD;
     msg->err        = MRT_ENOERR;
-    msg->bufsiz     = n;
     msg->peer_index = NULL;
+    msg->pidx       = NULL;
+    msg->attrstore  = NULL;
     msg->pitab      = NULL;
 
     return MRT_ENOERR;
 }
 
+int setmrtread_r(mrt_msg_t *msg, const void *data, size_t n, int flags)
+{
+    if ((flags & MRTF_NOCOPY) == 0) {
+        io_rw_t io = IO_MEM_RDINIT(data, n);
+        return setmrtreadfrom_r(msg, &io);
+    }
+
+    if (unlikely(n < MRT_HDRSIZ))
+        return (n > 0) ? MRT_EBADHDR : MRT_EIO;
+
+    int res = decodemrthdr(msg, data);
+    if (unlikely(res < 0))
+        return -res;
+    if (unlikely(n - MRT_HDRSIZ < msg->hdr.len))
+        return MRT_EBADHDR;  // truncated record
+
+    // read in place, caller memory must outlive the message
+    msg->buf    = (unsigned char *) data;
+    msg->bufsiz = msg->hdr.len + MRT_HDRSIZ;
+    return setupmrtmsg(msg, res | F_SH);
+}
+
+int setmrtreadfrom_r(mrt_msg_t *msg, io_rw_t *io)
+{
+    unsigned char hdrbuf[MRT_HDRSIZ];
+    const unsigned char *hdr = hdrbuf;
+    unsigned char *data = NULL;  // only set for zero-copy streams
+
+    size_t n;
+    if (io->peek) {
+        data = io->peek(io, MRT_HDRSIZ, &n);
+        hdr  = data;
+    } else {
+        n = io->read(io, hdrbuf, sizeof(hdrbuf));
+    }
+    if (unlikely(n != MRT_HDRSIZ))
+        return (n > 0) ? MRT_EBADHDR : MRT_EIO;  // either we couldn't fetch a complete header or there are no bytes left
+
+    int flags = decodemrthdr(msg, hdr);
+    if (unlikely(flags < 0))
+        return -flags;
+
+    // populate message buffer
+    n = msg->hdr.len + MRT_HDRSIZ;
+    if (data) {
+        // zero-copy, reference the whole record directly inside the stream
+        size_t avail;
+        data = io->peek(io, n, &avail);
+        if (unlikely(avail != n))
+            return io->error(io) ? MRT_EIO : MRT_EBADHDR;
+
+        io->consume(io, n);
+        msg->buf    = data;
+        msg->bufsiz = n;
+        flags      |= F_SH;
+    } else {
+        msg->buf    = msg->fastbuf;
+        msg->bufsiz = sizeof(msg->fastbuf);
+        if (unlikely(n > sizeof(msg->fastbuf))) {
+            if (n > retained.hiwater)
+                retained.hiwater = n;
+
+            msg->buf = mrtgetbuf(n, &msg->bufsiz);
+        }
+        if (unlikely(!msg->buf))
+            return MRT_ENOMEM;
+
+        // copy header over
+        memcpy(msg->buf, hdr, MRT_HDRSIZ);
+        // copy leftover packet
+        if (unlikely(io->read(io, &msg->buf[MRT_HDRSIZ], msg->hdr.len) != msg->hdr.len)) {
+            if (msg->buf != msg->fastbuf)
+                mrtputbuf(msg->buf, msg->bufsiz);
+
+            return io->error(io) ? MRT_EIO : MRT_EBADHDR;
+        }
+    }
+
+    return setupmrtmsg(msg, flags);
+}
+
+// iterator section
+
+void mrtiterinit(mrt_iter_t *it, const void *data, size_t n)
+{
+    it->ptr = data;
+    it->end = it->ptr + n;
+}
+
+int mrtiternext(mrt_iter_t *it, mrt_msg_t *msg)
+{
+    int err = setmrtread_r(msg, it->ptr, it->end - it->ptr, MRTF_NOCOPY);
+    if (likely(err == MRT_ENOERR))
+        it->ptr += msg->hdr.len + MRT_HDRSIZ;
+
+    return err;
+}
+
+size_t mrtiterleft(const mrt_iter_t *it)
+{
+    return it->end - it->ptr;
+}
+
+// header filter section
+
+enum {
+    // longest prefix of a record body holding every filtered header field:
+    // extended timestamp and a BGP4MP header with IPv6 addresses and states
+    MRTHF_PREFIXSIZ = sizeof(uint32_t) + 2 * sizeof(uint32_t) + 4 * sizeof(uint16_t) + 2 * sizeof(struct in6_addr)
+};
+
+static int tscmp(const struct timespec *a, const struct timespec *b)
+{
+    if (a->tv_sec != b->tv_sec)
+        return (a->tv_sec > b->tv_sec) - (a->tv_sec < b->tv_sec);
+
+    return (a->tv_nsec > b->tv_nsec) - (a->tv_nsec < b->tv_nsec);
+}
+
+// match fields available from the bare MRT header, microsecond timestamp
+// may not be decoded yet, so time is checked at second granularity
+static bool matchmrthdr(const mrt_header_t *hdr, const mrt_hdrfilter_t *flt)
+{
+    if ((flt->fields & MRTHF_TYPE) && hdr->type != flt->type)
+        return false;
+    if ((flt->fields & MRTHF_SUBTYPE) && hdr->subtype != flt->subtype)
+        return false;
+    if ((flt->fields & MRTHF_TIME) && (hdr->stamp.tv_sec < flt->start.tv_sec || hdr->stamp.tv_sec > flt->end.tv_sec))
+        return false;
+
+    return true;
+}
+
+int mrthdrmatch_r(mrt_msg_t *msg, const mrt_hdrfilter_t *flt)
+{
+    if (!matchmrthdr(&msg->hdr, flt))
+        return false;
+
+    if (flt->fields & MRTHF_TIME) {
+        if (tscmp(&msg->hdr.stamp, &flt->start) < 0 || tscmp(&msg->hdr.stamp, &flt->end) >= 0)
+            return false;
+    }
+    if ((flt->fields & (MRTHF_PEERAS | MRTHF_PEERADDR | MRTHF_LOCALAS)) == 0)
+        return true;
+
+    uint32_t peer_as, local_as;
+    const netaddr_t *peer_addr;
+    bool has_local = true;
+    if (msg->flags & F_IS_BGP) {
+        const bgp4mp_header_t *hdr = getbgp4mpheader_r(msg);
+        if (unlikely(!hdr))
+            return false;
+
+        peer_as   = hdr->peer_as;
+        local_as  = hdr->local_as;
+        peer_addr = &hdr->peer_addr;
+    } else if (msg->hdr.type == MRT_BGP && (msg->flags & (F_WRAPS_BGP | F_HAS_STATE))) {
+        const zebra_header_t *hdr = getzebraheader_r(msg);
+        if (unlikely(!hdr))
+            return false;
+
+        peer_as   = hdr->peer_as;
+        local_as  = (msg->flags & F_WRAPS_BGP) ? hdr->local_as : 0;
+        has_local = (msg->flags & F_WRAPS_BGP) != 0;  // state changes carry no local AS
+        peer_addr = &hdr->peer_addr;
+    } else {
+        return false;
+    }
+
+    if ((flt->fields & MRTHF_PEERAS) && peer_as != flt->peer_as)
+        return false;
+    if ((flt->fields & MRTHF_LOCALAS) && (!has_local || local_as != flt->local_as))
+        return false;
+    if ((flt->fields & MRTHF_PEERADDR) && !naddreq(peer_addr, &flt->peer_addr))
+        return false;
+
+    return true;
+}
+
+int setmrtreadfiltered(io_rw_t *io, const mrt_hdrfilter_t *flt)
+{
+    int res = setmrtreadfiltered_r(&curmsg, io, flt);
+    if (unlikely(res != MRT_ENOERR))
+        return res;
+
+    if ((curmsg.flags & F_NEEDS_PI) && (curpimsg.flags & F_RD))
+        return setuppitable(&curmsg, &curpimsg);
+
+    return res;
+}
+
+// zero-copy streams, records are matched in place and consumed either way
+static int readfilteredpeek(mrt_msg_t *msg, io_rw_t *io, const mrt_hdrfilter_t *flt)
+{
+    while (true) {
+        size_t n;
+        unsigned char *data = io->peek(io, MRT_HDRSIZ, &n);
+        if (unlikely(n != MRT_HDRSIZ))
+            return (n > 0) ? MRT_EBADHDR : MRT_EIO;
+
+        int flags = decodemrthdr(msg, data);
+        if (unlikely(flags < 0))
+            return -flags;
+
+        n = msg->hdr.len + MRT_HDRSIZ;
+        if (!matchmrthdr(&msg->hdr, flt)) {
+            if (unlikely(io->consume(io, n) != n))
+                return io->error(io) ? MRT_EIO : MRT_EBADHDR;
+
+            continue;
+        }
+
+        size_t avail;
+        data = io->peek(io, n, &avail);
+        if (unlikely(avail != n))
+            return io->error(io) ? MRT_EIO : MRT_EBADHDR;
+
+        io->consume(io, n);
+        msg->buf    = data;
+        msg->bufsiz = n;
+        setupmrtmsg(msg, flags | F_SH);
+        if (mrthdrmatch_r(msg, flt))
+            return MRT_ENOERR;
+    }
+}
+
+int setmrtreadfiltered_r(mrt_msg_t *msg, io_rw_t *io, const mrt_hdrfilter_t *flt)
+{
+    if (io->peek)
+        return readfilteredpeek(msg, io, flt);
+
+    while (true) {
+        // only read the header and the body prefix needed by the filter
+        unsigned char *buf = msg->fastbuf;
+        size_t nr = io->read(io, buf, MRT_HDRSIZ);
+        if (unlikely(nr != MRT_HDRSIZ))
+            return (nr > 0) ? MRT_EBADHDR : MRT_EIO;
+
+        int flags = decodemrthdr(msg, buf);
+        if (unlikely(flags < 0))
+            return -flags;
+
+        size_t len = msg->hdr.len;
+        size_t prefix = 0;
+        if (matchmrthdr(&msg->hdr, flt)) {
+            prefix = min(len, (size_t) MRTHF_PREFIXSIZ);
+            if (unlikely(io->read(io, &buf[MRT_HDRSIZ], prefix) != prefix))
+                return io->error(io) ? MRT_EIO : MRT_EBADHDR;
+
+            // decoders bound check against hdr.len, and never go past prefix
+            msg->buf    = buf;
+            msg->bufsiz = sizeof(msg->fastbuf);
+            setupmrtmsg(msg, flags);
+            if (mrthdrmatch_r(msg, flt))
+                break;
+        }
+
+        if (unlikely(io_skip(io, len - prefix) != len - prefix))
+            return io->error(io) ? MRT_EIO : MRT_EBADHDR;
+    }
+
+    // record accepted, read the rest of it
+    size_t n = msg->hdr.len + MRT_HDRSIZ;
+    size_t have = min(msg->hdr.len, (size_t) MRTHF_PREFIXSIZ) + MRT_HDRSIZ;
+    if (unlikely(n > sizeof(msg->fastbuf))) {
+        if (n > retained.hiwater)
+            retained.hiwater = n;
+
+        msg->buf = mrtgetbuf(n, &msg->bufsiz);
+        if (unlikely(!msg->buf)) {
+            msg->flags = 0;
+            return MRT_ENOMEM;
+        }
+
+        memcpy(msg->buf, msg->fastbuf, have);
+    }
+    if (unlikely(io->read(io, &msg->buf[have], n - have) != n - have)) {
+        if (msg->buf != msg->fastbuf)
+            mrtputbuf(msg->buf, msg->bufsiz);
+
+        msg->flags = 0;
+        return io->error(io) ? MRT_EIO : MRT_EBADHDR;
+    }
+
+    return MRT_ENOERR;
+}
+
 // header section
 
 mrt_header_t *getmrtheader(void)
@@ -434,12 +835,6 @@ int setmrtheaderv(const mrt_header_t *hdr, va_list va)
     return setmrtheaderv_r(&curmsg, hdr, va);
 }
 
-int setmrtheaderv_r(mrt_msg_t *msg, const mrt_header_t *hdr, va_list va)
-{
-    (void)msg, (void)hdr, (void)va;
-    return MRT_ENOERR;  // TODO
-}
-
 int setmrtheader_r(mrt_msg_t *msg, const mrt_header_t *hdr, ...)
 {
     va_list va;
@@ -469,9 +864,12 @@ int mrtclosepi(void)
 
 int mrtclose_r(mrt_msg_t *msg)
 {
+    if (msg->flags & F_WR)
+        mrtflush_r(msg);
+
     int err = mrterror_r(msg);
-    if (unlikely(msg->buf != msg->fastbuf))
-        free(msg->buf);
+    if (unlikely(msg->buf != msg->fastbuf && (msg->flags & F_SH) == 0))
+        mrtputbuf(msg->buf, msg->bufsiz);
     if (msg->flags & F_IS_PI && msg->pitab != msg->fastpitab)
         free(msg->pitab);
 
@@ -639,6 +1037,81 @@ peer_entry_t *nextpeerent_r(mrt_msg_t *msg)
     return &msg->pe;
 }
 
+int newpeerindex(peer_index_t **ppi)
+{
+    return newpeerindex_r(&curmsg, ppi);
+}
+
+int newpeerindex_r(mrt_msg_t *msg, peer_index_t **ppi)
+{
+    if (unlikely(msg->err != MRT_ENOERR))
+        return MRT_EINVOP;
+    if (unlikely((msg->flags & F_IS_PI) == 0))
+        return MRT_NOTPEERIDX;
+
+    const unsigned char *ptr = &msg->buf[MESSAGE_OFFSET];
+    const unsigned char *end = ptr + msg->hdr.len;
+    if (unlikely((size_t) (end - ptr) < sizeof(struct in_addr) + sizeof(uint16_t)))
+        return MRT_EBADPEERIDXHDR;
+
+    struct in_addr collector;
+    memcpy(&collector, ptr, sizeof(collector));
+    ptr += sizeof(collector);
+
+    uint16_t namelen, count;
+    memcpy(&namelen, ptr, sizeof(namelen));
+    namelen = frombig16(namelen);
+    ptr += sizeof(namelen);
+    if (unlikely((size_t) (end - ptr) < namelen + sizeof(count)))
+        return MRT_EBADPEERIDXHDR;
+
+    const unsigned char *name = ptr;
+    ptr += namelen;
+
+    memcpy(&count, ptr, sizeof(count));
+    count = frombig16(count);
+    ptr += sizeof(count);
+
+    // peers and view name share a single allocation
+    peer_index_t *pi = malloc(sizeof(*pi) + count * sizeof(*pi->peers) + namelen + 1);
+    if (unlikely(!pi))
+        return MRT_ENOMEM;
+
+    char *viewname = (char *) &pi->peers[count];
+    memcpy(viewname, name, namelen);
+    viewname[namelen] = '\0';
+
+    pi->collector = collector;
+    pi->viewname  = viewname;
+    pi->npeers    = count;
+    for (size_t i = 0; i < count; i++) {
+        if (unlikely(ptr == end))
+            goto bad;
+
+        int flags = *ptr;
+
+        size_t siz = 1 + sizeof(struct in_addr);
+        siz += (flags & PT_IPV6) ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+        siz += (flags & PT_AS32) ? sizeof(uint32_t) : sizeof(uint16_t);
+        if (unlikely((size_t) (end - ptr) < siz))
+            goto bad;
+
+        ptr = decodepeerent(&pi->peers[i], ptr);
+    }
+
+    *ppi = pi;
+    return MRT_ENOERR;
+
+bad:
+    free(pi);
+    return MRT_EBADPEERIDX;
+}
+
+void freepeerindex(peer_index_t *pi)
+{
+    free(pi);
+}
+
 int endpeerents(void)
 {
     return endpeerents_r(&curmsg);
@@ -681,6 +1154,35 @@ int setribpi_r(mrt_msg_t *msg, mrt_msg_t *pi)
     return setuppitable(msg, pi);
 }
 
+int setribpeerindex(const peer_index_t *pi)
+{
+    return setribpeerindex_r(&curmsg, pi);
+}
+
+int setribpeerindex_r(mrt_msg_t *msg, const peer_index_t *pi)
+{
+    if (unlikely(msg->err != MRT_ENOERR))
+        return MRT_EINVOP;
+    if (unlikely((msg->flags & F_NEEDS_PI) == 0))
+        return MRT_EINVOP;
+
+    msg->pidx = pi;
+    return MRT_ENOERR;
+}
+
+int setribattrstore_r(mrt_msg_t *msg, attrstore_t *st)
+{
+    if (unlikely(msg->err != MRT_ENOERR))
+        return MRT_EINVOP;
+    if (unlikely((msg->flags & F_RD) == 0))
+        return MRT_EINVOP;
+    if (unlikely(msg->hdr.type != MRT_TABLE_DUMPV2 && msg->hdr.type != MRT_TABLE_DUMP))
+        return MRT_EINVOP;
+
+    msg->attrstore = st;
+    return MRT_ENOERR;
+}
+
 void *getribents(size_t *pcount, size_t *pn)
 {
     return getribents_r(&curmsg, pcount, pn);
@@ -964,8 +1466,6 @@ static rib_entry_t *nextribent_legacy(mrt_msg_t *msg)
 
 static rib_entry_t *nextribent_v2(mrt_msg_t *msg)
 {
-    mrt_msg_t *pi = msg->peer_index;
-
     unsigned char *end = msg->buf + MESSAGE_OFFSET + msg->hdr.len;
     if (msg->reptr == end)
         return NULL;
@@ -977,7 +1477,9 @@ static rib_entry_t *nextribent_v2(mrt_msg_t *msg)
 
     memcpy(&idx, msg->reptr, sizeof(idx));
     idx = frombig16(idx);
-    if (idx >= pi->picount) {
+
+    size_t npeers = (msg->pidx) ? msg->pidx->npeers : msg->peer_index->picount;
+    if (idx >= npeers) {
         msg->err = MRT_EBADPEERIDX;
         return NULL;
     }
@@ -1016,8 +1518,16 @@ static rib_entry_t *nextribent_v2(mrt_msg_t *msg)
 
     msg->reptr += attr_len;
 
+    if (msg->pidx) {
+        // already decoded, reference it directly
+        msg->ribent.peer = &msg->pidx->peers[idx];
+        return &msg->ribent;
+    }
+
     // decode peer entry
-    unsigned char *peer_ent = &pi->buf[msg->peer_index->pitab[idx] + MESSAGE_OFFSET];
+    mrt_msg_t *pi = msg->peer_index;
+
+    unsigned char *peer_ent = &pi->buf[pi->pitab[idx] + MESSAGE_OFFSET];
     decodepeerent(&msg->ribpe, peer_ent);
     msg->ribent.peer = &msg->ribpe;
     return &msg->ribent;
@@ -1027,10 +1537,137 @@ rib_entry_t *nextribent_r(mrt_msg_t *msg)
 {
     CHECKFLAGSR(F_RE, NULL);
 
+    rib_entry_t *rib;
     if (msg->hdr.type == MRT_TABLE_DUMPV2)
-        return nextribent_v2(msg);
+        rib = nextribent_v2(msg);
     else
-        return nextribent_legacy(msg);
+        rib = nextribent_legacy(msg);
+
+    if (!rib || !msg->attrstore) {
+        if (rib)
+            rib->attrref = NULL;
+
+        return rib;
+    }
+
+    const attrref_t *ref = attrstore_intern(msg->attrstore, rib->peer_idx, rib->attrs, rib->attr_length);
+    if (unlikely(!ref)) {
+        msg->err = MRT_ENOMEM;
+        return NULL;
+    }
+
+    rib->attrref = ref;
+    rib->attrs   = (bgpattr_t *) ref->attrs;
+    return rib;
+}
+
+static bool putribrow(mrt_msg_t *msg, ribcols_t *cols, attrstore_t *st, const netaddr_t *pfx,
+                      uint16_t idx, time_t originated, uint32_t pathid,
+                      const unsigned char *attrs, size_t attr_len, size_t as_size)
+{
+    size_t i = cols->len;
+    if (cols->attrs) {
+        const attrref_t *ref = NULL;
+        if (st) {
+            ref = attrstore_intern(st, idx, attrs, attr_len);
+            if (unlikely(!ref)) {
+                msg->err = MRT_ENOMEM;
+                return false;
+            }
+        }
+
+        cols->attrs[i] = ref;
+    }
+
+    if (cols->stamp)
+        cols->stamp[i] = originated;
+    if (cols->peer_idx)
+        cols->peer_idx[i] = idx;
+    if (cols->pfx)
+        cols->pfx[i] = *pfx;
+    if (cols->pathid)
+        cols->pathid[i] = pathid;
+    if (cols->origin_as)
+        cols->origin_as[i] = getoriginas(attrs, attr_len, as_size);
+
+    cols->len++;
+    return true;
+}
+
+size_t nextribcols_r(mrt_msg_t *msg, ribcols_t *cols)
+{
+    CHECKFLAGSR(F_RE, 0);
+
+    size_t start = cols->len;
+    if (msg->hdr.type != MRT_TABLE_DUMPV2) {
+        // TABLE_DUMP records hold a single entry, with 16-bits ASes
+        attrstore_t *st = msg->attrstore;
+        msg->attrstore  = NULL;  // interned by putribrow() instead
+
+        rib_entry_t *rib;
+        while (cols->len < cols->cap && (rib = nextribent_r(msg)) != NULL) {
+            if (!putribrow(msg, cols, st, &rib->nlri, rib->peer_idx, rib->originated, rib->pathid,
+                           (const unsigned char *) rib->attrs, rib->attr_length, sizeof(uint16_t)))
+                break;
+        }
+
+        msg->attrstore = st;
+        return cols->len - start;
+    }
+
+    const unsigned char *end = msg->buf + MESSAGE_OFFSET + msg->hdr.len;
+
+    size_t npeers  = (msg->pidx) ? msg->pidx->npeers : msg->peer_index->picount;
+    size_t hdrsize = sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint16_t);
+    if (msg->flags & F_ADDPATH)
+        hdrsize += sizeof(uint32_t);
+
+    // same as nextribent_v2(), without peer entry decoding
+    while (cols->len < cols->cap && msg->reptr != end) {
+        const unsigned char *ptr = msg->reptr;
+        if (unlikely((size_t) (end - ptr) < hdrsize)) {
+            msg->err = MRT_EBADRIBENT;
+            break;
+        }
+
+        uint16_t idx;
+        memcpy(&idx, ptr, sizeof(idx));
+        idx = frombig16(idx);
+        ptr += sizeof(idx);
+        if (unlikely(idx >= npeers)) {
+            msg->err = MRT_EBADPEERIDX;
+            break;
+        }
+
+        uint32_t originated;
+        memcpy(&originated, ptr, sizeof(originated));
+        originated = frombig32(originated);
+        ptr += sizeof(originated);
+
+        uint32_t pathid = 0;
+        if (msg->flags & F_ADDPATH) {
+            memcpy(&pathid, ptr, sizeof(pathid));
+            pathid = frombig32(pathid);
+            ptr += sizeof(pathid);
+        }
+
+        uint16_t attr_len;
+        memcpy(&attr_len, ptr, sizeof(attr_len));
+        attr_len = frombig16(attr_len);
+        ptr += sizeof(attr_len);
+        if (unlikely((size_t) (end - ptr) < attr_len)) {
+            msg->err = MRT_EBADRIBENT;
+            break;
+        }
+
+        if (!putribrow(msg, cols, msg->attrstore, &msg->ribhdr.nlri, idx, originated, pathid,
+                       ptr, attr_len, sizeof(uint32_t)))
+            break;
+
+        msg->reptr = (unsigned char *) ptr + attr_len;
+    }
+
+    return cols->len - start;
 }
 
 int endribents(void)
@@ -1175,6 +1812,506 @@ void *unwrapbgp4mp_r(mrt_msg_t *msg, size_t *pn)
     return ptr;
 }
 
+// BGP4MP write section
+
+enum {
+    // largest BGP4MP header: 32 bits ASes, IPv6 addresses and state change
+    BGP4MP_MAXHDRSIZ = 2 * sizeof(uint32_t) + 2 * sizeof(uint16_t) + 2 * sizeof(struct in6_addr) + 2 * sizeof(uint16_t)
+};
+
+static size_t encodemrthdr(unsigned char *buf, const mrt_header_t *hdr, int flags, size_t len)
+{
+    uint32_t stamp = tobig32(hdr->stamp.tv_sec);
+    uint16_t type = tobig16(hdr->type);
+    uint16_t subtype = tobig16(hdr->subtype);
+
+    size_t hdrsiz = MRT_HDRSIZ;
+    if (flags & F_IS_EXT) {
+        uint32_t usec = tobig32(hdr->stamp.tv_nsec / 1000);
+        memcpy(&buf[MICROSECOND_TIMESTAMP_OFFSET], &usec, sizeof(usec));
+
+        // length field includes microsecond timestamp
+        hdrsiz = EXTENDED_MRT_HDRSIZ;
+        len += sizeof(usec);
+    }
+
+    uint32_t len32 = tobig32(len);
+    memcpy(&buf[TIMESTAMP_OFFSET], &stamp, sizeof(stamp));
+    memcpy(&buf[TYPE_OFFSET], &type, sizeof(type));
+    memcpy(&buf[SUBTYPE_OFFSET], &subtype, sizeof(subtype));
+    memcpy(&buf[LENGTH_OFFSET], &len32, sizeof(len32));
+    return hdrsiz;
+}
+
+static size_t encodebgp4mphdr(unsigned char *buf, const bgp4mp_header_t *hdr, int flags)
+{
+    unsigned char *ptr = buf;
+    if (flags & F_AS32) {
+        uint32_t as = tobig32(hdr->peer_as);
+        memcpy(ptr, &as, sizeof(as));
+        ptr += sizeof(as);
+        as = tobig32(hdr->local_as);
+        memcpy(ptr, &as, sizeof(as));
+        ptr += sizeof(as);
+    } else {
+        uint16_t as = tobig16(hdr->peer_as);
+        memcpy(ptr, &as, sizeof(as));
+        ptr += sizeof(as);
+        as = tobig16(hdr->local_as);
+        memcpy(ptr, &as, sizeof(as));
+        ptr += sizeof(as);
+    }
+
+    uint16_t iface = tobig16(hdr->iface);
+    memcpy(ptr, &iface, sizeof(iface));
+    ptr += sizeof(iface);
+
+    uint16_t afi;
+    switch (hdr->peer_addr.family) {
+    case AF_INET:
+        afi = tobig16(AFI_IPV4);
+        memcpy(ptr, &afi, sizeof(afi));
+        ptr += sizeof(afi);
+        memcpy(ptr, &hdr->peer_addr.sin, sizeof(hdr->peer_addr.sin));
+        ptr += sizeof(hdr->peer_addr.sin);
+        memcpy(ptr, &hdr->local_addr.sin, sizeof(hdr->local_addr.sin));
+        ptr += sizeof(hdr->local_addr.sin);
+        break;
+    case AF_INET6:
+        afi = tobig16(AFI_IPV6);
+        memcpy(ptr, &afi, sizeof(afi));
+        ptr += sizeof(afi);
+        memcpy(ptr, &hdr->peer_addr.sin6, sizeof(hdr->peer_addr.sin6));
+        ptr += sizeof(hdr->peer_addr.sin6);
+        memcpy(ptr, &hdr->local_addr.sin6, sizeof(hdr->local_addr.sin6));
+        ptr += sizeof(hdr->local_addr.sin6);
+        break;
+    default:
+        return 0;
+    }
+
+    if (flags & F_HAS_STATE) {
+        uint16_t state = tobig16(hdr->old_state);
+        memcpy(ptr, &state, sizeof(state));
+        ptr += sizeof(state);
+        state = tobig16(hdr->new_state);
+        memcpy(ptr, &state, sizeof(state));
+        ptr += sizeof(state);
+    }
+
+    return ptr - buf;
+}
+
+int mrtwritebgp4mp(io_rw_t *io, const mrt_header_t *hdr, const bgp4mp_header_t *bgp4mp, const void *data, size_t n)
+{
+    if (unlikely(hdr->type != MRT_BGP4MP && hdr->type != MRT_BGP4MP_ET))
+        return MRT_EINVOP;
+    if (unlikely(hdr->subtype < 0 || (size_t) hdr->subtype >= nelems(masktab[0])))
+        return MRT_EBADHDR;
+
+    int flags = mrtflags(hdr);
+    if (unlikely((flags & F_VALID) == 0))
+        return MRT_EBADHDR;
+    if ((flags & F_WRAPS_BGP) == 0)
+        n = 0;  // state changes carry no BGP data
+
+    unsigned char mrthdr[EXTENDED_MRT_HDRSIZ];
+    unsigned char bgp4mphdr[BGP4MP_MAXHDRSIZ];
+
+    size_t bgp4mpsiz = encodebgp4mphdr(bgp4mphdr, bgp4mp, flags);
+    if (unlikely(bgp4mpsiz == 0))
+        return MRT_EAFINOTSUP;
+
+    size_t len = bgp4mpsiz + n;
+    if (unlikely(len > UINT32_MAX - sizeof(uint32_t)))
+        return MRT_EINVOP;
+
+    size_t mrtsiz = encodemrthdr(mrthdr, hdr, flags, len);
+
+    // header, BGP4MP header and BGP data are handed over without copying them
+    struct iovec iov[] = {
+        { .iov_base = mrthdr,         .iov_len = mrtsiz    },
+        { .iov_base = bgp4mphdr,      .iov_len = bgp4mpsiz },
+        { .iov_base = (void *) data,  .iov_len = n         }
+    };
+
+    if (unlikely(io_writev(io, iov, (n > 0) ? 3 : 2) != mrtsiz + len))
+        return MRT_EIO;
+
+    return MRT_ENOERR;
+}
+
+// write section
+
+int setmrtwrite(io_rw_t *io)
+{
+    return setmrtwrite_r(&curmsg, io);
+}
+
+int setmrtwrite_r(mrt_msg_t *msg, io_rw_t *io)
+{
+    msg->flags  = F_WR;
+    msg->err    = MRT_ENOERR;
+    msg->buf    = msg->fastbuf;
+    msg->bufsiz = sizeof(msg->fastbuf);
+    if (io) {
+        // batch many records per write, fast buffer is used if this fails
+        unsigned char *buf = mrtgetbuf(MRTWRBUFSIZ, &msg->bufsiz);
+        if (likely(buf))
+            msg->buf = buf;
+        else
+            msg->bufsiz = sizeof(msg->fastbuf);
+    }
+
+    msg->peer_index = NULL;
+    msg->pidx       = NULL;
+    msg->attrstore  = NULL;
+    msg->pitab      = NULL;
+    msg->wrio       = io;
+    msg->recoff     = 0;
+    msg->wrlen      = 0;
+    msg->cntoff     = 0;
+    msg->wrcount    = 0;
+    msg->wrhdrsiz   = 0;
+    return MRT_ENOERR;
+}
+
+// write completed records to io, moving any partial record to buffer start
+static int mrtwrflush(mrt_msg_t *msg)
+{
+    if (msg->recoff == 0)
+        return MRT_ENOERR;
+
+    if (unlikely(msg->wrio->write(msg->wrio, msg->buf, msg->recoff) != msg->recoff))
+        return MRT_EIO;
+
+    uint32_t partial = msg->wrlen - msg->recoff;
+
+    memmove(msg->buf, &msg->buf[msg->recoff], partial);
+    if (msg->cntoff != 0)
+        msg->cntoff -= msg->recoff;
+
+    msg->wrlen  = partial;
+    msg->recoff = 0;
+    return MRT_ENOERR;
+}
+
+// ensure n more bytes fit inside buffer, returns pointer to them, NULL on error
+static unsigned char *mrtwrensure(mrt_msg_t *msg, size_t n)
+{
+    if (likely(n <= msg->bufsiz - msg->wrlen))
+        return &msg->buf[msg->wrlen];
+
+    if (msg->wrio) {
+        int err = mrtwrflush(msg);
+        if (unlikely(err != MRT_ENOERR)) {
+            msg->err = err;
+            return NULL;
+        }
+        if (n <= msg->bufsiz - msg->wrlen)
+            return &msg->buf[msg->wrlen];
+    }
+
+    size_t len = (size_t) msg->wrlen + n;
+    if (unlikely(len > UINT32_MAX)) {
+        msg->err = MRT_EINVOP;
+        return NULL;
+    }
+
+    uint32_t cap;
+    unsigned char *buf = mrtgetbuf(max(len, 2 * (size_t) msg->bufsiz), &cap);
+    if (unlikely(!buf)) {
+        msg->err = MRT_ENOMEM;
+        return NULL;
+    }
+
+    memcpy(buf, msg->buf, msg->wrlen);
+    if (msg->buf != msg->fastbuf)
+        mrtputbuf(msg->buf, msg->bufsiz);
+
+    msg->buf    = buf;
+    msg->bufsiz = cap;
+    return &msg->buf[msg->wrlen];
+}
+
+static int mrtwrappend(mrt_msg_t *msg, const void *data, size_t n)
+{
+    unsigned char *ptr = mrtwrensure(msg, n);
+    if (unlikely(!ptr))
+        return msg->err;
+
+    memcpy(ptr, data, n);
+    msg->wrlen += n;
+    return MRT_ENOERR;
+}
+
+// complete record being written, if any
+static int mrtwrend(mrt_msg_t *msg)
+{
+    if ((msg->flags & F_WRREC) == 0)
+        return MRT_ENOERR;
+
+    size_t len = msg->wrlen - msg->recoff - msg->wrhdrsiz;
+    if (unlikely((msg->flags & F_IS_EXT) && len > UINT32_MAX - sizeof(uint32_t))) {
+        msg->err = MRT_EINVOP;
+        return msg->err;
+    }
+
+    encodemrthdr(&msg->buf[msg->recoff], &msg->hdr, msg->flags, len);
+    if (msg->cntoff != 0) {
+        uint16_t count = tobig16(msg->wrcount);
+        memcpy(&msg->buf[msg->cntoff], &count, sizeof(count));
+    }
+
+    msg->hdr.len = len;
+    msg->flags  &= ~F_WRREC;
+    msg->recoff  = msg->wrlen;
+    msg->cntoff  = 0;
+    return MRT_ENOERR;
+}
+
+int setmrtheaderv_r(mrt_msg_t *msg, const mrt_header_t *hdr, va_list va)
+{
+    CHECKFLAGS(F_WR);
+
+    if (unlikely(mrtwrend(msg) != MRT_ENOERR))
+        return msg->err;
+
+    if (unlikely(hdr->type < MRT_BGP || hdr->type > MRT_BGP4MP_ET))
+        return MRT_ETYPENOTSUP;
+    if (unlikely(hdr->subtype < 0 || (size_t) hdr->subtype >= nelems(masktab[0])))
+        return MRT_EBADHDR;
+
+    int flags = mrtflags(hdr);
+    if (unlikely((flags & F_VALID) == 0))
+        return MRT_EBADHDR;
+
+    size_t hdrsiz = (flags & F_IS_EXT) ? EXTENDED_MRT_HDRSIZ : MRT_HDRSIZ;
+
+    // header is encoded on completion, reserve room for it, along with the largest fixed part
+    unsigned char *ptr = mrtwrensure(msg, hdrsiz + BGP4MP_MAXHDRSIZ);
+    if (unlikely(!ptr))
+        return msg->err;
+
+    ptr += hdrsiz;
+
+    uint32_t cntoff = 0;
+    if (flags & F_IS_BGP) {
+        const bgp4mp_header_t *bgp4mp = va_arg(va, const bgp4mp_header_t *);
+
+        size_t n = encodebgp4mphdr(ptr, bgp4mp, flags);
+        if (unlikely(n == 0))
+            return MRT_EAFINOTSUP;
+
+        ptr += n;
+    } else if (flags & F_IS_PI) {
+        struct in_addr collector = va_arg(va, struct in_addr);
+        const char *viewname     = va_arg(va, const char *);
+
+        size_t namelen = viewname ? strlen(viewname) : 0;
+        if (unlikely(namelen > UINT16_MAX))
+            return MRT_EINVOP;
+
+        // view name may be arbitrarily long
+        ptr = mrtwrensure(msg, hdrsiz + sizeof(collector) + sizeof(uint16_t) + namelen + sizeof(uint16_t));
+        if (unlikely(!ptr))
+            return msg->err;
+
+        ptr += hdrsiz;
+
+        uint16_t len = tobig16(namelen);
+        memcpy(ptr, &collector, sizeof(collector));
+        ptr += sizeof(collector);
+        memcpy(ptr, &len, sizeof(len));
+        ptr += sizeof(len);
+        memcpy(ptr, viewname, namelen);
+        ptr += namelen;
+
+        cntoff = ptr - msg->buf;
+        ptr   += sizeof(uint16_t);
+    } else if ((flags & F_NEEDS_PI) && hdr->type == MRT_TABLE_DUMPV2 &&
+               hdr->subtype != MRT_TABLE_DUMPV2_RIB_GENERIC && hdr->subtype != MRT_TABLE_DUMPV2_RIB_GENERIC_ADDPATH) {
+
+        uint32_t seqno         = va_arg(va, uint32_t);
+        const netaddr_t *nlri  = va_arg(va, const netaddr_t *);
+
+        bool ipv4 = hdr->subtype == MRT_TABLE_DUMPV2_RIB_IPV4_UNICAST ||
+                    hdr->subtype == MRT_TABLE_DUMPV2_RIB_IPV4_MULTICAST ||
+                    hdr->subtype == MRT_TABLE_DUMPV2_RIB_IPV4_UNICAST_ADDPATH ||
+                    hdr->subtype == MRT_TABLE_DUMPV2_RIB_IPV4_MULTICAST_ADDPATH;
+        if (unlikely(nlri->bitlen > (ipv4 ? 32 : 128)))
+            return MRT_EINVOP;
+
+        seqno = tobig32(seqno);
+        memcpy(ptr, &seqno, sizeof(seqno));
+        ptr += sizeof(seqno);
+
+        size_t n = naddrsize(nlri->bitlen);
+        *ptr++ = nlri->bitlen;
+        memcpy(ptr, nlri->bytes, n);
+        ptr += n;
+
+        cntoff = ptr - msg->buf;
+        ptr   += sizeof(uint16_t);
+    } else {
+        return MRT_ETYPENOTSUP;
+    }
+
+    msg->flags    = F_WR | F_WRREC | flags;
+    msg->hdr      = *hdr;
+    msg->recoff   = msg->wrlen;
+    msg->wrlen    = ptr - msg->buf;
+    msg->cntoff   = cntoff;
+    msg->wrcount  = 0;
+    msg->wrhdrsiz = hdrsiz;
+    return MRT_ENOERR;
+}
+
+int wrapbgp4mp(const void *data, size_t n)
+{
+    return wrapbgp4mp_r(&curmsg, data, n);
+}
+
+int wrapbgp4mp_r(mrt_msg_t *msg, const void *data, size_t n)
+{
+    CHECKFLAGS(F_WR | F_WRREC | F_IS_BGP | F_WRAPS_BGP);
+
+    return mrtwrappend(msg, data, n);
+}
+
+int putpeerent(const peer_entry_t *pe)
+{
+    return putpeerent_r(&curmsg, pe);
+}
+
+int putpeerent_r(mrt_msg_t *msg, const peer_entry_t *pe)
+{
+    CHECKFLAGS(F_WR | F_WRREC | F_IS_PI);
+
+    if (unlikely(msg->wrcount == UINT16_MAX))
+        return MRT_EINVOP;
+
+    // largest peer entry: type, BGP ID, IPv6 address, 32 bits AS
+    unsigned char *ptr = mrtwrensure(msg, 1 + sizeof(pe->id) + sizeof(struct in6_addr) + sizeof(uint32_t));
+    if (unlikely(!ptr))
+        return msg->err;
+
+    unsigned char *start = ptr;
+
+    int type = 0;
+    if (pe->addr.family == AF_INET6)
+        type |= PT_IPV6;
+    if (pe->as_size == sizeof(uint32_t) || pe->as > UINT16_MAX)
+        type |= PT_AS32;
+
+    *ptr++ = type;
+    memcpy(ptr, &pe->id, sizeof(pe->id));
+    ptr += sizeof(pe->id);
+    if (type & PT_IPV6) {
+        memcpy(ptr, &pe->addr.sin6, sizeof(pe->addr.sin6));
+        ptr += sizeof(pe->addr.sin6);
+    } else {
+        memcpy(ptr, &pe->addr.sin, sizeof(pe->addr.sin));
+        ptr += sizeof(pe->addr.sin);
+    }
+    if (type & PT_AS32) {
+        uint32_t as = tobig32(pe->as);
+        memcpy(ptr, &as, sizeof(as));
+        ptr += sizeof(as);
+    } else {
+        uint16_t as = tobig16(pe->as);
+        memcpy(ptr, &as, sizeof(as));
+        ptr += sizeof(as);
+    }
+
+    msg->wrlen += ptr - start;
+    msg->wrcount++;
+    return MRT_ENOERR;
+}
+
+int putribent(const rib_entry_t *pe, uint16_t idx, time_t seconds, const bgpattr_t *attrs, size_t attrs_size)
+{
+    return putribent_r(&curmsg, pe, idx, seconds, attrs, attrs_size);
+}
+
+int putribent_r(mrt_msg_t *msg, const rib_entry_t *pe, uint16_t idx, time_t seconds, const bgpattr_t *attrs, size_t attrs_size)
+{
+    CHECKFLAGS(F_WR | F_WRREC | F_NEEDS_PI);
+
+    if (unlikely(msg->wrcount == UINT16_MAX || attrs_size > UINT16_MAX))
+        return MRT_EINVOP;
+
+    size_t n = sizeof(idx) + sizeof(uint32_t) + sizeof(uint16_t) + attrs_size;
+    if (msg->flags & F_ADDPATH)
+        n += sizeof(uint32_t);
+
+    unsigned char *ptr = mrtwrensure(msg, n);
+    if (unlikely(!ptr))
+        return msg->err;
+
+    idx = tobig16(idx);
+    memcpy(ptr, &idx, sizeof(idx));
+    ptr += sizeof(idx);
+
+    uint32_t originated = tobig32(seconds);
+    memcpy(ptr, &originated, sizeof(originated));
+    ptr += sizeof(originated);
+
+    if (msg->flags & F_ADDPATH) {
+        uint32_t pathid = tobig32(pe ? pe->pathid : 0);
+        memcpy(ptr, &pathid, sizeof(pathid));
+        ptr += sizeof(pathid);
+    }
+
+    uint16_t len = tobig16(attrs_size);
+    memcpy(ptr, &len, sizeof(len));
+    ptr += sizeof(len);
+    memcpy(ptr, attrs, attrs_size);
+
+    msg->wrlen += n;
+    msg->wrcount++;
+    return MRT_ENOERR;
+}
+
+int mrtflush(void)
+{
+    return mrtflush_r(&curmsg);
+}
+
+int mrtflush_r(mrt_msg_t *msg)
+{
+    CHECKFLAGS(F_WR);
+
+    if (unlikely(mrtwrend(msg) != MRT_ENOERR))
+        return msg->err;
+    if (!msg->wrio)
+        return MRT_ENOERR;
+
+    int err = mrtwrflush(msg);
+    if (unlikely(err != MRT_ENOERR))
+        msg->err = err;
+
+    return err;
+}
+
+void *mrtfinish(size_t *pn)
+{
+    return mrtfinish_r(&curmsg, pn);
+}
+
+void *mrtfinish_r(mrt_msg_t *msg, size_t *pn)
+{
+    CHECKFLAGSR(F_WR, NULL);
+
+    if (unlikely(mrtwrend(msg) != MRT_ENOERR))
+        return NULL;
+
+    if (likely(pn))
+        *pn = msg->wrlen;
+
+    return msg->buf;
+}
+
 zebra_header_t *getzebraheader(void)
 {
     return getzebraheader_r(&curmsg);
@@ -0,0 +1,761 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <errno.h>
+#include <isolario/branch.h>
+#include <isolario/endian.h>
+#include <isolario/mrt.h>
+#include <isolario/mrtindex.h>
+#include <isolario/util.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+enum {
+    MRTZ_DEFSPAN  = 1024 * 1024,
+    MRTZ_CHUNKSIZ = 64 * 1024,
+    MRTZ_HDRSIZ   = 12,  // MRT header size
+    MRTZ_GROWSTEP = 64
+};
+
+static const unsigned char mrtz_magic[8] = { 'I', 'S', 'O', 'Z', 'I', 'D', 'X', '1' };
+
+// MRT record boundary tracking over uncompressed data
+typedef struct {
+    uint64_t pos;       // offset of next byte to be fed
+    uint64_t recstart;  // current record offset
+    uint64_t recend;    // next record offset, valid once header is complete
+    size_t hdrlen;      // current record header bytes collected so far
+    unsigned char hdr[MRTZ_HDRSIZ];
+} mrtztracker_t;
+
+static void resolvepoints(mrtzindex_t *idx, size_t *pending, uint64_t recstart, time_t stamp)
+{
+    while (*pending < idx->npoints && idx->points[*pending].out <= recstart) {
+        mrtzpoint_t *pt = &idx->points[*pending];
+
+        pt->recoff = recstart;
+        pt->stamp  = stamp;
+        ++*pending;
+    }
+}
+
+static void feedtracker(mrtztracker_t *tr, mrtzindex_t *idx, size_t *pending, const unsigned char *data, size_t n)
+{
+    while (n > 0) {
+        if (tr->hdrlen < MRTZ_HDRSIZ) {
+            size_t nc = min(n, MRTZ_HDRSIZ - tr->hdrlen);
+            memcpy(&tr->hdr[tr->hdrlen], data, nc);
+            tr->hdrlen += nc;
+            tr->pos    += nc;
+            data       += nc;
+            n          -= nc;
+            if (tr->hdrlen < MRTZ_HDRSIZ)
+                break;
+
+            uint32_t stamp, len;
+            memcpy(&stamp, &tr->hdr[0], sizeof(stamp));
+            memcpy(&len, &tr->hdr[8], sizeof(len));
+
+            tr->recend = tr->recstart + MRTZ_HDRSIZ + frombig32(len);
+            resolvepoints(idx, pending, tr->recstart, frombig32(stamp));
+        }
+
+        size_t nc = min(n, tr->recend - tr->pos);
+        tr->pos += nc;
+        data    += nc;
+        n       -= nc;
+        if (tr->pos == tr->recend) {
+            tr->recstart = tr->pos;
+            tr->hdrlen   = 0;
+        }
+    }
+}
+
+static int addpoint(mrtzindex_t *idx, size_t *cap, const z_stream *str, uint64_t in, uint64_t out, const unsigned char *window)
+{
+    if (idx->npoints == *cap) {
+        size_t newcap = *cap + MRTZ_GROWSTEP;
+        mrtzpoint_t *points = realloc(idx->points, newcap * sizeof(*points));
+        if (unlikely(!points))
+            return MRT_ENOMEM;
+
+        idx->points = points;
+        *cap = newcap;
+    }
+
+    mrtzpoint_t *pt = &idx->points[idx->npoints];
+    pt->window = malloc(MRTZ_WINSIZ);
+    if (unlikely(!pt->window))
+        return MRT_ENOMEM;
+
+    pt->in     = in;
+    pt->out    = out;
+    pt->recoff = UINT64_MAX;  // resolved once the following record header is decoded
+    pt->stamp  = 0;
+    pt->bits   = str->data_type & 7;
+
+    // window is circular, copy it linearized
+    size_t left = str->avail_out;
+    memcpy(pt->window, window + MRTZ_WINSIZ - left, left);
+    memcpy(pt->window + left, window, MRTZ_WINSIZ - left);
+
+    idx->npoints++;
+    return MRT_ENOERR;
+}
+
+int mrtzbuildindex(mrtzindex_t *idx, int fd, uint64_t span)
+{
+    if (span == 0)
+        span = MRTZ_DEFSPAN;
+
+    idx->span    = span;
+    idx->npoints = 0;
+    idx->points  = NULL;
+
+    unsigned char *input  = malloc(MRTZ_CHUNKSIZ);
+    unsigned char *window = calloc(1, MRTZ_WINSIZ);  // zeroed, it's copied even if partially filled
+    if (unlikely(!input || !window)) {
+        free(input);
+        free(window);
+        return MRT_ENOMEM;
+    }
+
+    z_stream str;
+    memset(&str, 0, sizeof(str));
+
+    int res = MRT_ENOERR;
+    if (inflateInit2(&str, 32 + 15) != Z_OK) {  // automatic zlib or gzip header detection
+        res = MRT_ENOMEM;
+        goto done;
+    }
+
+    mrtztracker_t tr;
+    memset(&tr, 0, sizeof(tr));
+
+    size_t cap     = 0;
+    size_t pending = 0;
+    uint64_t totin  = 0;
+    uint64_t totout = 0;
+    uint64_t last   = 0;
+
+    int err = Z_OK;
+    do {
+        ssize_t nr = read(fd, input, MRTZ_CHUNKSIZ);
+        if (nr <= 0) {
+            res = MRT_EIO;  // either a read error or truncated stream
+            break;
+        }
+
+        str.next_in  = input;
+        str.avail_in = nr;
+        do {
+            if (str.avail_out == 0) {
+                str.next_out  = window;
+                str.avail_out = MRTZ_WINSIZ;
+            }
+
+            unsigned char *out = str.next_out;
+
+            totin  += str.avail_in;
+            totout += str.avail_out;
+            err = inflate(&str, Z_BLOCK);  // stop at deflate block boundaries
+            totin  -= str.avail_in;
+            totout -= str.avail_out;
+
+            if (unlikely(err == Z_NEED_DICT || err == Z_DATA_ERROR || err == Z_MEM_ERROR)) {
+                res = (err == Z_MEM_ERROR) ? MRT_ENOMEM : MRT_EIO;
+                break;
+            }
+
+            feedtracker(&tr, idx, &pending, out, str.next_out - out);
+            if (err == Z_STREAM_END)
+                break;
+
+            // checkpoint at the end of any block but the last one
+            if ((str.data_type & 128) && !(str.data_type & 64) &&
+                (totout == 0 || totout - last > span)) {
+                res = addpoint(idx, &cap, &str, totin, totout, window);
+                if (unlikely(res != MRT_ENOERR))
+                    break;
+
+                last = totout;
+            }
+        } while (str.avail_in != 0);
+    } while (res == MRT_ENOERR && err != Z_STREAM_END);
+
+    inflateEnd(&str);
+
+    // drop trailing checkpoints not followed by any record
+    while (idx->npoints > pending)
+        free(idx->points[--idx->npoints].window);
+
+done:
+    free(input);
+    free(window);
+    if (res != MRT_ENOERR)
+        mrtzfreeindex(idx);
+
+    return res;
+}
+
+static void putbe64(unsigned char *dst, uint64_t v)
+{
+    v = tobig64(v);
+    memcpy(dst, &v, sizeof(v));
+}
+
+static uint64_t getbe64(const unsigned char *src)
+{
+    uint64_t v;
+    memcpy(&v, src, sizeof(v));
+    return frombig64(v);
+}
+
+enum {
+    MRTZ_FILEHDRSIZ  = sizeof(mrtz_magic) + 2 * sizeof(uint64_t),
+    MRTZ_FILEPOINTSIZ = 4 * sizeof(uint64_t) + 1
+};
+
+int mrtzsaveindex(const mrtzindex_t *idx, io_rw_t *io)
+{
+    unsigned char buf[MRTZ_FILEHDRSIZ];
+
+    memcpy(buf, mrtz_magic, sizeof(mrtz_magic));
+    putbe64(&buf[sizeof(mrtz_magic)], idx->span);
+    putbe64(&buf[sizeof(mrtz_magic) + sizeof(uint64_t)], idx->npoints);
+    if (io->write(io, buf, sizeof(buf)) != sizeof(buf))
+        return MRT_EIO;
+
+    for (size_t i = 0; i < idx->npoints; i++) {
+        const mrtzpoint_t *pt = &idx->points[i];
+        unsigned char rec[MRTZ_FILEPOINTSIZ];
+
+        putbe64(&rec[0], pt->in);
+        putbe64(&rec[8], pt->out);
+        putbe64(&rec[16], pt->recoff);
+        putbe64(&rec[24], (int64_t) pt->stamp);
+        rec[32] = pt->bits;
+        if (io->write(io, rec, sizeof(rec)) != sizeof(rec))
+            return MRT_EIO;
+        if (io->write(io, pt->window, MRTZ_WINSIZ) != MRTZ_WINSIZ)
+            return MRT_EIO;
+    }
+
+    return (io->error(io) == 0) ? MRT_ENOERR : MRT_EIO;
+}
+
+int mrtzloadindex(mrtzindex_t *idx, io_rw_t *io)
+{
+    idx->span    = 0;
+    idx->npoints = 0;
+    idx->points  = NULL;
+
+    unsigned char buf[MRTZ_FILEHDRSIZ];
+    if (io->read(io, buf, sizeof(buf)) != sizeof(buf))
+        return MRT_EIO;
+    if (memcmp(buf, mrtz_magic, sizeof(mrtz_magic)) != 0)
+        return MRT_EIO;
+
+    uint64_t span    = getbe64(&buf[sizeof(mrtz_magic)]);
+    uint64_t npoints = getbe64(&buf[sizeof(mrtz_magic) + sizeof(uint64_t)]);
+
+    idx->span = span;
+
+    // point count is untrusted, grow as records are actually read
+    size_t cap = 0;
+    int res = MRT_ENOERR;
+    for (uint64_t i = 0; i < npoints; i++) {
+        unsigned char rec[MRTZ_FILEPOINTSIZ];
+        if (io->read(io, rec, sizeof(rec)) != sizeof(rec)) {
+            res = MRT_EIO;
+            break;
+        }
+
+        if (idx->npoints == cap) {
+            size_t newcap = cap + MRTZ_GROWSTEP;
+            mrtzpoint_t *points = realloc(idx->points, newcap * sizeof(*points));
+            if (unlikely(!points)) {
+                res = MRT_ENOMEM;
+                break;
+            }
+
+            idx->points = points;
+            cap = newcap;
+        }
+
+        mrtzpoint_t *pt = &idx->points[idx->npoints];
+
+        pt->in     = getbe64(&rec[0]);
+        pt->out    = getbe64(&rec[8]);
+        pt->recoff = getbe64(&rec[16]);
+        pt->stamp  = (int64_t) getbe64(&rec[24]);
+        pt->bits   = rec[32] & 7;
+        pt->window = malloc(MRTZ_WINSIZ);
+        if (unlikely(!pt->window)) {
+            res = MRT_ENOMEM;
+            break;
+        }
+
+        idx->npoints++;
+        if (io->read(io, pt->window, MRTZ_WINSIZ) != MRTZ_WINSIZ) {
+            res = MRT_EIO;
+            break;
+        }
+    }
+
+    if (res != MRT_ENOERR)
+        mrtzfreeindex(idx);
+
+    return res;
+}
+
+void mrtzfreeindex(mrtzindex_t *idx)
+{
+    for (size_t i = 0; i < idx->npoints; i++)
+        free(idx->points[i].window);
+
+    free(idx->points);
+    idx->npoints = 0;
+    idx->points  = NULL;
+}
+
+const mrtzpoint_t *mrtzfindpoint(const mrtzindex_t *idx, time_t t)
+{
+    if (idx->npoints == 0)
+        return NULL;
+
+    // binary search for the first checkpoint whose stamp is not before t
+    size_t lo = 0, hi = idx->npoints;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->points[mid].stamp < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return &idx->points[(lo > 0) ? lo - 1 : 0];
+}
+
+io_rw_t *mrtzopenat(int fd, const mrtzpoint_t *pt, size_t bufsiz)
+{
+    off_t off = pt->in - (pt->bits ? 1 : 0);
+    if (lseek(fd, off, SEEK_SET) != off)
+        goto fail;
+
+    unsigned char c = 0;
+    ssize_t nr = (pt->bits) ? read(fd, &c, 1) : 1;
+    if (nr != 1) {
+        if (nr == 0)
+            errno = EIO;  // truncated file
+
+        goto fail;
+    }
+
+    io_rw_t *io = io_zresume(fd, bufsiz, pt->bits, c, pt->window, MRTZ_WINSIZ);
+    if (unlikely(!io))
+        goto fail;
+
+    // skip to record boundary
+    unsigned char buf[4096];
+
+    uint64_t left = pt->recoff - pt->out;
+    while (left > 0) {
+        size_t n = min(left, sizeof(buf));
+        if (io->read(io, buf, n) != n) {
+            io->close(io);  // closes fd too
+            errno = EIO;
+            return NULL;
+        }
+
+        left -= n;
+    }
+
+    return io;
+
+fail:
+    close(fd);
+    return NULL;
+}
+
+// time index ==================================================================
+
+static const unsigned char mrtt_magic[8] = { 'I', 'S', 'O', 'T', 'I', 'D', 'X', '1' };
+
+static int peercmp(uint32_t as, const netaddr_t *addr, const mrttpeer_t *peer)
+{
+    if (as != peer->peer_as)
+        return (as > peer->peer_as) - (as < peer->peer_as);
+    if (addr->family != peer->peer_addr.family)
+        return (addr->family > peer->peer_addr.family) - (addr->family < peer->peer_addr.family);
+
+    size_t n = (addr->family == AF_INET6) ? sizeof(struct in6_addr) : sizeof(struct in_addr);
+    return memcmp(addr->bytes, peer->peer_addr.bytes, n);
+}
+
+// binary search, returns the peer position or the insertion point
+static size_t searchpeer(const mrttindex_t *idx, uint32_t as, const netaddr_t *addr, bool *found)
+{
+    size_t lo = 0, hi = idx->npeers;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = peercmp(as, addr, &idx->peers[mid]);
+        if (cmp == 0) {
+            *found = true;
+            return mid;
+        }
+        if (cmp > 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *found = false;
+    return lo;
+}
+
+static int trackpeer(mrttindex_t *idx, size_t *cap, uint32_t as, const netaddr_t *addr, const mrttpoint_t *pos)
+{
+    bool found;
+    size_t i = searchpeer(idx, as, addr, &found);
+    if (!found) {
+        if (idx->npeers == *cap) {
+            size_t newcap = *cap + MRTZ_GROWSTEP;
+            mrttpeer_t *peers = realloc(idx->peers, newcap * sizeof(*peers));
+            if (unlikely(!peers))
+                return MRT_ENOMEM;
+
+            idx->peers = peers;
+            *cap = newcap;
+        }
+
+        mrttpeer_t *peer = &idx->peers[i];
+        memmove(peer + 1, peer, (idx->npeers - i) * sizeof(*peer));
+        idx->npeers++;
+
+        memset(peer, 0, sizeof(*peer));
+        peer->peer_as   = as;
+        peer->peer_addr = *addr;
+        peer->first     = *pos;
+    }
+
+    mrttpeer_t *peer = &idx->peers[i];
+    peer->last = *pos;
+    peer->nrecs++;
+    return MRT_ENOERR;
+}
+
+int mrttbuildindex(mrttindex_t *idx, io_rw_t *io, uint64_t span)
+{
+    if (span == 0)
+        span = MRTT_DEFSPAN;
+
+    memset(idx, 0, sizeof(*idx));
+    idx->span = span;
+
+    size_t cap = 0, peercap = 0;
+    uint64_t last = 0;
+
+    mrt_msg_t msg;
+    int res;
+    while ((res = setmrtreadfrom_r(&msg, io)) == MRT_ENOERR) {
+        const mrt_header_t *hdr = getmrtheader_r(&msg);
+
+        mrttpoint_t pos = {
+            .off   = idx->size,
+            .recno = idx->nrecs,
+            .stamp = hdr->stamp.tv_sec
+        };
+
+        if (idx->npoints == 0 || pos.off - last >= span) {
+            if (idx->npoints == cap) {
+                size_t newcap = cap + MRTZ_GROWSTEP;
+                mrttpoint_t *points = realloc(idx->points, newcap * sizeof(*points));
+                if (unlikely(!points)) {
+                    res = MRT_ENOMEM;
+                    mrtclose_r(&msg);
+                    break;
+                }
+
+                idx->points = points;
+                cap = newcap;
+            }
+
+            idx->points[idx->npoints++] = pos;
+            last = pos.off;
+        }
+
+        // peers are tracked on a best effort basis, bad headers are ignored
+        if (hdr->type == MRT_BGP4MP || hdr->type == MRT_BGP4MP_ET) {
+            const bgp4mp_header_t *bgp4mp = getbgp4mpheader_r(&msg);
+            if (bgp4mp)
+                res = trackpeer(idx, &peercap, bgp4mp->peer_as, &bgp4mp->peer_addr, &pos);
+        } else if (hdr->type == MRT_BGP) {
+            const zebra_header_t *zebra = getzebraheader_r(&msg);
+            if (zebra)
+                res = trackpeer(idx, &peercap, zebra->peer_as, &zebra->peer_addr, &pos);
+        }
+
+        idx->size += hdr->len + MRTZ_HDRSIZ;
+        idx->nrecs++;
+
+        mrtclose_r(&msg);
+        if (unlikely(res != MRT_ENOERR))
+            break;
+    }
+
+    if (res == MRT_EIO && !io->error(io))
+        res = MRT_ENOERR;  // regular end of stream
+    if (res != MRT_ENOERR)
+        mrttfreeindex(idx);
+
+    return res;
+}
+
+enum {
+    MRTT_FILEHDRSIZ   = sizeof(mrtt_magic) + 5 * sizeof(uint64_t),
+    MRTT_FILEPOINTSIZ = 3 * sizeof(uint64_t),
+    MRTT_FILEPEERSIZ  = sizeof(uint32_t) + 1 + sizeof(struct in6_addr) + sizeof(uint64_t) + 2 * MRTT_FILEPOINTSIZ
+};
+
+static void putpoint(unsigned char *dst, const mrttpoint_t *pt)
+{
+    putbe64(&dst[0], pt->off);
+    putbe64(&dst[8], pt->recno);
+    putbe64(&dst[16], (int64_t) pt->stamp);
+}
+
+static void getpoint(mrttpoint_t *pt, const unsigned char *src)
+{
+    pt->off   = getbe64(&src[0]);
+    pt->recno = getbe64(&src[8]);
+    pt->stamp = (int64_t) getbe64(&src[16]);
+}
+
+int mrttsaveindex(const mrttindex_t *idx, io_rw_t *io)
+{
+    unsigned char buf[MRTT_FILEHDRSIZ];
+
+    memcpy(buf, mrtt_magic, sizeof(mrtt_magic));
+    putbe64(&buf[8], idx->span);
+    putbe64(&buf[16], idx->nrecs);
+    putbe64(&buf[24], idx->size);
+    putbe64(&buf[32], idx->npoints);
+    putbe64(&buf[40], idx->npeers);
+    if (io->write(io, buf, sizeof(buf)) != sizeof(buf))
+        return MRT_EIO;
+
+    for (size_t i = 0; i < idx->npoints; i++) {
+        unsigned char rec[MRTT_FILEPOINTSIZ];
+
+        putpoint(rec, &idx->points[i]);
+        if (io->write(io, rec, sizeof(rec)) != sizeof(rec))
+            return MRT_EIO;
+    }
+    for (size_t i = 0; i < idx->npeers; i++) {
+        const mrttpeer_t *peer = &idx->peers[i];
+        unsigned char rec[MRTT_FILEPEERSIZ];
+
+        uint32_t as = tobig32(peer->peer_as);
+        memcpy(&rec[0], &as, sizeof(as));
+        rec[4] = (peer->peer_addr.family == AF_INET6);
+        memcpy(&rec[5], peer->peer_addr.bytes, sizeof(struct in6_addr));
+        putbe64(&rec[21], peer->nrecs);
+        putpoint(&rec[29], &peer->first);
+        putpoint(&rec[29 + MRTT_FILEPOINTSIZ], &peer->last);
+        if (io->write(io, rec, sizeof(rec)) != sizeof(rec))
+            return MRT_EIO;
+    }
+
+    return (io->error(io) == 0) ? MRT_ENOERR : MRT_EIO;
+}
+
+int mrttloadindex(mrttindex_t *idx, io_rw_t *io)
+{
+    memset(idx, 0, sizeof(*idx));
+
+    unsigned char buf[MRTT_FILEHDRSIZ];
+    if (io->read(io, buf, sizeof(buf)) != sizeof(buf))
+        return MRT_EIO;
+    if (memcmp(buf, mrtt_magic, sizeof(mrtt_magic)) != 0)
+        return MRT_EIO;
+
+    uint64_t npoints = getbe64(&buf[32]);
+    uint64_t npeers  = getbe64(&buf[40]);
+
+    idx->span  = getbe64(&buf[8]);
+    idx->nrecs = getbe64(&buf[16]);
+    idx->size  = getbe64(&buf[24]);
+
+    // counts are untrusted, grow as records are actually read
+    size_t cap = 0;
+    int res = MRT_ENOERR;
+    for (uint64_t i = 0; i < npoints; i++) {
+        unsigned char rec[MRTT_FILEPOINTSIZ];
+        if (io->read(io, rec, sizeof(rec)) != sizeof(rec)) {
+            res = MRT_EIO;
+            break;
+        }
+
+        if (idx->npoints == cap) {
+            size_t newcap = cap + MRTZ_GROWSTEP;
+            mrttpoint_t *points = realloc(idx->points, newcap * sizeof(*points));
+            if (unlikely(!points)) {
+                res = MRT_ENOMEM;
+                break;
+            }
+
+            idx->points = points;
+            cap = newcap;
+        }
+
+        getpoint(&idx->points[idx->npoints++], rec);
+    }
+
+    cap = 0;
+    for (uint64_t i = 0; i < npeers && res == MRT_ENOERR; i++) {
+        unsigned char rec[MRTT_FILEPEERSIZ];
+        if (io->read(io, rec, sizeof(rec)) != sizeof(rec)) {
+            res = MRT_EIO;
+            break;
+        }
+
+        if (idx->npeers == cap) {
+            size_t newcap = cap + MRTZ_GROWSTEP;
+            mrttpeer_t *peers = realloc(idx->peers, newcap * sizeof(*peers));
+            if (unlikely(!peers)) {
+                res = MRT_ENOMEM;
+                break;
+            }
+
+            idx->peers = peers;
+            cap = newcap;
+        }
+
+        mrttpeer_t *peer = &idx->peers[idx->npeers++];
+
+        uint32_t as;
+        memcpy(&as, &rec[0], sizeof(as));
+        peer->peer_as = frombig32(as);
+        makenaddr(&peer->peer_addr, rec[4] ? AF_INET6 : AF_INET, &rec[5], rec[4] ? 128 : 32);
+        peer->nrecs = getbe64(&rec[21]);
+        getpoint(&peer->first, &rec[29]);
+        getpoint(&peer->last, &rec[29 + MRTT_FILEPOINTSIZ]);
+    }
+
+    if (res != MRT_ENOERR)
+        mrttfreeindex(idx);
+
+    return res;
+}
+
+void mrttfreeindex(mrttindex_t *idx)
+{
+    free(idx->points);
+    free(idx->peers);
+    idx->npoints = 0;
+    idx->points  = NULL;
+    idx->npeers  = 0;
+    idx->peers   = NULL;
+}
+
+const mrttpoint_t *mrttfindpoint(const mrttindex_t *idx, time_t t)
+{
+    if (idx->npoints == 0)
+        return NULL;
+
+    size_t lo = 0, hi = idx->npoints;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->points[mid].stamp < t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return &idx->points[(lo > 0) ? lo - 1 : 0];
+}
+
+const mrttpeer_t *mrttfindpeer(const mrttindex_t *idx, uint32_t peer_as, const netaddr_t *peer_addr)
+{
+    bool found;
+    size_t i = searchpeer(idx, peer_as, peer_addr, &found);
+    return found ? &idx->peers[i] : NULL;
+}
+
+int mrttseekpoint(io_rw_t *io, const mrttpoint_t *pt)
+{
+    return (io_skip(io, pt->off) == pt->off) ? MRT_ENOERR : MRT_EIO;
+}
+
+io_rw_t *mrttzopenat(int fd, const mrtzindex_t *zidx, const mrttpoint_t *pt, size_t bufsiz)
+{
+    // last checkpoint whose record doesn't follow pt
+    size_t lo = 0, hi = zidx->npoints;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (zidx->points[mid].recoff <= pt->off)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    io_rw_t *io;
+    uint64_t off = pt->off;
+    if (lo > 0) {
+        const mrtzpoint_t *zpt = &zidx->points[lo - 1];
+
+        io = mrtzopenat(fd, zpt, bufsiz);
+        off -= zpt->recoff;
+    } else {
+        // no checkpoint precedes pt, decode from the beginning
+        if (lseek(fd, 0, SEEK_SET) != 0) {
+            close(fd);
+            return NULL;
+        }
+
+        io = io_zopen(fd, bufsiz, "r");
+        if (unlikely(!io))
+            close(fd);
+    }
+    if (unlikely(!io))
+        return NULL;
+
+    if (io_skip(io, off) != off) {
+        io->close(io);
+        errno = EIO;
+        return NULL;
+    }
+
+    return io;
+}
@@ -0,0 +1,336 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <isolario/branch.h>
+#include <isolario/mrtmerge.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct mrtment_s {
+    struct mrtment_s *next;  // free list link
+    uint64_t key;            // timestamp, in nanoseconds
+    uint64_t seq;            // read order, keeps equal timestamps stable
+    size_t stream;
+    mrt_msg_t msg;
+} mrtment_t;
+
+typedef struct {
+    io_rw_t *io;
+    uint64_t last;    // key of the last record read from stream
+    size_t npending;  // records read ahead and not yet returned
+    bool live;        // stream has more records
+} mrtmstream_t;
+
+struct mrtmerge_s {
+    uint64_t window;
+    size_t lookahead;
+    uint64_t seq;
+
+    mrtment_t *cur;   // record last returned to caller
+    mrtment_t *free;  // recycled records
+
+    // records read ahead, min-heap on (key, stream, seq)
+    mrtment_t **recs;
+    size_t nrecs;
+
+    // live streams below read ahead limit, min-heap on (last, index)
+    size_t *readq;
+    size_t nreadq;
+
+    size_t nstreams;
+    mrtmstream_t streams[];
+};
+
+static uint64_t tstokey(const struct timespec *ts)
+{
+    return (uint64_t) ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+static bool recless(const mrtment_t *a, const mrtment_t *b)
+{
+    if (a->key != b->key)
+        return a->key < b->key;
+    if (a->stream != b->stream)
+        return a->stream < b->stream;
+
+    return a->seq < b->seq;
+}
+
+static void recpush(mrtmerge_t *mm, mrtment_t *ent)
+{
+    size_t i = mm->nrecs++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!recless(ent, mm->recs[parent]))
+            break;
+
+        mm->recs[i] = mm->recs[parent];
+        i = parent;
+    }
+    mm->recs[i] = ent;
+}
+
+static mrtment_t *recpop(mrtmerge_t *mm)
+{
+    mrtment_t *top  = mm->recs[0];
+    mrtment_t *last = mm->recs[--mm->nrecs];
+
+    size_t i = 0;
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= mm->nrecs)
+            break;
+        if (child + 1 < mm->nrecs && recless(mm->recs[child + 1], mm->recs[child]))
+            child++;
+        if (!recless(mm->recs[child], last))
+            break;
+
+        mm->recs[i] = mm->recs[child];
+        i = child;
+    }
+    if (mm->nrecs > 0)
+        mm->recs[i] = last;
+
+    return top;
+}
+
+static bool streamless(const mrtmerge_t *mm, size_t a, size_t b)
+{
+    const mrtmstream_t *sa = &mm->streams[a];
+    const mrtmstream_t *sb = &mm->streams[b];
+    if (sa->last != sb->last)
+        return sa->last < sb->last;
+
+    return a < b;
+}
+
+static void readqpush(mrtmerge_t *mm, size_t idx)
+{
+    size_t i = mm->nreadq++;
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!streamless(mm, idx, mm->readq[parent]))
+            break;
+
+        mm->readq[i] = mm->readq[parent];
+        i = parent;
+    }
+    mm->readq[i] = idx;
+}
+
+// restore heap property after the top stream key increased
+static void readqfixtop(mrtmerge_t *mm)
+{
+    size_t idx = mm->readq[0];
+    size_t i = 0;
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= mm->nreadq)
+            break;
+        if (child + 1 < mm->nreadq && streamless(mm, mm->readq[child + 1], mm->readq[child]))
+            child++;
+        if (!streamless(mm, mm->readq[child], idx))
+            break;
+
+        mm->readq[i] = mm->readq[child];
+        i = child;
+    }
+    mm->readq[i] = idx;
+}
+
+static void readqpoptop(mrtmerge_t *mm)
+{
+    mm->readq[0] = mm->readq[--mm->nreadq];
+    if (mm->nreadq > 0)
+        readqfixtop(mm);
+}
+
+mrtmerge_t *newmrtmerge(io_rw_t *const ios[], size_t n, const struct timespec *window, size_t lookahead)
+{
+    if (lookahead == 0)
+        lookahead = MRTM_DEFLOOKAHEAD;
+
+    mrtmerge_t *mm = malloc(sizeof(*mm) + n * sizeof(*mm->streams));
+    if (unlikely(!mm))
+        return NULL;
+
+    mm->window    = window ? tstokey(window) : 0;
+    mm->lookahead = lookahead;
+    mm->seq       = 0;
+    mm->cur       = NULL;
+    mm->free      = NULL;
+    mm->nrecs     = 0;
+    mm->nreadq    = 0;
+    mm->nstreams  = n;
+    mm->recs      = malloc(n * lookahead * sizeof(*mm->recs));
+    mm->readq     = malloc(n * sizeof(*mm->readq));
+    if (unlikely((!mm->recs || !mm->readq) && n > 0)) {
+        free(mm->recs);
+        free(mm->readq);
+        free(mm);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        mrtmstream_t *s = &mm->streams[i];
+        s->io       = ios[i];
+        s->last     = 0;
+        s->npending = 0;
+        s->live     = true;
+
+        readqpush(mm, i);
+    }
+    return mm;
+}
+
+// read one record from the stream on top of the read queue
+static int readahead(mrtmerge_t *mm)
+{
+    size_t idx = mm->readq[0];
+    mrtmstream_t *s = &mm->streams[idx];
+
+    mrtment_t *ent = mm->free;
+    if (ent) {
+        mm->free = ent->next;
+    } else {
+        ent = malloc(sizeof(*ent));
+        if (unlikely(!ent))
+            return MRT_ENOMEM;
+    }
+
+    int err = setmrtreadfrom_r(&ent->msg, s->io);
+    if (unlikely(err != MRT_ENOERR)) {
+        ent->next = mm->free;
+        mm->free  = ent;
+
+        s->live = false;
+        readqpoptop(mm);
+        if (err == MRT_EIO && !s->io->error(s->io))
+            err = MRT_ENOERR;  // regular end of stream
+
+        return err;
+    }
+
+    ent->key    = tstokey(&getmrtheader_r(&ent->msg)->stamp);
+    ent->seq    = mm->seq++;
+    ent->stream = idx;
+    recpush(mm, ent);
+
+    // never move a stream backwards, a late record doesn't mean
+    // earlier ones weren't already seen
+    if (ent->key > s->last)
+        s->last = ent->key;
+
+    if (++s->npending == mm->lookahead)
+        readqpoptop(mm);
+    else
+        readqfixtop(mm);
+
+    return MRT_ENOERR;
+}
+
+static void releasecur(mrtmerge_t *mm)
+{
+    mrtment_t *ent = mm->cur;
+    if (!ent)
+        return;
+
+    mrtclose_r(&ent->msg);
+
+    mrtmstream_t *s = &mm->streams[ent->stream];
+    if (s->npending-- == mm->lookahead && s->live)
+        readqpush(mm, ent->stream);  // stream was held at its read ahead limit
+
+    ent->next = mm->free;
+    mm->free  = ent;
+    mm->cur   = NULL;
+}
+
+int mrtmergenext(mrtmerge_t *mm, mrt_msg_t **pmsg, size_t *pstream)
+{
+    releasecur(mm);
+
+    // read ahead until every stream that may still hold a record belonging
+    // before the current minimum has gone past it by at least the window
+    while (mm->nreadq > 0) {
+        const mrtmstream_t *s = &mm->streams[mm->readq[0]];
+        if (mm->nrecs > 0) {
+            uint64_t limit = mm->recs[0]->key + mm->window;
+            if (limit < mm->window)
+                limit = UINT64_MAX;  // saturate on overflow
+
+            if (s->npending > 0 && s->last >= limit)
+                break;
+        }
+
+        size_t idx = mm->readq[0];
+        int err = readahead(mm);
+        if (unlikely(err != MRT_ENOERR)) {
+            if (pstream)
+                *pstream = idx;
+
+            return err;
+        }
+    }
+
+    if (mm->nrecs == 0) {
+        if (pstream)
+            *pstream = mm->nstreams;
+
+        return MRT_EIO;
+    }
+
+    mm->cur = recpop(mm);
+    *pmsg = &mm->cur->msg;
+    if (pstream)
+        *pstream = mm->cur->stream;
+
+    return MRT_ENOERR;
+}
+
+void freemrtmerge(mrtmerge_t *mm)
+{
+    releasecur(mm);
+    while (mm->nrecs > 0) {
+        mrtment_t *ent = mm->recs[--mm->nrecs];
+        mrtclose_r(&ent->msg);
+        free(ent);
+    }
+    while (mm->free) {
+        mrtment_t *ent = mm->free;
+        mm->free = ent->next;
+        free(ent);
+    }
+
+    free(mm->recs);
+    free(mm->readq);
+    free(mm);
+}
@@ -0,0 +1,381 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <isolario/branch.h>
+#include <isolario/endian.h>
+#include <isolario/mrtpool.h>
+#include <isolario/threading.h>
+#include <isolario/util.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+enum {
+    MRTP_HDRSIZ     = 12,   // MRT header size
+    MRTP_LENOFF     = 8,    // MRT header length field offset
+    MRTP_AVGRECSIZ  = 512,  // initial batch buffer estimate per record
+    MRTP_INFLIGHT   = 2     // batches in flight per worker
+};
+
+// with MRTPF_ORDERED, a batch processed ahead of its turn, waiting to be committed
+typedef struct {
+    bool ready;
+    uint64_t seqno;
+    size_t nrecs;
+} mrtpslot_t;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t done;  // signaled whenever a batch is completed
+
+    size_t inflight;     // batches dispatched and not yet completed
+    uint64_t nextbatch;  // with MRTPF_ORDERED, next batch to be committed
+    bool committing;     // with MRTPF_ORDERED, a worker is running commit callbacks
+    atomic_int res;      // first non-zero callback result or error, stops processing
+
+    int flags;
+    peer_index_t *pi;
+    mrtribfunc_t fn;
+    mrtribcommitfunc_t commit;
+    void *arg;
+
+    size_t nslots;       // one per batch in flight, indexed by batch number
+    mrtpslot_t *slots;
+} mrtpctx_t;
+
+typedef struct {
+    uint64_t batchno;
+    uint64_t seqno;  // sequence number of the first record in batch
+    size_t nrecs;
+    size_t size, cap;
+    unsigned char data[];
+} mrtpbatch_t;
+
+typedef struct {
+    mrtpctx_t *ctx;
+    mrtpbatch_t *batch;
+} mrtpjob_t;
+
+static void setresult(mrtpctx_t *ctx, int res)
+{
+    int expected = 0;
+    atomic_compare_exchange_strong(&ctx->res, &expected, res);
+}
+
+static void runbatch(mrtpctx_t *ctx, const mrtpbatch_t *batch)
+{
+    mrt_msg_t msg;
+
+    const unsigned char *ptr = batch->data;
+    for (size_t i = 0; i < batch->nrecs; i++) {
+        if (unlikely(atomic_load_explicit(&ctx->res, memory_order_relaxed) != 0))
+            break;
+
+        // record length was validated while reading batch
+        uint32_t len;
+        memcpy(&len, &ptr[MRTP_LENOFF], sizeof(len));
+        size_t n = MRTP_HDRSIZ + (size_t) frombig32(len);
+
+        int err = setmrtread_r(&msg, ptr, n, MRTF_NOCOPY);
+        ptr += n;
+        if (unlikely(err != MRT_ENOERR)) {
+            setresult(ctx, err);
+            break;
+        }
+
+        if (ismrtrib_r(&msg))
+            setribpeerindex_r(&msg, ctx->pi);
+
+        int res = ctx->fn(&msg, batch->seqno + i, ctx->arg);
+        mrtclose_r(&msg);
+        if (res != 0) {
+            setresult(ctx, res);
+            break;
+        }
+    }
+}
+
+static void commitbatch(mrtpctx_t *ctx, uint64_t seqno, size_t nrecs)
+{
+    if (!ctx->commit || atomic_load_explicit(&ctx->res, memory_order_relaxed) != 0)
+        return;
+
+    int res = ctx->commit(seqno, nrecs, ctx->arg);
+    if (res != 0)
+        setresult(ctx, res);
+}
+
+// mark batch as processed and commit every batch whose turn has come,
+// no worker ever waits for its turn: whoever completes the batch holding
+// the turn commits it, along with any following one already processed
+static void commitordered(mrtpctx_t *ctx, uint64_t batchno, uint64_t seqno, size_t nrecs)
+{
+    pthread_mutex_lock(&ctx->mutex);
+
+    mrtpslot_t *slot = &ctx->slots[batchno % ctx->nslots];
+    slot->ready = true;
+    slot->seqno = seqno;
+    slot->nrecs = nrecs;
+    if (ctx->committing) {
+        // committer re-checks the next slot under lock, it will pick it up
+        pthread_mutex_unlock(&ctx->mutex);
+        return;
+    }
+
+    ctx->committing = true;
+    while ((slot = &ctx->slots[ctx->nextbatch % ctx->nslots])->ready) {
+        slot->ready = false;
+        seqno = slot->seqno;
+        nrecs = slot->nrecs;
+
+        pthread_mutex_unlock(&ctx->mutex);
+        commitbatch(ctx, seqno, nrecs);
+        pthread_mutex_lock(&ctx->mutex);
+
+        ctx->nextbatch++;
+        ctx->inflight--;
+        pthread_cond_broadcast(&ctx->done);
+    }
+    ctx->committing = false;
+
+    pthread_mutex_unlock(&ctx->mutex);
+}
+
+static void handlebatch(void *job)
+{
+    mrtpjob_t *j = job;
+    mrtpctx_t *ctx = j->ctx;
+    mrtpbatch_t *batch = j->batch;
+
+    uint64_t batchno = batch->batchno;
+    uint64_t seqno   = batch->seqno;
+    size_t nrecs     = batch->nrecs;
+
+    runbatch(ctx, batch);
+    free(batch);
+
+    if (ctx->flags & MRTPF_ORDERED) {
+        commitordered(ctx, batchno, seqno, nrecs);
+        return;
+    }
+
+    commitbatch(ctx, seqno, nrecs);
+
+    pthread_mutex_lock(&ctx->mutex);
+
+    ctx->inflight--;
+    pthread_cond_broadcast(&ctx->done);
+
+    pthread_mutex_unlock(&ctx->mutex);
+}
+
+static mrtpbatch_t *newbatch(size_t cap, uint64_t batchno, uint64_t seqno)
+{
+    mrtpbatch_t *batch = malloc(sizeof(*batch) + cap);
+    if (unlikely(!batch))
+        return NULL;
+
+    batch->batchno = batchno;
+    batch->seqno   = seqno;
+    batch->nrecs   = 0;
+    batch->size    = 0;
+    batch->cap     = cap;
+    return batch;
+}
+
+static int dispatchbatch(pool_t *pool, mrtpctx_t *ctx, mrtpbatch_t *batch, size_t maxinflight)
+{
+    pthread_mutex_lock(&ctx->mutex);
+    while (ctx->inflight >= maxinflight)
+        pthread_cond_wait(&ctx->done, &ctx->mutex);
+
+    ctx->inflight++;
+    pthread_mutex_unlock(&ctx->mutex);
+
+    mrtpjob_t job = { ctx, batch };
+    if (unlikely(pool_dispatch(pool, &job, sizeof(job)) != 0)) {
+        pthread_mutex_lock(&ctx->mutex);
+        ctx->inflight--;
+        pthread_mutex_unlock(&ctx->mutex);
+        return MRT_ENOMEM;
+    }
+
+    return MRT_ENOERR;
+}
+
+// read next record into batch, growing it as necessary
+static int readrecord(io_rw_t *io, mrtpbatch_t **pbatch)
+{
+    unsigned char hdr[MRTP_HDRSIZ];
+
+    size_t n = io->read(io, hdr, sizeof(hdr));
+    if (unlikely(n != sizeof(hdr)))
+        return (n > 0) ? MRT_EBADHDR : MRT_EIO;
+
+    uint32_t len;
+    memcpy(&len, &hdr[MRTP_LENOFF], sizeof(len));
+    len = frombig32(len);
+
+    mrtpbatch_t *batch = *pbatch;
+
+    size_t size = batch->size + MRTP_HDRSIZ + len;
+    if (unlikely(size > batch->cap)) {
+        size_t cap = max(size, batch->cap * 2);
+
+        batch = realloc(batch, sizeof(*batch) + cap);
+        if (unlikely(!batch))
+            return MRT_ENOMEM;
+
+        batch->cap = cap;
+        *pbatch    = batch;
+    }
+
+    unsigned char *ptr = &batch->data[batch->size];
+
+    memcpy(ptr, hdr, sizeof(hdr));
+    if (unlikely(io->read(io, ptr + sizeof(hdr), len) != len))
+        return io->error(io) ? MRT_EIO : MRT_EBADHDR;
+
+    batch->size = size;
+    batch->nrecs++;
+    return MRT_ENOERR;
+}
+
+int mrtribforeach(io_rw_t *io, int nthreads, size_t batchsiz, int flags, mrtribfunc_t fn, mrtribcommitfunc_t commit, void *arg)
+{
+    if (nthreads <= 0) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = clamp(ncpus, 1, INT_MAX / 2);
+    }
+    if (batchsiz == 0)
+        batchsiz = MRTP_DEFBATCHSIZ;
+
+    mrtpctx_t ctx;
+
+    // decode Peer Index once, workers share it read-only
+    mrt_msg_t *msg = malloc(sizeof(*msg));
+    if (unlikely(!msg))
+        return MRT_ENOMEM;
+
+    int err = setmrtreadfrom_r(msg, io);
+    if (likely(err == MRT_ENOERR)) {
+        err = newpeerindex_r(msg, &ctx.pi);
+        mrtclose_r(msg);
+    }
+
+    free(msg);
+    if (unlikely(err != MRT_ENOERR))
+        return err;
+
+    pthread_mutex_init(&ctx.mutex, NULL);
+    pthread_cond_init(&ctx.done, NULL);
+    ctx.inflight   = 0;
+    ctx.nextbatch  = 0;
+    ctx.committing = false;
+    ctx.flags      = flags;
+    ctx.fn         = fn;
+    ctx.commit     = commit;
+    ctx.arg        = arg;
+    ctx.nslots     = 0;
+    ctx.slots      = NULL;
+    atomic_init(&ctx.res, 0);
+
+    pool_t *pool = pool_create(nthreads, handlebatch);
+    if (unlikely(!pool || pool_nthreads(pool) == 0)) {
+        err = MRT_ENOMEM;
+        goto out;
+    }
+
+    size_t maxinflight = (size_t) pool_nthreads(pool) * MRTP_INFLIGHT;
+    if (flags & MRTPF_ORDERED) {
+        ctx.nslots = maxinflight;
+        ctx.slots  = calloc(ctx.nslots, sizeof(*ctx.slots));
+        if (unlikely(!ctx.slots)) {
+            err = MRT_ENOMEM;
+            goto out;
+        }
+    }
+
+    size_t initcap     = batchsiz * MRTP_AVGRECSIZ;
+    uint64_t batchno   = 0;
+    uint64_t seqno     = 0;
+
+    mrtpbatch_t *batch = NULL;
+    while (likely(atomic_load_explicit(&ctx.res, memory_order_relaxed) == 0)) {
+        if (!batch) {
+            batch = newbatch(initcap, batchno, seqno);
+            if (unlikely(!batch)) {
+                err = MRT_ENOMEM;
+                break;
+            }
+        }
+
+        err = readrecord(io, &batch);
+        if (unlikely(err != MRT_ENOERR))
+            break;
+
+        seqno++;
+        if (batch->nrecs == batchsiz) {
+            err = dispatchbatch(pool, &ctx, batch, maxinflight);
+            if (unlikely(err != MRT_ENOERR))
+                break;
+
+            batch = NULL;
+            batchno++;
+        }
+    }
+
+    if (err == MRT_EIO && !io->error(io))
+        err = MRT_ENOERR;  // clean end of dump
+
+    if (batch && batch->nrecs > 0 && err == MRT_ENOERR) {
+        err = dispatchbatch(pool, &ctx, batch, maxinflight);
+        if (likely(err == MRT_ENOERR))
+            batch = NULL;
+    }
+
+    free(batch);
+
+out:
+    if (pool)
+        pool_join(pool);  // waits for every dispatched batch
+
+    free(ctx.slots);
+    pthread_cond_destroy(&ctx.done);
+    pthread_mutex_destroy(&ctx.mutex);
+    freepeerindex(ctx.pi);
+
+    int res = atomic_load(&ctx.res);
+    return (res != 0) ? res : err;
+}
@@ -0,0 +1,1256 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <isolario/bgp.h>
+#include <isolario/bgpattribs.h>
+#include <isolario/branch.h>
+#include <isolario/mrtindex.h>
+#include <isolario/ribengine.h>
+#include <isolario/strutil.h>
+#include <isolario/util.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    RIB_MINBUCKETS  = 1024,
+    RIB_PAGESIZ     = 256,     // routes allocated at once
+    RIB_GROWSTEP    = 64,
+    RIB_MRTHDRSIZ   = 12,      // MRT header size
+    RIB_ESTABLISHED = 6,       // BGP FSM Established state
+    RIB_ATTRBUFSIZ  = 0xffff
+};
+
+typedef struct ribroute_s {
+    struct ribroute_s *next;  // hash chain, or free list link
+    uint32_t hash;
+    uint32_t peer;
+    uint32_t pathid;
+    netaddr_t pfx;            // host bits are always zeroed
+    const attrref_t *attrs;
+} ribroute_t;
+
+typedef struct ribpage_s {
+    struct ribpage_s *next;
+    ribroute_t block[RIB_PAGESIZ];
+} ribpage_t;
+
+typedef struct {
+    uint32_t peer, pathid;
+    netaddr_t pfx;
+    uint32_t seq;             // order of changes logged between checkpoints
+    const attrref_t *attrs;   // NULL for routes withdrawn since the previous checkpoint
+} ckroute_t;
+
+// the first checkpoint holds the whole state, any other one only the routes
+// changed since the previous, routes are sorted by key in both cases
+typedef struct {
+    time_t stamp;
+    uint64_t off;
+    size_t npeers;            // peers never go away, so these are the engine's first
+    size_t nroutes;
+    ckroute_t *routes;
+} ribckpt_t;
+
+struct ribengine_s {
+    attrstore_t *store;
+    bool ownstore;      // views share their parent's store
+
+    time_t stamp;       // last applied record
+    time_t interval;
+    time_t lastckpt;
+    uint64_t off;       // offset following the last applied record
+
+    // peers, in order of appearance, indexed by an open addressing table
+    size_t npeers, peerscap;
+    ribpeer_t *peers;
+    size_t nslots;      // always a power of 2
+    size_t *slots;      // peer index + 1, 0 for empty slots
+
+    // routes, hashed on (peer, prefix, path identifier)
+    size_t nroutes;
+    size_t nbuckets;    // always a power of 2
+    ribroute_t **buckets;
+    ribroute_t *freeroutes;
+    ribpage_t *pages;
+
+    size_t maxckpts, nckpts, ckptscap;
+    ribckpt_t *ckpts;
+
+    // changes since the last checkpoint, only logged once there is one
+    size_t nlog, logcap;
+    ckroute_t *log;
+
+    // prefixes of the UPDATE being applied, withdrawn ones first
+    size_t npfxs, pfxscap;
+    netaddrap_t *pfxs;
+
+    bgp_msg_t bgp;
+    unsigned char attrbuf[RIB_ATTRBUFSIZ];
+};
+
+static uint32_t peerhash(uint32_t peer_as, const netaddr_t *peer_addr)
+{
+    uint64_t h = memdjb2(peer_addr->bytes, naddrsize(peer_addr->bitlen));
+
+    h = ((h << 5) + h) ^ peer_as;
+    return h ^ (h >> 32);
+}
+
+static uint32_t routehash(uint32_t peer, const netaddr_t *pfx, uint32_t pathid)
+{
+    uint64_t h = memdjb2(pfx->bytes, naddrsize(pfx->bitlen));
+
+    h = ((h << 5) + h) ^ pfx->bitlen;
+    h = ((h << 5) + h) ^ peer;
+    h = ((h << 5) + h) ^ pathid;
+    return h ^ (h >> 32);
+}
+
+static void canonpfx(netaddr_t *dst, const netaddr_t *src)
+{
+    makenaddr(dst, src->family, src->bytes, src->bitlen);
+    if (src->bitlen & 7)
+        dst->bytes[src->bitlen >> 3] &= 0xff << (8 - (src->bitlen & 7));
+}
+
+static ribengine_t *newengine(attrstore_t *store, time_t interval, size_t maxckpts)
+{
+    ribengine_t *eng = malloc(sizeof(*eng));
+    if (unlikely(!eng))
+        return NULL;
+
+    eng->ownstore = (store == NULL);
+    if (eng->ownstore)
+        store = attrstore_create(0);
+
+    eng->store = store;
+    eng->buckets = calloc(RIB_MINBUCKETS, sizeof(*eng->buckets));
+    if (unlikely(!eng->store || !eng->buckets)) {
+        if (eng->ownstore && eng->store)
+            attrstore_destroy(eng->store);
+
+        free(eng->buckets);
+        free(eng);
+        return NULL;
+    }
+
+    eng->stamp    = 0;
+    eng->interval = interval;
+    eng->lastckpt = 0;
+    eng->off      = 0;
+
+    eng->npeers   = 0;
+    eng->peerscap = 0;
+    eng->peers    = NULL;
+    eng->nslots   = 0;
+    eng->slots    = NULL;
+
+    eng->nroutes    = 0;
+    eng->nbuckets   = RIB_MINBUCKETS;
+    eng->freeroutes = NULL;
+    eng->pages      = NULL;
+
+    eng->maxckpts = maxckpts;
+    eng->nckpts   = 0;
+    eng->ckptscap = 0;
+    eng->ckpts    = NULL;
+
+    eng->nlog   = 0;
+    eng->logcap = 0;
+    eng->log    = NULL;
+
+    eng->npfxs   = 0;
+    eng->pfxscap = 0;
+    eng->pfxs    = NULL;
+    return eng;
+}
+
+ribengine_t *ribengine_create(time_t interval, size_t maxckpts)
+{
+    return newengine(NULL, interval, maxckpts);
+}
+
+// peers =======================================================================
+
+size_t ribengine_findpeer(const ribengine_t *eng, uint32_t peer_as, const netaddr_t *peer_addr)
+{
+    if (eng->nslots == 0)
+        return SIZE_MAX;
+
+    size_t mask = eng->nslots - 1;
+    for (size_t i = peerhash(peer_as, peer_addr) & mask; eng->slots[i] != 0; i = (i + 1) & mask) {
+        const ribpeer_t *p = &eng->peers[eng->slots[i] - 1];
+        if (p->peer_as == peer_as && naddreq(&p->peer_addr, peer_addr))
+            return eng->slots[i] - 1;
+    }
+    return SIZE_MAX;
+}
+
+static void slotpeer(ribengine_t *eng, size_t idx)
+{
+    const ribpeer_t *p = &eng->peers[idx];
+
+    size_t mask = eng->nslots - 1;
+    size_t i = peerhash(p->peer_as, &p->peer_addr) & mask;
+    while (eng->slots[i] != 0)
+        i = (i + 1) & mask;
+
+    eng->slots[i] = idx + 1;
+}
+
+// returns peer index, SIZE_MAX on out of memory
+static size_t addpeer(ribengine_t *eng, uint32_t peer_as, const netaddr_t *peer_addr)
+{
+    if (eng->npeers == eng->peerscap) {
+        size_t newcap = eng->peerscap + RIB_GROWSTEP;
+        ribpeer_t *peers = realloc(eng->peers, newcap * sizeof(*peers));
+        if (unlikely(!peers))
+            return SIZE_MAX;
+
+        eng->peers    = peers;
+        eng->peerscap = newcap;
+    }
+    if (2 * (eng->npeers + 1) > eng->nslots) {
+        size_t nslots = (eng->nslots == 0) ? 2 * RIB_GROWSTEP : 2 * eng->nslots;
+        size_t *slots = calloc(nslots, sizeof(*slots));
+        if (unlikely(!slots))
+            return SIZE_MAX;
+
+        free(eng->slots);
+        eng->slots  = slots;
+        eng->nslots = nslots;
+        for (size_t i = 0; i < eng->npeers; i++)
+            slotpeer(eng, i);
+    }
+
+    size_t idx = eng->npeers++;
+
+    ribpeer_t *p = &eng->peers[idx];
+    p->peer_as   = peer_as;
+    p->peer_addr = *peer_addr;
+    p->nroutes   = 0;
+
+    slotpeer(eng, idx);
+    return idx;
+}
+
+static size_t getpeer(ribengine_t *eng, uint32_t peer_as, const netaddr_t *peer_addr)
+{
+    size_t idx = ribengine_findpeer(eng, peer_as, peer_addr);
+    if (idx == SIZE_MAX)
+        idx = addpeer(eng, peer_as, peer_addr);
+
+    return idx;
+}
+
+size_t ribengine_npeers(const ribengine_t *eng)
+{
+    return eng->npeers;
+}
+
+const ribpeer_t *ribengine_peer(const ribengine_t *eng, size_t i)
+{
+    return (i < eng->npeers) ? &eng->peers[i] : NULL;
+}
+
+// routes ======================================================================
+
+static void rehash(ribengine_t *eng)
+{
+    size_t nbuckets = eng->nbuckets << 1;
+
+    ribroute_t **buckets = calloc(nbuckets, sizeof(*buckets));
+    if (unlikely(!buckets))
+        return;  // keep going with longer chains
+
+    for (size_t i = 0; i < eng->nbuckets; i++) {
+        ribroute_t *r = eng->buckets[i];
+        while (r) {
+            ribroute_t *next = r->next;
+            ribroute_t **head = &buckets[r->hash & (nbuckets - 1)];
+
+            r->next = *head;
+            *head   = r;
+            r       = next;
+        }
+    }
+
+    free(eng->buckets);
+    eng->buckets  = buckets;
+    eng->nbuckets = nbuckets;
+}
+
+static ribroute_t *getfreeroute(ribengine_t *eng)
+{
+    if (!eng->freeroutes) {
+        ribpage_t *p = malloc(sizeof(*p));
+        if (unlikely(!p))
+            return NULL;
+
+        for (size_t i = 0; i < RIB_PAGESIZ; i++) {
+            p->block[i].next = eng->freeroutes;
+            eng->freeroutes  = &p->block[i];
+        }
+
+        p->next    = eng->pages;
+        eng->pages = p;
+    }
+
+    ribroute_t *r   = eng->freeroutes;
+    eng->freeroutes = r->next;
+    return r;
+}
+
+static ribroute_t **findroute(const ribengine_t *eng, uint32_t hash, size_t peer, const netaddr_t *pfx, uint32_t pathid)
+{
+    ribroute_t **ptr = &eng->buckets[hash & (eng->nbuckets - 1)];
+    for (ribroute_t *r = *ptr; r; ptr = &r->next, r = r->next) {
+        if (r->hash == hash && r->peer == peer && r->pathid == pathid &&
+            r->pfx.family == pfx->family && r->pfx.bitlen == pfx->bitlen &&
+            memcmp(r->pfx.bytes, pfx->bytes, sizeof(pfx->bytes)) == 0)
+            return ptr;
+    }
+    return NULL;
+}
+
+// record a change for the next checkpoint, attrs is NULL for withdrawals
+static int logroute(ribengine_t *eng, size_t peer, const netaddr_t *pfx, uint32_t pathid, const attrref_t *attrs)
+{
+    if (eng->nckpts == 0)
+        return MRT_ENOERR;  // the first checkpoint copies the whole state anyway
+
+    if (eng->nlog == eng->logcap) {
+        size_t newcap = max(eng->logcap * 2, RIB_PAGESIZ);
+        ckroute_t *log = realloc(eng->log, newcap * sizeof(*log));
+        if (unlikely(!log))
+            return MRT_ENOMEM;
+
+        eng->log    = log;
+        eng->logcap = newcap;
+    }
+
+    ckroute_t *c = &eng->log[eng->nlog];
+    c->peer   = peer;
+    c->pathid = pathid;
+    c->pfx    = *pfx;
+    c->seq    = eng->nlog++;
+    c->attrs  = attrs ? attrstore_ref(attrs) : NULL;
+    return MRT_ENOERR;
+}
+
+// takes ownership of the reference to attrs, pfx must be canonical
+static int putroute(ribengine_t *eng, size_t peer, const netaddr_t *pfx, uint32_t pathid, const attrref_t *attrs)
+{
+    uint32_t hash = routehash(peer, pfx, pathid);
+
+    ribroute_t **ptr = findroute(eng, hash, peer, pfx, pathid);
+    ribroute_t *r = ptr ? *ptr : getfreeroute(eng);
+    if (unlikely(!r || logroute(eng, peer, pfx, pathid, attrs) != MRT_ENOERR)) {
+        if (r && !ptr) {
+            r->next         = eng->freeroutes;
+            eng->freeroutes = r;
+        }
+
+        attrstore_unref(eng->store, attrs);
+        return MRT_ENOMEM;
+    }
+    if (ptr) {
+        attrstore_unref(eng->store, r->attrs);
+        r->attrs = attrs;
+        return MRT_ENOERR;
+    }
+
+    r->hash   = hash;
+    r->peer   = peer;
+    r->pathid = pathid;
+    r->pfx    = *pfx;
+    r->attrs  = attrs;
+
+    ribroute_t **head = &eng->buckets[hash & (eng->nbuckets - 1)];
+    r->next = *head;
+    *head   = r;
+
+    eng->peers[peer].nroutes++;
+    if (++eng->nroutes > eng->nbuckets)
+        rehash(eng);
+
+    return MRT_ENOERR;
+}
+
+static int delroute(ribengine_t *eng, size_t peer, const netaddr_t *pfx, uint32_t pathid)
+{
+    netaddr_t key;
+    canonpfx(&key, pfx);
+
+    ribroute_t **ptr = findroute(eng, routehash(peer, &key, pathid), peer, &key, pathid);
+    if (!ptr)
+        return MRT_ENOERR;  // withdrawal of an unknown route, nothing to do
+    if (unlikely(logroute(eng, peer, &key, pathid, NULL) != MRT_ENOERR))
+        return MRT_ENOMEM;
+
+    ribroute_t *r = *ptr;
+    *ptr = r->next;
+
+    attrstore_unref(eng->store, r->attrs);
+    r->next         = eng->freeroutes;
+    eng->freeroutes = r;
+
+    eng->peers[peer].nroutes--;
+    eng->nroutes--;
+    return MRT_ENOERR;
+}
+
+// session went down, scans the whole table but it's seldom done
+static int clearpeer(ribengine_t *eng, size_t peer)
+{
+    for (size_t i = 0; i < eng->nbuckets && eng->peers[peer].nroutes > 0; i++) {
+        ribroute_t **ptr = &eng->buckets[i];
+        while (*ptr) {
+            ribroute_t *r = *ptr;
+            if (r->peer != peer) {
+                ptr = &r->next;
+                continue;
+            }
+            if (unlikely(logroute(eng, peer, &r->pfx, r->pathid, NULL) != MRT_ENOERR))
+                return MRT_ENOMEM;
+
+            *ptr = r->next;
+
+            attrstore_unref(eng->store, r->attrs);
+            r->next         = eng->freeroutes;
+            eng->freeroutes = r;
+
+            eng->peers[peer].nroutes--;
+            eng->nroutes--;
+        }
+    }
+    return MRT_ENOERR;
+}
+
+const attrref_t *ribengine_lookup(const ribengine_t *eng, size_t peer, const netaddr_t *pfx, uint32_t pathid)
+{
+    if (unlikely(peer >= eng->npeers))
+        return NULL;
+
+    netaddr_t key;
+    canonpfx(&key, pfx);
+
+    ribroute_t **ptr = findroute(eng, routehash(peer, &key, pathid), peer, &key, pathid);
+    return ptr ? (*ptr)->attrs : NULL;
+}
+
+int ribengine_foreach(const ribengine_t *eng, size_t peer, ribroutefunc_t fn, void *arg)
+{
+    size_t left;  // routes still to be visited, stop scanning once done
+    if (peer == SIZE_MAX)
+        left = eng->nroutes;
+    else if (likely(peer < eng->npeers))
+        left = eng->peers[peer].nroutes;
+    else
+        return 0;
+
+    for (size_t i = 0; i < eng->nbuckets && left > 0; i++) {
+        for (const ribroute_t *r = eng->buckets[i]; r; r = r->next) {
+            if (peer != SIZE_MAX && r->peer != peer)
+                continue;
+
+            int res = fn(r->peer, &r->pfx, r->pathid, r->attrs, arg);
+            if (res != 0)
+                return res;
+
+            left--;
+        }
+    }
+    return 0;
+}
+
+// loading and applying ========================================================
+
+// rebuild AS_PATH with 32 bits ASes, reconciled with AS4_PATH (RFC 6793)
+static int putaspath32(unsigned char *dst, size_t cap, int flags, bgp_msg_t *bgp, size_t *psize)
+{
+    if (unlikely(cap < ATTR_EXTENDED_HEADER_SIZE))
+        return BGP_EBADATTR;
+
+    bgpattr_t *attr = (bgpattr_t *) dst;
+    attr->flags    = flags | ATTR_EXTENDED_LENGTH;
+    attr->code     = AS_PATH_CODE;
+    attr->exlen[0] = 0;
+    attr->exlen[1] = 0;
+
+    int res = startrealaspath_r(bgp);
+    if (unlikely(res != BGP_ENOERR))
+        return res;
+
+    uint32_t seg[AS_SEGMENT_COUNT_MAX];
+    size_t count = 0;
+    size_t size  = ATTR_EXTENDED_HEADER_SIZE;
+
+    int type = AS_SEGMENT_SEQ, segno = -1;
+    while (true) {
+        const as_pathent_t *ent = nextaspath_r(bgp);
+        if (count > 0 && (!ent || ent->segno != segno || count == nelems(seg))) {
+            size += AS_SEGMENT_HEADER_SIZE + count * sizeof(*seg);
+            if (unlikely(size > cap || !putasseg32(attr, type, seg, count))) {
+                res = BGP_EBADATTR;  // can't grow any further
+                break;
+            }
+
+            count = 0;
+        }
+        if (!ent)
+            break;
+
+        type  = ent->type;
+        segno = ent->segno;
+        seg[count++] = ent->as;
+    }
+
+    int err = bgperror_r(bgp);
+    endaspath_r(bgp);
+    if (res == BGP_ENOERR)
+        res = err;
+    if (unlikely(res != BGP_ENOERR))
+        return res;
+
+    // use the short form whenever possible
+    size_t len = size - ATTR_EXTENDED_HEADER_SIZE;
+    if (len <= ATTR_LENGTH_MAX) {
+        memmove(attr->data, attr->exdata, len);
+        attr->flags &= ~ATTR_EXTENDED_LENGTH;
+        attr->len    = len;
+        size--;
+    }
+
+    *psize = size;
+    return BGP_ENOERR;
+}
+
+// truncate MP_REACH_NLRI to its next hop, as TABLE_DUMPV2 RIB entries do
+// (RFC 6396), returns 0 if malformed
+static size_t putmpreachnhop(unsigned char *dst, const bgpattr_t *attr)
+{
+    size_t len;
+    const unsigned char *ptr = getattrlen(attr, &len);
+
+    // full attribute from an UPDATE (or a nonstandard RIB entry):
+    // a zero next hop length is meaningless, but AFI always starts with 0
+    if (len > 0 && ptr[0] == 0) {
+        if (unlikely(len < MP_REACH_BASE_LEN))
+            return 0;
+
+        ptr += sizeof(uint16_t) + sizeof(uint8_t);  // skip AFI and SAFI
+        len -= sizeof(uint16_t) + sizeof(uint8_t);
+    }
+
+    if (unlikely(len == 0 || ptr[0] >= ATTR_LENGTH_MAX || ptr[0] + 1u > len))
+        return 0;
+
+    len = ptr[0] + 1;  // next hop length and next hop
+
+    bgpattr_t *mp = (bgpattr_t *) dst;
+    mp->flags = attr->flags & ~ATTR_EXTENDED_LENGTH;
+    mp->code  = MP_REACH_NLRI_CODE;
+    mp->len   = len;
+    memcpy(mp->data, ptr, len);
+    return ATTR_HEADER_SIZE + len;
+}
+
+// 32 bits AGGREGATOR, taken from AS4_AGGREGATOR where appropriate
+static size_t putaggregator32(unsigned char *dst, const bgpattr_t *attr, bgp_msg_t *bgp)
+{
+    size_t len;
+    getattrlen(attr, &len);
+
+    const bgpattr_t *real = getrealbgpaggregator_r(bgp);
+    if (unlikely(len != AGGREGATOR_AS16_LENGTH || !real))
+        return 0;
+
+    getattrlen(real, &len);
+    if (unlikely(real != attr && len != AS4_AGGREGATOR_LENGTH))
+        real = attr;  // ignore a malformed AS4_AGGREGATOR
+
+    bgpattr_t *aggr = (bgpattr_t *) dst;
+    aggr->flags = attr->flags & ~ATTR_EXTENDED_LENGTH;
+    aggr->code  = AGGREGATOR_CODE;
+    aggr->len   = AGGREGATOR_AS32_LENGTH;
+    setaggregator(aggr, getaggregatoras(real), sizeof(uint32_t), getaggregatoraddress(real));
+    return ATTR_HEADER_SIZE + AGGREGATOR_AS32_LENGTH;
+}
+
+/**
+ * Copy attributes into the engine buffer, in the canonical form used by
+ * TABLE_DUMPV2 RIB entries (RFC 6396): ASes are 32 bits wide, MP_REACH_NLRI
+ * retains its next hop only, MP_UNREACH_NLRI is dropped.
+ * Attributes come from a RIB entry if bgp is NULL, from the UPDATE inside
+ * bgp otherwise, whose AS path is reconciled with AS4_PATH when needed.
+ */
+static int canonattrs(ribengine_t *eng, const void *attrs, size_t n, bgp_msg_t *bgp, size_t *plen)
+{
+    bool as16 = bgp && !isbgpasn32bit_r(bgp);
+
+    const unsigned char *src = attrs;
+    unsigned char *dst = eng->attrbuf;
+
+    size_t len = 0;
+    while (n >= ATTR_HEADER_SIZE) {
+        const bgpattr_t *attr = (const bgpattr_t *) src;
+
+        size_t hdrsize = (attr->flags & ATTR_EXTENDED_LENGTH) ? ATTR_EXTENDED_HEADER_SIZE : ATTR_HEADER_SIZE;
+        if (unlikely(n < hdrsize))
+            break;
+
+        size_t size;
+        getattrlen(attr, &size);
+        size += hdrsize;
+        if (unlikely(size > n))
+            break;  // truncated, keep what is valid
+
+        // every rewrite but AS_PATH's is never larger than the source
+        size_t avail = sizeof(eng->attrbuf) - len;
+        if (unlikely(size > avail))
+            break;
+
+        size_t m = size;
+        switch (attr->code) {
+        case MP_REACH_NLRI_CODE:
+            m = putmpreachnhop(dst + len, attr);
+            break;
+        case MP_UNREACH_NLRI_CODE:
+            m = 0;
+            break;
+        case AS_PATH_CODE:
+            if (as16) {
+                int res = putaspath32(dst + len, avail, attr->flags & ~ATTR_EXTENDED_LENGTH, bgp, &m);
+                if (unlikely(res != BGP_ENOERR))
+                    return res;
+            } else {
+                memcpy(dst + len, src, size);
+            }
+            break;
+        case AGGREGATOR_CODE:
+            if (as16)
+                m = putaggregator32(dst + len, attr, bgp);
+            else
+                memcpy(dst + len, src, size);
+            break;
+        case AS4_PATH_CODE:
+        case AS4_AGGREGATOR_CODE:
+            if (as16) {
+                m = 0;  // already merged
+                break;
+            }
+            // fallthrough
+        default:
+            memcpy(dst + len, src, size);
+            break;
+        }
+
+        len += m;
+        src += size;
+        n   -= size;
+    }
+
+    *plen = len;
+    return BGP_ENOERR;
+}
+
+static bool isunicastrib(int subtype)
+{
+    switch (subtype) {
+    case MRT_TABLE_DUMPV2_RIB_IPV4_UNICAST:
+    case MRT_TABLE_DUMPV2_RIB_IPV6_UNICAST:
+    case MRT_TABLE_DUMPV2_RIB_IPV4_UNICAST_ADDPATH:
+    case MRT_TABLE_DUMPV2_RIB_IPV6_UNICAST_ADDPATH:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// map translates Peer Index positions to engine peers, resolved lazily
+static int loadrib(ribengine_t *eng, mrt_msg_t *msg, const peer_index_t *pi, size_t *map)
+{
+    int res = setribpeerindex_r(msg, pi);
+    if (unlikely(res != MRT_ENOERR))
+        return res;
+
+    const rib_header_t *rib = startribents_r(msg, NULL);
+    if (unlikely(!rib))
+        return mrterror_r(msg);
+
+    netaddr_t pfx;
+    canonpfx(&pfx, &rib->nlri);
+
+    rib_entry_t *ent;
+    while ((ent = nextribent_r(msg)) != NULL) {
+        if (unlikely(ent->peer_idx >= pi->npeers)) {
+            res = MRT_EBADRIBENT;
+            break;
+        }
+
+        size_t peer = map[ent->peer_idx];
+        if (peer == SIZE_MAX) {
+            peer = getpeer(eng, ent->peer->as, &ent->peer->addr);
+            if (unlikely(peer == SIZE_MAX)) {
+                res = MRT_ENOMEM;
+                break;
+            }
+
+            map[ent->peer_idx] = peer;
+        }
+
+        size_t len;
+        canonattrs(eng, ent->attrs, ent->attr_length, NULL, &len);  // never fails for RIB entries
+
+        const attrref_t *attrs = attrstore_intern(eng->store, peer, eng->attrbuf, len);
+        if (unlikely(!attrs)) {
+            res = MRT_ENOMEM;
+            break;
+        }
+
+        res = putroute(eng, peer, &pfx, ent->pathid, attrs);
+        if (unlikely(res != MRT_ENOERR))
+            break;
+    }
+
+    int err = endribents_r(msg);
+    return (res != MRT_ENOERR) ? res : err;
+}
+
+int ribengine_loaddump(ribengine_t *eng, io_rw_t *io)
+{
+    peer_index_t *pi = NULL;
+    size_t *map = NULL;
+
+    mrt_msg_t msg;
+    int res;
+    while ((res = setmrtreadfrom_r(&msg, io)) == MRT_ENOERR) {
+        const mrt_header_t *hdr = getmrtheader_r(&msg);
+        if (hdr->stamp.tv_sec > eng->stamp)
+            eng->stamp = hdr->stamp.tv_sec;
+
+        if (hdr->type == MRT_TABLE_DUMPV2 && hdr->subtype == MRT_TABLE_DUMPV2_PEER_INDEX_TABLE) {
+            freepeerindex(pi);
+            free(map);
+            map = NULL;
+
+            res = newpeerindex_r(&msg, &pi);
+            if (res == MRT_ENOERR) {
+                map = malloc(pi->npeers * sizeof(*map) + 1);
+                if (likely(map)) {
+                    for (size_t i = 0; i < pi->npeers; i++)
+                        map[i] = SIZE_MAX;
+                } else {
+                    res = MRT_ENOMEM;
+                }
+            } else {
+                pi = NULL;
+            }
+        } else if (hdr->type == MRT_TABLE_DUMPV2 && isunicastrib(hdr->subtype)) {
+            res = (pi && map) ? loadrib(eng, &msg, pi, map) : MRT_ENEEDSPEERIDX;
+        }
+
+        int err = mrtclose_r(&msg);
+        if (res == MRT_ENOERR)
+            res = err;
+        if (unlikely(res != MRT_ENOERR))
+            break;
+    }
+
+    freepeerindex(pi);
+    free(map);
+
+    if (res == MRT_EIO && !io->error(io))
+        res = MRT_ENOERR;  // regular end of stream
+    if (unlikely(res != MRT_ENOERR))
+        return res;
+
+    eng->lastckpt = eng->stamp;
+    return ribengine_checkpoint(eng, 0);
+}
+
+static int pushpfx(ribengine_t *eng, const void *ptr, bool addpath)
+{
+    if (eng->npfxs == eng->pfxscap) {
+        size_t newcap = max(eng->pfxscap * 2, RIB_PAGESIZ);
+        netaddrap_t *pfxs = realloc(eng->pfxs, newcap * sizeof(*pfxs));
+        if (unlikely(!pfxs))
+            return MRT_ENOMEM;
+
+        eng->pfxs    = pfxs;
+        eng->pfxscap = newcap;
+    }
+
+    netaddrap_t *ap = &eng->pfxs[eng->npfxs++];
+    if (addpath) {
+        *ap = *(const netaddrap_t *) ptr;
+    } else {
+        ap->pfx    = *(const netaddr_t *) ptr;
+        ap->pathid = 0;
+    }
+    return MRT_ENOERR;
+}
+
+static int applyupdate(ribengine_t *eng, mrt_msg_t *msg, size_t peer)
+{
+    size_t n;
+    void *data = unwrapbgp4mp_r(msg, &n);
+    if (unlikely(!data))
+        return mrterror_r(msg);
+
+    bool addpath = ismrtaddpath_r(msg);
+
+    int flags = BGPF_NOCOPY;
+    if (addpath)
+        flags |= BGPF_ADDPATH;
+    if (ismrtasn32bit_r(msg))
+        flags |= BGPF_ASN32BIT;
+
+    bgp_msg_t *bgp = &eng->bgp;
+
+    int res = setbgpread_r(bgp, data, n, flags);
+    if (unlikely(res != BGP_ENOERR))
+        return res;
+    if (getbgptype_r(bgp) != BGP_UPDATE)
+        return bgpclose_r(bgp);
+
+    // the whole record is decoded before touching the engine,
+    // so a malformed field leaves it untouched
+    size_t len;
+    const void *raw = getbgpattribs_r(bgp, &len);
+    if (raw)
+        res = canonattrs(eng, raw, len, bgp, &len);
+
+    void *ptr;
+
+    eng->npfxs = 0;
+    if (res == BGP_ENOERR)
+        res = startallwithdrawn_r(bgp);
+    if (res == BGP_ENOERR) {
+        while (res == MRT_ENOERR && (ptr = nextwithdrawn_r(bgp)) != NULL)
+            res = pushpfx(eng, ptr, addpath);
+
+        endwithdrawn_r(bgp);
+    }
+
+    size_t nwithdrawn = eng->npfxs;
+    if (res == BGP_ENOERR)
+        res = bgperror_r(bgp);
+    if (res == BGP_ENOERR && raw)
+        res = startallnlri_r(bgp);
+    if (res == BGP_ENOERR && raw) {
+        while (res == MRT_ENOERR && (ptr = nextnlri_r(bgp)) != NULL)
+            res = pushpfx(eng, ptr, addpath);
+
+        endnlri_r(bgp);
+    }
+    if (res == BGP_ENOERR)
+        res = bgperror_r(bgp);
+
+    int err = bgpclose_r(bgp);
+    if (res == BGP_ENOERR)
+        res = err;
+    if (unlikely(res != BGP_ENOERR))
+        return res;
+
+    // withdrawals first, the same prefix may be announced again in NLRI
+    for (size_t i = 0; i < nwithdrawn; i++) {
+        res = delroute(eng, peer, &eng->pfxs[i].pfx, eng->pfxs[i].pathid);
+        if (unlikely(res != MRT_ENOERR))
+            return res;
+    }
+    if (eng->npfxs == nwithdrawn)
+        return MRT_ENOERR;
+
+    const attrref_t *attrs = attrstore_intern(eng->store, peer, eng->attrbuf, len);
+    if (unlikely(!attrs))
+        return MRT_ENOMEM;
+
+    for (size_t i = nwithdrawn; i < eng->npfxs; i++) {
+        netaddr_t pfx;
+        canonpfx(&pfx, &eng->pfxs[i].pfx);
+        res = putroute(eng, peer, &pfx, eng->pfxs[i].pathid, attrstore_ref(attrs));
+        if (unlikely(res != MRT_ENOERR))
+            break;
+    }
+
+    attrstore_unref(eng->store, attrs);
+    return res;
+}
+
+int ribengine_apply(ribengine_t *eng, mrt_msg_t *msg, uint64_t off)
+{
+    const mrt_header_t *hdr = getmrtheader_r(msg);
+    if (unlikely(!hdr))
+        return mrterror_r(msg);
+
+    if (hdr->type != MRT_BGP4MP && hdr->type != MRT_BGP4MP_ET)
+        return MRT_ENOERR;
+
+    if (eng->interval > 0 && hdr->stamp.tv_sec >= eng->lastckpt + eng->interval) {
+        int res = ribengine_checkpoint(eng, off);
+        if (unlikely(res != MRT_ENOERR))
+            return res;
+
+        eng->lastckpt = hdr->stamp.tv_sec;
+    }
+
+    eng->stamp = hdr->stamp.tv_sec;
+    eng->off   = off + hdr->len + RIB_MRTHDRSIZ;
+
+    const bgp4mp_header_t *bgp4mp = getbgp4mpheader_r(msg);
+    if (unlikely(!bgp4mp))
+        return mrterror_r(msg);
+
+    size_t peer;
+    switch (hdr->subtype) {
+    case BGP4MP_STATE_CHANGE:
+    case BGP4MP_STATE_CHANGE_AS4:
+        if (bgp4mp->old_state == RIB_ESTABLISHED && bgp4mp->new_state != RIB_ESTABLISHED) {
+            peer = ribengine_findpeer(eng, bgp4mp->peer_as, &bgp4mp->peer_addr);
+            if (peer != SIZE_MAX)
+                return clearpeer(eng, peer);
+        }
+
+        return MRT_ENOERR;
+
+    case BGP4MP_MESSAGE:
+    case BGP4MP_MESSAGE_AS4:
+    case BGP4MP_MESSAGE_ADDPATH:
+    case BGP4MP_MESSAGE_AS4_ADDPATH:
+        peer = getpeer(eng, bgp4mp->peer_as, &bgp4mp->peer_addr);
+        if (unlikely(peer == SIZE_MAX))
+            return MRT_ENOMEM;
+
+        return applyupdate(eng, msg, peer);
+
+    default:
+        return MRT_ENOERR;  // locally originated messages and deprecated subtypes
+    }
+}
+
+// apply records from io, starting at offset off, up to time until
+static int replayuntil(ribengine_t *eng, io_rw_t *io, uint64_t off, bool bounded, time_t until)
+{
+    mrt_msg_t msg;
+    int res;
+    while ((res = setmrtreadfrom_r(&msg, io)) == MRT_ENOERR) {
+        const mrt_header_t *hdr = getmrtheader_r(&msg);
+        if (bounded && hdr->stamp.tv_sec > until) {
+            mrtclose_r(&msg);
+            return MRT_ENOERR;
+        }
+
+        res = ribengine_apply(eng, &msg, off);
+        off += hdr->len + RIB_MRTHDRSIZ;
+
+        mrtclose_r(&msg);
+
+        // BGP_ENOMEM and MRT_ENOMEM share the same value
+        if (unlikely(res == MRT_ENOMEM))
+            return res;
+    }
+
+    if (res == MRT_EIO && !io->error(io))
+        res = MRT_ENOERR;  // regular end of stream
+
+    return res;
+}
+
+int ribengine_replay(ribengine_t *eng, io_rw_t *io)
+{
+    return replayuntil(eng, io, eng->off, false, 0);
+}
+
+// checkpoints =================================================================
+
+static int keycmp(const ckroute_t *a, const ckroute_t *b)
+{
+    if (a->peer != b->peer)
+        return (a->peer > b->peer) - (a->peer < b->peer);
+    if (a->pathid != b->pathid)
+        return (a->pathid > b->pathid) - (a->pathid < b->pathid);
+    if (a->pfx.family != b->pfx.family)
+        return a->pfx.family - b->pfx.family;
+    if (a->pfx.bitlen != b->pfx.bitlen)
+        return a->pfx.bitlen - b->pfx.bitlen;
+
+    return memcmp(a->pfx.bytes, b->pfx.bytes, sizeof(a->pfx.bytes));
+}
+
+static int ckroutecmp(const void *a, const void *b)
+{
+    const ckroute_t *ca = a, *cb = b;
+
+    int res = keycmp(ca, cb);
+    if (res == 0)
+        res = (ca->seq > cb->seq) - (ca->seq < cb->seq);
+
+    return res;
+}
+
+static void freeckpt(ribengine_t *eng, ribckpt_t *ck)
+{
+    for (size_t i = 0; i < ck->nroutes; i++) {
+        if (ck->routes[i].attrs)
+            attrstore_unref(eng->store, ck->routes[i].attrs);
+    }
+
+    free(ck->routes);
+}
+
+// sort the log by key, retaining only the last change of each route
+static size_t compactlog(ribengine_t *eng)
+{
+    qsort(eng->log, eng->nlog, sizeof(*eng->log), ckroutecmp);
+
+    size_t n = 0;
+    for (size_t i = 0; i < eng->nlog; i++) {
+        ckroute_t *c = &eng->log[i];
+        if (i + 1 < eng->nlog && keycmp(c, c + 1) == 0) {
+            if (c->attrs)
+                attrstore_unref(eng->store, c->attrs);
+
+            continue;
+        }
+
+        eng->log[n++] = *c;
+    }
+    return n;
+}
+
+// apply the changes inside ckpts[1] to the whole state inside ckpts[0],
+// which is then dropped
+static int foldckpt(ribengine_t *eng)
+{
+    ribckpt_t *base = &eng->ckpts[0];
+    ribckpt_t *next = &eng->ckpts[1];
+
+    ckroute_t *routes = malloc((base->nroutes + next->nroutes) * sizeof(*routes) + 1);
+    if (unlikely(!routes))
+        return MRT_ENOMEM;
+
+    // both are sorted, plain merge, references are moved over
+    size_t i = 0, j = 0, n = 0;
+    while (i < base->nroutes || j < next->nroutes) {
+        int cmp;
+        if (i == base->nroutes)
+            cmp = 1;
+        else if (j == next->nroutes)
+            cmp = -1;
+        else
+            cmp = keycmp(&base->routes[i], &next->routes[j]);
+
+        if (cmp < 0) {
+            routes[n++] = base->routes[i++];
+            continue;
+        }
+        if (cmp == 0)
+            attrstore_unref(eng->store, base->routes[i++].attrs);
+
+        const ckroute_t *c = &next->routes[j++];
+        if (c->attrs)
+            routes[n++] = *c;
+    }
+
+    free(base->routes);
+    free(next->routes);
+    next->routes  = routes;
+    next->nroutes = n;
+
+    memmove(&eng->ckpts[0], &eng->ckpts[1], (eng->nckpts - 1) * sizeof(*eng->ckpts));
+    eng->nckpts--;
+    return MRT_ENOERR;
+}
+
+int ribengine_checkpoint(ribengine_t *eng, uint64_t off)
+{
+    if (eng->nckpts == eng->ckptscap) {
+        size_t newcap = eng->ckptscap + RIB_GROWSTEP;
+        ribckpt_t *ckpts = realloc(eng->ckpts, newcap * sizeof(*ckpts));
+        if (unlikely(!ckpts))
+            return MRT_ENOMEM;
+
+        eng->ckpts    = ckpts;
+        eng->ckptscap = newcap;
+    }
+
+    ribckpt_t ck;
+    ck.stamp  = eng->stamp;
+    ck.off    = off;
+    ck.npeers = eng->npeers;
+    if (eng->nckpts == 0) {
+        // first checkpoint, flat copy, attributes are shared with the live state
+        ck.nroutes = eng->nroutes;
+        ck.routes  = malloc(eng->nroutes * sizeof(*ck.routes) + 1);
+        if (unlikely(!ck.routes))
+            return MRT_ENOMEM;
+
+        ckroute_t *dst = ck.routes;
+        for (size_t i = 0; i < eng->nbuckets; i++) {
+            for (const ribroute_t *r = eng->buckets[i]; r; r = r->next) {
+                dst->peer   = r->peer;
+                dst->pathid = r->pathid;
+                dst->pfx    = r->pfx;
+                dst->seq    = 0;
+                dst->attrs  = attrstore_ref(r->attrs);
+                dst++;
+            }
+        }
+
+        qsort(ck.routes, ck.nroutes, sizeof(*ck.routes), ckroutecmp);
+    } else {
+        // any other only takes over the changes logged since the last one
+        ck.nroutes = compactlog(eng);
+        ck.routes  = realloc(eng->log, ck.nroutes * sizeof(*ck.routes) + 1);
+        if (unlikely(!ck.routes))
+            ck.routes = eng->log;  // can't shrink it, keep it as is
+
+        eng->nlog   = 0;
+        eng->logcap = 0;
+        eng->log    = NULL;
+    }
+
+    eng->ckpts[eng->nckpts++] = ck;
+    if (eng->maxckpts > 0 && eng->nckpts > eng->maxckpts)
+        return foldckpt(eng);
+
+    return MRT_ENOERR;
+}
+
+size_t ribengine_ncheckpoints(const ribengine_t *eng)
+{
+    return eng->nckpts;
+}
+
+// restore state as of checkpoint n, from the first one onwards
+static int restore(ribengine_t *view, const ribengine_t *eng, size_t n)
+{
+    const ribckpt_t *ck = &eng->ckpts[n];
+    for (size_t i = 0; i < ck->npeers; i++) {
+        if (unlikely(addpeer(view, eng->peers[i].peer_as, &eng->peers[i].peer_addr) == SIZE_MAX))
+            return MRT_ENOMEM;
+    }
+    for (size_t i = 0; i <= n; i++) {
+        ck = &eng->ckpts[i];
+        for (size_t j = 0; j < ck->nroutes; j++) {
+            const ckroute_t *r = &ck->routes[j];
+
+            int res;
+            if (r->attrs)
+                res = putroute(view, r->peer, &r->pfx, r->pathid, attrstore_ref(r->attrs));
+            else
+                res = delroute(view, r->peer, &r->pfx, r->pathid);
+
+            if (unlikely(res != MRT_ENOERR))
+                return res;
+        }
+    }
+
+    view->stamp = ck->stamp;
+    view->off   = ck->off;
+    return MRT_ENOERR;
+}
+
+int ribengine_query(ribengine_t *eng, time_t t, io_rw_t *io, ribengine_t **pview)
+{
+    // last checkpoint not following t
+    size_t lo = 0, hi = eng->nckpts;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (eng->ckpts[mid].stamp <= t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return MRT_EINVOP;
+
+    const ribckpt_t *ck = &eng->ckpts[lo - 1];
+
+    ribengine_t *view = newengine(eng->store, 0, 0);
+    if (unlikely(!view))
+        return MRT_ENOMEM;
+
+    int res = restore(view, eng, lo - 1);
+    if (res == MRT_ENOERR)
+        res = mrttseekpoint(io, &(mrttpoint_t) { .off = ck->off });
+    if (res == MRT_ENOERR)
+        res = replayuntil(view, io, ck->off, true, t);
+
+    if (unlikely(res != MRT_ENOERR)) {
+        ribengine_destroy(view);
+        return res;
+    }
+
+    *pview = view;
+    return MRT_ENOERR;
+}
+
+time_t ribengine_time(const ribengine_t *eng)
+{
+    return eng->stamp;
+}
+
+void ribengine_destroy(ribengine_t *eng)
+{
+    for (size_t i = 0; i < eng->nckpts; i++)
+        freeckpt(eng, &eng->ckpts[i]);
+    for (size_t i = 0; i < eng->nlog; i++) {
+        if (eng->log[i].attrs)
+            attrstore_unref(eng->store, eng->log[i].attrs);
+    }
+
+    for (size_t i = 0; i < eng->nbuckets; i++) {
+        for (const ribroute_t *r = eng->buckets[i]; r; r = r->next)
+            attrstore_unref(eng->store, r->attrs);
+    }
+
+    ribpage_t *p = eng->pages;
+    while (p) {
+        ribpage_t *next = p->next;
+
+        free(p);
+        p = next;
+    }
+
+    if (eng->ownstore)
+        attrstore_destroy(eng->store);
+
+    free(eng->pfxs);
+    free(eng->log);
+    free(eng->ckpts);
+    free(eng->buckets);
+    free(eng->slots);
+    free(eng->peers);
+    free(eng);
+}
@@ -47,6 +47,15 @@ int main(void)
     if (!CU_add_test(suite, "test for simple open packet read", testopenread))
         goto error;
 
+    if (!CU_add_test(suite, "test for update attributes index", testupdateindex))
+        goto error;
+
+    if (!CU_add_test(suite, "test for update bulk prefix decoding", testupdateprefixes))
+        goto error;
+
+    if (!CU_add_test(suite, "test for update real AS path decoding", testupdaterealaspath))
+        goto error;
+
     if (!CU_add_test(suite, "test for string to community", testcommunityconv))
         goto error;
 
@@ -37,6 +37,12 @@ void testopenread(void);
 
 void testupdateread(void);
 
+void testupdateindex(void);
+
+void testupdateprefixes(void);
+
+void testupdaterealaspath(void);
+
 void testcommunityconv(void);
 
 void testlargecommunityconv(void);
@@ -31,6 +31,7 @@
 #include <CUnit/CUnit.h>
 #include <isolario/bgp.h>
 #include <isolario/bgpparams.h>
+#include <isolario/endian.h>
 #include <isolario/util.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -45,3 +46,301 @@ void testupdateread(void)
     CU_ASSERT_EQUAL(bgpclose(), BGP_ENOERR);
 }
 
+enum {
+    BGP_HEADER_SIZE = 19
+};
+
+static size_t makeupdate(unsigned char *pkt,
+                         const void *wdrn, size_t wlen,
+                         const void *attrs, size_t alen,
+                         const void *nlri, size_t nlen)
+{
+    size_t n = BGP_HEADER_SIZE;
+
+    memset(pkt, 0xff, 16);
+    pkt[18] = BGP_UPDATE;
+
+    pkt[n++] = wlen >> 8;
+    pkt[n++] = wlen & 0xff;
+    if (wlen > 0)
+        memcpy(&pkt[n], wdrn, wlen);
+
+    n += wlen;
+    pkt[n++] = alen >> 8;
+    pkt[n++] = alen & 0xff;
+    memcpy(&pkt[n], attrs, alen);
+    n += alen;
+    if (nlen > 0)
+        memcpy(&pkt[n], nlri, nlen);
+
+    n += nlen;
+
+    pkt[16] = n >> 8;
+    pkt[17] = n & 0xff;
+    return n;
+}
+
+void testupdateindex(void)
+{
+    static const unsigned char attrs[] = {
+        0x40, ORIGIN_CODE, 1, ORIGIN_IGP,
+        0x40, AS_PATH_CODE, 6, AS_SEGMENT_SEQ, 2, 0x00, 0x01, 0x00, 0x02,
+        0xc0, 99, 2, 0xab, 0xcd,                      // unknown attribute
+        0xd0, 100, 0x00, 0x01, 0xee                   // unknown, extended length
+    };
+
+    static const unsigned char nlri[] = {
+        24, 10, 0, 0  // 10.0.0.0/24
+    };
+
+    unsigned char pkt[64];
+    size_t n = makeupdate(pkt, NULL, 0, attrs, sizeof(attrs), nlri, sizeof(nlri));
+
+    for (int i = 0; i < 2; i++) {
+        int flags = (i == 0) ? BGPF_INDEXATTRS : BGPF_DEFAULT;
+        CU_ASSERT_EQUAL_FATAL(setbgpread(pkt, n, flags), BGP_ENOERR);
+
+        bgpattr_t *attr = getbgpattrib(99);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(attr);
+        CU_ASSERT_EQUAL(attr->code, 99);
+        CU_ASSERT_EQUAL(attr->len, 2);
+        CU_ASSERT_EQUAL(attr->data[1], 0xcd);
+
+        attr = getbgpattrib(100);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(attr);
+        CU_ASSERT_EQUAL(attr->exdata[0], 0xee);
+
+        attr = getbgpaspath();
+        CU_ASSERT_PTR_NOT_NULL_FATAL(attr);
+        CU_ASSERT_EQUAL(attr->code, AS_PATH_CODE);
+        CU_ASSERT_PTR_EQUAL(getbgpattrib(ORIGIN_CODE), getbgporigin());
+        CU_ASSERT_PTR_NULL(getbgpcommunities());
+        CU_ASSERT_PTR_NULL(getbgpattrib(101));
+
+        int count = 0;
+        startbgpattribs();
+        while ((attr = nextbgpattrib()) != NULL)
+            count++;
+
+        CU_ASSERT_EQUAL(endbgpattribs(), BGP_ENOERR);
+        CU_ASSERT_EQUAL(count, 4);
+
+        count = 0;
+        startnlri();
+        while (nextnlri())
+            count++;
+
+        CU_ASSERT_EQUAL(endnlri(), BGP_ENOERR);
+        CU_ASSERT_EQUAL(count, 1);
+        CU_ASSERT_EQUAL(bgpclose(), BGP_ENOERR);
+    }
+
+    // last attribute overflows the Path Attributes field
+    pkt[BGP_HEADER_SIZE + 3]--;  // attributes length low byte
+    CU_ASSERT_EQUAL(setbgpread(pkt, n, BGPF_INDEXATTRS), BGP_EBADATTR);
+}
+
+void testupdateprefixes(void)
+{
+    static const unsigned char wdrn[] = {
+        8, 10,           // 10.0.0.0/8
+        22, 192, 168, 4  // 192.168.4.0/22
+    };
+    static const unsigned char attrs[] = {
+        0x40, ORIGIN_CODE, 1, ORIGIN_IGP,
+        // MP_REACH_NLRI, IPv6 unicast, 2001:db8::/32
+        0x80, MP_REACH_NLRI_CODE, 26, 0x00, AFI_IPV6, SAFI_UNICAST, 16,
+        0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+        0,
+        32, 0x20, 0x01, 0x0d, 0xb8,
+        // MP_UNREACH_NLRI, IPv6 unicast, 2001:db8:1::/48
+        0x80, MP_UNREACH_NLRI_CODE, 10, 0x00, AFI_IPV6, SAFI_UNICAST,
+        48, 0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01
+    };
+    static const unsigned char nlri[] = {
+        24, 10, 1, 2,  // 10.1.2.0/24
+        0,             // 0.0.0.0/0
+        32, 1, 2, 3, 4 // 1.2.3.4/32
+    };
+    static const unsigned char apnlri[] = {
+        0, 0, 0, 7, 24, 10, 1, 2,  // 10.1.2.0/24, path id 7
+        0, 0, 1, 0, 0              // 0.0.0.0/0, path id 256
+    };
+
+    unsigned char pkt[128];
+    netaddr_t addrs[4], expect;
+    netaddrap_t aps[4];
+
+    size_t n = makeupdate(pkt, wdrn, sizeof(wdrn), attrs, sizeof(attrs), nlri, sizeof(nlri));
+    CU_ASSERT_EQUAL_FATAL(setbgpread(pkt, n, BGPF_DEFAULT), BGP_ENOERR);
+
+    CU_ASSERT_EQUAL(getwithdrawnprefixes(addrs, nelems(addrs)), 2);
+    stonaddr(&expect, "192.168.4.0");
+    expect.bitlen = 22;
+    CU_ASSERT_EQUAL(addrs[1].family, AF_INET);
+    CU_ASSERT(prefixeq(&addrs[1], &expect));
+
+    // only the first prefix fits, but every prefix is counted
+    CU_ASSERT_EQUAL(getnlriprefixes(addrs, 1), 3);
+    CU_ASSERT_EQUAL(addrs[0].bitlen, 24);
+    CU_ASSERT_EQUAL(addrs[0].bytes[2], 2);
+    CU_ASSERT_EQUAL(getnlriprefixes(addrs, nelems(addrs)), 3);
+    CU_ASSERT_EQUAL(addrs[1].bitlen, 0);
+    CU_ASSERT_EQUAL(addrs[2].u32[0], htonl(0x01020304));
+
+    CU_ASSERT_EQUAL(getmpreachprefixes(addrs, nelems(addrs)), 1);
+    stonaddr(&expect, "2001:db8::");
+    expect.bitlen = 32;
+    CU_ASSERT_EQUAL(addrs[0].family, AF_INET6);
+    CU_ASSERT(prefixeq(&addrs[0], &expect));
+
+    CU_ASSERT_EQUAL(getmpunreachprefixes(addrs, nelems(addrs)), 1);
+    stonaddr(&expect, "2001:db8:1::");
+    expect.bitlen = 48;
+    CU_ASSERT(prefixeq(&addrs[0], &expect));
+    CU_ASSERT_EQUAL(bgpclose(), BGP_ENOERR);
+
+    // ADD-PATH
+    n = makeupdate(pkt, NULL, 0, attrs, 4, apnlri, sizeof(apnlri));
+    CU_ASSERT_EQUAL_FATAL(setbgpread(pkt, n, BGPF_ADDPATH), BGP_ENOERR);
+    CU_ASSERT_EQUAL(getwithdrawnprefixes(NULL, 0), 0);
+    CU_ASSERT_EQUAL(getmpreachprefixes(aps, nelems(aps)), 0);
+    CU_ASSERT_EQUAL(getnlriprefixes(aps, nelems(aps)), 2);
+    CU_ASSERT_EQUAL(aps[0].pathid, 7);
+    CU_ASSERT_EQUAL(aps[0].pfx.bitlen, 24);
+    CU_ASSERT_EQUAL(aps[1].pathid, 256);
+    CU_ASSERT_EQUAL(aps[1].pfx.bitlen, 0);
+    CU_ASSERT_EQUAL(bgpclose(), BGP_ENOERR);
+
+    // MP_REACH_NLRI next hop length exceeding the attribute
+    unsigned char badnh[sizeof(attrs)];
+    memcpy(badnh, attrs, sizeof(badnh));
+    badnh[10] = 30;
+    n = makeupdate(pkt, NULL, 0, badnh, sizeof(badnh), NULL, 0);
+    CU_ASSERT_EQUAL_FATAL(setbgpread(pkt, n, BGPF_DEFAULT), BGP_ENOERR);
+    CU_ASSERT_EQUAL(getmpreachprefixes(addrs, nelems(addrs)), 0);
+    CU_ASSERT_EQUAL(bgperror(), BGP_EBADATTR);
+    bgpclose();
+
+    // IPv4 prefix longer than 32 bits
+    n = makeupdate(pkt, NULL, 0, attrs, 4, nlri, sizeof(nlri));
+    pkt[n - 5] = 33;
+    CU_ASSERT_EQUAL_FATAL(setbgpread(pkt, n, BGPF_DEFAULT), BGP_ENOERR);
+    CU_ASSERT_EQUAL(getnlriprefixes(addrs, nelems(addrs)), 0);
+    CU_ASSERT_EQUAL(bgperror(), BGP_EBADNLRI);
+    bgpclose();
+}
+
+void testupdaterealaspath(void)
+{
+    static const unsigned char attrs[] = {
+        0x40, ORIGIN_CODE, 1, ORIGIN_IGP,
+        0x40, AS_PATH_CODE, 16,
+        AS_SEGMENT_SEQ, 4, 0x00, 0x01, 0x00, 0x02, 0x5b, 0xa0, 0x5b, 0xa0,  // 1 2 AS_TRANS AS_TRANS
+        AS_SEGMENT_SET, 2, 0x00, 0x07, 0x00, 0x08,                          // { 7 8 }
+        0xc0, AS4_PATH_CODE, 20,
+        AS_SEGMENT_SEQ, 2, 0x00, 0x01, 0x11, 0x70, 0x00, 0x01, 0x38, 0x80,  // 70000 80000
+        AS_SEGMENT_SET, 2, 0x00, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00, 0x08   // { 7 8 }
+    };
+    static const uint32_t expect[] = {
+        1, 2, 70000, 80000, 7, 8
+    };
+
+    unsigned char pkt[512];
+    uint32_t path[80];
+    uint8_t types[80];
+
+    size_t n = makeupdate(pkt, NULL, 0, attrs, sizeof(attrs), NULL, 0);
+    CU_ASSERT_EQUAL_FATAL(setbgpread(pkt, n, BGPF_DEFAULT), BGP_ENOERR);
+
+    // compare against iteration, twice to also hit the cache
+    for (int i = 0; i < 2; i++) {
+        memset(path, 0, sizeof(path));
+        CU_ASSERT_EQUAL_FATAL(getrealaspath(path, nelems(path), types), nelems(expect));
+        CU_ASSERT_EQUAL(memcmp(path, expect, sizeof(expect)), 0);
+        CU_ASSERT_EQUAL(types[3], AS_SEGMENT_SEQ);
+        CU_ASSERT_EQUAL(types[4], AS_SEGMENT_SET);
+
+        as_pathent_t *ent;
+        size_t count = 0;
+
+        startrealaspath();
+        while ((ent = nextaspath()) != NULL && count < nelems(expect))
+            CU_ASSERT_EQUAL(ent->as, path[count++]);
+
+        CU_ASSERT_EQUAL(endaspath(), BGP_ENOERR);
+        CU_ASSERT_EQUAL(count, nelems(expect));
+    }
+
+    path[2] = 0;
+    CU_ASSERT_EQUAL(getrealaspath(path, 2, NULL), nelems(expect));
+    CU_ASSERT_EQUAL(path[1], 2);
+    CU_ASSERT_EQUAL(path[2], 0);
+
+    // direct access to cache
+    const uint32_t *cached;
+    const uint8_t *cachedtypes;
+    size_t len;
+
+    cached = getrealaspathptr(&len, &cachedtypes);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cached);
+    CU_ASSERT_EQUAL_FATAL(len, nelems(expect));
+    CU_ASSERT_EQUAL(memcmp(cached, expect, sizeof(expect)), 0);
+    CU_ASSERT_EQUAL(cachedtypes[4], AS_SEGMENT_SET);
+    CU_ASSERT_EQUAL(bgpclose(), BGP_ENOERR);
+
+    // AS4_PATH reconciliation boundary falls on a set, which is taken whole
+    static const unsigned char setattrs[] = {
+        0x40, ORIGIN_CODE, 1, ORIGIN_IGP,
+        0x40, AS_PATH_CODE, 14,
+        AS_SEGMENT_SEQ, 1, 0x00, 0x01,              // 1
+        AS_SEGMENT_SET, 2, 0x00, 0x07, 0x00, 0x08,  // { 7 8 }
+        AS_SEGMENT_SEQ, 1, 0x5b, 0xa0,              // AS_TRANS
+        0xc0, AS4_PATH_CODE, 6,
+        AS_SEGMENT_SEQ, 1, 0x00, 0x01, 0x11, 0x70   // 70000
+    };
+    static const uint32_t setexpect[] = {
+        1, 7, 8, 70000
+    };
+
+    n = makeupdate(pkt, NULL, 0, setattrs, sizeof(setattrs), NULL, 0);
+    CU_ASSERT_EQUAL_FATAL(setbgpread(pkt, n, BGPF_DEFAULT), BGP_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(getrealaspath(path, nelems(path), NULL), nelems(setexpect));
+    CU_ASSERT_EQUAL(memcmp(path, setexpect, sizeof(setexpect)), 0);
+
+    as_pathent_t *ent;
+    size_t count = 0;
+
+    startrealaspath();
+    while ((ent = nextaspath()) != NULL && count < nelems(setexpect))
+        CU_ASSERT_EQUAL(ent->as, setexpect[count++]);
+
+    CU_ASSERT_PTR_NULL(ent);
+    CU_ASSERT_EQUAL(endaspath(), BGP_ENOERR);
+    CU_ASSERT_EQUAL(count, nelems(setexpect));
+    CU_ASSERT_EQUAL(bgpclose(), BGP_ENOERR);
+
+    // 32-bits path too long to be cached
+    unsigned char asn32[10 + 70 * 4] = {
+        0x40, ORIGIN_CODE, 1, ORIGIN_IGP,
+        0x50, AS_PATH_CODE, 0x01, 0x1a,  // 282 bytes
+        AS_SEGMENT_SEQ, 70
+    };
+    for (int i = 0; i < 70; i++) {
+        uint32_t as = tobig32(100000 + i);
+        memcpy(&asn32[10 + i * sizeof(as)], &as, sizeof(as));
+    }
+
+    n = makeupdate(pkt, NULL, 0, asn32, sizeof(asn32), NULL, 0);
+    CU_ASSERT_EQUAL_FATAL(setbgpread(pkt, n, BGPF_ASN32BIT), BGP_ENOERR);
+    for (int i = 0; i < 2; i++) {
+        CU_ASSERT_EQUAL_FATAL(getrealaspath(path, nelems(path), NULL), 70);
+        for (int j = 0; j < 70; j++)
+            CU_ASSERT_EQUAL(path[j], 100000u + j);
+    }
+
+    CU_ASSERT_PTR_NULL(getrealaspathptr(&len, NULL));
+    CU_ASSERT_EQUAL(bgperror(), BGP_ENOERR);
+
+    CU_ASSERT_EQUAL(bgpclose(), BGP_ENOERR);
+}
@@ -0,0 +1,159 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <CUnit/CUnit.h>
+#include <isolario/attrstore.h>
+#include <isolario/mrt.h>
+#include <string.h>
+
+#include "test.h"
+
+void testattrstore(void)
+{
+    static const unsigned char origin[]  = { 0x40, 0x01, 0x01, 0x00 };
+    static const unsigned char nexthop[] = { 0x40, 0x03, 0x04, 0xc0, 0x00, 0x02, 0x01 };
+
+    attrstore_t *st = attrstore_create(0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(st);
+
+    const attrref_t *a = attrstore_intern(st, 0, origin, sizeof(origin));
+    const attrref_t *b = attrstore_intern(st, 0, origin, sizeof(origin));
+    const attrref_t *c = attrstore_intern(st, 1, origin, sizeof(origin));
+    const attrref_t *d = attrstore_intern(st, 0, nexthop, sizeof(nexthop));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(a);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(c);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(d);
+
+    CU_ASSERT_PTR_EQUAL(a, b);
+    CU_ASSERT_PTR_NOT_EQUAL(a, c);  // same bytes from a different peer
+    CU_ASSERT_PTR_NOT_EQUAL(a, d);
+    CU_ASSERT_EQUAL(attrstore_count(st), 3);
+    CU_ASSERT_EQUAL(d->len, sizeof(nexthop));
+    CU_ASSERT_EQUAL(memcmp(d->attrs, nexthop, sizeof(nexthop)), 0);
+
+    // handle survives until its last reference is released
+    attrstore_unref(st, a);
+    CU_ASSERT_EQUAL(attrstore_count(st), 3);
+    attrstore_unref(st, b);
+    CU_ASSERT_EQUAL(attrstore_count(st), 2);
+
+    CU_ASSERT_PTR_EQUAL(attrstore_ref(c), c);
+    attrstore_unref(st, c);
+    attrstore_unref(st, c);
+    attrstore_unref(st, d);
+    CU_ASSERT_EQUAL(attrstore_count(st), 0);
+
+    // many distinct blobs, forcing rehash
+    unsigned char attrs[8] = { 0x40, 0x08, 0x04 };  // COMMUNITY
+    for (unsigned i = 0; i < 1000; i++) {
+        memcpy(&attrs[4], &i, sizeof(i));
+        CU_ASSERT_PTR_NOT_NULL(attrstore_intern(st, 0, attrs, sizeof(attrs)));
+    }
+    for (unsigned i = 0; i < 1000; i++) {
+        memcpy(&attrs[4], &i, sizeof(i));
+        attrstore_intern(st, 0, attrs, sizeof(attrs));
+    }
+    CU_ASSERT_EQUAL(attrstore_count(st), 1000);
+
+    attrstore_destroy(st);
+}
+
+void testmrtattrstore(void)
+{
+    static const unsigned char pirec[] = {
+        0x59, 0x68, 0x2f, 0x00, 0x00, 0x0d, 0x00, 0x01,  // 1500000000, TABLE_DUMPV2, PEER_INDEX_TABLE
+        0x00, 0x00, 0x00, 0x13,                          // length
+        0xc0, 0x00, 0x02, 0xff,                          // collector 192.0.2.255
+        0x00, 0x00,                                      // no view name
+        0x00, 0x01,                                      // peer count
+        0x00, 0x0a, 0x00, 0x00, 0x02,                    // IPv4, 16 bits AS, BGP ID 10.0.0.2
+        0xc0, 0x00, 0x02, 0x01,                          // 192.0.2.1
+        0xfc, 0x00                                       // AS64512
+    };
+    static const unsigned char ribrecs[][34] = { {
+        0x59, 0x68, 0x2f, 0x00, 0x00, 0x0d, 0x00, 0x02,  // 1500000000, TABLE_DUMPV2, RIB_IPV4_UNICAST
+        0x00, 0x00, 0x00, 0x16,                          // length
+        0x00, 0x00, 0x00, 0x00,                          // sequence number
+        0x18, 0x0a, 0x01, 0x02,                          // 10.1.2.0/24
+        0x00, 0x01,                                      // entry count
+        0x00, 0x00, 0x59, 0x68, 0x2f, 0x00,              // peer 0
+        0x00, 0x04, 0x40, 0x01, 0x01, 0x00               // ORIGIN IGP
+    }, {
+        0x59, 0x68, 0x2f, 0x00, 0x00, 0x0d, 0x00, 0x02,  // 1500000000, TABLE_DUMPV2, RIB_IPV4_UNICAST
+        0x00, 0x00, 0x00, 0x16,                          // length
+        0x00, 0x00, 0x00, 0x01,                          // sequence number
+        0x18, 0x0a, 0x01, 0x03,                          // 10.1.3.0/24
+        0x00, 0x01,                                      // entry count
+        0x00, 0x00, 0x59, 0x68, 0x2f, 0x01,              // peer 0
+        0x00, 0x04, 0x40, 0x01, 0x01, 0x00               // ORIGIN IGP
+    } };
+
+    mrt_msg_t msg;
+    peer_index_t *pi;
+
+    CU_ASSERT_EQUAL_FATAL(setmrtread_r(&msg, pirec, sizeof(pirec), MRTF_NOCOPY), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(newpeerindex_r(&msg, &pi), MRT_ENOERR);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+
+    attrstore_t *st = attrstore_create(0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(st);
+
+    const attrref_t *refs[2];
+    for (int i = 0; i < 2; i++) {
+        CU_ASSERT_EQUAL_FATAL(setmrtread_r(&msg, ribrecs[i], sizeof(ribrecs[i]), MRTF_NOCOPY), MRT_ENOERR);
+        CU_ASSERT_EQUAL_FATAL(setribpeerindex_r(&msg, pi), MRT_ENOERR);
+        CU_ASSERT_EQUAL_FATAL(setribattrstore_r(&msg, st), MRT_ENOERR);
+
+        startribents_r(&msg, NULL);
+
+        rib_entry_t *rib = nextribent_r(&msg);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(rib);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(rib->attrref);
+        CU_ASSERT_PTR_EQUAL(rib->attrs, rib->attrref->attrs);
+        CU_ASSERT_EQUAL(rib->attrref->len, 4);
+        refs[i] = rib->attrref;
+
+        CU_ASSERT_PTR_NULL(nextribent_r(&msg));
+        CU_ASSERT_EQUAL(endribents_r(&msg), MRT_ENOERR);
+        CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+    }
+
+    // handle outlives the records it came from
+    CU_ASSERT_PTR_EQUAL(refs[0], refs[1]);
+    CU_ASSERT_EQUAL(attrstore_count(st), 1);
+    CU_ASSERT_EQUAL(refs[0]->attrs[0], 0x40);
+
+    attrstore_unref(st, refs[0]);
+    attrstore_unref(st, refs[1]);
+    CU_ASSERT_EQUAL(attrstore_count(st), 0);
+
+    attrstore_destroy(st);
+    freepeerindex(pi);
+}
@@ -31,6 +31,9 @@
 #include <CUnit/CUnit.h>
 #include <isolario/io.h>
 #include <isolario/util.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <test_util.h>
 #include <sys/types.h>
@@ -96,6 +99,11 @@ void testxz(void)
     write_and_read("miao.xz", io_xzopen, DEFAULT_STRING);
 }
 
+void testzstd(void)
+{
+    write_and_read("miao.zst", io_zstdopen, DEFAULT_STRING);
+}
+
 void testlz4(void)
 {
     write_and_read("miao.lz4", io_lz4open, DEFAULT_STRING);
@@ -161,3 +169,545 @@ void testlz4smallwrites(void)
 
     unlink(filename);
 }
+
+void testmmap(void)
+{
+    const char *filename = "miao.mmap";
+
+    int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    size_t len = strlen(DEFAULT_STRING);
+    CU_ASSERT_TRUE_FATAL(write(fd, DEFAULT_STRING, len) == (ssize_t) len);
+    close(fd);
+
+    fd = open(filename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io_rw_t *io = io_mmapopen(fd, "r");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io->peek);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io->consume);
+
+    // peek doesn't advance the stream
+    size_t n;
+    const char *p = io->peek(io, 3, &n);
+    CU_ASSERT_TRUE_FATAL(n == 3);
+    CU_ASSERT_TRUE(memcmp(p, "the", 3) == 0);
+
+    n = io->consume(io, 4);
+    CU_ASSERT_TRUE_FATAL(n == 4);
+
+    char buf[len + 1];
+    n = io->read(io, buf, len);
+    CU_ASSERT_TRUE_FATAL(n == len - 4);
+    CU_ASSERT_TRUE_FATAL(io->error(io) == 0);
+
+    buf[n] = '\0';
+    CU_ASSERT_STRING_EQUAL(buf, DEFAULT_STRING + 4);
+
+    // at end of stream peek returns the leftover amount
+    io->peek(io, 1, &n);
+    CU_ASSERT_TRUE(n == 0);
+
+    int err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    unlink(filename);
+}
+
+void testbufio(void)
+{
+    const char *filename = "miao.buf";
+
+    int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    // small buffer, to exercise both refills and buffer bypass
+    io_rw_t *io = io_bufopen(io_zopen(fd, 0, "w"), 8, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    size_t len = strlen(DEFAULT_STRING);
+    for (size_t i = 0; i < len; i++)
+        CU_ASSERT_TRUE_FATAL(io->write(io, &DEFAULT_STRING[i], 1) == 1);
+
+    CU_ASSERT_TRUE_FATAL(io->write(io, DEFAULT_STRING, len) == len);
+    CU_ASSERT_TRUE_FATAL(io->error(io) == 0);
+
+    int err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    fd = open(filename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io = io_bufopen(io_zopen(fd, 0, "r"), 8, "r");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    char buf[len + 1];
+    size_t n = io->read(io, buf, 3);
+    CU_ASSERT_TRUE_FATAL(n == 3);
+    n = io->read(io, buf + 3, len - 3);
+    CU_ASSERT_TRUE_FATAL(n == len - 3);
+    CU_ASSERT_TRUE_FATAL(io->error(io) == 0);
+
+    buf[len] = '\0';
+    CU_ASSERT_STRING_EQUAL(buf, DEFAULT_STRING);
+
+    n = io->consume(io, 4);
+    CU_ASSERT_TRUE_FATAL(n == 4);
+    n = io->read(io, buf, len);
+    CU_ASSERT_TRUE_FATAL(n == len - 4);
+
+    buf[n] = '\0';
+    CU_ASSERT_STRING_EQUAL(buf, DEFAULT_STRING + 4);
+
+    err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    unlink(filename);
+}
+
+void testbz2mt(void)
+{
+    const char *filename = "miao.mt.bz2";
+
+    int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    // smallest block size, so that data spans several blocks
+    io_rw_t *io = io_bz2open(fd, 0, "w1");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    enum { NLINES = 64 * 1024 };
+
+    char line[64];
+    size_t total = 0;
+    for (unsigned i = 0; i < NLINES; i++) {
+        int len = snprintf(line, sizeof(line), "%u %u\n", i, (i * 2654435761u) >> 7);
+        CU_ASSERT_TRUE_FATAL(io->write(io, line, len) == (size_t) len);
+        total += len;
+    }
+
+    int err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    fd = open(filename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io = io_bz2open(fd, 0, "rt*", 4);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    size_t n = 0;
+    for (unsigned i = 0; i < NLINES; i++) {
+        char buf[sizeof(line)];
+
+        int len = snprintf(line, sizeof(line), "%u %u\n", i, (i * 2654435761u) >> 7);
+        CU_ASSERT_TRUE_FATAL(io->read(io, buf, len) == (size_t) len);
+        CU_ASSERT_TRUE_FATAL(memcmp(buf, line, len) == 0);
+        n += len;
+    }
+
+    CU_ASSERT_TRUE(n == total);
+    CU_ASSERT_TRUE(io->read(io, line, sizeof(line)) == 0);
+    CU_ASSERT_TRUE(io->error(io) == 0);
+
+    err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    unlink(filename);
+}
+
+void testbz2mtmagic(void)
+{
+    const char *filename = "miao.magic.bz2";
+
+    // the block header symbol bitmaps of data using only these bytes
+    // read 0x3141, 0x5926, 0x5359, so every block contains a block magic
+    static const unsigned char syms[] = {
+        0x02, 0x03, 0x07, 0x09, 0x0f,
+        0x11, 0x13, 0x14, 0x17, 0x1a, 0x1d, 0x1e,
+        0x21, 0x23, 0x26, 0x27, 0x29, 0x2b, 0x2c, 0x2f
+    };
+
+    enum { NBYTES = 512 * 1024 };
+
+    unsigned char *data = malloc(NBYTES);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+
+    uint32_t seed = 1;
+    for (size_t i = 0; i < NBYTES; i++) {
+        seed = seed * 1103515245u + 12345u;
+
+        // avoid runs of 4 equal bytes, run-length encoding would add symbols
+        size_t k = (seed >> 16) % sizeof(syms);
+        if (i >= 3 && data[i-1] == syms[k] && data[i-2] == syms[k] && data[i-3] == syms[k])
+            k = (k + 1) % sizeof(syms);
+
+        data[i] = syms[k];
+    }
+
+    int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io_rw_t *io = io_bz2open(fd, 0, "w1");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+    CU_ASSERT_TRUE_FATAL(io->write(io, data, NBYTES) == NBYTES);
+
+    int err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    fd = open(filename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io = io_bz2open(fd, 0, "rt*", 4);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    unsigned char *buf = malloc(NBYTES);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+
+    CU_ASSERT_TRUE(io->read(io, buf, NBYTES) == NBYTES);
+    CU_ASSERT_TRUE(memcmp(buf, data, NBYTES) == 0);
+    CU_ASSERT_TRUE(io->read(io, buf, 1) == 0);
+    CU_ASSERT_TRUE(io->error(io) == 0);
+
+    err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    free(buf);
+    free(data);
+    unlink(filename);
+}
+
+void testbz2mtcorrupt(void)
+{
+    const char *filename = "miao.corrupt.bz2";
+
+    enum { NBYTES = 1024 * 1024 };
+
+    // incompressible data, so blocks are as large as they get
+    unsigned char *data = malloc(NBYTES);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+
+    uint32_t seed = 1;
+    for (size_t i = 0; i < NBYTES; i++) {
+        seed = seed * 1103515245u + 12345u;
+        data[i] = seed >> 24;
+    }
+
+    int fd = open(filename, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io_rw_t *io = io_bz2open(dup(fd), 0, "w1");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+    CU_ASSERT_TRUE_FATAL(io->write(io, data, NBYTES) == NBYTES);
+
+    int err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    // damage the second block, no merge with the following ones can fix it
+    unsigned char garbage[64];
+    memset(garbage, 0x55, sizeof(garbage));
+    CU_ASSERT_TRUE_FATAL(pwrite(fd, garbage, sizeof(garbage), 150000) == sizeof(garbage));
+    close(fd);
+
+    fd = open(filename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io = io_bz2open(fd, 0, "rt*", 4);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    unsigned char *buf = malloc(NBYTES);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(buf);
+
+    // the first block is still handed out
+    size_t n = io->read(io, buf, NBYTES);
+    CU_ASSERT_TRUE(n > 0 && n < NBYTES);
+    CU_ASSERT_TRUE(memcmp(buf, data, n) == 0);
+    CU_ASSERT_TRUE(io->error(io) != 0);
+
+    io->close(io);
+
+    free(buf);
+    free(data);
+    unlink(filename);
+}
+
+void testxzmt(void)
+{
+    const char *filename = "miao.mt.xz";
+
+    int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io_rw_t *io = io_xzopen(fd, 0, "w1t*", 2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    size_t len = strlen(DEFAULT_STRING);
+    for (int i = 0; i < 1024; i++)
+        CU_ASSERT_TRUE_FATAL(io->write(io, DEFAULT_STRING, len) == len);
+
+    int err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    fd = open(filename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io = io_xzopen(fd, 0, "rt2");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    char buf[len + 1];
+    for (int i = 0; i < 1024; i++) {
+        CU_ASSERT_TRUE_FATAL(io->read(io, buf, len) == len);
+
+        buf[len] = '\0';
+        CU_ASSERT_STRING_EQUAL_FATAL(buf, DEFAULT_STRING);
+    }
+
+    CU_ASSERT_TRUE(io->read(io, buf, len) == 0);
+    CU_ASSERT_TRUE(io->error(io) == 0);
+
+    err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    unlink(filename);
+}
+
+void testzstdmt(void)
+{
+    const char *filename = "miao.mt.zst";
+
+    int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io_rw_t *io = io_zstdopen(fd, 0, "w1l20ct*", 2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    size_t len = strlen(DEFAULT_STRING);
+    for (int i = 0; i < 64 * 1024; i++)
+        CU_ASSERT_TRUE_FATAL(io->write(io, DEFAULT_STRING, len) == len);
+
+    int err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    fd = open(filename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    // window log out of bounds is refused, fd is left open
+    errno = 0;
+    CU_ASSERT_PTR_NULL(io_zstdopen(fd, 0, "rl99"));
+    CU_ASSERT_EQUAL(errno, EINVAL);
+
+    io = io_zstdopen(fd, 0, "rl20");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    char buf[len + 1];
+    for (int i = 0; i < 64 * 1024; i++) {
+        CU_ASSERT_TRUE_FATAL(io->read(io, buf, len) == len);
+
+        buf[len] = '\0';
+        CU_ASSERT_STRING_EQUAL_FATAL(buf, DEFAULT_STRING);
+    }
+
+    CU_ASSERT_TRUE(io->read(io, buf, len) == 0);
+    CU_ASSERT_TRUE(io->error(io) == 0);
+
+    err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    unlink(filename);
+}
+
+void testziomt(void)
+{
+    static const char *const formats[] = { "wt*", "wzt*", "wdt*" };
+    static const char *const rdformats[] = { "r", "rz", "rd" };
+
+    const char *filename = "miao.mt.Z";
+
+    enum { NLINES = 64 * 1024 };
+
+    for (size_t f = 0; f < nelems(formats); f++) {
+        int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+        CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+        io_rw_t *io = io_zopen(fd, 0, formats[f], 4);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+        char line[64];
+        for (unsigned i = 0; i < NLINES; i++) {
+            int len = snprintf(line, sizeof(line), "%u %u\n", i, (i * 2654435761u) >> 7);
+            CU_ASSERT_TRUE_FATAL(io->write(io, line, len) == (size_t) len);
+        }
+
+        int err = io->close(io);
+        CU_ASSERT_TRUE_FATAL(err == 0);
+
+        // output must be a single stream, readable by the regular decoder
+        fd = open(filename, O_RDONLY);
+        CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+        io = io_zopen(fd, 0, rdformats[f]);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+        for (unsigned i = 0; i < NLINES; i++) {
+            char buf[sizeof(line)];
+
+            int len = snprintf(line, sizeof(line), "%u %u\n", i, (i * 2654435761u) >> 7);
+            CU_ASSERT_TRUE_FATAL(io->read(io, buf, len) == (size_t) len);
+            CU_ASSERT_TRUE_FATAL(memcmp(buf, line, len) == 0);
+        }
+
+        CU_ASSERT_TRUE(io->read(io, line, sizeof(line)) == 0);
+        CU_ASSERT_TRUE(io->error(io) == 0);
+
+        err = io->close(io);
+        CU_ASSERT_TRUE_FATAL(err == 0);
+    }
+
+    unlink(filename);
+}
+
+void testasyncio(void)
+{
+    const char *filename = "miao.async.Z";
+
+    int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io_rw_t *io = io_zopen(fd, 0, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    size_t len = strlen(DEFAULT_STRING);
+    for (int i = 0; i < 1024; i++)
+        CU_ASSERT_TRUE_FATAL(io->write(io, DEFAULT_STRING, len) == len);
+
+    int err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    fd = open(filename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    // small buffers not multiple of the string length, so reads span them
+    io = io_asyncopen(io_zopen(fd, 0, "r"), 3, 100);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    char buf[len + 1];
+    for (int i = 0; i < 1023; i++) {
+        CU_ASSERT_TRUE_FATAL(io->read(io, buf, len) == len);
+
+        buf[len] = '\0';
+        CU_ASSERT_STRING_EQUAL_FATAL(buf, DEFAULT_STRING);
+    }
+
+    CU_ASSERT_TRUE_FATAL(io->consume(io, 4) == 4);
+    CU_ASSERT_TRUE_FATAL(io->read(io, buf, len) == len - 4);
+
+    buf[len - 4] = '\0';
+    CU_ASSERT_STRING_EQUAL(buf, DEFAULT_STRING + 4);
+    CU_ASSERT_TRUE(io->read(io, buf, len) == 0);
+    CU_ASSERT_TRUE(io->error(io) == 0);
+
+    err = io->close(io);
+    CU_ASSERT_TRUE_FATAL(err == 0);
+
+    unlink(filename);
+}
+
+static void checkuring(io_ring_t *ring)
+{
+    static const char *const filenames[] = { "miao.uring.0", "miao.uring.1" };
+
+    enum { NLINES = 16 * 1024 };
+
+    // a couple of files, read concurrently on the same ring
+    for (size_t f = 0; f < nelems(filenames); f++) {
+        FILE *file = fopen(filenames[f], "w");
+        CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+
+        for (unsigned i = 0; i < NLINES; i++)
+            fprintf(file, "%zu %u %u\n", f, i, (i * 2654435761u) >> 7);
+
+        CU_ASSERT_TRUE_FATAL(fclose(file) == 0);
+    }
+
+    io_rw_t *ios[nelems(filenames)];
+    for (size_t f = 0; f < nelems(filenames); f++) {
+        int fd = open(filenames[f], O_RDONLY);
+        CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+        ios[f] = io_uringopen(ring, fd, 3, 4096);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(ios[f]);
+    }
+
+    char line[64], buf[sizeof(line)];
+    for (unsigned i = 0; i < NLINES; i++) {
+        for (size_t f = 0; f < nelems(filenames); f++) {
+            int len = snprintf(line, sizeof(line), "%zu %u %u\n", f, i, (i * 2654435761u) >> 7);
+            if (i % 7 == 3) {
+                CU_ASSERT_TRUE_FATAL(ios[f]->consume(ios[f], len) == (size_t) len);
+            } else {
+                CU_ASSERT_TRUE_FATAL(ios[f]->read(ios[f], buf, len) == (size_t) len);
+                CU_ASSERT_TRUE_FATAL(memcmp(buf, line, len) == 0);
+            }
+        }
+    }
+
+    for (size_t f = 0; f < nelems(filenames); f++) {
+        CU_ASSERT_TRUE(ios[f]->read(ios[f], buf, sizeof(buf)) == 0);
+        CU_ASSERT_TRUE(ios[f]->error(ios[f]) == 0);
+        CU_ASSERT_TRUE(ios[f]->close(ios[f]) == 0);
+
+        unlink(filenames[f]);
+    }
+}
+
+void testuring(void)
+{
+    // io_uring may be unavailable, in that case readers fallback to read(2)
+    io_ring_t *ring = io_ringcreate(8);
+
+    checkuring(ring);
+    checkuring(NULL);
+
+    io_ringfree(ring);
+}
+
+void testdirectio(void)
+{
+    const char *filename = "miao.direct";
+
+    enum { NLINES = 16 * 1024, SKIPLINES = 10 };
+
+    FILE *file = fopen(filename, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(file);
+
+    for (unsigned i = 0; i < NLINES; i++)
+        fprintf(file, "%u %u\n", i, (i * 2654435761u) >> 7);
+
+    CU_ASSERT_TRUE_FATAL(fclose(file) == 0);
+
+    int fd = open(filename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    // start from an unaligned offset
+    char line[64], buf[sizeof(line)];
+    for (unsigned i = 0; i < SKIPLINES; i++) {
+        int len = snprintf(line, sizeof(line), "%u %u\n", i, (i * 2654435761u) >> 7);
+        CU_ASSERT_TRUE_FATAL(read(fd, buf, len) == len);
+    }
+
+    io_rw_t *io = io_directopen(fd, 4096);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+    for (unsigned i = SKIPLINES; i < NLINES; i++) {
+        int len = snprintf(line, sizeof(line), "%u %u\n", i, (i * 2654435761u) >> 7);
+        CU_ASSERT_TRUE_FATAL(io->read(io, buf, len) == (size_t) len);
+        CU_ASSERT_TRUE_FATAL(memcmp(buf, line, len) == 0);
+    }
+
+    CU_ASSERT_TRUE(io->read(io, buf, sizeof(buf)) == 0);
+    CU_ASSERT_TRUE(io->error(io) == 0);
+    CU_ASSERT_TRUE(io->close(io) == 0);
+
+    unlink(filename);
+}
@@ -95,18 +95,99 @@ int main(void)
     if (!CU_add_test(suite, "test abstract I/O with Zlib", testzio))
         goto error;
 
+    if (!CU_add_test(suite, "test abstract I/O with Zlib parallel compression", testziomt))
+        goto error;
+
     if (!CU_add_test(suite, "test abstract I/O with bz2", testbz2))
         goto error;
 
+    if (!CU_add_test(suite, "test abstract I/O with bz2 parallel decompression", testbz2mt))
+        goto error;
+
+    if (!CU_add_test(suite, "test abstract I/O with bz2 chance block magic", testbz2mtmagic))
+        goto error;
+
+    if (!CU_add_test(suite, "test abstract I/O with bz2 corrupted block", testbz2mtcorrupt))
+        goto error;
+
     if (!CU_add_test(suite, "test abstract I/O with LZMA", testxz))
         goto error;
 
+    if (!CU_add_test(suite, "test abstract I/O with multi-threaded LZMA", testxzmt))
+        goto error;
+
+    if (!CU_add_test(suite, "test abstract I/O with Zstandard", testzstd))
+        goto error;
+
+    if (!CU_add_test(suite, "test abstract I/O with multi-threaded Zstandard", testzstdmt))
+        goto error;
+
     if (!CU_add_test(suite, "test abstract I/O with LZ4", testlz4))
         goto error;
 
     if (!CU_add_test(suite, "test abstract I/O with LZ4 by performing small writes and reads", testlz4smallwrites))
         goto error;
 
+    if (!CU_add_test(suite, "test memory mapped I/O with zero-copy peek and consume", testmmap))
+        goto error;
+
+    if (!CU_add_test(suite, "test buffered I/O stacked on Zlib", testbufio))
+        goto error;
+
+    if (!CU_add_test(suite, "test asynchronous read-ahead I/O stacked on Zlib", testasyncio))
+        goto error;
+
+    if (!CU_add_test(suite, "test io_uring reader with a shared ring", testuring))
+        goto error;
+
+    if (!CU_add_test(suite, "test direct I/O reader bypassing page cache", testdirectio))
+        goto error;
+
+    if (!CU_add_test(suite, "test checkpoint index over gzip compressed MRT", testmrtzindex))
+        goto error;
+
+    if (!CU_add_test(suite, "test time index over plain, LZ4 and gzip compressed MRT", testmrttindex))
+        goto error;
+
+    if (!CU_add_test(suite, "test BGP4MP record writing with scatter-gather I/O", testmrtwritebgp4mp))
+        goto error;
+
+    if (!CU_add_test(suite, "test zero-copy MRT iterator", testmrtiterator))
+        goto error;
+
+    if (!CU_add_test(suite, "test retained buffers for large MRT records", testmrtbufretain))
+        goto error;
+
+    if (!CU_add_test(suite, "test immutable Peer Index", testmrtpeerindex))
+        goto error;
+
+    if (!CU_add_test(suite, "test batched MRT writer", testmrtwriter))
+        goto error;
+
+    if (!CU_add_test(suite, "test MRT header filter pushdown", testmrthdrfilter))
+        goto error;
+
+    if (!CU_add_test(suite, "test columnar RIB entries and NLRI decoding", testmrtribcols))
+        goto error;
+
+    if (!CU_add_test(suite, "test attribute store", testattrstore))
+        goto error;
+
+    if (!CU_add_test(suite, "test RIB attributes interning", testmrtattrstore))
+        goto error;
+
+    if (!CU_add_test(suite, "test parallel TABLE_DUMPV2 processing", testmrtribforeach))
+        goto error;
+
+    if (!CU_add_test(suite, "test timestamp ordered merge of MRT streams", testmrtmerge))
+        goto error;
+
+    if (!CU_add_test(suite, "test RIB reconstruction with checkpoints", testribengine))
+        goto error;
+
+    if (!CU_add_test(suite, "test RIB engine canonical attributes", testribengineattrs))
+        goto error;
+
     if (!CU_add_test(suite, "test bgp dump packet row", testbgpdumppacketrow))
         goto error;
 
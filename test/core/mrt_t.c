@@ -0,0 +1,956 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <CUnit/CUnit.h>
+#include <fcntl.h>
+#include <isolario/attrstore.h>
+#include <isolario/io.h>
+#include <isolario/mrt.h>
+#include <isolario/ribcols.h>
+#include <isolario/util.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+
+static void checkbgp4mp(io_rw_t *io, int subtype, const void *data, size_t n)
+{
+    mrt_msg_t msg;
+
+    CU_ASSERT_EQUAL_FATAL(setmrtreadfrom_r(&msg, io), MRT_ENOERR);
+
+    mrt_header_t *hdr = getmrtheader_r(&msg);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(hdr);
+    CU_ASSERT_EQUAL(hdr->type, MRT_BGP4MP_ET);
+    CU_ASSERT_EQUAL(hdr->subtype, subtype);
+    CU_ASSERT_EQUAL(hdr->stamp.tv_sec, 1500000000);
+    CU_ASSERT_EQUAL(hdr->stamp.tv_nsec, 123456000);
+
+    bgp4mp_header_t *bgp4mp = getbgp4mpheader_r(&msg);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(bgp4mp);
+    CU_ASSERT_EQUAL(bgp4mp->peer_as, 4200000000u);
+    CU_ASSERT_EQUAL(bgp4mp->local_as, 12345);
+    CU_ASSERT_EQUAL(bgp4mp->iface, 7);
+    CU_ASSERT_EQUAL(bgp4mp->peer_addr.family, AF_INET6);
+
+    netaddr_t addr;
+    stonaddr(&addr, "2001:db8::1");
+    CU_ASSERT_EQUAL(memcmp(&bgp4mp->peer_addr.sin6, &addr.sin6, sizeof(addr.sin6)), 0);
+
+    if (n > 0) {
+        size_t len;
+        void *bgp = unwrapbgp4mp_r(&msg, &len);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(bgp);
+        CU_ASSERT_EQUAL_FATAL(len, n);
+        CU_ASSERT_EQUAL(memcmp(bgp, data, n), 0);
+    } else {
+        CU_ASSERT_EQUAL(bgp4mp->old_state, 5);
+        CU_ASSERT_EQUAL(bgp4mp->new_state, 6);
+    }
+
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+}
+
+void testmrtwritebgp4mp(void)
+{
+    bgp_msg_t bgp;
+
+    CU_ASSERT_EQUAL_FATAL(setbgpwrite_r(&bgp, BGP_KEEPALIVE, BGPF_DEFAULT), BGP_ENOERR);
+
+    size_t n;
+    void *data = bgpfinish_r(&bgp, &n);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.stamp.tv_sec  = 1500000000;
+    hdr.stamp.tv_nsec = 123456000;
+    hdr.type = MRT_BGP4MP_ET;
+
+    bgp4mp_header_t bgp4mp;
+    memset(&bgp4mp, 0, sizeof(bgp4mp));
+    bgp4mp.peer_as   = 4200000000u;
+    bgp4mp.local_as  = 12345;
+    bgp4mp.iface     = 7;
+    bgp4mp.old_state = 5;
+    bgp4mp.new_state = 6;
+    stonaddr(&bgp4mp.peer_addr, "2001:db8::1");
+    stonaddr(&bgp4mp.local_addr, "2001:db8::2");
+
+    // memory I/O implements writev() natively
+    unsigned char buf[512];
+    io_rw_t io;
+
+    io_mem_wrinit(&io, buf, sizeof(buf));
+
+    hdr.subtype = BGP4MP_MESSAGE_AS4;
+    CU_ASSERT_EQUAL_FATAL(mrtwritebgp4mp(&io, &hdr, &bgp4mp, data, n), MRT_ENOERR);
+
+    size_t reclen = io.mem.ptr - buf;
+
+    hdr.subtype = BGP4MP_STATE_CHANGE_AS4;
+    CU_ASSERT_EQUAL_FATAL(mrtwritebgp4mp(&io, &hdr, &bgp4mp, NULL, 0), MRT_ENOERR);
+
+    size_t size = io.mem.ptr - buf;
+
+    io_mem_rdinit(&io, buf, size);
+    checkbgp4mp(&io, BGP4MP_MESSAGE_AS4, data, n);
+    checkbgp4mp(&io, BGP4MP_STATE_CHANGE_AS4, NULL, 0);
+
+    // compressed I/O falls back to a single gathered write()
+    const char *filename = "miao.writev.gz";
+
+    int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io_rw_t *zio = io_zopen(fd, 0, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(zio);
+    CU_ASSERT_PTR_NULL(zio->writev);
+
+    hdr.subtype = BGP4MP_MESSAGE_AS4;
+    CU_ASSERT_EQUAL_FATAL(mrtwritebgp4mp(zio, &hdr, &bgp4mp, data, n), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(zio->close(zio), 0);
+
+    fd = open(filename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    zio = io_zopen(fd, 0, "r");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(zio);
+
+    unsigned char zbuf[sizeof(buf)];
+    CU_ASSERT_EQUAL_FATAL(zio->read(zio, zbuf, sizeof(zbuf)), reclen);
+    CU_ASSERT_EQUAL(memcmp(zbuf, buf, reclen), 0);
+    CU_ASSERT_EQUAL(zio->close(zio), 0);
+
+    CU_ASSERT_EQUAL(bgpclose_r(&bgp), BGP_ENOERR);
+    unlink(filename);
+}
+
+void testmrtiterator(void)
+{
+    bgp_msg_t bgp;
+
+    CU_ASSERT_EQUAL_FATAL(setbgpwrite_r(&bgp, BGP_KEEPALIVE, BGPF_DEFAULT), BGP_ENOERR);
+
+    size_t n;
+    void *data = bgpfinish_r(&bgp, &n);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type    = MRT_BGP4MP;
+    hdr.subtype = BGP4MP_MESSAGE_AS4;
+
+    bgp4mp_header_t bgp4mp;
+    memset(&bgp4mp, 0, sizeof(bgp4mp));
+    bgp4mp.peer_as  = 64512;
+    bgp4mp.local_as = 64513;
+    stonaddr(&bgp4mp.peer_addr, "192.0.2.1");
+    stonaddr(&bgp4mp.local_addr, "192.0.2.2");
+
+    enum { NRECORDS = 16 };
+
+    unsigned char buf[4096];
+    io_rw_t io;
+
+    io_mem_wrinit(&io, buf, sizeof(buf));
+    for (int i = 0; i < NRECORDS; i++) {
+        hdr.stamp.tv_sec = 1500000000 + i;
+        CU_ASSERT_EQUAL_FATAL(mrtwritebgp4mp(&io, &hdr, &bgp4mp, data, n), MRT_ENOERR);
+    }
+
+    size_t size = io.mem.ptr - buf;
+
+    mrt_iter_t it;
+    mrt_msg_t msg;
+
+    mrtiterinit(&it, buf, size);
+
+    int i = 0, err;
+    while ((err = mrtiternext(&it, &msg)) == MRT_ENOERR) {
+        // records are referenced in place
+        CU_ASSERT_TRUE(msg.buf >= buf && msg.buf < buf + size);
+        CU_ASSERT_EQUAL(getmrtheader_r(&msg)->stamp.tv_sec, 1500000000 + i);
+
+        size_t len;
+        void *pkt = unwrapbgp4mp_r(&msg, &len);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(pkt);
+        CU_ASSERT_EQUAL(len, n);
+        CU_ASSERT_EQUAL(memcmp(pkt, data, n), 0);
+
+        CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+        i++;
+    }
+
+    CU_ASSERT_EQUAL(err, MRT_EIO);
+    CU_ASSERT_EQUAL(i, NRECORDS);
+    CU_ASSERT_EQUAL(mrtiterleft(&it), 0);
+
+    // truncated trailing record
+    mrtiterinit(&it, buf, size - 1);
+    for (i = 0; i < NRECORDS - 1; i++) {
+        CU_ASSERT_EQUAL_FATAL(mrtiternext(&it, &msg), MRT_ENOERR);
+        mrtclose_r(&msg);
+    }
+
+    CU_ASSERT_EQUAL(mrtiternext(&it, &msg), MRT_EBADHDR);
+
+    // default mode still copies the record
+    CU_ASSERT_EQUAL_FATAL(setmrtread_r(&msg, buf, size, MRTF_DEFAULT), MRT_ENOERR);
+    CU_ASSERT_TRUE(msg.buf < buf || msg.buf >= buf + size);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+
+    CU_ASSERT_EQUAL(bgpclose_r(&bgp), BGP_ENOERR);
+}
+
+void testmrtbufretain(void)
+{
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type    = MRT_BGP4MP;
+    hdr.subtype = BGP4MP_MESSAGE_AS4;
+
+    bgp4mp_header_t bgp4mp;
+    memset(&bgp4mp, 0, sizeof(bgp4mp));
+    bgp4mp.peer_as  = 64512;
+    bgp4mp.local_as = 64513;
+    stonaddr(&bgp4mp.peer_addr, "192.0.2.1");
+    stonaddr(&bgp4mp.local_addr, "192.0.2.2");
+
+    // records exceeding MRTBUFSIZ, payload needn't be a valid BGP packet
+    static const size_t sizes[] = { 6000, 5000, 7000, 100, 6500 };
+    enum { NRECORDS = sizeof(sizes) / sizeof(sizes[0]) };
+
+    static unsigned char payload[8000];
+    static unsigned char buf[64 * 1024];
+    memset(payload, 0xab, sizeof(payload));
+
+    io_rw_t io;
+    io_mem_wrinit(&io, buf, sizeof(buf));
+    for (int i = 0; i < NRECORDS; i++)
+        CU_ASSERT_EQUAL_FATAL(mrtwritebgp4mp(&io, &hdr, &bgp4mp, payload, sizes[i]), MRT_ENOERR);
+
+    size_t size = io.mem.ptr - buf;
+
+    mrtreleasebufs();
+    setmrtbufretain(0);
+
+    mrt_msg_t msg;
+    unsigned char *bufs[NRECORDS];
+
+    io_mem_rdinit(&io, buf, size);
+    for (int i = 0; i < NRECORDS; i++) {
+        CU_ASSERT_EQUAL_FATAL(setmrtreadfrom_r(&msg, &io), MRT_ENOERR);
+
+        size_t len;
+        void *pkt = unwrapbgp4mp_r(&msg, &len);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(pkt);
+        CU_ASSERT_EQUAL(len, sizes[i]);
+        CU_ASSERT_EQUAL(memcmp(pkt, payload, len), 0);
+
+        bufs[i] = msg.buf;
+        CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+    }
+
+    // buffer grown for the first record is recycled by the next one,
+    // small records still use the fast buffer
+    CU_ASSERT_PTR_EQUAL(bufs[0], bufs[1]);
+    CU_ASSERT_PTR_EQUAL(bufs[3], msg.fastbuf);
+    CU_ASSERT_TRUE(getmrtbufhiwater() > 7000);
+
+    // shrink policy, large buffers are dropped on close
+    setmrtbufretain(MRTBUFSIZ);
+
+    io_mem_rdinit(&io, buf, size);
+    CU_ASSERT_EQUAL_FATAL(setmrtreadfrom_r(&msg, &io), MRT_ENOERR);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(setmrtreadfrom_r(&msg, &io), MRT_ENOERR);
+
+    size_t len;
+    void *pkt = unwrapbgp4mp_r(&msg, &len);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pkt);
+    CU_ASSERT_EQUAL(len, sizes[1]);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+
+    setmrtbufretain(0);
+    mrtreleasebufs();
+}
+
+void testmrtpeerindex(void)
+{
+    static const unsigned char pirec[] = {
+        0x59, 0x68, 0x2f, 0x00, 0x00, 0x0d, 0x00, 0x01,  // 1500000000, TABLE_DUMPV2, PEER_INDEX_TABLE
+        0x00, 0x00, 0x00, 0x2e,                          // length
+        0xc0, 0x00, 0x02, 0xff,                          // collector 192.0.2.255
+        0x00, 0x02, 'r', 'v',                            // view name
+        0x00, 0x02,                                      // peer count
+        0x03, 0x0a, 0x00, 0x00, 0x01,                    // IPv6, 32 bits AS, BGP ID 10.0.0.1
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,  // 2001:db8::1
+        0xfa, 0x56, 0xea, 0x00,                          // AS4200000000
+        0x00, 0x0a, 0x00, 0x00, 0x02,                    // IPv4, 16 bits AS, BGP ID 10.0.0.2
+        0xc0, 0x00, 0x02, 0x01,                          // 192.0.2.1
+        0xfc, 0x00                                       // AS64512
+    };
+    static const unsigned char ribrec[] = {
+        0x59, 0x68, 0x2f, 0x00, 0x00, 0x0d, 0x00, 0x02,  // 1500000000, TABLE_DUMPV2, RIB_IPV4_UNICAST
+        0x00, 0x00, 0x00, 0x1a,                          // length
+        0x00, 0x00, 0x00, 0x07,                          // sequence number
+        0x18, 0x0a, 0x01, 0x02,                          // 10.1.2.0/24
+        0x00, 0x02,                                      // entry count
+        0x00, 0x01, 0x59, 0x68, 0x2f, 0x00,              // peer 1
+        0x00, 0x00,                                      // no attributes
+        0x00, 0x00, 0x59, 0x68, 0x2f, 0x00,              // peer 0
+        0x00, 0x00                                       // no attributes
+    };
+
+    mrt_msg_t msg;
+
+    CU_ASSERT_EQUAL_FATAL(setmrtread_r(&msg, pirec, sizeof(pirec), MRTF_NOCOPY), MRT_ENOERR);
+
+    peer_index_t *pi;
+    CU_ASSERT_EQUAL_FATAL(newpeerindex_r(&msg, &pi), MRT_ENOERR);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+
+    CU_ASSERT_EQUAL(ntohl(pi->collector.s_addr), 0xc00002ff);
+    CU_ASSERT_STRING_EQUAL(pi->viewname, "rv");
+    CU_ASSERT_EQUAL_FATAL(pi->npeers, 2);
+    CU_ASSERT_EQUAL(pi->peers[0].addr.family, AF_INET6);
+    CU_ASSERT_EQUAL(pi->peers[0].as, 4200000000u);
+    CU_ASSERT_EQUAL(pi->peers[0].as_size, sizeof(uint32_t));
+    CU_ASSERT_EQUAL(pi->peers[1].addr.family, AF_INET);
+    CU_ASSERT_EQUAL(pi->peers[1].as, 64512);
+    CU_ASSERT_EQUAL(pi->peers[1].as_size, sizeof(uint16_t));
+
+    // Peer Index can't be associated with non-RIB records
+    CU_ASSERT_EQUAL_FATAL(setmrtread_r(&msg, pirec, sizeof(pirec), MRTF_NOCOPY), MRT_ENOERR);
+    CU_ASSERT_EQUAL(setribpeerindex_r(&msg, pi), MRT_EINVOP);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+
+    CU_ASSERT_EQUAL_FATAL(setmrtread_r(&msg, ribrec, sizeof(ribrec), MRTF_NOCOPY), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(setribpeerindex_r(&msg, pi), MRT_ENOERR);
+
+    size_t count;
+    rib_header_t *hdr = startribents_r(&msg, &count);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(hdr);
+    CU_ASSERT_EQUAL(hdr->seqno, 7);
+    CU_ASSERT_EQUAL(count, 2);
+
+    // entries reference the Peer Index directly
+    rib_entry_t *rib = nextribent_r(&msg);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(rib);
+    CU_ASSERT_PTR_EQUAL(rib->peer, &pi->peers[1]);
+    CU_ASSERT_EQUAL(rib->nlri.bitlen, 24);
+
+    rib = nextribent_r(&msg);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(rib);
+    CU_ASSERT_PTR_EQUAL(rib->peer, &pi->peers[0]);
+    CU_ASSERT_PTR_NULL(nextribent_r(&msg));
+    CU_ASSERT_EQUAL(endribents_r(&msg), MRT_ENOERR);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+
+    freepeerindex(pi);
+
+    // truncated peer entry
+    unsigned char bad[sizeof(pirec)];
+    memcpy(bad, pirec, sizeof(bad));
+    bad[11] -= 1;
+
+    CU_ASSERT_EQUAL_FATAL(setmrtread_r(&msg, bad, sizeof(bad) - 1, MRTF_NOCOPY), MRT_ENOERR);
+    CU_ASSERT_EQUAL(newpeerindex_r(&msg, &pi), MRT_EBADPEERIDX);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+}
+
+enum {
+    WRNRIBS  = 3000,  // large enough to fill write buffer
+    WRNPEERS = 300    // large enough for a 16 bits AS overflow
+};
+
+static const unsigned char wrattrs[] = { 0x40, 0x01, 0x01, 0x00 };  // ORIGIN IGP
+
+static void putribdump(mrt_msg_t *msg, struct in_addr collector)
+{
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.stamp.tv_sec = 1500000000;
+    hdr.type         = MRT_TABLE_DUMPV2;
+    hdr.subtype      = MRT_TABLE_DUMPV2_PEER_INDEX_TABLE;
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(msg, &hdr, collector, "view"), MRT_ENOERR);
+
+    peer_entry_t pe;
+    memset(&pe, 0, sizeof(pe));
+    for (uint32_t i = 0; i < WRNPEERS; i++) {
+        pe.as = 64512 + i * 1000;
+        pe.id.s_addr = htonl(i);
+        stonaddr(&pe.addr, (i & 1) ? "2001:db8::1" : "192.0.2.1");
+        CU_ASSERT_EQUAL_FATAL(putpeerent_r(msg, &pe), MRT_ENOERR);
+    }
+
+    netaddr_t pfx;
+    stonaddr(&pfx, "10.0.0.0/8");
+
+    hdr.subtype = MRT_TABLE_DUMPV2_RIB_IPV4_UNICAST;
+    for (uint32_t i = 0; i < WRNRIBS; i++) {
+        CU_ASSERT_EQUAL_FATAL(setmrtheader_r(msg, &hdr, i, &pfx), MRT_ENOERR);
+        for (uint16_t j = 0; j < i % 4 + 1; j++)
+            CU_ASSERT_EQUAL_FATAL(putribent_r(msg, NULL, j, 1400000000 + j, (const bgpattr_t *) wrattrs, sizeof(wrattrs)), MRT_ENOERR);
+    }
+
+    // prefix length must fit the address family, nothing is written
+    pfx.bitlen = 33;
+    CU_ASSERT_EQUAL(setmrtheader_r(msg, &hdr, WRNRIBS, &pfx), MRT_EINVOP);
+
+    stonaddr(&pfx, "2001:db8::/32");
+    pfx.bitlen  = 129;
+    hdr.subtype = MRT_TABLE_DUMPV2_RIB_IPV6_UNICAST;
+    CU_ASSERT_EQUAL(setmrtheader_r(msg, &hdr, WRNRIBS, &pfx), MRT_EINVOP);
+}
+
+static void checkribdump(mrt_iter_t *it, struct in_addr collector)
+{
+    mrt_msg_t msg;
+
+    CU_ASSERT_EQUAL_FATAL(mrtiternext(it, &msg), MRT_ENOERR);
+
+    char viewname[16];
+    getpiviewname_r(&msg, viewname, sizeof(viewname));
+    CU_ASSERT_STRING_EQUAL(viewname, "view");
+
+    peer_index_t *pi;
+    CU_ASSERT_EQUAL_FATAL(newpeerindex_r(&msg, &pi), MRT_ENOERR);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+    CU_ASSERT_EQUAL(pi->collector.s_addr, collector.s_addr);
+    CU_ASSERT_EQUAL_FATAL(pi->npeers, WRNPEERS);
+    for (uint32_t i = 0; i < WRNPEERS; i++) {
+        CU_ASSERT_EQUAL(pi->peers[i].as, 64512 + i * 1000);
+        CU_ASSERT_EQUAL(pi->peers[i].addr.family, (i & 1) ? AF_INET6 : AF_INET);
+        CU_ASSERT_EQUAL(ntohl(pi->peers[i].id.s_addr), i);
+    }
+
+    for (uint32_t i = 0; i < WRNRIBS; i++) {
+        CU_ASSERT_EQUAL_FATAL(mrtiternext(it, &msg), MRT_ENOERR);
+        CU_ASSERT_EQUAL_FATAL(setribpeerindex_r(&msg, pi), MRT_ENOERR);
+
+        size_t count;
+        rib_header_t *rh = startribents_r(&msg, &count);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(rh);
+        CU_ASSERT_EQUAL(rh->seqno, i);
+        CU_ASSERT_EQUAL(rh->nlri.bitlen, 8);
+        CU_ASSERT_EQUAL(count, i % 4 + 1);
+
+        rib_entry_t *rib;
+        uint16_t j = 0;
+        while ((rib = nextribent_r(&msg)) != NULL) {
+            CU_ASSERT_EQUAL(rib->peer_idx, j);
+            CU_ASSERT_EQUAL(rib->originated, 1400000000 + j);
+            CU_ASSERT_EQUAL(rib->attr_length, sizeof(wrattrs));
+            CU_ASSERT_EQUAL(memcmp(rib->attrs, wrattrs, sizeof(wrattrs)), 0);
+            j++;
+        }
+
+        CU_ASSERT_EQUAL(j, count);
+        CU_ASSERT_EQUAL(endribents_r(&msg), MRT_ENOERR);
+        CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+    }
+
+    freepeerindex(pi);
+}
+
+void testmrtwriter(void)
+{
+    bgp_msg_t bgp;
+
+    CU_ASSERT_EQUAL_FATAL(setbgpwrite_r(&bgp, BGP_KEEPALIVE, BGPF_DEFAULT), BGP_ENOERR);
+
+    size_t n;
+    void *data = bgpfinish_r(&bgp, &n);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+
+    struct in_addr collector = { htonl(0xc00002ff) };
+
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.stamp.tv_sec  = 1500000000;
+    hdr.stamp.tv_nsec = 123456000;
+    hdr.type          = MRT_BGP4MP_ET;
+    hdr.subtype       = BGP4MP_MESSAGE_AS4;
+
+    bgp4mp_header_t bgp4mp;
+    memset(&bgp4mp, 0, sizeof(bgp4mp));
+    bgp4mp.peer_as   = 4200000000u;
+    bgp4mp.local_as  = 12345;
+    bgp4mp.iface     = 7;
+    bgp4mp.old_state = 5;
+    bgp4mp.new_state = 6;
+    stonaddr(&bgp4mp.peer_addr, "2001:db8::1");
+    stonaddr(&bgp4mp.local_addr, "2001:db8::2");
+
+    static unsigned char buf[512 * 1024];
+    io_rw_t io;
+    mrt_msg_t msg;
+
+    // batched records, written to io
+    io_mem_wrinit(&io, buf, sizeof(buf));
+    CU_ASSERT_EQUAL_FATAL(setmrtwrite_r(&msg, &io), MRT_ENOERR);
+
+    putribdump(&msg, collector);
+
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, &bgp4mp), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(wrapbgp4mp_r(&msg, data, n), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(mrtclose_r(&msg), MRT_ENOERR);
+
+    size_t size = io.mem.ptr - buf;
+
+    mrt_iter_t it;
+    mrtiterinit(&it, buf, size);
+
+    checkribdump(&it, collector);
+
+    CU_ASSERT_EQUAL_FATAL(mrtiternext(&it, &msg), MRT_ENOERR);
+    CU_ASSERT_EQUAL(getmrtheader_r(&msg)->type, MRT_BGP4MP_ET);
+    CU_ASSERT_EQUAL(getmrtheader_r(&msg)->stamp.tv_nsec, 123456000);
+
+    size_t len;
+    void *pkt = unwrapbgp4mp_r(&msg, &len);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pkt);
+    CU_ASSERT_EQUAL(len, n);
+    CU_ASSERT_EQUAL(memcmp(pkt, data, n), 0);
+    CU_ASSERT_EQUAL(getbgp4mpheader_r(&msg)->peer_as, 4200000000u);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+
+    CU_ASSERT_EQUAL(mrtiternext(&it, &msg), MRT_EIO);
+
+    // in memory records
+    CU_ASSERT_EQUAL_FATAL(setmrtwrite_r(&msg, NULL), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, &bgp4mp), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(wrapbgp4mp_r(&msg, data, n), MRT_ENOERR);
+
+    hdr.subtype = BGP4MP_STATE_CHANGE_AS4;
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, &bgp4mp), MRT_ENOERR);
+
+    size_t memsiz;
+    unsigned char *mem = mrtfinish_r(&msg, &memsiz);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mem);
+
+    // memory is invalidated on close
+    memcpy(buf, mem, memsiz);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+
+    io_mem_rdinit(&io, buf, memsiz);
+    checkbgp4mp(&io, BGP4MP_MESSAGE_AS4, data, n);
+    checkbgp4mp(&io, BGP4MP_STATE_CHANGE_AS4, NULL, 0);
+
+    // state changes carry no BGP data, errors are sticky
+    CU_ASSERT_EQUAL_FATAL(setmrtwrite_r(&msg, NULL), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, &bgp4mp), MRT_ENOERR);
+    CU_ASSERT_EQUAL(wrapbgp4mp_r(&msg, data, n), MRT_EINVOP);
+    CU_ASSERT_EQUAL(putpeerent_r(&msg, &(peer_entry_t) { 0 }), MRT_EINVOP);
+    CU_ASSERT_PTR_NULL(mrtfinish_r(&msg, &memsiz));
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_EINVOP);
+
+    CU_ASSERT_EQUAL(bgpclose_r(&bgp), BGP_ENOERR);
+}
+
+enum {
+    HFNRECS  = 300,
+    HFNPEERS = 3,
+    HFBIGLEN = 6000  // larger than MRTBUFSIZ and skip buffer
+};
+
+static size_t puthfstream(unsigned char *buf, size_t bufsiz)
+{
+    static unsigned char payload[HFBIGLEN];
+
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = MRT_BGP4MP_ET;
+
+    bgp4mp_header_t bgp4mp;
+    memset(&bgp4mp, 0, sizeof(bgp4mp));
+    bgp4mp.local_as = 64500;
+
+    io_rw_t io;
+    io_mem_wrinit(&io, buf, bufsiz);
+
+    mrt_msg_t msg;
+    CU_ASSERT_EQUAL_FATAL(setmrtwrite_r(&msg, &io), MRT_ENOERR);
+    for (int i = 0; i < HFNRECS; i++) {
+        int peer = i % HFNPEERS;
+
+        hdr.stamp.tv_sec  = 1500000000 + i / HFNPEERS;
+        hdr.stamp.tv_nsec = peer * 100000000;
+        hdr.subtype       = (i % 7 == 0) ? BGP4MP_STATE_CHANGE_AS4 : BGP4MP_MESSAGE_AS4;
+
+        bgp4mp.peer_as = 65001 + peer;
+        bgp4mp.iface   = i;
+        stonaddr(&bgp4mp.peer_addr,  (peer == 2) ? "2001:db8::1" : (peer == 1) ? "192.0.2.2" : "192.0.2.1");
+        stonaddr(&bgp4mp.local_addr, (peer == 2) ? "2001:db8::ff" : "192.0.2.255");
+
+        CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, &bgp4mp), MRT_ENOERR);
+        if (hdr.subtype == BGP4MP_MESSAGE_AS4) {
+            size_t n = (i % 10 == 1) ? HFBIGLEN : 64;
+            memset(payload, i & 0xff, n);
+            CU_ASSERT_EQUAL_FATAL(wrapbgp4mp_r(&msg, payload, n), MRT_ENOERR);
+        }
+    }
+    CU_ASSERT_EQUAL_FATAL(mrtclose_r(&msg), MRT_ENOERR);
+    return io.mem.ptr - buf;
+}
+
+// check filtered reads against a full scan
+static void checkhfilter(io_rw_t *io, const unsigned char *data, size_t size, const mrt_hdrfilter_t *flt, int nexpect)
+{
+    io_rw_t ref;
+    io_mem_rdinit(&ref, data, size);
+
+    int count = 0;
+    mrt_msg_t msg, expect;
+    while (setmrtreadfrom_r(&expect, &ref) == MRT_ENOERR) {
+        if (!mrthdrmatch_r(&expect, flt)) {
+            CU_ASSERT_EQUAL(mrtclose_r(&expect), MRT_ENOERR);
+            continue;
+        }
+
+        CU_ASSERT_EQUAL_FATAL(setmrtreadfiltered_r(&msg, io, flt), MRT_ENOERR);
+        CU_ASSERT_EQUAL(getmrtheader_r(&msg)->len, getmrtheader_r(&expect)->len);
+        CU_ASSERT_EQUAL(getmrtheader_r(&msg)->stamp.tv_nsec, getmrtheader_r(&expect)->stamp.tv_nsec);
+        CU_ASSERT_EQUAL(getbgp4mpheader_r(&msg)->iface, getbgp4mpheader_r(&expect)->iface);
+        if (isbgpwrapper_r(&expect)) {
+            size_t n, m;
+            void *pkt  = unwrapbgp4mp_r(&msg, &n);
+            void *epkt = unwrapbgp4mp_r(&expect, &m);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(pkt);
+            CU_ASSERT_EQUAL_FATAL(n, m);
+            CU_ASSERT_EQUAL(memcmp(pkt, epkt, n), 0);
+        }
+
+        CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+        CU_ASSERT_EQUAL(mrtclose_r(&expect), MRT_ENOERR);
+        count++;
+    }
+
+    CU_ASSERT_EQUAL(setmrtreadfiltered_r(&msg, io, flt), MRT_EIO);
+    CU_ASSERT_EQUAL(count, nexpect);
+}
+
+void testmrthdrfilter(void)
+{
+    static unsigned char buf[HFNRECS * (HFBIGLEN + 128) / 10 + HFNRECS * 160];
+    size_t size = puthfstream(buf, sizeof(buf));
+
+    const char *filename = "miao.mrthf";
+
+    int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+    CU_ASSERT_TRUE_FATAL(write(fd, buf, size) == (ssize_t) size);
+    close(fd);
+
+    mrt_hdrfilter_t flts[5];
+    memset(flts, 0, sizeof(flts));
+
+    flts[0].fields  = MRTHF_PEERAS;
+    flts[0].peer_as = 65002;
+
+    flts[1].fields  = MRTHF_PEERADDR | MRTHF_SUBTYPE;
+    flts[1].subtype = BGP4MP_MESSAGE_AS4;
+    stonaddr(&flts[1].peer_addr, "2001:db8::1");
+
+    flts[2].fields = MRTHF_TIME;
+    flts[2].start  = (struct timespec) { 1500000010, 100000000 };
+    flts[2].end    = (struct timespec) { 1500000020, 0 };
+
+    flts[3].fields = MRTHF_TYPE;
+    flts[3].type   = MRT_TABLE_DUMPV2;
+
+    flts[4].fields   = MRTHF_LOCALAS | MRTHF_TYPE;
+    flts[4].type     = MRT_BGP4MP_ET;
+    flts[4].local_as = 64500;
+
+    // peer 2 is one third, minus state changes
+    const int nexpect[] = { HFNRECS / HFNPEERS, 86, 29, 0, HFNRECS };
+
+    for (size_t i = 0; i < nelems(flts); i++) {
+        // memory I/O
+        io_rw_t io;
+        io_mem_rdinit(&io, buf, size);
+        checkhfilter(&io, buf, size, &flts[i], nexpect[i]);
+
+        // plain fd, large bodies are seeked over
+        fd = open(filename, O_RDONLY);
+        CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+        io_fd_init(&io, fd);
+        checkhfilter(&io, buf, size, &flts[i], nexpect[i]);
+        close(fd);
+
+        // zero-copy
+        fd = open(filename, O_RDONLY);
+        CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+        io_rw_t *mio = io_mmapopen(fd, "r");
+        CU_ASSERT_PTR_NOT_NULL_FATAL(mio);
+        checkhfilter(mio, buf, size, &flts[i], nexpect[i]);
+        mio->close(mio);
+    }
+
+    unlink(filename);
+}
+
+// ORIGIN IGP, then a 32-bits AS_PATH ending with either an AS_SEQUENCE or an AS_SET
+static size_t putcolsattrs(unsigned char *buf, uint32_t as, int segtype)
+{
+    static const unsigned char head[] = {
+        0x40, 0x01, 0x01, 0x00,                          // ORIGIN IGP
+        0x40, 0x02, 0x0c,                                // AS_PATH, 12 bytes
+        0x02, 0x01, 0x00, 0x00, 0xfc, 0x00               // AS_SEQUENCE AS64512
+    };
+
+    memcpy(buf, head, sizeof(head));
+
+    unsigned char *ptr = buf + sizeof(head);
+    *ptr++ = segtype;
+    *ptr++ = 1;
+    *ptr++ = as >> 24;
+    *ptr++ = as >> 16;
+    *ptr++ = as >> 8;
+    *ptr++ = as;
+    return ptr - buf;
+}
+
+void testmrtribcols(void)
+{
+    enum { NENTS = 5, NCOLS = 2 };
+
+    static unsigned char buf[4096];
+    unsigned char attrs[32];
+    io_rw_t io;
+    mrt_msg_t msg;
+
+    io_mem_wrinit(&io, buf, sizeof(buf));
+    CU_ASSERT_EQUAL_FATAL(setmrtwrite_r(&msg, &io), MRT_ENOERR);
+
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.stamp.tv_sec = 1500000000;
+    hdr.type         = MRT_TABLE_DUMPV2;
+    hdr.subtype      = MRT_TABLE_DUMPV2_PEER_INDEX_TABLE;
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, (struct in_addr) { 0 }, ""), MRT_ENOERR);
+
+    peer_entry_t pe;
+    memset(&pe, 0, sizeof(pe));
+    for (uint32_t i = 0; i < NENTS; i++) {
+        pe.as = 64512 + i;
+        stonaddr(&pe.addr, "192.0.2.1");
+        CU_ASSERT_EQUAL_FATAL(putpeerent_r(&msg, &pe), MRT_ENOERR);
+    }
+
+    netaddr_t pfx;
+    stonaddr(&pfx, "10.0.0.0/8");
+
+    hdr.subtype = MRT_TABLE_DUMPV2_RIB_IPV4_UNICAST;
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, 0, &pfx), MRT_ENOERR);
+    for (uint16_t i = 0; i < NENTS; i++) {
+        // last entry's path ends with an AS_SET, hence has no origin
+        size_t n = putcolsattrs(attrs, 4200000000u + i, (i == NENTS - 1) ? AS_SEGMENT_SET : AS_SEGMENT_SEQ);
+        CU_ASSERT_EQUAL_FATAL(putribent_r(&msg, NULL, NENTS - 1 - i, 1400000000 + i, (const bgpattr_t *) attrs, n), MRT_ENOERR);
+    }
+
+    CU_ASSERT_EQUAL_FATAL(mrtclose_r(&msg), MRT_ENOERR);
+
+    size_t size = io.mem.ptr - buf;
+
+    mrt_iter_t it;
+    mrtiterinit(&it, buf, size);
+
+    peer_index_t *pi;
+    CU_ASSERT_EQUAL_FATAL(mrtiternext(&it, &msg), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(newpeerindex_r(&msg, &pi), MRT_ENOERR);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+
+    attrstore_t *st = attrstore_create(0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(st);
+
+    time_t stamps[NCOLS];
+    uint32_t peers[NCOLS], pathids[NCOLS], origins[NCOLS];
+    netaddr_t pfxs[NCOLS];
+    const attrref_t *refs[NCOLS];
+
+    ribcols_t cols = {
+        .cap       = NCOLS,
+        .stamp     = stamps,
+        .peer_idx  = peers,
+        .pfx       = pfxs,
+        .pathid    = pathids,
+        .origin_as = origins,
+        .attrs     = refs
+    };
+
+    CU_ASSERT_EQUAL_FATAL(mrtiternext(&it, &msg), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(setribpeerindex_r(&msg, pi), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(setribattrstore_r(&msg, st), MRT_ENOERR);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(startribents_r(&msg, NULL));
+
+    size_t row = 0, n;
+    while ((n = nextribcols_r(&msg, &cols)) > 0) {
+        CU_ASSERT_EQUAL(n, cols.len);
+        CU_ASSERT(n <= NCOLS);
+
+        for (size_t i = 0; i < n; i++, row++) {
+            CU_ASSERT_EQUAL(stamps[i], (time_t) (1400000000 + row));
+            CU_ASSERT_EQUAL(peers[i], NENTS - 1 - row);
+            CU_ASSERT_EQUAL(pathids[i], 0);
+            CU_ASSERT_EQUAL(pfxs[i].bitlen, 8);
+            CU_ASSERT_EQUAL(pfxs[i].family, AF_INET);
+            CU_ASSERT_EQUAL(origins[i], (row == NENTS - 1) ? 0 : 4200000000u + row);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(refs[i]);
+            CU_ASSERT_EQUAL(refs[i]->peer, peers[i]);
+            CU_ASSERT_EQUAL(getoriginas(refs[i]->attrs, refs[i]->len, sizeof(uint32_t)), origins[i]);
+
+            attrstore_unref(st, refs[i]);
+        }
+
+        cols.len = 0;
+    }
+
+    CU_ASSERT_EQUAL(row, NENTS);
+    CU_ASSERT_EQUAL(endribents_r(&msg), MRT_ENOERR);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+    CU_ASSERT_EQUAL(attrstore_count(st), 0);
+
+    // legacy TABLE_DUMP, one entry per record, 16-bits ASes
+    static const unsigned char legacy[] = {
+        0x59, 0x68, 0x2f, 0x00,                          // timestamp
+        0x00, 0x0c, 0x00, 0x01,                          // TABLE_DUMP, AFI_IPV4
+        0x00, 0x00, 0x00, 0x21,                          // length
+        0x00, 0x00, 0x00, 0x07,                          // view, sequence number
+        0x0a, 0x02, 0x00, 0x00, 0x10, 0x01,              // 10.2.0.0/16, status
+        0x53, 0x72, 0x4e, 0x00,                          // originated
+        0xc0, 0x00, 0x02, 0x01, 0xfc, 0x01,              // peer 192.0.2.1, AS64513
+        0x00, 0x0b,                                      // attributes length
+        0x40, 0x01, 0x01, 0x00,                          // ORIGIN IGP
+        0x40, 0x02, 0x04, 0x02, 0x01, 0xfc, 0x02         // AS_SEQUENCE AS64514
+    };
+
+    CU_ASSERT_EQUAL_FATAL(setmrtread_r(&msg, legacy, sizeof(legacy), 0), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(setribattrstore_r(&msg, st), MRT_ENOERR);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(startribents_r(&msg, NULL));
+
+    memset(pfxs, 0, sizeof(pfxs));
+    CU_ASSERT_EQUAL_FATAL(nextribcols_r(&msg, &cols), 1);
+    CU_ASSERT_EQUAL(stamps[0], (time_t) 1400000000);
+    CU_ASSERT_EQUAL(peers[0], 0);
+    CU_ASSERT_EQUAL(origins[0], 64514);
+
+    stonaddr(&pfx, "10.2.0.0/16");
+    CU_ASSERT(naddreq(&pfxs[0], &pfx));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(refs[0]);
+    CU_ASSERT_EQUAL(refs[0]->len, 11);
+    CU_ASSERT_EQUAL(memcmp(refs[0]->attrs, &legacy[34], 11), 0);
+    attrstore_unref(st, refs[0]);
+
+    cols.len = 0;
+    CU_ASSERT_EQUAL(nextribcols_r(&msg, &cols), 0);
+    CU_ASSERT_EQUAL(endribents_r(&msg), MRT_ENOERR);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+    CU_ASSERT_EQUAL(attrstore_count(st), 0);
+
+    // UPDATE, announced and withdrawn prefixes
+    bgp_msg_t bgp;
+    CU_ASSERT_EQUAL_FATAL(setbgpwrite_r(&bgp, BGP_UPDATE, BGPF_ASN32BIT), BGP_ENOERR);
+
+    CU_ASSERT_EQUAL_FATAL(startwithdrawn_r(&bgp), BGP_ENOERR);
+    stonaddr(&pfx, "10.1.0.0/16");
+    CU_ASSERT_EQUAL_FATAL(putwithdrawn_r(&bgp, &pfx), BGP_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(endwithdrawn_r(&bgp), BGP_ENOERR);
+
+    size_t alen = putcolsattrs(attrs, 4200000000u, AS_SEGMENT_SEQ);
+    CU_ASSERT_EQUAL_FATAL(startbgpattribs_r(&bgp), BGP_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(putbgpattrib_r(&bgp, (const bgpattr_t *) &attrs[0]), BGP_ENOERR);  // ORIGIN
+    CU_ASSERT_EQUAL_FATAL(putbgpattrib_r(&bgp, (const bgpattr_t *) &attrs[4]), BGP_ENOERR);  // AS_PATH
+    CU_ASSERT_EQUAL_FATAL(endbgpattribs_r(&bgp), BGP_ENOERR);
+
+    static const char *const nlri[] = { "10.2.0.0/16", "10.3.0.0/16", "10.4.0.0/24" };
+
+    CU_ASSERT_EQUAL_FATAL(startnlri_r(&bgp), BGP_ENOERR);
+    for (size_t i = 0; i < nelems(nlri); i++) {
+        stonaddr(&pfx, nlri[i]);
+        CU_ASSERT_EQUAL_FATAL(putnlri_r(&bgp, &pfx), BGP_ENOERR);
+    }
+    CU_ASSERT_EQUAL_FATAL(endnlri_r(&bgp), BGP_ENOERR);
+
+    size_t pktlen;
+    void *pkt = bgpfinish_r(&bgp, &pktlen);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pkt);
+    CU_ASSERT_EQUAL_FATAL(setbgpread_r(&bgp, pkt, pktlen, BGPF_ASN32BIT), BGP_ENOERR);
+
+    cols.len = 0;
+    CU_ASSERT_EQUAL_FATAL(startallwithdrawn_r(&bgp), BGP_ENOERR);
+    CU_ASSERT_EQUAL(nextwithdrawncols_r(&bgp, &cols, 1500000000, 3), 1);
+    CU_ASSERT_EQUAL(nextwithdrawncols_r(&bgp, &cols, 1500000000, 3), 0);
+    CU_ASSERT_EQUAL(endwithdrawn_r(&bgp), BGP_ENOERR);
+    CU_ASSERT_EQUAL(cols.len, 1);
+    CU_ASSERT_STRING_EQUAL(naddrtos(&pfxs[0], NADDR_CIDR), "10.1.0.0/16");
+    CU_ASSERT_EQUAL(peers[0], 3);
+    CU_ASSERT_EQUAL(origins[0], 0);
+    CU_ASSERT_PTR_NULL(refs[0]);
+
+    row = 0;
+    cols.len = 0;
+    CU_ASSERT_EQUAL_FATAL(startallnlri_r(&bgp), BGP_ENOERR);
+    while ((n = nextnlricols_r(&bgp, &cols, 1500000000, 3, st)) > 0) {
+        for (size_t i = 0; i < n; i++, row++) {
+            CU_ASSERT_STRING_EQUAL(naddrtos(&pfxs[i], NADDR_CIDR), nlri[row]);
+            CU_ASSERT_EQUAL(stamps[i], 1500000000);
+            CU_ASSERT_EQUAL(origins[i], 4200000000u);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(refs[i]);
+            CU_ASSERT_EQUAL(refs[i]->len, alen);
+
+            attrstore_unref(st, refs[i]);
+        }
+
+        cols.len = 0;
+    }
+
+    CU_ASSERT_EQUAL(row, nelems(nlri));
+    CU_ASSERT_EQUAL(endnlri_r(&bgp), BGP_ENOERR);
+    CU_ASSERT_EQUAL(bgpclose_r(&bgp), BGP_ENOERR);
+    CU_ASSERT_EQUAL(attrstore_count(st), 0);
+
+    // 16-bits AS_PATH originated by AS_TRANS, real origin is inside AS4_PATH
+    static const unsigned char as4attrs[] = {
+        0x40, 0x02, 0x06, 0x02, 0x02, 0xfc, 0x00, 0x5b, 0xa0,  // AS_PATH AS64512 AS_TRANS
+        0xc0, 0x11, 0x06, 0x02, 0x01, 0xfa, 0x56, 0xea, 0x00   // AS4_PATH AS4200000000
+    };
+    CU_ASSERT_EQUAL(getoriginas(as4attrs, sizeof(as4attrs), sizeof(uint16_t)), 4200000000u);
+    CU_ASSERT_EQUAL(getoriginas(as4attrs, 9, sizeof(uint16_t)), AS_TRANS);
+
+    attrstore_destroy(st);
+    freepeerindex(pi);
+}
@@ -0,0 +1,374 @@
+//
+// Copyright (c) 2018, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <CUnit/CUnit.h>
+#include <fcntl.h>
+#include <isolario/endian.h>
+#include <isolario/io.h>
+#include <isolario/mrt.h>
+#include <isolario/mrtindex.h>
+#include <isolario/util.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+
+enum {
+    NRECORDS  = 32 * 1024,
+    MAXRECLEN = 256,
+    BASETIME  = 1500000000
+};
+
+// generates a synthetic MRT stream, records are one per second
+static unsigned char *mkmrtstream(size_t *pn)
+{
+    unsigned char *data = malloc(NRECORDS * (12 + MAXRECLEN));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+
+    uint32_t seed = 1;
+    size_t n = 0;
+    for (uint32_t i = 0; i < NRECORDS; i++) {
+        seed = seed * 1103515245 + 12345;
+
+        uint32_t len   = 20 + (seed >> 16) % (MAXRECLEN - 20);
+        uint32_t stamp = tobig32(BASETIME + i);
+        uint16_t type  = tobig16(16);  // BGP4MP
+        uint16_t sub   = tobig16(1);
+        uint32_t blen  = tobig32(len);
+
+        memcpy(&data[n], &stamp, sizeof(stamp));
+        memcpy(&data[n + 4], &type, sizeof(type));
+        memcpy(&data[n + 6], &sub, sizeof(sub));
+        memcpy(&data[n + 8], &blen, sizeof(blen));
+        n += 12;
+
+        for (uint32_t j = 0; j < len; j++) {
+            seed = seed * 1103515245 + 12345;
+            data[n++] = (seed >> 24) & 0x3f;  // compressible, but not too much
+        }
+    }
+
+    *pn = n;
+    return data;
+}
+
+void testmrtzindex(void)
+{
+    const char *filename = "miao.mrt.gz";
+
+    size_t n;
+    unsigned char *data = mkmrtstream(&n);
+
+    int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io_rw_t *io = io_zopen(fd, 0, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+    CU_ASSERT_TRUE_FATAL(io->write(io, data, n) == n);
+    CU_ASSERT_TRUE_FATAL(io->close(io) == 0);
+
+    fd = open(filename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    mrtzindex_t idx;
+    CU_ASSERT_TRUE_FATAL(mrtzbuildindex(&idx, fd, 256 * 1024) == 0);
+    CU_ASSERT_TRUE_FATAL(idx.npoints > 4);
+    close(fd);
+
+    // store to sidecar and reload it
+    size_t bufsiz = 64 + idx.npoints * (64 + MRTZ_WINSIZ);
+    unsigned char *sidecar = malloc(bufsiz);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sidecar);
+
+    io_rw_t mio;
+    io_mem_wrinit(&mio, sidecar, bufsiz);
+    CU_ASSERT_TRUE_FATAL(mrtzsaveindex(&idx, &mio) == 0);
+
+    mrtzindex_t loaded;
+    io_mem_rdinit(&mio, sidecar, bufsiz);
+    CU_ASSERT_TRUE_FATAL(mrtzloadindex(&loaded, &mio) == 0);
+    CU_ASSERT_TRUE_FATAL(loaded.npoints == idx.npoints);
+    mrtzfreeindex(&idx);
+
+    // every checkpoint must lead to a record boundary within the data
+    for (size_t i = 0; i < loaded.npoints; i++) {
+        const mrtzpoint_t *pt = &loaded.points[i];
+
+        CU_ASSERT_TRUE_FATAL(pt->recoff >= pt->out && pt->recoff < n);
+
+        fd = open(filename, O_RDONLY);
+        CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+        io = mrtzopenat(fd, pt, 0);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+
+        unsigned char buf[12 + MAXRECLEN];
+        size_t len = n - pt->recoff;
+        if (len > sizeof(buf))
+            len = sizeof(buf);
+
+        CU_ASSERT_TRUE_FATAL(io->read(io, buf, len) == len);
+        CU_ASSERT_TRUE(memcmp(buf, &data[pt->recoff], len) == 0);
+
+        uint32_t stamp;
+        memcpy(&stamp, buf, sizeof(stamp));
+        CU_ASSERT_TRUE(frombig32(stamp) == pt->stamp);
+        CU_ASSERT_TRUE(io->close(io) == 0);
+    }
+
+    // lookup by time
+    time_t t = BASETIME + NRECORDS / 2;
+    const mrtzpoint_t *pt = mrtzfindpoint(&loaded, t);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pt);
+    CU_ASSERT_TRUE(pt->stamp < t);
+    if (pt + 1 < loaded.points + loaded.npoints)
+        CU_ASSERT_TRUE(pt[1].stamp >= t);
+
+    mrtzfreeindex(&loaded);
+    free(sidecar);
+    free(data);
+    unlink(filename);
+}
+
+enum {
+    NTRECORDS = 20000,
+    NTPEERS   = 5
+};
+
+// generates BGP4MP_ET records from a few peers, four records per second
+static unsigned char *mkbgp4mpstream(size_t *pn)
+{
+    static unsigned char payload[100];
+
+    size_t bufsiz = NTRECORDS * (64 + sizeof(payload));
+    unsigned char *data = malloc(bufsiz);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = MRT_BGP4MP_ET;
+
+    bgp4mp_header_t bgp4mp;
+    memset(&bgp4mp, 0, sizeof(bgp4mp));
+    bgp4mp.local_as = 64500;
+    stonaddr(&bgp4mp.local_addr, "192.0.2.255");
+
+    io_rw_t io;
+    io_mem_wrinit(&io, data, bufsiz);
+
+    mrt_msg_t msg;
+    CU_ASSERT_EQUAL_FATAL(setmrtwrite_r(&msg, &io), MRT_ENOERR);
+    for (uint32_t i = 0; i < NTRECORDS; i++) {
+        char addr[32];
+        snprintf(addr, sizeof(addr), "192.0.2.%u", (unsigned int) (i % NTPEERS) + 1);
+
+        hdr.stamp.tv_sec  = BASETIME + i / 4;
+        hdr.stamp.tv_nsec = (i % 4) * 250000000;
+        hdr.subtype       = (i & 1) ? BGP4MP_MESSAGE_AS4 : BGP4MP_STATE_CHANGE_AS4;
+        bgp4mp.peer_as    = 65000 + i % NTPEERS;
+        stonaddr(&bgp4mp.peer_addr, addr);
+
+        CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, &bgp4mp), MRT_ENOERR);
+        if (i & 1)
+            CU_ASSERT_EQUAL_FATAL(wrapbgp4mp_r(&msg, payload, sizeof(payload)), MRT_ENOERR);
+    }
+    CU_ASSERT_EQUAL_FATAL(mrtclose_r(&msg), MRT_ENOERR);
+
+    *pn = io.mem.ptr - data;
+    return data;
+}
+
+// first record at or after t must be the first one of its second
+static void checkseek(io_rw_t *io, const mrttpoint_t *pt, time_t t)
+{
+    mrt_hdrfilter_t flt;
+    memset(&flt, 0, sizeof(flt));
+    flt.fields = MRTHF_TIME;
+    flt.start  = (struct timespec) { t, 0 };
+    flt.end    = (struct timespec) { BASETIME + NTRECORDS, 0 };
+
+    CU_ASSERT_TRUE_FATAL(pt->stamp < t);
+
+    mrt_msg_t msg;
+    CU_ASSERT_EQUAL_FATAL(setmrtreadfiltered_r(&msg, io, &flt), MRT_ENOERR);
+    CU_ASSERT_EQUAL(getmrtheader_r(&msg)->stamp.tv_sec, t);
+    CU_ASSERT_EQUAL(getmrtheader_r(&msg)->stamp.tv_nsec, 0);
+    CU_ASSERT_EQUAL(getbgp4mpheader_r(&msg)->peer_as, 65000 + ((t - BASETIME) * 4) % NTPEERS);
+    CU_ASSERT_EQUAL(mrtclose_r(&msg), MRT_ENOERR);
+}
+
+void testmrttindex(void)
+{
+    const char *filename   = "miao.mrt";
+    const char *zfilename  = "miao.mrt.gz";
+    const char *lzfilename = "miao.mrt.lz4";
+
+    size_t n;
+    unsigned char *data = mkbgp4mpstream(&n);
+
+    int fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+    CU_ASSERT_TRUE_FATAL(write(fd, data, n) == (ssize_t) n);
+    close(fd);
+
+    fd = open(zfilename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io_rw_t *io = io_zopen(fd, 0, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+    CU_ASSERT_TRUE_FATAL(io->write(io, data, n) == n);
+    CU_ASSERT_TRUE_FATAL(io->close(io) == 0);
+
+    fd = open(lzfilename, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io = io_lz4open(fd, 0, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+    CU_ASSERT_TRUE_FATAL(io->write(io, data, n) == n);
+    CU_ASSERT_TRUE_FATAL(io->close(io) == 0);
+
+    // build over a plain file
+    fd = open(filename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+    io_rw_t fio;
+    io_fd_init(&fio, fd);
+
+    mrttindex_t idx;
+    CU_ASSERT_EQUAL_FATAL(mrttbuildindex(&idx, &fio, 64 * 1024), MRT_ENOERR);
+    close(fd);
+
+    CU_ASSERT_EQUAL(idx.nrecs, NTRECORDS);
+    CU_ASSERT_EQUAL(idx.size, n);
+    CU_ASSERT_TRUE_FATAL(idx.npoints > 4);
+    CU_ASSERT_EQUAL_FATAL(idx.npeers, NTPEERS);
+    for (size_t i = 0; i < idx.npeers; i++) {
+        const mrttpeer_t *peer = &idx.peers[i];
+
+        CU_ASSERT_EQUAL(peer->peer_as, 65000 + i);
+        CU_ASSERT_EQUAL(peer->nrecs, NTRECORDS / NTPEERS);
+        CU_ASSERT_EQUAL(peer->first.recno, i);
+        CU_ASSERT_EQUAL(peer->last.recno, NTRECORDS - NTPEERS + i);
+    }
+
+    netaddr_t addr;
+    stonaddr(&addr, "192.0.2.3");
+    const mrttpeer_t *peer = mrttfindpeer(&idx, 65002, &addr);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(peer);
+    CU_ASSERT_EQUAL(peer->first.stamp, BASETIME);
+    CU_ASSERT_PTR_NULL(mrttfindpeer(&idx, 65003, &addr));
+
+    // store to sidecar and reload it
+    size_t bufsiz = 64 + idx.npoints * 32 + idx.npeers * 128;
+    unsigned char *sidecar = malloc(bufsiz);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sidecar);
+
+    io_rw_t mio;
+    io_mem_wrinit(&mio, sidecar, bufsiz);
+    CU_ASSERT_EQUAL_FATAL(mrttsaveindex(&idx, &mio), MRT_ENOERR);
+
+    mrttindex_t loaded;
+    io_mem_rdinit(&mio, sidecar, bufsiz);
+    CU_ASSERT_EQUAL_FATAL(mrttloadindex(&loaded, &mio), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(loaded.npoints, idx.npoints);
+    CU_ASSERT_EQUAL_FATAL(loaded.npeers, idx.npeers);
+    CU_ASSERT_EQUAL(loaded.size, idx.size);
+    CU_ASSERT_EQUAL(memcmp(loaded.points, idx.points, idx.npoints * sizeof(*idx.points)), 0);
+    CU_ASSERT_TRUE(naddreq(&loaded.peers[2].peer_addr, &addr));
+    mrttfreeindex(&idx);
+
+    // a bogus point count must fail on short read, not allocate upfront
+    mrttindex_t bogus;
+    unsigned char npoints[8];
+    memcpy(npoints, &sidecar[32], sizeof(npoints));
+    memcpy(&sidecar[32], "\x00\x00\x01\x00\x00\x00\x00\x00", sizeof(npoints));
+    io_mem_rdinit(&mio, sidecar, bufsiz);
+    CU_ASSERT_EQUAL(mrttloadindex(&bogus, &mio), MRT_EIO);
+    memcpy(&sidecar[32], npoints, sizeof(npoints));
+
+    // every point is at a record boundary
+    for (size_t i = 0; i < loaded.npoints; i++) {
+        const mrttpoint_t *pt = &loaded.points[i];
+
+        CU_ASSERT_TRUE_FATAL(pt->off < n);
+
+        uint32_t stamp;
+        memcpy(&stamp, &data[pt->off], sizeof(stamp));
+        CU_ASSERT_EQUAL(frombig32(stamp), pt->stamp);
+    }
+
+    mrtzindex_t zidx;
+    fd = open(zfilename, O_RDONLY);
+    CU_ASSERT_TRUE_FATAL(fd >= 0);
+    CU_ASSERT_TRUE_FATAL(mrtzbuildindex(&zidx, fd, 256 * 1024) == 0);
+    close(fd);
+
+    // lookup by time, over every kind of stream
+    const time_t times[] = { BASETIME + 1, BASETIME + NTRECORDS / 8, BASETIME + NTRECORDS / 4 - 1 };
+    for (size_t i = 0; i < nelems(times); i++) {
+        const mrttpoint_t *pt = mrttfindpoint(&loaded, times[i]);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(pt);
+
+        fd = open(filename, O_RDONLY);
+        CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+        io_fd_init(&fio, fd);
+        CU_ASSERT_EQUAL_FATAL(mrttseekpoint(&fio, pt), MRT_ENOERR);
+        checkseek(&fio, pt, times[i]);
+        close(fd);
+
+        fd = open(lzfilename, O_RDONLY);
+        CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+        io = io_lz4open(fd, 0, "r");
+        CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+        CU_ASSERT_EQUAL_FATAL(mrttseekpoint(io, pt), MRT_ENOERR);
+        checkseek(io, pt, times[i]);
+        io->close(io);
+
+        fd = open(zfilename, O_RDONLY);
+        CU_ASSERT_TRUE_FATAL(fd >= 0);
+
+        io = mrttzopenat(fd, &zidx, pt, 0);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(io);
+        checkseek(io, pt, times[i]);
+        io->close(io);
+    }
+
+    mrtzfreeindex(&zidx);
+    mrttfreeindex(&loaded);
+    free(sidecar);
+    free(data);
+    unlink(filename);
+    unlink(zfilename);
+    unlink(lzfilename);
+}
@@ -0,0 +1,165 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <CUnit/CUnit.h>
+#include <isolario/io.h>
+#include <isolario/mrtmerge.h>
+#include <string.h>
+
+#include "test.h"
+
+enum {
+    NSTREAMS = 3,
+    NRECS    = 200
+};
+
+// state change records with a recognizable stream and sequence number
+static size_t putstream(unsigned char *buf, size_t bufsiz, size_t stream)
+{
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type    = MRT_BGP4MP_ET;
+    hdr.subtype = BGP4MP_STATE_CHANGE_AS4;
+
+    bgp4mp_header_t bgp4mp;
+    memset(&bgp4mp, 0, sizeof(bgp4mp));
+    bgp4mp.peer_as   = 64512 + stream;
+    bgp4mp.new_state = 1;
+    stonaddr(&bgp4mp.peer_addr, "192.0.2.1");
+    stonaddr(&bgp4mp.local_addr, "192.0.2.2");
+
+    io_rw_t io;
+    io_mem_wrinit(&io, buf, bufsiz);
+
+    mrt_msg_t msg;
+    CU_ASSERT_EQUAL_FATAL(setmrtwrite_r(&msg, &io), MRT_ENOERR);
+    for (size_t i = 0; i < NRECS; i++) {
+        size_t j = i;
+        switch (stream) {
+        case 0:
+            // strictly sorted, even seconds
+            hdr.stamp.tv_sec  = 1500000000 + 2 * j;
+            hdr.stamp.tv_nsec = 0;
+            break;
+        case 1:
+            // strictly sorted, odd seconds plus half a second
+            hdr.stamp.tv_sec  = 1500000001 + 2 * j;
+            hdr.stamp.tv_nsec = 500000000;
+            break;
+        case 2:
+            // even seconds plus some microseconds, adjacent pairs swapped
+            j ^= 1;
+            hdr.stamp.tv_sec  = 1500000000 + 2 * j;
+            hdr.stamp.tv_nsec = 250000000 + j * 1000;
+            break;
+        }
+
+        bgp4mp.iface = j;
+        CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, &bgp4mp), MRT_ENOERR);
+    }
+    CU_ASSERT_EQUAL_FATAL(mrtclose_r(&msg), MRT_ENOERR);
+    return io.mem.ptr - buf;
+}
+
+static int tscmp(const struct timespec *a, const struct timespec *b)
+{
+    if (a->tv_sec != b->tv_sec)
+        return (a->tv_sec > b->tv_sec) - (a->tv_sec < b->tv_sec);
+
+    return (a->tv_nsec > b->tv_nsec) - (a->tv_nsec < b->tv_nsec);
+}
+
+void testmrtmerge(void)
+{
+    static unsigned char bufs[NSTREAMS][NRECS * 64];
+    size_t sizes[NSTREAMS];
+    for (size_t i = 0; i < NSTREAMS; i++)
+        sizes[i] = putstream(bufs[i], sizeof(bufs[i]), i);
+
+    io_rw_t ios[NSTREAMS];
+    io_rw_t *pios[NSTREAMS];
+    for (size_t i = 0; i < NSTREAMS; i++) {
+        io_mem_rdinit(&ios[i], bufs[i], sizes[i]);
+        pios[i] = &ios[i];
+    }
+
+    const struct timespec window = { 3, 0 };
+    mrtmerge_t *mm = newmrtmerge(pios, NSTREAMS, &window, 4);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mm);
+
+    struct timespec last = { 0, 0 };
+    size_t next[NSTREAMS] = { 0 };
+
+    mrt_msg_t *msg;
+    size_t stream;
+    int err;
+    while ((err = mrtmergenext(mm, &msg, &stream)) == MRT_ENOERR) {
+        CU_ASSERT_FATAL(stream < NSTREAMS);
+
+        const mrt_header_t *hdr = getmrtheader_r(msg);
+        CU_ASSERT(tscmp(&last, &hdr->stamp) <= 0);
+        last = hdr->stamp;
+
+        // every stream is returned sorted
+        const bgp4mp_header_t *bgp4mp = getbgp4mpheader_r(msg);
+        CU_ASSERT_EQUAL(bgp4mp->peer_as, 64512 + stream);
+        CU_ASSERT_EQUAL(bgp4mp->iface, next[stream]);
+        next[stream]++;
+    }
+
+    CU_ASSERT_EQUAL(err, MRT_EIO);
+    CU_ASSERT_EQUAL(stream, NSTREAMS);
+    for (size_t i = 0; i < NSTREAMS; i++)
+        CU_ASSERT_EQUAL(next[i], NRECS);
+
+    freemrtmerge(mm);
+
+    // truncated stream is reported and excluded, the others go on
+    for (size_t i = 0; i < NSTREAMS; i++)
+        io_mem_rdinit(&ios[i], bufs[i], (i == 1) ? sizes[i] / 2 + 1 : sizes[i]);
+
+    mm = newmrtmerge(pios, NSTREAMS, &window, 0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mm);
+
+    size_t count = 0, nerrs = 0;
+    while ((err = mrtmergenext(mm, &msg, &stream)) != MRT_EIO || stream != NSTREAMS) {
+        if (err != MRT_ENOERR) {
+            CU_ASSERT_EQUAL(stream, 1);
+            nerrs++;
+        } else {
+            count++;
+        }
+    }
+
+    CU_ASSERT_EQUAL(nerrs, 1);
+    CU_ASSERT(count > 2 * NRECS && count < 3 * NRECS);
+
+    freemrtmerge(mm);
+}
@@ -0,0 +1,240 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <CUnit/CUnit.h>
+#include <isolario/endian.h>
+#include <isolario/io.h>
+#include <isolario/mrtpool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+
+enum {
+    NRIBS  = 10000,
+    NPEERS = 2
+};
+
+static const uint32_t peer_as[NPEERS] = { 4200000000u, 64512 };
+
+static unsigned char *putmrthdr(unsigned char *ptr, int subtype, uint32_t len)
+{
+    uint32_t u32 = tobig32(1500000000);
+    memcpy(ptr, &u32, sizeof(u32));
+    ptr += sizeof(u32);
+
+    uint16_t u16 = tobig16(MRT_TABLE_DUMPV2);
+    memcpy(ptr, &u16, sizeof(u16));
+    ptr += sizeof(u16);
+
+    u16 = tobig16(subtype);
+    memcpy(ptr, &u16, sizeof(u16));
+    ptr += sizeof(u16);
+
+    u32 = tobig32(len);
+    memcpy(ptr, &u32, sizeof(u32));
+    return ptr + sizeof(u32);
+}
+
+// generates a synthetic TABLE_DUMPV2 dump, with NRIBS IPv4 unicast RIBs, each one with an entry per peer
+static unsigned char *mkribdump(size_t *pn)
+{
+    unsigned char *data = malloc(64 + NRIBS * 64);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+
+    // PEER_INDEX_TABLE: collector id, empty view name, peer count, peers
+    unsigned char *ptr = putmrthdr(data, MRT_TABLE_DUMPV2_PEER_INDEX_TABLE, 4 + 2 + 2 + (1 + 4 + 4 + 4) + (1 + 4 + 4 + 2));
+    memset(ptr, 0, 4 + 2);
+    ptr += 4 + 2;
+    *ptr++ = 0;
+    *ptr++ = NPEERS;
+
+    uint32_t as32 = tobig32(peer_as[0]);
+    *ptr++ = 0x2;  // IPv4, 32 bits AS
+    memset(ptr, 1, 4 + 4);
+    ptr += 4 + 4;
+    memcpy(ptr, &as32, sizeof(as32));
+    ptr += sizeof(as32);
+
+    uint16_t as16 = tobig16(peer_as[1]);
+    *ptr++ = 0x0;  // IPv4, 16 bits AS
+    memset(ptr, 2, 4 + 4);
+    ptr += 4 + 4;
+    memcpy(ptr, &as16, sizeof(as16));
+    ptr += sizeof(as16);
+
+    static const unsigned char attrs[] = { 0x40, 0x01, 0x01, 0x00 };  // ORIGIN IGP
+
+    for (uint32_t i = 0; i < NRIBS; i++) {
+        // sequence number, /24 prefix, entry count, entries
+        uint32_t entsiz = 2 + 4 + 2 + sizeof(attrs);
+        ptr = putmrthdr(ptr, MRT_TABLE_DUMPV2_RIB_IPV4_UNICAST, 4 + 1 + 3 + 2 + NPEERS * entsiz);
+
+        uint32_t seqno = tobig32(i);
+        memcpy(ptr, &seqno, sizeof(seqno));
+        ptr += sizeof(seqno);
+
+        *ptr++ = 24;
+        *ptr++ = 10;
+        *ptr++ = i >> 8;
+        *ptr++ = i & 0xff;
+
+        *ptr++ = 0;
+        *ptr++ = NPEERS;
+        for (int j = 0; j < NPEERS; j++) {
+            *ptr++ = 0;
+            *ptr++ = j;
+            memset(ptr, 0, 4);
+            ptr += 4;
+            *ptr++ = 0;
+            *ptr++ = sizeof(attrs);
+            memcpy(ptr, attrs, sizeof(attrs));
+            ptr += sizeof(attrs);
+        }
+    }
+
+    *pn = ptr - data;
+    return data;
+}
+
+typedef struct {
+    atomic_ulong count;
+    atomic_ulong seqsum;
+    atomic_int running;
+    atomic_int bad;
+    uint64_t last;  // only for ordered runs
+    uint64_t stopat;
+    unsigned long limit;
+    unsigned char staged[NRIBS];
+} ribstats_t;
+
+static int countribs(mrt_msg_t *msg, uint64_t seqno, void *arg)
+{
+    ribstats_t *st = arg;
+
+    size_t count;
+    rib_header_t *hdr = startribents_r(msg, &count);
+    if (!hdr || hdr->seqno != seqno || count != NPEERS)
+        atomic_fetch_add(&st->bad, 1);
+
+    rib_entry_t *rib;
+    for (int i = 0; (rib = nextribent_r(msg)) != NULL; i++) {
+        if (rib->peer->as != peer_as[i] || rib->nlri.bitlen != 24)
+            atomic_fetch_add(&st->bad, 1);
+    }
+    if (endribents_r(msg) != MRT_ENOERR)
+        atomic_fetch_add(&st->bad, 1);
+
+    atomic_fetch_add(&st->seqsum, seqno);
+    unsigned long n = atomic_fetch_add(&st->count, 1) + 1;
+    return (st->limit != 0 && n == st->limit) ? -1 : 0;
+}
+
+static int stageribs(mrt_msg_t *msg, uint64_t seqno, void *arg)
+{
+    ribstats_t *st = arg;
+
+    st->staged[seqno] = 1;
+    return countribs(msg, seqno, arg);
+}
+
+static int commitribs(uint64_t seqno, size_t nrecs, void *arg)
+{
+    ribstats_t *st = arg;
+
+    if (atomic_fetch_add(&st->running, 1) != 0)
+        atomic_fetch_add(&st->bad, 1);  // concurrent commits
+    if (seqno != st->last)
+        atomic_fetch_add(&st->bad, 1);
+
+    for (size_t i = 0; i < nrecs; i++) {
+        if (!st->staged[seqno + i])
+            atomic_fetch_add(&st->bad, 1);
+    }
+
+    st->last = seqno + nrecs;
+
+    atomic_fetch_sub(&st->running, 1);
+    return (st->stopat != 0 && st->last >= st->stopat) ? -1 : 0;
+}
+
+void testmrtribforeach(void)
+{
+    size_t n;
+    unsigned char *data = mkribdump(&n);
+
+    const unsigned long seqsum = (unsigned long) NRIBS * (NRIBS - 1) / 2;
+    ribstats_t st;
+    io_rw_t io;
+
+    memset(&st, 0, sizeof(st));
+    io_mem_rdinit(&io, data, n);
+    CU_ASSERT_EQUAL(mrtribforeach(&io, 4, 64, MRTPF_DEFAULT, countribs, NULL, &st), MRT_ENOERR);
+    CU_ASSERT_EQUAL(atomic_load(&st.count), NRIBS);
+    CU_ASSERT_EQUAL(atomic_load(&st.seqsum), seqsum);
+    CU_ASSERT_EQUAL(atomic_load(&st.bad), 0);
+
+    memset(&st, 0, sizeof(st));
+    io_mem_rdinit(&io, data, n);
+    CU_ASSERT_EQUAL(mrtribforeach(&io, 4, 0, MRTPF_ORDERED, stageribs, commitribs, &st), MRT_ENOERR);
+    CU_ASSERT_EQUAL(atomic_load(&st.count), NRIBS);
+    CU_ASSERT_EQUAL(st.last, NRIBS);
+    CU_ASSERT_EQUAL(atomic_load(&st.bad), 0);
+
+    // stop early, callback result is returned
+    memset(&st, 0, sizeof(st));
+    st.limit = 100;
+    io_mem_rdinit(&io, data, n);
+    CU_ASSERT_EQUAL(mrtribforeach(&io, 1, 16, MRTPF_DEFAULT, countribs, NULL, &st), -1);
+    CU_ASSERT_EQUAL(atomic_load(&st.count), 100);
+
+    // stop early from commit, no batch is committed afterwards
+    memset(&st, 0, sizeof(st));
+    st.stopat = 96;
+    io_mem_rdinit(&io, data, n);
+    CU_ASSERT_EQUAL(mrtribforeach(&io, 0, 16, MRTPF_ORDERED, stageribs, commitribs, &st), -1);
+    CU_ASSERT_EQUAL(st.last, 96);
+    CU_ASSERT_EQUAL(atomic_load(&st.bad), 0);
+
+    // dump must start with a PEER_INDEX_TABLE
+    size_t pisiz = 12 + 4 + 2 + 2 + (1 + 4 + 4 + 4) + (1 + 4 + 4 + 2);
+
+    io_mem_rdinit(&io, data + pisiz, n - pisiz);
+    CU_ASSERT_EQUAL(mrtribforeach(&io, 2, 0, MRTPF_DEFAULT, countribs, NULL, &st), MRT_NOTPEERIDX);
+
+    // truncated dump
+    memset(&st, 0, sizeof(st));
+    io_mem_rdinit(&io, data, n - 1);
+    CU_ASSERT_EQUAL(mrtribforeach(&io, 2, 0, MRTPF_DEFAULT, countribs, NULL, &st), MRT_EBADHDR);
+
+    free(data);
+}
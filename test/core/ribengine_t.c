@@ -0,0 +1,459 @@
+//
+// Copyright (c) 2019, Enrico Gregori, Alessandro Improta, Luca Sani, Institute
+// of Informatics and Telematics of the Italian National Research Council
+// (IIT-CNR). All rights reserved.
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//
+// 1. Redistributions of source code must retain the above copyright notice,
+// this list of conditions and the following disclaimer.
+//
+// 2. Redistributions in binary form must reproduce the above copyright notice,
+// this list of conditions and the following disclaimer in the documentation
+// and/or other materials provided with the distribution.
+//
+// 3. Neither the name of the copyright holder nor the names of its contributors
+// may be used to endorse or promote products derived from this software without
+// specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+// ARE DISCLAIMED. IN NO EVENT SHALL THE IIT-CNR BE LIABLE FOR ANY DIRECT,
+// INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <CUnit/CUnit.h>
+#include <isolario/bgp.h>
+#include <isolario/ribengine.h>
+#include <string.h>
+
+#include "test.h"
+
+enum {
+    T0 = 1500000000
+};
+
+static const unsigned char igp[]        = { 0x40, 0x01, 0x01, 0x00 };  // ORIGIN IGP
+static const unsigned char egp[]        = { 0x40, 0x01, 0x01, 0x01 };  // ORIGIN EGP
+static const unsigned char incomplete[] = { 0x40, 0x01, 0x01, 0x02 };  // ORIGIN INCOMPLETE
+
+static void putdump(io_rw_t *io)
+{
+    mrt_msg_t msg;
+    CU_ASSERT_EQUAL_FATAL(setmrtwrite_r(&msg, io), MRT_ENOERR);
+
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.stamp.tv_sec = T0;
+    hdr.type         = MRT_TABLE_DUMPV2;
+    hdr.subtype      = MRT_TABLE_DUMPV2_PEER_INDEX_TABLE;
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, (struct in_addr) { 0 }, ""), MRT_ENOERR);
+
+    peer_entry_t pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.as = 64512;
+    stonaddr(&pe.addr, "192.0.2.1");
+    CU_ASSERT_EQUAL_FATAL(putpeerent_r(&msg, &pe), MRT_ENOERR);
+    pe.as = 64513;
+    stonaddr(&pe.addr, "192.0.2.2");
+    CU_ASSERT_EQUAL_FATAL(putpeerent_r(&msg, &pe), MRT_ENOERR);
+
+    netaddr_t pfx;
+    hdr.subtype = MRT_TABLE_DUMPV2_RIB_IPV4_UNICAST;
+
+    stonaddr(&pfx, "10.0.0.0/8");
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, 0, &pfx), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(putribent_r(&msg, NULL, 0, T0, (const bgpattr_t *) igp, sizeof(igp)), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(putribent_r(&msg, NULL, 1, T0, (const bgpattr_t *) igp, sizeof(igp)), MRT_ENOERR);
+
+    stonaddr(&pfx, "10.1.0.0/16");
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, 1, &pfx), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(putribent_r(&msg, NULL, 0, T0, (const bgpattr_t *) incomplete, sizeof(incomplete)), MRT_ENOERR);
+
+    CU_ASSERT_EQUAL_FATAL(mrtclose_r(&msg), MRT_ENOERR);
+}
+
+static void putupdate(mrt_msg_t *msg, time_t stamp, uint32_t peer_as, const char *peer_addr,
+                      const char *withdrawn, const char *nlri, const unsigned char *attr)
+{
+    bgp_msg_t bgp;
+    netaddr_t pfx;
+
+    CU_ASSERT_EQUAL_FATAL(setbgpwrite_r(&bgp, BGP_UPDATE, BGPF_ASN32BIT), BGP_ENOERR);
+    if (withdrawn) {
+        stonaddr(&pfx, withdrawn);
+        CU_ASSERT_EQUAL_FATAL(startwithdrawn_r(&bgp), BGP_ENOERR);
+        CU_ASSERT_EQUAL_FATAL(putwithdrawn_r(&bgp, &pfx), BGP_ENOERR);
+        CU_ASSERT_EQUAL_FATAL(endwithdrawn_r(&bgp), BGP_ENOERR);
+    }
+    if (nlri) {
+        CU_ASSERT_EQUAL_FATAL(startbgpattribs_r(&bgp), BGP_ENOERR);
+        CU_ASSERT_EQUAL_FATAL(putbgpattrib_r(&bgp, (const bgpattr_t *) attr), BGP_ENOERR);
+        CU_ASSERT_EQUAL_FATAL(endbgpattribs_r(&bgp), BGP_ENOERR);
+
+        stonaddr(&pfx, nlri);
+        CU_ASSERT_EQUAL_FATAL(startnlri_r(&bgp), BGP_ENOERR);
+        CU_ASSERT_EQUAL_FATAL(putnlri_r(&bgp, &pfx), BGP_ENOERR);
+        CU_ASSERT_EQUAL_FATAL(endnlri_r(&bgp), BGP_ENOERR);
+    }
+
+    size_t n;
+    void *data = bgpfinish_r(&bgp, &n);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.stamp.tv_sec = stamp;
+    hdr.type         = MRT_BGP4MP;
+    hdr.subtype      = BGP4MP_MESSAGE_AS4;
+
+    bgp4mp_header_t bgp4mp;
+    memset(&bgp4mp, 0, sizeof(bgp4mp));
+    bgp4mp.peer_as  = peer_as;
+    bgp4mp.local_as = 65000;
+    stonaddr(&bgp4mp.peer_addr, peer_addr);
+    stonaddr(&bgp4mp.local_addr, "192.0.2.254");
+
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(msg, &hdr, &bgp4mp), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(wrapbgp4mp_r(msg, data, n), MRT_ENOERR);
+    bgpclose_r(&bgp);
+}
+
+static void putupdates(io_rw_t *io)
+{
+    mrt_msg_t msg;
+    CU_ASSERT_EQUAL_FATAL(setmrtwrite_r(&msg, io), MRT_ENOERR);
+
+    putupdate(&msg, T0 + 60, 64512, "192.0.2.1", "10.1.0.0/16", "10.2.0.0/16", egp);
+    putupdate(&msg, T0 + 120, 64513, "192.0.2.2", NULL, "10.3.0.0/16", igp);
+
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.stamp.tv_sec = T0 + 180;
+    hdr.type         = MRT_BGP4MP;
+    hdr.subtype      = BGP4MP_STATE_CHANGE_AS4;
+
+    bgp4mp_header_t bgp4mp;
+    memset(&bgp4mp, 0, sizeof(bgp4mp));
+    bgp4mp.peer_as   = 64512;
+    bgp4mp.local_as  = 65000;
+    bgp4mp.old_state = 6;  // Established
+    bgp4mp.new_state = 1;  // Idle
+    stonaddr(&bgp4mp.peer_addr, "192.0.2.1");
+    stonaddr(&bgp4mp.local_addr, "192.0.2.254");
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, &bgp4mp), MRT_ENOERR);
+
+    putupdate(&msg, T0 + 240, 64512, "192.0.2.1", NULL, "10.4.0.0/16", igp);
+
+    CU_ASSERT_EQUAL_FATAL(mrtclose_r(&msg), MRT_ENOERR);
+}
+
+static const attrref_t *lookup(const ribengine_t *eng, size_t peer, const char *s)
+{
+    netaddr_t pfx;
+    stonaddr(&pfx, s);
+    return ribengine_lookup(eng, peer, &pfx, 0);
+}
+
+static int countroutes(size_t peer, const netaddr_t *pfx, uint32_t pathid, const attrref_t *attrs, void *arg)
+{
+    (void) peer, (void) pfx, (void) pathid, (void) attrs;
+
+    (*(size_t *) arg)++;
+    return 0;
+}
+
+void testribengine(void)
+{
+    static unsigned char dump[4096], upd[4096];
+    io_rw_t io;
+
+    io_mem_wrinit(&io, dump, sizeof(dump));
+    putdump(&io);
+    size_t dumpsize = io.mem.ptr - dump;
+
+    io_mem_wrinit(&io, upd, sizeof(upd));
+    putupdates(&io);
+    size_t updsize = io.mem.ptr - upd;
+
+    ribengine_t *eng = ribengine_create(100, 0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(eng);
+
+    io_mem_rdinit(&io, dump, dumpsize);
+    CU_ASSERT_EQUAL_FATAL(ribengine_loaddump(eng, &io), MRT_ENOERR);
+    CU_ASSERT_EQUAL(ribengine_time(eng), T0);
+    CU_ASSERT_EQUAL(ribengine_ncheckpoints(eng), 1);
+    CU_ASSERT_EQUAL_FATAL(ribengine_npeers(eng), 2);
+
+    netaddr_t addr;
+    stonaddr(&addr, "192.0.2.1");
+    size_t p0 = ribengine_findpeer(eng, 64512, &addr);
+    stonaddr(&addr, "192.0.2.2");
+    size_t p1 = ribengine_findpeer(eng, 64513, &addr);
+    CU_ASSERT_EQUAL_FATAL(p0, 0);
+    CU_ASSERT_EQUAL_FATAL(p1, 1);
+    CU_ASSERT_EQUAL(ribengine_findpeer(eng, 64514, &addr), SIZE_MAX);
+    CU_ASSERT_EQUAL(ribengine_peer(eng, p0)->nroutes, 2);
+    CU_ASSERT_EQUAL(ribengine_peer(eng, p1)->nroutes, 1);
+
+    const attrref_t *ref = lookup(eng, p0, "10.1.0.0/16");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ref);
+    CU_ASSERT_EQUAL(ref->len, sizeof(incomplete));
+    CU_ASSERT_EQUAL(memcmp(ref->attrs, incomplete, sizeof(incomplete)), 0);
+    CU_ASSERT_PTR_NOT_NULL(lookup(eng, p1, "10.0.0.0/8"));
+    CU_ASSERT_PTR_NULL(lookup(eng, p1, "10.1.0.0/16"));
+
+    // full replay, checkpoints are taken before T0 + 120 and T0 + 240
+    io_mem_rdinit(&io, upd, updsize);
+    CU_ASSERT_EQUAL_FATAL(ribengine_replay(eng, &io), MRT_ENOERR);
+    CU_ASSERT_EQUAL(ribengine_time(eng), T0 + 240);
+    CU_ASSERT_EQUAL(ribengine_ncheckpoints(eng), 3);
+
+    // session reset cleared peer 0 before 10.4.0.0/16 was announced
+    CU_ASSERT_EQUAL(ribengine_peer(eng, p0)->nroutes, 1);
+    CU_ASSERT_PTR_NOT_NULL(lookup(eng, p0, "10.4.0.0/16"));
+    CU_ASSERT_PTR_NULL(lookup(eng, p0, "10.0.0.0/8"));
+    CU_ASSERT_PTR_NULL(lookup(eng, p0, "10.2.0.0/16"));
+
+    size_t count = 0;
+    CU_ASSERT_EQUAL(ribengine_foreach(eng, p1, countroutes, &count), 0);
+    CU_ASSERT_EQUAL(count, 2);
+
+    count = 0;
+    CU_ASSERT_EQUAL(ribengine_foreach(eng, SIZE_MAX, countroutes, &count), 0);
+    CU_ASSERT_EQUAL(count, 3);
+    CU_ASSERT_PTR_NOT_NULL(lookup(eng, p1, "10.3.0.0/16"));
+
+    // state in between checkpoints
+    ribengine_t *view;
+
+    io_mem_rdinit(&io, upd, updsize);
+    CU_ASSERT_EQUAL_FATAL(ribengine_query(eng, T0 + 150, &io, &view), MRT_ENOERR);
+    CU_ASSERT_EQUAL(ribengine_time(view), T0 + 120);
+    CU_ASSERT_EQUAL(ribengine_ncheckpoints(view), 0);
+    CU_ASSERT_EQUAL_FATAL(ribengine_npeers(view), 2);
+    CU_ASSERT_EQUAL(ribengine_peer(view, p0)->nroutes, 2);
+    CU_ASSERT_EQUAL(ribengine_peer(view, p1)->nroutes, 2);
+    CU_ASSERT_PTR_NULL(lookup(view, p0, "10.1.0.0/16"));
+    CU_ASSERT_PTR_NOT_NULL(lookup(view, p1, "10.3.0.0/16"));
+
+    ref = lookup(view, p0, "10.2.0.0/16");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ref);
+    CU_ASSERT_EQUAL(memcmp(ref->attrs, egp, sizeof(egp)), 0);
+    ribengine_destroy(view);
+
+    // right after the session reset, nothing left to replay
+    io_mem_rdinit(&io, upd, updsize);
+    CU_ASSERT_EQUAL_FATAL(ribengine_query(eng, T0 + 180, &io, &view), MRT_ENOERR);
+    CU_ASSERT_EQUAL(ribengine_peer(view, p0)->nroutes, 0);
+    CU_ASSERT_EQUAL(ribengine_peer(view, p1)->nroutes, 2);
+    ribengine_destroy(view);
+
+    io_mem_rdinit(&io, upd, updsize);
+    CU_ASSERT_EQUAL(ribengine_query(eng, T0 - 1, &io, &view), MRT_EINVOP);
+
+    ribengine_destroy(eng);
+
+    // bounded checkpoints, the snapshot is folded into the one before T0 + 120
+    eng = ribengine_create(100, 2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(eng);
+
+    io_mem_rdinit(&io, dump, dumpsize);
+    CU_ASSERT_EQUAL_FATAL(ribengine_loaddump(eng, &io), MRT_ENOERR);
+    io_mem_rdinit(&io, upd, updsize);
+    CU_ASSERT_EQUAL_FATAL(ribengine_replay(eng, &io), MRT_ENOERR);
+    CU_ASSERT_EQUAL(ribengine_ncheckpoints(eng), 2);
+
+    io_mem_rdinit(&io, upd, updsize);
+    CU_ASSERT_EQUAL(ribengine_query(eng, T0 + 59, &io, &view), MRT_EINVOP);
+
+    io_mem_rdinit(&io, upd, updsize);
+    CU_ASSERT_EQUAL_FATAL(ribengine_query(eng, T0 + 150, &io, &view), MRT_ENOERR);
+    CU_ASSERT_EQUAL(ribengine_peer(view, p0)->nroutes, 2);
+    CU_ASSERT_EQUAL(ribengine_peer(view, p1)->nroutes, 2);
+    CU_ASSERT_PTR_NULL(lookup(view, p0, "10.1.0.0/16"));
+    CU_ASSERT_PTR_NOT_NULL(lookup(view, p0, "10.2.0.0/16"));
+    ribengine_destroy(view);
+
+    io_mem_rdinit(&io, upd, updsize);
+    CU_ASSERT_EQUAL_FATAL(ribengine_query(eng, T0 + 240, &io, &view), MRT_ENOERR);
+    CU_ASSERT_EQUAL(ribengine_peer(view, p0)->nroutes, 1);
+    CU_ASSERT_PTR_NOT_NULL(lookup(view, p0, "10.4.0.0/16"));
+    CU_ASSERT_PTR_NULL(lookup(view, p0, "10.0.0.0/8"));
+    ribengine_destroy(view);
+
+    ribengine_destroy(eng);
+}
+
+static const unsigned char nhop6[] = {
+    0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01
+};
+
+// ORIGIN IGP, AS_PATH 64512 4200000000, AGGREGATOR 4200000000 192.0.2.1
+static const unsigned char rib4attrs[] = {
+    0x40, 0x01, 0x01, 0x00,
+    0x40, 0x02, 0x0a, 0x02, 0x02, 0x00, 0x00, 0xfc, 0x00, 0xfa, 0x56, 0xea, 0x00,
+    0xc0, 0x07, 0x08, 0xfa, 0x56, 0xea, 0x00, 0xc0, 0x00, 0x02, 0x01
+};
+
+// same attributes from an OLD BGP speaker, with AS_TRANS in place of 4200000000
+static const unsigned char upd4body[] = {
+    0x00, 0x00,  // no withdrawn
+    0x00, 0x2e,  // attributes length
+    0x40, 0x01, 0x01, 0x00,
+    0x40, 0x02, 0x06, 0x02, 0x02, 0xfc, 0x00, 0x5b, 0xa0,
+    0xc0, 0x07, 0x06, 0x5b, 0xa0, 0xc0, 0x00, 0x02, 0x01,
+    0xc0, 0x11, 0x0a, 0x02, 0x02, 0x00, 0x00, 0xfc, 0x00, 0xfa, 0x56, 0xea, 0x00,
+    0xc0, 0x12, 0x08, 0xfa, 0x56, 0xea, 0x00, 0xc0, 0x00, 0x02, 0x01,
+    0x10, 0x0a, 0x01  // 10.1.0.0/16
+};
+
+static void putattrdump(io_rw_t *io)
+{
+    mrt_msg_t msg;
+    CU_ASSERT_EQUAL_FATAL(setmrtwrite_r(&msg, io), MRT_ENOERR);
+
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.stamp.tv_sec = T0;
+    hdr.type         = MRT_TABLE_DUMPV2;
+    hdr.subtype      = MRT_TABLE_DUMPV2_PEER_INDEX_TABLE;
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, (struct in_addr) { 0 }, ""), MRT_ENOERR);
+
+    peer_entry_t pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.as = 64512;
+    stonaddr(&pe.addr, "192.0.2.1");
+    CU_ASSERT_EQUAL_FATAL(putpeerent_r(&msg, &pe), MRT_ENOERR);
+
+    netaddr_t pfx;
+    hdr.subtype = MRT_TABLE_DUMPV2_RIB_IPV4_UNICAST;
+
+    stonaddr(&pfx, "10.0.0.0/8");
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, 0, &pfx), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(putribent_r(&msg, NULL, 0, T0, (const bgpattr_t *) rib4attrs, sizeof(rib4attrs)), MRT_ENOERR);
+
+    // ORIGIN IGP, truncated MP_REACH_NLRI
+    unsigned char rib6attrs[8 + sizeof(nhop6)] = {
+        0x40, 0x01, 0x01, 0x00,
+        0x80, 0x0e, 0x11, 0x10
+    };
+    memcpy(&rib6attrs[8], nhop6, sizeof(nhop6));
+
+    hdr.subtype = MRT_TABLE_DUMPV2_RIB_IPV6_UNICAST;
+
+    stonaddr(&pfx, "2001:db8::/32");
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(&msg, &hdr, 1, &pfx), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(putribent_r(&msg, NULL, 0, T0, (const bgpattr_t *) rib6attrs, sizeof(rib6attrs)), MRT_ENOERR);
+
+    CU_ASSERT_EQUAL_FATAL(mrtclose_r(&msg), MRT_ENOERR);
+}
+
+static void putrawupdate(mrt_msg_t *msg, int subtype, const unsigned char *body, size_t n)
+{
+    unsigned char buf[4096];
+
+    size_t size = 19 + n;  // marker, length and type
+    memset(buf, 0xff, 16);
+    buf[16] = size >> 8;
+    buf[17] = size & 0xff;
+    buf[18] = BGP_UPDATE;
+    memcpy(&buf[19], body, n);
+
+    mrt_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.stamp.tv_sec = T0 + 60;
+    hdr.type         = MRT_BGP4MP;
+    hdr.subtype      = subtype;
+
+    bgp4mp_header_t bgp4mp;
+    memset(&bgp4mp, 0, sizeof(bgp4mp));
+    bgp4mp.peer_as  = 64512;
+    bgp4mp.local_as = 65000;
+    stonaddr(&bgp4mp.peer_addr, "192.0.2.1");
+    stonaddr(&bgp4mp.local_addr, "192.0.2.254");
+
+    CU_ASSERT_EQUAL_FATAL(setmrtheader_r(msg, &hdr, &bgp4mp), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(wrapbgp4mp_r(msg, buf, size), MRT_ENOERR);
+}
+
+static void putattrupdates(io_rw_t *io)
+{
+    mrt_msg_t msg;
+    CU_ASSERT_EQUAL_FATAL(setmrtwrite_r(&msg, io), MRT_ENOERR);
+
+    putrawupdate(&msg, BGP4MP_MESSAGE, upd4body, sizeof(upd4body));
+
+    // ORIGIN IGP, full MP_REACH_NLRI announcing 2001:db8:1::/48
+    unsigned char upd6body[] = {
+        0x00, 0x00,
+        0x00, 0x23,
+        0x40, 0x01, 0x01, 0x00,
+        0x80, 0x0e, 0x1c, 0x00, 0x02, 0x01, 0x10,
+        [31] = 0x00,  // reserved
+        0x30, 0x20, 0x01, 0x0d, 0xb8, 0x00, 0x01
+    };
+    memcpy(&upd6body[15], nhop6, sizeof(nhop6));
+
+    putrawupdate(&msg, BGP4MP_MESSAGE_AS4, upd6body, sizeof(upd6body));
+
+    // withdraws 10.0.0.0/8, but its NLRI is truncated, so it's ignored whole
+    static const unsigned char badbody[] = {
+        0x00, 0x02, 0x08, 0x0a,
+        0x00, 0x04,
+        0x40, 0x01, 0x01, 0x00,
+        0x18, 0x0a, 0x01
+    };
+    putrawupdate(&msg, BGP4MP_MESSAGE_AS4, badbody, sizeof(badbody));
+
+    CU_ASSERT_EQUAL_FATAL(mrtclose_r(&msg), MRT_ENOERR);
+}
+
+void testribengineattrs(void)
+{
+    static unsigned char dump[4096], upd[4096];
+    io_rw_t io;
+
+    io_mem_wrinit(&io, dump, sizeof(dump));
+    putattrdump(&io);
+    size_t dumpsize = io.mem.ptr - dump;
+
+    io_mem_wrinit(&io, upd, sizeof(upd));
+    putattrupdates(&io);
+    size_t updsize = io.mem.ptr - upd;
+
+    ribengine_t *eng = ribengine_create(0, 0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(eng);
+
+    io_mem_rdinit(&io, dump, dumpsize);
+    CU_ASSERT_EQUAL_FATAL(ribengine_loaddump(eng, &io), MRT_ENOERR);
+    io_mem_rdinit(&io, upd, updsize);
+    CU_ASSERT_EQUAL_FATAL(ribengine_replay(eng, &io), MRT_ENOERR);
+    CU_ASSERT_EQUAL_FATAL(ribengine_npeers(eng), 1);
+    CU_ASSERT_EQUAL(ribengine_peer(eng, 0)->nroutes, 4);
+
+    // 16 bits ASes are reconciled with AS4_PATH and AS4_AGGREGATOR,
+    // so the very same attributes are shared with the snapshot,
+    // the malformed record didn't withdraw the route either
+    const attrref_t *ref = lookup(eng, 0, "10.0.0.0/8");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ref);
+    CU_ASSERT_EQUAL(ref->len, sizeof(rib4attrs));
+    CU_ASSERT_EQUAL(memcmp(ref->attrs, rib4attrs, sizeof(rib4attrs)), 0);
+    CU_ASSERT_PTR_EQUAL(lookup(eng, 0, "10.1.0.0/16"), ref);
+
+    // the IPv6 next hop survives, without announced prefixes
+    ref = lookup(eng, 0, "2001:db8::/32");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ref);
+    CU_ASSERT_EQUAL(ref->len, 4 + 3 + 1 + sizeof(nhop6));
+    CU_ASSERT_EQUAL(memcmp(&ref->attrs[8], nhop6, sizeof(nhop6)), 0);
+    CU_ASSERT_PTR_EQUAL(lookup(eng, 0, "2001:db8:1::/48"), ref);
+
+    ribengine_destroy(eng);
+}
@@ -65,14 +65,68 @@ void testpatgetfirstsubnets(void);
 
 void testzio(void);
 
+void testziomt(void);
+
 void testbz2(void);
 
+void testbz2mt(void);
+
+void testbz2mtmagic(void);
+
+void testbz2mtcorrupt(void);
+
 void testxz(void);
 
+void testxzmt(void);
+
+void testzstd(void);
+
+void testzstdmt(void);
+
 void testlz4(void);
 
 void testlz4smallwrites(void);
 
+void testmmap(void);
+
+void testbufio(void);
+
+void testasyncio(void);
+
+void testuring(void);
+
+void testdirectio(void);
+
+void testmrtzindex(void);
+
+void testmrttindex(void);
+
+void testmrtwritebgp4mp(void);
+
+void testmrtiterator(void);
+
+void testmrtbufretain(void);
+
+void testmrtpeerindex(void);
+
+void testmrtwriter(void);
+
+void testmrthdrfilter(void);
+
+void testmrtribcols(void);
+
+void testattrstore(void);
+
+void testmrtattrstore(void);
+
+void testmrtribforeach(void);
+
+void testmrtmerge(void);
+
+void testribengine(void);
+
+void testribengineattrs(void);
+
 void testbgpdumppacketrow(void);
 
 void testjsonsimple(void);